@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_MAX_PHASES 32
+// Dependency mask entry for a phase, by index
+#define BOOT_DEP(phase) (1u << (phase))
+
+// Boot initialization as a dependency graph: each phase runs once every phase
+// it depends on has finished, so independent phases can run concurrently.
+// This only does the bookkeeping and records when each phase ran; BootRunner
+// runs the phases.
+//
+// Not thread safe, callers serialize access.
+class BootGraph {
+  public:
+    typedef void (*phaseFn_t)();
+
+    struct Phase {
+        const char *name;
+        phaseFn_t fn;
+        uint32_t deps; // BOOT_DEP() of each phase that must finish first
+    };
+
+    static constexpr int NONE = -1;
+
+    BootGraph(const Phase *phases, size_t nPhases);
+
+    // False if a phase depends on a phase that doesn't exist, or the
+    // dependencies have a cycle, so some phase could never run
+    bool valid() const;
+
+    // Claims the first unclaimed phase whose dependencies have all finished,
+    // or returns NONE if there isn't one yet
+    int claim(uint64_t nowUs);
+    void finish(int phase, uint64_t nowUs);
+
+    bool done() const { return finished_ == all(); }
+    size_t size() const { return nPhases_; }
+    const Phase &phase(size_t i) const { return phases_[i]; }
+    bool finished(size_t i) const { return finished_ & BOOT_DEP(i); }
+    uint64_t startUs(size_t i) const { return startUs_[i]; }
+    uint64_t endUs(size_t i) const { return endUs_[i]; }
+
+  private:
+    const Phase *phases_;
+    size_t nPhases_;
+    uint32_t claimed_ = 0, finished_ = 0;
+    uint64_t startUs_[BOOT_MAX_PHASES] = {}, endUs_[BOOT_MAX_PHASES] = {};
+
+    uint32_t all() const { return nPhases_ == 32 ? UINT32_MAX : BOOT_DEP(nPhases_) - 1; }
+};
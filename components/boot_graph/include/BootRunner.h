@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "BootGraph.h"
+
+// Boot phases run on this many tasks, the booting task included
+#define BOOT_WORKERS 3
+#define BOOT_WORKER_STACK_SIZE 4096
+
+// Runs a BootGraph's phases concurrently, then logs when each ran and exports
+// the timeline as the boot_phase_start_seconds, boot_phase_duration_seconds
+// and boot_seconds metrics. Times are since the chip started.
+class BootRunner {
+  public:
+    BootRunner(BootGraph &graph) : graph_(graph) {}
+
+    // Returns once every phase has finished. The graph must be valid().
+    void run(size_t workers = BOOT_WORKERS);
+
+    // Logs the timeline at WARN so it reaches the remote logger
+    void log() const;
+
+    // The runner exporting metrics, the most recent to run
+    static const BootRunner *active() { return active_; }
+    const BootGraph &graph() const { return graph_; }
+    uint64_t doneUs() const { return doneUs_; }
+
+    void _work();
+
+  private:
+    BootGraph &graph_;
+    SemaphoreHandle_t mutex_ = nullptr;
+    // Given whenever a phase finishes to wake workers waiting for one
+    SemaphoreHandle_t progress_ = nullptr, exited_ = nullptr;
+    size_t workers_ = 0;
+    uint64_t doneUs_ = 0;
+
+    static const BootRunner *active_;
+};
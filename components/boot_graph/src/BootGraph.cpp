@@ -0,0 +1,46 @@
+#include "BootGraph.h"
+
+BootGraph::BootGraph(const Phase *phases, size_t nPhases) : phases_(phases), nPhases_(nPhases) {
+    if (nPhases_ > BOOT_MAX_PHASES) {
+        nPhases_ = BOOT_MAX_PHASES;
+    }
+}
+
+bool BootGraph::valid() const {
+    for (size_t i = 0; i < nPhases_; i++) {
+        if (phases_[i].deps & ~all()) {
+            return false;
+        }
+    }
+
+    // Finish whatever could run until nothing more can; anything left is
+    // stuck behind a cycle
+    uint32_t done = 0;
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (size_t i = 0; i < nPhases_; i++) {
+            if (!(done & BOOT_DEP(i)) && (phases_[i].deps & ~done) == 0) {
+                done |= BOOT_DEP(i);
+                progress = true;
+            }
+        }
+    }
+    return done == all();
+}
+
+int BootGraph::claim(uint64_t nowUs) {
+    for (size_t i = 0; i < nPhases_; i++) {
+        if (!(claimed_ & BOOT_DEP(i)) && (phases_[i].deps & ~finished_) == 0) {
+            claimed_ |= BOOT_DEP(i);
+            startUs_[i] = nowUs;
+            return i;
+        }
+    }
+    return NONE;
+}
+
+void BootGraph::finish(int phase, uint64_t nowUs) {
+    finished_ |= BOOT_DEP(phase);
+    endUs_[phase] = nowUs;
+}
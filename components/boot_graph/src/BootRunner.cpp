@@ -0,0 +1,136 @@
+#include "BootRunner.h"
+
+#include <cstdio>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#include "Metrics.h"
+
+static const char *TAG = "BOOT";
+
+const BootRunner *BootRunner::active_ = nullptr;
+
+namespace {
+// One sample per phase of the active runner's graph
+class PhaseMetric : public Metric {
+  public:
+    typedef float (*valueFn_t)(const BootGraph &graph, size_t phase);
+
+    PhaseMetric(const char *name, const char *help, valueFn_t fn)
+        : Metric(name, help, nullptr, Type::Gauge), fn_(fn) {}
+
+  protected:
+    void writeSamples(Writer &w) const override {
+        const BootRunner *runner = BootRunner::active();
+        if (!runner) {
+            return;
+        }
+        const BootGraph &graph = runner->graph();
+        char label[48];
+        for (size_t i = 0; i < graph.size(); i++) {
+            snprintf(label, sizeof(label), "phase=\"%s\"", graph.phase(i).name);
+            w.sample(*this, "", label, fn_(graph, i));
+        }
+    }
+
+  private:
+    valueFn_t fn_;
+};
+} // namespace
+
+static PhaseMetric startMetric(
+    "boot_phase_start_seconds", "When a boot phase started",
+    [](const BootGraph &graph, size_t i) { return graph.startUs(i) / 1e6f; });
+static PhaseMetric durationMetric(
+    "boot_phase_duration_seconds", "How long a boot phase took",
+    [](const BootGraph &graph, size_t i) {
+        return (graph.endUs(i) - graph.startUs(i)) / 1e6f;
+    });
+static MetricGaugeFn bootMetric("boot_seconds", "When every boot phase had finished", [] {
+    const BootRunner *runner = BootRunner::active();
+    return runner ? runner->doneUs() / 1e6f : NAN;
+});
+
+static void workerTask(void *runner) {
+    ((BootRunner *)runner)->_work();
+    vTaskDelete(NULL);
+}
+
+void BootRunner::_work() {
+    while (1) {
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        bool done = graph_.done();
+        int phase = done ? BootGraph::NONE : graph_.claim(esp_timer_get_time());
+        xSemaphoreGive(mutex_);
+
+        if (done) {
+            break;
+        }
+        if (phase == BootGraph::NONE) {
+            // Everything runnable is running, wait for something to finish
+            xSemaphoreTake(progress_, portMAX_DELAY);
+            continue;
+        }
+
+        ESP_LOGI(TAG, "%s started", graph_.phase(phase).name);
+        graph_.phase(phase).fn();
+
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        graph_.finish(phase, esp_timer_get_time());
+        xSemaphoreGive(mutex_);
+
+        // Wake every waiting worker, any of them may be able to start a phase
+        for (size_t i = 0; i < workers_; i++) {
+            xSemaphoreGive(progress_);
+        }
+    }
+
+    xSemaphoreGive(exited_);
+}
+
+void BootRunner::run(size_t workers) {
+    if (!graph_.valid()) {
+        ESP_LOGE(TAG, "Boot phases have missing or circular dependencies");
+        abort();
+    }
+
+    workers_ = workers ? workers : 1;
+    mutex_ = xSemaphoreCreateMutex();
+    progress_ = xSemaphoreCreateCounting(workers_, 0);
+    exited_ = xSemaphoreCreateCounting(workers_, 0);
+    assert(mutex_ && progress_ && exited_);
+
+    char name[configMAX_TASK_NAME_LEN];
+    for (size_t i = 1; i < workers_; i++) {
+        snprintf(name, sizeof(name), "boot%u", i);
+        // Same priority as the booting task so phases run as they did before
+        xTaskCreate(workerTask, name, BOOT_WORKER_STACK_SIZE, this,
+                    uxTaskPriorityGet(NULL), NULL);
+    }
+
+    _work();
+    for (size_t i = 0; i < workers_; i++) {
+        xSemaphoreTake(exited_, portMAX_DELAY);
+    }
+
+    vSemaphoreDelete(mutex_);
+    vSemaphoreDelete(progress_);
+    vSemaphoreDelete(exited_);
+    mutex_ = progress_ = exited_ = nullptr;
+
+    doneUs_ = esp_timer_get_time();
+    active_ = this;
+}
+
+void BootRunner::log() const {
+    char line[384];
+    size_t pos = 0;
+    for (size_t i = 0; i < graph_.size() && pos < sizeof(line); i++) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %s=+%llu(%llu)",
+                        graph_.phase(i).name, graph_.startUs(i) / 1000,
+                        (graph_.endUs(i) - graph_.startUs(i)) / 1000);
+    }
+    ESP_LOGW(TAG, "done=%llums phases(+start(duration)ms):%s", doneUs_ / 1000, line);
+}
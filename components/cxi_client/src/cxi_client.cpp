@@ -1,12 +1,19 @@
 #include "cxi_client.h"
 
+#include "Metrics.h"
+#include "ModbusMetrics.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #define NEGATIVE_TEMP_MASK (1 << 15)
 #define TEMP_UNSIGNED_MASK ~NEGATIVE_TEMP_MASK
 
 static const char *TAG = "CXIC";
 
+// Requests count each attempt, errors only those that failed after retrying
+static ModbusMetrics metrics("cxi");
+static MetricCounter retried("modbus_retries_total", "Modbus requests retried", "client=\"cxi\"");
+
 std::unordered_map<CxiRegister, CxiRegDef> cxi_registers_ = {
     {CxiRegister::OnOff, {"OnOff", 28301, MB_PARAM_HOLDING, CxiRegisterFormat::Unsigned, 0}},
     {CxiRegister::Mode, {"Mode", 28302, MB_PARAM_HOLDING, CxiRegisterFormat::Unsigned, 0}},
@@ -99,7 +106,12 @@ esp_err_t cxi_client_get_param(CxiRegDef def, uint16_t *value, unsigned int retr
     esp_err_t err = ESP_OK;
 
     for (int i = 0; i <= (int)retries; i++) {
+        if (i > 0) {
+            retried.inc();
+        }
+        int64_t startUs = esp_timer_get_time();
         err = mbc_master_get_parameter(def.idx, (char *)def.name, (uint8_t *)value, &type);
+        metrics.request(ModbusMetrics::Op::Read, (esp_timer_get_time() - startUs) / 1000);
         if (err == ESP_OK) {
 
             break;
@@ -111,6 +123,7 @@ esp_err_t cxi_client_get_param(CxiRegDef def, uint16_t *value, unsigned int retr
     if (err == ESP_OK) {
         ESP_LOGD(TAG, "Get OK %s(%d)=%u", def.name, def.idx, *value);
     } else {
+        metrics.error(ModbusMetrics::Op::Read);
         ESP_LOGE(TAG, "Get failed %s(%d), err = 0x%x (%s)", def.name, def.idx, (int)err,
                  (char *)esp_err_to_name(err));
     }
@@ -137,7 +150,12 @@ esp_err_t cxi_client_set_param(CxiRegDef def, uint16_t value, unsigned int retri
     esp_err_t err = ESP_OK;
 
     for (int i = 0; i <= (int)retries; i++) {
+        if (i > 0) {
+            retried.inc();
+        }
+        int64_t startUs = esp_timer_get_time();
         err = mbc_master_set_parameter(def.idx, (char *)def.name, (uint8_t *)&value, &type);
+        metrics.request(ModbusMetrics::Op::Write, (esp_timer_get_time() - startUs) / 1000);
         if (err == ESP_OK) {
             break;
         }
@@ -147,6 +165,7 @@ esp_err_t cxi_client_set_param(CxiRegDef def, uint16_t value, unsigned int retri
     if (err == ESP_OK) {
         ESP_LOGD(TAG, "Set OK %s(%d)=%u", def.name, def.idx, value);
     } else {
+        metrics.error(ModbusMetrics::Op::Write);
         ESP_LOGE(TAG, "Set failed %s(%d)=%u, err = 0x%x (%s)", def.name, def.idx, value, (int)err,
                  (char *)esp_err_to_name(err));
     }
@@ -0,0 +1,232 @@
+#include "esp_http_client.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <netdb.h>
+#include <string>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+struct esp_http_client {
+    esp_http_client_config_t config;
+    std::string host, path;
+    int port = 80;
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    int sock = -1;
+    int status = 0;
+    int64_t contentLength = -1;
+    int64_t bodyRead = 0;
+    bool keepAlive = true;
+    // Body bytes received along with the headers
+    std::string pending;
+
+    void event(esp_http_client_event_id_t id, char *key = nullptr, char *value = nullptr) {
+        if (config.event_handler) {
+            esp_http_client_event_t evt = {id, this, nullptr, 0, config.user_data, key, value};
+            config.event_handler(&evt);
+        }
+    }
+
+    void disconnect() {
+        if (sock >= 0) {
+            ::close(sock);
+            sock = -1;
+            event(HTTP_EVENT_DISCONNECTED);
+        }
+    }
+
+    esp_err_t connect() {
+        addrinfo hints = {}, *res;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) {
+            return ESP_FAIL;
+        }
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        timeval timeout = {config.timeout_ms / 1000, config.timeout_ms % 1000 * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        int err = ::connect(sock, res->ai_addr, res->ai_addrlen);
+        freeaddrinfo(res);
+        if (err != 0) {
+            ::close(sock);
+            sock = -1;
+            return ESP_FAIL;
+        }
+        event(HTTP_EVENT_ON_CONNECTED);
+        return ESP_OK;
+    }
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+    esp_http_client *client = new esp_http_client();
+    client->config = *config;
+    if (!client->config.timeout_ms) {
+        client->config.timeout_ms = 5000;
+    }
+    if (esp_http_client_set_url(client, config->url) != ESP_OK) {
+        delete client;
+        return nullptr;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    client->disconnect();
+    delete client;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url) {
+    std::string u = url;
+    if (u.rfind("http://", 0) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    u = u.substr(7);
+    size_t slash = u.find('/');
+    std::string hostPort = u.substr(0, slash);
+    client->path = slash == std::string::npos ? "/" : u.substr(slash);
+    size_t colon = hostPort.find(':');
+    std::string host = hostPort.substr(0, colon);
+    int port = colon == std::string::npos ? 80 : std::stoi(hostPort.substr(colon + 1));
+    if (host != client->host || port != client->port) {
+        client->disconnect();
+    }
+    client->host = host;
+    client->port = port;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key,
+                                     const char *value) {
+    esp_http_client_delete_header(client, key);
+    client->headers.push_back({key, value});
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key) {
+    auto &h = client->headers;
+    h.erase(std::remove_if(h.begin(), h.end(),
+                           [&](auto &kv) { return !strcasecmp(kv.first.c_str(), key); }),
+            h.end());
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+    if (client->sock >= 0 && !esp_http_client_is_complete_data_received(client)) {
+        client->disconnect();
+    }
+
+    std::string req = "GET " + client->path + " HTTP/1.1\r\nHost: " + client->host + "\r\n";
+    for (auto &kv : client->headers) {
+        req += kv.first + ": " + kv.second + "\r\n";
+    }
+    req += "\r\n";
+
+    client->status = 0;
+    client->contentLength = -1;
+    client->bodyRead = 0;
+    client->pending.clear();
+    // A kept connection may have been closed by the server, so try a new one
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = client->sock >= 0;
+        if (!reused && client->connect() != ESP_OK) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (send(client->sock, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size()) {
+            client->event(HTTP_EVENT_HEADERS_SENT);
+            return ESP_OK;
+        }
+        client->disconnect();
+        if (!reused) {
+            break;
+        }
+    }
+    return ESP_FAIL;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+    std::string head;
+    size_t end;
+    char buf[1024];
+    while ((end = head.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(client->sock, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            client->disconnect();
+            return ESP_FAIL;
+        }
+        head.append(buf, n);
+    }
+    client->pending = head.substr(end + 4);
+    head.resize(end + 2);
+
+    size_t lineEnd = head.find("\r\n");
+    if (sscanf(head.c_str(), "HTTP/1.%*d %d", &client->status) != 1) {
+        client->disconnect();
+        return ESP_FAIL;
+    }
+    client->keepAlive = client->config.keep_alive_enable;
+    for (size_t pos = lineEnd + 2; pos < head.size(); pos = lineEnd + 2) {
+        lineEnd = head.find("\r\n", pos);
+        std::string line = head.substr(pos, lineEnd - pos);
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, colon);
+        std::string value = line.substr(line.find_first_not_of(' ', colon + 1));
+        if (!strcasecmp(key.c_str(), "Content-Length")) {
+            client->contentLength = std::stoll(value);
+        } else if (!strcasecmp(key.c_str(), "Connection") &&
+                   !strcasecmp(value.c_str(), "close")) {
+            client->keepAlive = false;
+        }
+        client->event(HTTP_EVENT_ON_HEADER, key.data(), value.data());
+    }
+    return client->contentLength;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) { return client->status; }
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+    if (client->contentLength >= 0) {
+        len = std::min<int64_t>(len, client->contentLength - client->bodyRead);
+    }
+    if (len <= 0) {
+        return 0;
+    }
+    int n;
+    if (!client->pending.empty()) {
+        n = std::min<size_t>(len, client->pending.size());
+        memcpy(buffer, client->pending.data(), n);
+        client->pending.erase(0, n);
+    } else {
+        n = recv(client->sock, buffer, len, 0);
+        if (n <= 0) {
+            client->disconnect();
+            return -1;
+        }
+    }
+    client->bodyRead += n;
+    if (esp_http_client_is_complete_data_received(client)) {
+        client->event(HTTP_EVENT_ON_FINISH);
+        if (!client->keepAlive) {
+            client->disconnect();
+        }
+    }
+    return n;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client) {
+    return client->contentLength >= 0 && client->bodyRead >= client->contentLength;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+    client->disconnect();
+    return ESP_OK;
+}
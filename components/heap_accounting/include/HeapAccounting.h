@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "HeapTrend.h"
+
+#define HEAP_MAX_SUBSYSTEMS 10
+#define HEAP_MAX_SUBSYSTEM_TASKS 3
+// Tasks sampled, including deleted tasks that still own blocks
+#define HEAP_MAX_TASKS 48
+// A subsystem growing faster than this over its trend window is warned about
+#define HEAP_LEAK_WARN_BYTES_PER_HOUR 256
+
+// Attributes heap usage to subsystems by the task that allocated each block,
+// using the heap's task tracking (CONFIG_HEAP_TASK_TRACKING), and fits a
+// growth slope per subsystem so a slow leak can be traced to its owner long
+// before the heap runs out. Blocks from tasks outside every subsystem,
+// including ones that have since exited, are counted as "other".
+//
+// Usage and slopes are exported as the heap_subsystem_bytes and
+// heap_subsystem_growth_bytes_per_hour metrics. Call sample() at a fixed
+// interval; the trend window is HEAP_TREND_SAMPLES of those intervals.
+class HeapAccounting {
+  public:
+    struct Subsystem {
+        const char *name;
+        // Names of the tasks whose allocations are charged to it
+        const char *tasks[HEAP_MAX_SUBSYSTEM_TASKS];
+    };
+
+    HeapAccounting(const Subsystem *subsystems, size_t nSubsystems);
+    ~HeapAccounting();
+
+    // Walks every heap block, so takes a few ms. Logs a warning for each
+    // subsystem that newly grows faster than the warning threshold.
+    void sample();
+
+    // Subsystems, with "other" last
+    size_t numSubsystems() const { return nSubsystems_ + 1; }
+    const char *subsystemName(size_t i) const;
+    int32_t bytes(size_t i) const { return bytes_[i].load(std::memory_order_relaxed); }
+    float slopePerHour(size_t i) const { return slope_[i].load(std::memory_order_relaxed); }
+
+    // Logs each subsystem's usage and growth at WARN so it reaches the remote logger
+    void log() const;
+
+    // The instance exporting metrics, the most recently constructed
+    static const HeapAccounting *active() { return active_; }
+
+  private:
+    const Subsystem *subsystems_;
+    size_t nSubsystems_;
+
+    // Sample buffers and trends live in PSRAM
+    TaskStatus_t *status_;
+    void *totals_;
+    HeapTrend *trends_;
+
+    std::atomic<int32_t> bytes_[HEAP_MAX_SUBSYSTEMS + 1] = {};
+    std::atomic<float> slope_[HEAP_MAX_SUBSYSTEMS + 1] = {};
+    bool warned_[HEAP_MAX_SUBSYSTEMS + 1] = {};
+
+    static const HeapAccounting *active_;
+
+    size_t subsystemForTask(const char *taskName) const;
+};
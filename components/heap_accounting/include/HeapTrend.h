@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Samples in the window a growth slope is fitted over
+#define HEAP_TREND_SAMPLES 96
+// Fewer samples than this are too noisy to report a slope from
+#define HEAP_TREND_MIN_SAMPLES 8
+
+// Fits a least squares line through a sliding window of heap usage samples,
+// so steady growth stands out from the allocations that come and go.
+class HeapTrend {
+  public:
+    // timeSecs only has to increase modulo 2^32
+    void add(uint32_t timeSecs, int32_t bytes);
+
+    size_t size() const { return size_; }
+    int32_t latest() const {
+        return size_ ? bytes_[(head_ + HEAP_TREND_SAMPLES - 1) % HEAP_TREND_SAMPLES] : 0;
+    }
+    // Growth over the window in bytes per hour, 0 until there are
+    // HEAP_TREND_MIN_SAMPLES samples
+    float slopePerHour() const;
+
+  private:
+    uint32_t times_[HEAP_TREND_SAMPLES] = {};
+    int32_t bytes_[HEAP_TREND_SAMPLES] = {};
+    size_t head_ = 0; // Next write position
+    size_t size_ = 0;
+};
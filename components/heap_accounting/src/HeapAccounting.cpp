@@ -0,0 +1,167 @@
+#include "HeapAccounting.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "esp_heap_caps.h"
+#include "esp_heap_task_info.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "Metrics.h"
+
+static const char *TAG = "HEAP";
+
+const HeapAccounting *HeapAccounting::active_ = nullptr;
+
+namespace {
+// One sample per subsystem of the active accounting
+class SubsystemMetric : public Metric {
+  public:
+    typedef float (*valueFn_t)(const HeapAccounting &acct, size_t subsystem);
+
+    SubsystemMetric(const char *name, const char *help, valueFn_t fn)
+        : Metric(name, help, nullptr, Type::Gauge), fn_(fn) {}
+
+  protected:
+    void writeSamples(Writer &w) const override {
+        const HeapAccounting *acct = HeapAccounting::active();
+        if (!acct) {
+            return;
+        }
+        char label[48];
+        for (size_t i = 0; i < acct->numSubsystems(); i++) {
+            snprintf(label, sizeof(label), "subsystem=\"%s\"", acct->subsystemName(i));
+            w.sample(*this, "", label, fn_(*acct, i));
+        }
+    }
+
+  private:
+    valueFn_t fn_;
+};
+} // namespace
+
+static SubsystemMetric bytesMetric(
+    "heap_subsystem_bytes", "Heap allocated by a subsystem's tasks",
+    [](const HeapAccounting &acct, size_t i) { return (float)acct.bytes(i); });
+static SubsystemMetric slopeMetric(
+    "heap_subsystem_growth_bytes_per_hour", "Trend in heap allocated by a subsystem's tasks",
+    [](const HeapAccounting &acct, size_t i) { return acct.slopePerHour(i); });
+
+HeapAccounting::HeapAccounting(const Subsystem *subsystems, size_t nSubsystems)
+    : subsystems_(subsystems), nSubsystems_(nSubsystems) {
+    if (nSubsystems_ > HEAP_MAX_SUBSYSTEMS) {
+        // Static initialization, logging may not be up yet
+        nSubsystems_ = HEAP_MAX_SUBSYSTEMS;
+    }
+
+    status_ = (TaskStatus_t *)heap_caps_calloc(HEAP_MAX_TASKS, sizeof(TaskStatus_t),
+                                               MALLOC_CAP_SPIRAM);
+#if CONFIG_HEAP_TASK_TRACKING
+    totals_ = heap_caps_calloc(HEAP_MAX_TASKS, sizeof(heap_task_totals_t), MALLOC_CAP_SPIRAM);
+#else
+    totals_ = nullptr;
+#endif
+    trends_ = (HeapTrend *)heap_caps_malloc(numSubsystems() * sizeof(HeapTrend),
+                                            MALLOC_CAP_SPIRAM);
+    for (size_t i = 0; trends_ && i < numSubsystems(); i++) {
+        new (&trends_[i]) HeapTrend();
+    }
+
+    active_ = this;
+}
+
+HeapAccounting::~HeapAccounting() {
+    if (active_ == this) {
+        active_ = nullptr;
+    }
+    heap_caps_free(status_);
+    heap_caps_free(totals_);
+    heap_caps_free(trends_);
+}
+
+const char *HeapAccounting::subsystemName(size_t i) const {
+    return i < nSubsystems_ ? subsystems_[i].name : "other";
+}
+
+size_t HeapAccounting::subsystemForTask(const char *taskName) const {
+    for (size_t i = 0; taskName && i < nSubsystems_; i++) {
+        for (const char *name : subsystems_[i].tasks) {
+            if (name && strcmp(name, taskName) == 0) {
+                return i;
+            }
+        }
+    }
+    return nSubsystems_;
+}
+
+void HeapAccounting::sample() {
+#if CONFIG_HEAP_TASK_TRACKING
+    if (!status_ || !totals_ || !trends_) {
+        return;
+    }
+
+    UBaseType_t nTasks = uxTaskGetSystemState(status_, HEAP_MAX_TASKS, nullptr);
+
+    heap_task_totals_t *totals = (heap_task_totals_t *)totals_;
+    size_t nTotals = 0, nBlocks = 0;
+    heap_task_info_params_t params = {};
+    params.caps[0] = MALLOC_CAP_INTERNAL;
+    params.mask[0] = MALLOC_CAP_INTERNAL;
+    params.caps[1] = MALLOC_CAP_SPIRAM;
+    params.mask[1] = MALLOC_CAP_SPIRAM;
+    params.totals = totals;
+    params.num_totals = &nTotals;
+    params.max_totals = HEAP_MAX_TASKS;
+    params.num_blocks = &nBlocks;
+    heap_caps_get_per_task_info(&params);
+
+    int32_t bytes[HEAP_MAX_SUBSYSTEMS + 1] = {};
+    for (size_t i = 0; i < nTotals; i++) {
+        // Tasks that have exited aren't in the system state and fall to "other"
+        const char *name = nullptr;
+        for (UBaseType_t t = 0; t < nTasks; t++) {
+            if (status_[t].xHandle == totals[i].task) {
+                name = status_[t].pcTaskName;
+                break;
+            }
+        }
+        bytes[subsystemForTask(name)] += totals[i].size[0] + totals[i].size[1];
+    }
+
+    // Not from the tick count, which wraps after 49.7 days at 1kHz
+    uint32_t nowSecs = esp_timer_get_time() / 1000000;
+    for (size_t i = 0; i < numSubsystems(); i++) {
+        trends_[i].add(nowSecs, bytes[i]);
+        float slope = trends_[i].slopePerHour();
+        bytes_[i].store(bytes[i], std::memory_order_relaxed);
+        slope_[i].store(slope, std::memory_order_relaxed);
+
+        // Only warn as a subsystem crosses the threshold so a persistent leak
+        // doesn't flood the log
+        bool leaking = slope > HEAP_LEAK_WARN_BYTES_PER_HOUR;
+        if (leaking && !warned_[i]) {
+            ESP_LOGW(TAG, "%s heap growing %.0fb/h over %u samples, now %ldb",
+                     subsystemName(i), slope, trends_[i].size(), bytes[i]);
+        }
+        warned_[i] = leaking;
+    }
+#else
+    static bool logged = false;
+    if (!logged) {
+        ESP_LOGW(TAG, "Heap task tracking disabled, not accounting by subsystem");
+        logged = true;
+    }
+#endif
+}
+
+void HeapAccounting::log() const {
+    char line[256];
+    size_t pos = 0;
+    for (size_t i = 0; i < numSubsystems() && pos < sizeof(line); i++) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %s=%ldb(%+.0f/h)", subsystemName(i),
+                        bytes(i), slopePerHour(i));
+    }
+    ESP_LOGW(TAG, "subsystems:%s", line);
+}
@@ -0,0 +1,40 @@
+#include "HeapTrend.h"
+
+void HeapTrend::add(uint32_t timeSecs, int32_t bytes) {
+    times_[head_] = timeSecs;
+    bytes_[head_] = bytes;
+    head_ = (head_ + 1) % HEAP_TREND_SAMPLES;
+    if (size_ < HEAP_TREND_SAMPLES) {
+        size_++;
+    }
+}
+
+float HeapTrend::slopePerHour() const {
+    if (size_ < HEAP_TREND_MIN_SAMPLES) {
+        return 0;
+    }
+
+    // Relative to the oldest sample so the sums stay small enough for doubles
+    // to be exact
+    size_t oldest = (head_ + HEAP_TREND_SAMPLES - size_) % HEAP_TREND_SAMPLES;
+    uint32_t t0 = times_[oldest];
+    int32_t b0 = bytes_[oldest];
+
+    double sumT = 0, sumB = 0, sumTT = 0, sumTB = 0;
+    for (size_t i = 0; i < size_; i++) {
+        size_t idx = (oldest + i) % HEAP_TREND_SAMPLES;
+        double t = (double)(times_[idx] - t0) / 3600;
+        double b = bytes_[idx] - b0;
+        sumT += t;
+        sumB += b;
+        sumTT += t * t;
+        sumTB += t * b;
+    }
+
+    double denom = size_ * sumTT - sumT * sumT;
+    if (denom <= 0) {
+        // All samples at the same time
+        return 0;
+    }
+    return (size_ * sumTB - sumT * sumB) / denom;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOOP_MAX_PHASES 8
+// Histogram buckets: LOOP_HIST_BUCKETS - 1 upper bounds plus one for anything longer
+#define LOOP_HIST_BUCKETS 12
+// Phase overruns and deadline misses are logged at most this often for each
+#define LOOP_WARN_INTERVAL std::chrono::minutes(1)
+
+// Times a periodic control loop: how long each iteration's work takes, how
+// late each iteration starts, how many iterations miss their deadline and how
+// long each phase of the work takes against its budget.
+//
+// An iteration runs start(), one endPhase() per phase and finish(). The loop
+// then waits up to the given time for its next iteration; starting any later
+// than that is start jitter. An iteration misses its deadline when its work
+// ends more than deadlineMs after it was due to start.
+//
+// The histograms are exported as the loop_*_seconds metrics, labelled with
+// the loop's name.
+//
+// Not thread safe, only call from the loop's task. The methods without a time
+// read the steady clock.
+class LoopMonitor {
+  public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    struct Phase {
+        const char *name;
+        uint32_t budgetMs;
+    };
+
+    struct Stats {
+        uint32_t count;
+        uint32_t overruns; // Over budget, or missed deadlines for the iteration
+        uint64_t totalUs;
+        uint32_t maxUs;
+        uint32_t hist[LOOP_HIST_BUCKETS];
+
+        uint32_t meanUs() const { return count ? totalUs / count : 0; }
+    };
+
+    LoopMonitor(const char *name, uint32_t deadlineMs, const Phase *phases, size_t nPhases);
+    ~LoopMonitor();
+    LoopMonitor(const LoopMonitor &) = delete;
+    LoopMonitor &operator=(const LoopMonitor &) = delete;
+
+    void start() { start(std::chrono::steady_clock::now()); }
+    void start(time_point now);
+    // Ends the phase that ran since start() or the previous endPhase()
+    void endPhase(size_t phase) { endPhase(phase, std::chrono::steady_clock::now()); }
+    void endPhase(size_t phase, time_point now);
+    void finish(uint32_t waitMs) { finish(std::chrono::steady_clock::now(), waitMs); }
+    void finish(time_point now, uint32_t waitMs);
+
+    const char *name() const { return name_; }
+    size_t numPhases() const { return nPhases_; }
+    const Phase &phase(size_t phase) const { return phases_[phase]; }
+    const Stats &phaseStats(size_t phase) const { return phaseStats_[phase]; }
+    const Stats &iterationStats() const { return iterStats_; }
+    const Stats &startJitterStats() const { return jitterStats_; }
+
+    // Upper bound of a histogram bucket, 0 for the last, unbounded one
+    static uint32_t bucketLimitMs(size_t bucket);
+
+    // Logs the iteration, jitter and phase stats at WARN so they reach the
+    // remote logger
+    void log() const;
+
+  private:
+    const char *name_;
+    uint32_t deadlineMs_;
+    const Phase *phases_;
+    size_t nPhases_;
+
+    Stats phaseStats_[LOOP_MAX_PHASES] = {};
+    Stats iterStats_ = {}, jitterStats_ = {};
+
+    bool running_ = false, haveDue_ = false;
+    time_point due_{}, dueStart_{}, startedAt_{}, lastMark_{};
+
+    // Indexed by phase, with the deadline last
+    time_point lastWarn_[LOOP_MAX_PHASES + 1] = {};
+    uint32_t unwarned_[LOOP_MAX_PHASES + 1] = {};
+
+    // Every monitor, for the metrics
+    LoopMonitor *next_ = nullptr;
+    static LoopMonitor *head_;
+
+    friend class LoopHistogramMetric;
+
+    static void record(Stats &stats, uint32_t us);
+    void warn(size_t idx, time_point now, const char *what, uint32_t us, uint32_t limitMs);
+    void logStats(const char *what, const Stats &stats) const;
+};
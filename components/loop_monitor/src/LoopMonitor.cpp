@@ -0,0 +1,231 @@
+#include "LoopMonitor.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <iterator>
+#include <mutex>
+
+#include "esp_log.h"
+
+#include "Metrics.h"
+
+static const char *TAG = "LOOP";
+
+static const uint32_t bucketLimitsMs[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000};
+static_assert(std::size(bucketLimitsMs) == LOOP_HIST_BUCKETS - 1);
+
+static uint32_t toUs(std::chrono::steady_clock::duration d) {
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    if (us < 0) {
+        return 0;
+    }
+    return us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+LoopMonitor *LoopMonitor::head_ = nullptr;
+// Guards the list of monitors, which the metrics server walks from its task
+static std::mutex monitorsMutex;
+
+// One histogram per monitor, or per phase of each monitor. The stats are read
+// without locking, so a scrape may catch an iteration half recorded. Times on
+// a bucket's bound are counted in the bucket above it.
+class LoopHistogramMetric : public Metric {
+  public:
+    enum class Which { Iteration, StartJitter, Phase };
+
+    LoopHistogramMetric(const char *name, const char *help, Which which)
+        : Metric(name, help, nullptr, Type::Histogram), which_(which) {}
+
+  protected:
+    void writeSamples(Writer &w) const override {
+        std::lock_guard<std::mutex> lock(monitorsMutex);
+        char labels[64];
+        for (const LoopMonitor *mon = LoopMonitor::head_; mon; mon = mon->next_) {
+            switch (which_) {
+            case Which::Iteration:
+                snprintf(labels, sizeof(labels), "loop=\"%s\"", mon->name_);
+                writeStats(w, labels, mon->iterStats_);
+                break;
+            case Which::StartJitter:
+                snprintf(labels, sizeof(labels), "loop=\"%s\"", mon->name_);
+                writeStats(w, labels, mon->jitterStats_);
+                break;
+            case Which::Phase:
+                for (size_t i = 0; i < mon->nPhases_; i++) {
+                    snprintf(labels, sizeof(labels), "loop=\"%s\",phase=\"%s\"", mon->name_,
+                             mon->phases_[i].name);
+                    writeStats(w, labels, mon->phaseStats_[i]);
+                }
+                break;
+            }
+        }
+    }
+
+  private:
+    Which which_;
+
+    void writeStats(Writer &w, const char *labels, const LoopMonitor::Stats &stats) const {
+        char bucketLabels[96];
+        uint32_t cumulative = 0;
+        for (size_t i = 0; i < std::size(bucketLimitsMs); i++) {
+            cumulative += stats.hist[i];
+            snprintf(bucketLabels, sizeof(bucketLabels), "%s,le=\"%g\"", labels,
+                     bucketLimitsMs[i] / 1e3);
+            w.sample(*this, "_bucket", bucketLabels, cumulative);
+        }
+        cumulative += stats.hist[LOOP_HIST_BUCKETS - 1];
+        snprintf(bucketLabels, sizeof(bucketLabels), "%s,le=\"+Inf\"", labels);
+        w.sample(*this, "_bucket", bucketLabels, cumulative);
+        w.sample(*this, "_sum", labels, stats.totalUs / 1e6f);
+        w.sample(*this, "_count", labels, cumulative);
+    }
+};
+
+static LoopHistogramMetric iterationMetric("loop_iteration_seconds",
+                                           "Time a loop iteration's work took",
+                                           LoopHistogramMetric::Which::Iteration);
+static LoopHistogramMetric jitterMetric("loop_start_jitter_seconds",
+                                        "How late a loop iteration started",
+                                        LoopHistogramMetric::Which::StartJitter);
+static LoopHistogramMetric phaseMetric("loop_phase_seconds", "Time a phase of a loop took",
+                                       LoopHistogramMetric::Which::Phase);
+
+LoopMonitor::LoopMonitor(const char *name, uint32_t deadlineMs, const Phase *phases,
+                         size_t nPhases)
+    : name_(name), deadlineMs_(deadlineMs), phases_(phases), nPhases_(nPhases) {
+    if (nPhases_ > LOOP_MAX_PHASES) {
+        ESP_LOGE(TAG, "%s: %zu phases, only timing the first %d", name_, nPhases_,
+                 LOOP_MAX_PHASES);
+        nPhases_ = LOOP_MAX_PHASES;
+    }
+
+    std::lock_guard<std::mutex> lock(monitorsMutex);
+    next_ = head_;
+    head_ = this;
+}
+
+LoopMonitor::~LoopMonitor() {
+    std::lock_guard<std::mutex> lock(monitorsMutex);
+    for (LoopMonitor **p = &head_; *p; p = &(*p)->next_) {
+        if (*p == this) {
+            *p = next_;
+            break;
+        }
+    }
+}
+
+uint32_t LoopMonitor::bucketLimitMs(size_t bucket) {
+    return bucket < std::size(bucketLimitsMs) ? bucketLimitsMs[bucket] : 0;
+}
+
+void LoopMonitor::record(Stats &stats, uint32_t us) {
+    stats.count++;
+    stats.totalUs += us;
+    if (us > stats.maxUs) {
+        stats.maxUs = us;
+    }
+
+    size_t bucket = 0;
+    while (bucket < std::size(bucketLimitsMs) && us >= bucketLimitsMs[bucket] * 1000) {
+        bucket++;
+    }
+    stats.hist[bucket]++;
+}
+
+void LoopMonitor::start(time_point now) {
+    startedAt_ = lastMark_ = dueStart_ = now;
+    if (haveDue_) {
+        // A loop woken early, e.g. by a UI event, isn't late
+        record(jitterStats_, toUs(now - due_));
+        if (due_ < now) {
+            dueStart_ = due_;
+        }
+    }
+    running_ = true;
+}
+
+void LoopMonitor::endPhase(size_t phase, time_point now) {
+    if (!running_ || phase >= nPhases_) {
+        return;
+    }
+
+    uint32_t us = toUs(now - lastMark_);
+    lastMark_ = now;
+    Stats &stats = phaseStats_[phase];
+    record(stats, us);
+
+    uint32_t budgetMs = phases_[phase].budgetMs;
+    if (budgetMs && us > budgetMs * 1000) {
+        stats.overruns++;
+        warn(phase, now, phases_[phase].name, us, budgetMs);
+    }
+}
+
+void LoopMonitor::finish(time_point now, uint32_t waitMs) {
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+
+    record(iterStats_, toUs(now - startedAt_));
+
+    // A late start counts against the deadline but not the work time
+    uint32_t us = toUs(now - dueStart_);
+    if (us > deadlineMs_ * 1000) {
+        iterStats_.overruns++;
+        warn(LOOP_MAX_PHASES, now, "iteration", us, deadlineMs_);
+    }
+
+    due_ = now + std::chrono::milliseconds(waitMs);
+    haveDue_ = true;
+}
+
+void LoopMonitor::warn(size_t idx, time_point now, const char *what, uint32_t us,
+                       uint32_t limitMs) {
+    unwarned_[idx]++;
+    if (lastWarn_[idx] != time_point{} && now - lastWarn_[idx] < LOOP_WARN_INTERVAL) {
+        return;
+    }
+
+    ESP_LOGW(TAG,
+             "%s %s took %" PRIu32 "ms, limit %" PRIu32 "ms (%" PRIu32
+             " over since last warning)",
+             name_, what, us / 1000, limitMs, unwarned_[idx]);
+    lastWarn_[idx] = now;
+    unwarned_[idx] = 0;
+}
+
+void LoopMonitor::logStats(const char *what, const Stats &stats) const {
+    char hist[LOOP_HIST_BUCKETS * 11];
+    size_t pos = 0;
+    for (size_t i = 0; i < LOOP_HIST_BUCKETS && pos < sizeof(hist); i++) {
+        pos += snprintf(hist + pos, sizeof(hist) - pos, "%s%" PRIu32, i ? "/" : "", stats.hist[i]);
+    }
+
+    ESP_LOGW(TAG,
+             "%s %s n=%" PRIu32 " mean=%" PRIu32 "us max=%" PRIu32 "us over=%" PRIu32 " hist=%s",
+             name_, what, stats.count, stats.meanUs(), stats.maxUs, stats.overruns, hist);
+}
+
+void LoopMonitor::log() const {
+    if (iterStats_.count == 0) {
+        return;
+    }
+
+    char buckets[LOOP_HIST_BUCKETS * 6];
+    size_t pos = 0;
+    for (size_t i = 0; i < std::size(bucketLimitsMs) && pos < sizeof(buckets); i++) {
+        pos += snprintf(buckets + pos, sizeof(buckets) - pos, "<%" PRIu32 "/", bucketLimitsMs[i]);
+    }
+    if (pos < sizeof(buckets)) {
+        snprintf(buckets + pos, sizeof(buckets) - pos, ">=%" PRIu32,
+                 bucketLimitsMs[std::size(bucketLimitsMs) - 1]);
+    }
+    ESP_LOGW(TAG, "%s deadline=%" PRIu32 "ms hist buckets (ms) %s", name_, deadlineMs_, buckets);
+
+    logStats("iteration", iterStats_);
+    logStats("start_jitter", jitterStats_);
+    for (size_t i = 0; i < nPhases_; i++) {
+        logStats(phases_[i].name, phaseStats_[i]);
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <stddef.h>
+#include <stdint.h>
+
+// Upper bounds a histogram may have, not counting +Inf
+#define METRIC_MAX_BOUNDS 15
+
+// A metric exported in the Prometheus text format.
+//
+// Define metrics as static objects only. Each adds itself to a global list
+// during static initialization, before any task runs, and the list never
+// changes after that, so it's read without locking. Updates are single
+// relaxed atomic operations on 32-bit values, so they're cheap enough for hot
+// paths. Counters and histogram sums wrap at 2^32, which Prometheus treats
+// like a restart.
+//
+// Metrics may share a name with different labels, e.g. `op="read"`. Those are
+// exported together under the first one's help text.
+class Metric {
+  public:
+    enum class Type { Counter, Gauge, Histogram };
+
+    Metric(const Metric &) = delete;
+    Metric &operator=(const Metric &) = delete;
+
+    const char *name() const { return name_; }
+    const char *labels() const { return labels_; }
+    Type type() const { return type_; }
+
+    // Writes every metric in the text exposition format to buf, truncating to
+    // size including the terminating null. Returns the full length, like
+    // snprintf, so render(nullptr, 0) measures the output.
+    static size_t render(char *buf, size_t size);
+
+  protected:
+    Metric(const char *name, const char *help, const char *labels, Type type);
+
+    class Writer {
+      public:
+        Writer(char *buf, size_t size) : buf_(buf), size_(size) {}
+        void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+        // Writes the name and labels, with extra labels added, then the value
+        void sample(const Metric &m, const char *suffix, const char *extraLabels, float value);
+        void sample(const Metric &m, const char *suffix, const char *extraLabels,
+                    uint32_t value);
+        size_t pos() const { return pos_; }
+
+      private:
+        char *buf_;
+        size_t size_, pos_ = 0;
+
+        void nameAndLabels(const Metric &m, const char *suffix, const char *extraLabels);
+    };
+
+    virtual void writeSamples(Writer &w) const = 0;
+
+  private:
+    const char *name_, *help_, *labels_;
+    Type type_;
+    Metric *next_ = nullptr;
+
+    static Metric *head_, **tail_;
+};
+
+class MetricCounter : public Metric {
+  public:
+    MetricCounter(const char *name, const char *help, const char *labels = nullptr)
+        : Metric(name, help, labels, Type::Counter) {}
+
+    void inc(uint32_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+  protected:
+    void writeSamples(Writer &w) const override;
+
+  private:
+    std::atomic<uint32_t> value_{0};
+};
+
+// Exported as NaN until first set
+class MetricGauge : public Metric {
+  public:
+    MetricGauge(const char *name, const char *help, const char *labels = nullptr)
+        : Metric(name, help, labels, Type::Gauge) {}
+
+    void set(float value) { value_.store(value, std::memory_order_relaxed); }
+    float value() const { return value_.load(std::memory_order_relaxed); }
+
+  protected:
+    void writeSamples(Writer &w) const override;
+
+  private:
+    std::atomic<float> value_{NAN};
+};
+
+// A gauge read when the metrics are rendered. fn is called from the server's
+// task, so it must be thread safe.
+class MetricGaugeFn : public Metric {
+  public:
+    typedef float (*valueFn_t)();
+
+    MetricGaugeFn(const char *name, const char *help, valueFn_t fn, const char *labels = nullptr)
+        : Metric(name, help, labels, Type::Gauge), fn_(fn) {}
+
+  protected:
+    void writeSamples(Writer &w) const override;
+
+  private:
+    valueFn_t fn_;
+};
+
+// Observations are integers in some unit, e.g. ms, and are exported
+// multiplied by unitScale, e.g. 0.001 for seconds. bounds are ascending upper
+// bounds in the observation unit.
+class MetricHistogram : public Metric {
+  public:
+    MetricHistogram(const char *name, const char *help, const uint32_t *bounds, size_t nBounds,
+                    float unitScale, const char *labels = nullptr);
+
+    void observe(uint32_t value);
+
+    uint32_t count() const;
+    uint32_t bucketCount(size_t bucket) const {
+        return counts_[bucket].load(std::memory_order_relaxed);
+    }
+
+  protected:
+    void writeSamples(Writer &w) const override;
+
+  private:
+    const uint32_t *bounds_;
+    size_t nBounds_;
+    float unitScale_;
+    // The last bucket is +Inf
+    std::atomic<uint32_t> counts_[METRIC_MAX_BOUNDS + 1] = {};
+    std::atomic<uint32_t> sum_{0};
+};
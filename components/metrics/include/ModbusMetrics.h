@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Metrics.h"
+
+// Request, error and latency metrics for one Modbus client, labelled
+// `client="<name>"` and, for the counters, `op="read"` or `op="write"`.
+//
+// Define as a static object, like the metrics it holds.
+class ModbusMetrics {
+  public:
+    enum class Op { Read, Write };
+
+    explicit ModbusMetrics(const char *client);
+
+    // Counts a request, or each attempt at one when retrying
+    void request(Op op, uint32_t elapsedMs);
+    // Counts a request that failed, after any retries
+    void error(Op op);
+
+  private:
+    char opLabels_[2][40];
+    char clientLabels_[24];
+    MetricCounter requests_[2];
+    MetricCounter errors_[2];
+    MetricHistogram latency_;
+};
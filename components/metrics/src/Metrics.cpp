@@ -0,0 +1,152 @@
+#include "Metrics.h"
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_log.h"
+
+static const char *TAG = "METRICS";
+
+// Constant initialized, so safe to use from other files' static initializers
+Metric *Metric::head_ = nullptr;
+Metric **Metric::tail_ = &Metric::head_;
+
+Metric::Metric(const char *name, const char *help, const char *labels, Type type)
+    : name_(name), help_(help), labels_(labels), type_(type) {
+    // Appended so metrics render in definition order
+    *tail_ = this;
+    tail_ = &next_;
+}
+
+static const char *typeName(Metric::Type type) {
+    switch (type) {
+    case Metric::Type::Counter:
+        return "counter";
+    case Metric::Type::Gauge:
+        return "gauge";
+    case Metric::Type::Histogram:
+        return "histogram";
+    }
+    return "untyped";
+}
+
+size_t Metric::render(char *buf, size_t size) {
+    Writer w(buf, size);
+    if (size) {
+        buf[0] = '\0';
+    }
+
+    for (const Metric *m = head_; m; m = m->next_) {
+        // Metrics sharing a name were written with the first of them
+        bool seen = false;
+        for (const Metric *prev = head_; prev != m && !seen; prev = prev->next_) {
+            seen = strcmp(prev->name_, m->name_) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+
+        w.printf("# HELP %s %s\n# TYPE %s %s\n", m->name_, m->help_, m->name_,
+                 typeName(m->type_));
+        for (const Metric *same = m; same; same = same->next_) {
+            if (strcmp(same->name_, m->name_) != 0) {
+                continue;
+            }
+            if (same->type_ != m->type_) {
+                ESP_LOGE(TAG, "%s registered with different types", m->name_);
+                continue;
+            }
+            same->writeSamples(w);
+        }
+    }
+
+    return w.pos();
+}
+
+void Metric::Writer::printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    char *dst = pos_ < size_ ? buf_ + pos_ : nullptr;
+    int wrote = vsnprintf(dst, dst ? size_ - pos_ : 0, fmt, args);
+    va_end(args);
+
+    if (wrote > 0) {
+        pos_ += wrote;
+    }
+}
+
+void Metric::Writer::nameAndLabels(const Metric &m, const char *suffix,
+                                   const char *extraLabels) {
+    printf("%s%s", m.name_, suffix);
+    if (m.labels_ || extraLabels) {
+        printf("{%s%s%s}", m.labels_ ? m.labels_ : "", m.labels_ && extraLabels ? "," : "",
+               extraLabels ? extraLabels : "");
+    }
+}
+
+void Metric::Writer::sample(const Metric &m, const char *suffix, const char *extraLabels,
+                            float value) {
+    nameAndLabels(m, suffix, extraLabels);
+    if (std::isnan(value)) {
+        printf(" NaN\n");
+    } else if (std::isinf(value)) {
+        printf(" %s\n", value > 0 ? "+Inf" : "-Inf");
+    } else {
+        printf(" %.7g\n", value);
+    }
+}
+
+void Metric::Writer::sample(const Metric &m, const char *suffix, const char *extraLabels,
+                            uint32_t value) {
+    nameAndLabels(m, suffix, extraLabels);
+    printf(" %" PRIu32 "\n", value);
+}
+
+void MetricCounter::writeSamples(Writer &w) const { w.sample(*this, "", nullptr, value()); }
+
+void MetricGauge::writeSamples(Writer &w) const { w.sample(*this, "", nullptr, value()); }
+
+void MetricGaugeFn::writeSamples(Writer &w) const { w.sample(*this, "", nullptr, fn_()); }
+
+MetricHistogram::MetricHistogram(const char *name, const char *help, const uint32_t *bounds,
+                                 size_t nBounds, float unitScale, const char *labels)
+    : Metric(name, help, labels, Type::Histogram), bounds_(bounds), nBounds_(nBounds),
+      unitScale_(unitScale) {
+    if (nBounds_ > METRIC_MAX_BOUNDS) {
+        // Static initialization, logging may not be up yet
+        nBounds_ = METRIC_MAX_BOUNDS;
+    }
+}
+
+void MetricHistogram::observe(uint32_t value) {
+    size_t bucket = 0;
+    while (bucket < nBounds_ && value > bounds_[bucket]) {
+        bucket++;
+    }
+    counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint32_t MetricHistogram::count() const {
+    uint32_t count = 0;
+    for (size_t i = 0; i <= nBounds_; i++) {
+        count += bucketCount(i);
+    }
+    return count;
+}
+
+void MetricHistogram::writeSamples(Writer &w) const {
+    char le[24];
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < nBounds_; i++) {
+        cumulative += bucketCount(i);
+        snprintf(le, sizeof(le), "le=\"%g\"", bounds_[i] * unitScale_);
+        w.sample(*this, "_bucket", le, cumulative);
+    }
+    cumulative += bucketCount(nBounds_);
+    w.sample(*this, "_bucket", "le=\"+Inf\"", cumulative);
+    w.sample(*this, "_sum", nullptr, sum_.load(std::memory_order_relaxed) * unitScale_);
+    w.sample(*this, "_count", nullptr, cumulative);
+}
@@ -0,0 +1,27 @@
+#include "ModbusMetrics.h"
+
+#include <cstdio>
+#include <iterator>
+
+static const uint32_t latencyBoundsMs[] = {10, 20, 50, 100, 200, 500, 1000, 2000};
+
+// The metrics only keep pointers to their labels, which are filled in below
+// before anything renders them
+ModbusMetrics::ModbusMetrics(const char *client)
+    : requests_{{"modbus_requests_total", "Modbus requests", opLabels_[0]},
+                {"modbus_requests_total", "Modbus requests", opLabels_[1]}},
+      errors_{{"modbus_errors_total", "Failed Modbus requests", opLabels_[0]},
+              {"modbus_errors_total", "Failed Modbus requests", opLabels_[1]}},
+      latency_("modbus_request_seconds", "Modbus request time", latencyBoundsMs,
+               std::size(latencyBoundsMs), 0.001, clientLabels_) {
+    snprintf(opLabels_[0], sizeof(opLabels_[0]), "client=\"%s\",op=\"read\"", client);
+    snprintf(opLabels_[1], sizeof(opLabels_[1]), "client=\"%s\",op=\"write\"", client);
+    snprintf(clientLabels_, sizeof(clientLabels_), "client=\"%s\"", client);
+}
+
+void ModbusMetrics::request(Op op, uint32_t elapsedMs) {
+    latency_.observe(elapsedMs);
+    requests_[(int)op].inc();
+}
+
+void ModbusMetrics::error(Op op) { errors_[(int)op].inc(); }
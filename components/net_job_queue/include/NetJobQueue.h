@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Deadlines of the network jobs, kept in a min-heap per class so a worker can
+// always find the most overdue job it may run.
+//
+// Long jobs (OTA downloads, uploads) are limited to maxLong running at once,
+// so with more workers than that one is always free for the short periodic
+// jobs. Not thread safe, callers serialize access.
+class NetJobQueue {
+  public:
+    enum class JobClass : uint8_t { Short, Long, NumClasses };
+
+    static constexpr int NONE = -1;
+
+    NetJobQueue(size_t maxLong = 1) : maxLong_(maxLong) {}
+
+    // Returns the job's index, in the order added
+    int add(JobClass cls, uint64_t dueMs = 0);
+
+    // Claims the most overdue job due by nowMs that may run now, or returns
+    // NONE. Short jobs win ties.
+    int claim(uint64_t nowMs);
+    // Puts a claimed job back, due again at dueMs
+    void finish(int job, uint64_t dueMs);
+
+    // When the next job that could be claimed is due, UINT64_MAX if none
+    uint64_t nextDueMs() const;
+
+    size_t size() const { return jobs_.size(); }
+    JobClass jobClass(int job) const { return jobs_[job].cls; }
+    uint64_t dueMs(int job) const { return jobs_[job].dueMs; }
+    bool running(int job) const { return jobs_[job].running; }
+
+  private:
+    struct Job {
+        JobClass cls;
+        uint64_t dueMs;
+        bool running;
+    };
+    struct Deadline {
+        uint64_t dueMs;
+        int job;
+        // For std::push_heap to keep the earliest on top
+        bool operator<(const Deadline &o) const { return dueMs > o.dueMs; }
+    };
+
+    std::vector<Job> jobs_;
+    std::vector<Deadline> heaps_[(size_t)JobClass::NumClasses];
+    size_t maxLong_, longRunning_ = 0;
+
+    bool mayRun(JobClass cls) const { return cls != JobClass::Long || longRunning_ < maxLong_; }
+    void push(int job);
+};
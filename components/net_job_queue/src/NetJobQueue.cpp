@@ -0,0 +1,61 @@
+#include "NetJobQueue.h"
+
+#include <algorithm>
+
+void NetJobQueue::push(int job) {
+    std::vector<Deadline> &heap = heaps_[(size_t)jobs_[job].cls];
+    heap.push_back(Deadline{jobs_[job].dueMs, job});
+    std::push_heap(heap.begin(), heap.end());
+}
+
+int NetJobQueue::add(JobClass cls, uint64_t dueMs) {
+    jobs_.push_back(Job{cls, dueMs, false});
+    int job = jobs_.size() - 1;
+    push(job);
+    return job;
+}
+
+int NetJobQueue::claim(uint64_t nowMs) {
+    std::vector<Deadline> *best = nullptr;
+    for (size_t cls = 0; cls < (size_t)JobClass::NumClasses; cls++) {
+        std::vector<Deadline> &heap = heaps_[cls];
+        if (heap.empty() || heap.front().dueMs > nowMs || !mayRun((JobClass)cls)) {
+            continue;
+        }
+        if (!best || heap.front().dueMs < best->front().dueMs) {
+            best = &heap;
+        }
+    }
+    if (!best) {
+        return NONE;
+    }
+
+    std::pop_heap(best->begin(), best->end());
+    int job = best->back().job;
+    best->pop_back();
+
+    jobs_[job].running = true;
+    if (jobs_[job].cls == JobClass::Long) {
+        longRunning_++;
+    }
+    return job;
+}
+
+void NetJobQueue::finish(int job, uint64_t dueMs) {
+    if (jobs_[job].cls == JobClass::Long) {
+        longRunning_--;
+    }
+    jobs_[job].running = false;
+    jobs_[job].dueMs = dueMs;
+    push(job);
+}
+
+uint64_t NetJobQueue::nextDueMs() const {
+    uint64_t next = UINT64_MAX;
+    for (size_t cls = 0; cls < (size_t)JobClass::NumClasses; cls++) {
+        if (!heaps_[cls].empty() && mayRun((JobClass)cls)) {
+            next = std::min(next, heaps_[cls].front().dueMs);
+        }
+    }
+    return next;
+}
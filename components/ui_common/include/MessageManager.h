@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
@@ -9,7 +10,10 @@
 
 typedef std::function<void(uint8_t)> cancelCbFn_t;
 
-typedef std::function<void()> __intCancelCbFn_t;
+// Default cap on message containers that exist at once. Messages set while
+// every container is in use wait, lowest ID first, until one is cleared.
+#define MSG_MAX_LIVE 4
+#define MSG_MAX_LEN 64
 
 class MessageManager {
   public:
@@ -20,13 +24,17 @@ class MessageManager {
     // centralized list of message IDs. Alternatively, could consider making this
     // a template so at least the message IDs are typed.
     MessageManager(size_t nMsgIds, lv_obj_t *msgsContainer, const lv_font_t *closeSymbolFont,
-                   cancelCbFn_t *cancelCb);
+                   cancelCbFn_t *cancelCb, size_t maxLive = MSG_MAX_LIVE);
     ~MessageManager() {
         lv_timer_del(msgTimer_);
-        for (int i = 0; i < nMsgIds_; i++) {
-            delete messages_[i];
+        for (MessageContainer *msg : live_) {
+            delete msg;
         }
-        delete messages_;
+        for (MessageContainer *msg : pool_) {
+            delete msg;
+        }
+        delete[] byId_;
+        delete[] waiting_;
     }
 
     void setMessage(uint8_t msgID, bool allowCancel, const char *msg);
@@ -45,16 +53,16 @@ class MessageManager {
     class MessageContainer {
       public:
         MessageContainer(MessageManager *manager, lv_obj_t *parent,
-                         const lv_font_t *closeSymbolFont, __intCancelCbFn_t *cancelCb);
-        ~MessageContainer() {
-            lv_obj_del(container_);
-            delete cancelCb_;
-        }
+                         const lv_font_t *closeSymbolFont);
+        ~MessageContainer() { lv_obj_del(container_); }
 
         void setVisibility(bool visible);
         void setCancelable(bool cancelable);
         void setText(const char *str);
 
+        uint8_t msgID() { return msgID_; }
+        void setMsgID(uint8_t msgID) { msgID_ = msgID; }
+
         bool isVisible() { return visible_; }
         bool isFocused();
         uint32_t getIndex() { return lv_obj_get_index(container_); }
@@ -64,22 +72,41 @@ class MessageManager {
             return lv_obj_get_height(container_);
         }
 
+        static void cancelEventCb(lv_event_t *e);
+
       private:
+        MessageManager *manager_;
         lv_obj_t *parent_;
-        __intCancelCbFn_t *cancelCb_;
+        uint8_t msgID_ = 0;
 
         lv_obj_t *container_, *cancel_, *textContainer_, *text_;
         bool cancelable_ = true, visible_ = true;
     };
 
+    struct WaitingMessage {
+        bool waiting;
+        bool allowCancel;
+        char text[MSG_MAX_LEN];
+    };
+
     lv_obj_t *msgsContainer_;
+    const lv_font_t *closeSymbolFont_;
     cancelCbFn_t *cancelCb_;
 
-    MessageContainer **messages_;
-    size_t nMsgIds_;
+    size_t nMsgIds_, maxLive_;
+    // Containers are created on first use and recycled through pool_, so at
+    // most maxLive_ ever exist. byId_ maps a message to its container, or
+    // nullptr if it isn't showing.
+    MessageContainer **byId_;
+    std::vector<MessageContainer *> live_, pool_;
+    WaitingMessage *waiting_;
+    size_t nWaiting_ = 0;
+
     lv_timer_t *msgTimer_;
-    lv_coord_t msgHeight_;
+    lv_coord_t msgHeight_ = 0;
 
+    MessageContainer *acquireContainer();
+    void show(MessageContainer *msgContainer, uint8_t msgID, bool allowCancel, const char *msg);
     MessageContainer *focusedMessage();
     void onCancelMessage(uint8_t msgID);
 };
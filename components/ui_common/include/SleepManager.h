@@ -1,8 +1,16 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "backlight.h"
 #include "lvgl/lvgl.h"
 
+// How often touch is polled while the display sleeps
+#define SLEEP_TOUCH_POLL_MS 50
+// Longest wait while asleep with an interrupt-driven touch, which notifies
+// the UI task on a press
+#define SLEEP_TOUCH_IRQ_WAIT_MS 1000
+
 class SleepManager {
 public:
   SleepManager(lv_obj_t *homeScr, int bcklGpio);
@@ -13,11 +21,55 @@ public:
 
   void update();
 
+  // Run LVGL for one UI loop iteration. While the display sleeps all LVGL
+  // timers are paused and only the touch input is read, so nothing is
+  // rendered until a touch wakes it. Returns ms until it should run again;
+  // with touch IRQs the caller should also wake when notified.
+  uint32_t handleTimers();
+
+  bool asleep() const { return state_ == State::Asleep; }
+  // Touched recently, i.e. not yet dimmed
+  bool awake() const { return state_ == State::Awake; }
+
+  // Backlight level while awake, e.g. from a time of day curve. The dimmed
+  // level follows it.
+  void setBrightness(uint8_t pct);
+
+  // Residency is also exported as display_state_seconds_total and
+  // display_sleeps_total
+  void logStats();
+
 private:
-  bool displayAwake_ = true;
+  enum State { Awake, Dimmed, Asleep, NumStates };
+
+  struct StateStats {
+    uint64_t ms = 0;       // Time spent in the state
+    uint64_t busyUs = 0;   // Time spent in handleTimers
+    uint32_t loops = 0;    // handleTimers calls
+  };
+
+  State state_ = State::Awake;
+  uint8_t brightnessPct_ = 100;
 
   lv_obj_t *homeScr_;
   disp_backlight_h backlight_;
 
   lv_obj_t *sleepScreen_;
+
+  StateStats stats_[NumStates];
+  uint32_t stateStartMs_;
+  uint32_t sleeps_ = 0;
+  // Whole seconds of each state added to display_state_seconds_total
+  uint32_t publishedSecs_[NumStates] = {};
+
+  // Backlight target integrated over time, for the average brightness
+  uint8_t blPct_ = 0;
+  uint32_t blSinceMs_;
+  uint64_t blPctMs_ = 0;
+
+  void setState(State state);
+  void fadeTo(uint8_t pct, int fadeMs);
+  uint8_t dimPct() const;
+  void accountTime();
+  void pollTouch();
 };
@@ -25,6 +25,12 @@ disp_backlight_h disp_backlight_new(const disp_backlight_config_t *config);
 // brightness_percent is 0-100 for PWM; for GPIO control 0 is off, >0 is on.
 void disp_backlight_set(disp_backlight_h bckl, int brightness_percent);
 
+// Ramps to brightness_percent over fade_ms using the LEDC hardware fader and
+// returns immediately, replacing any fade in progress. GPIO control switches
+// at once.
+void disp_backlight_fade(disp_backlight_h bckl, int brightness_percent,
+                         int fade_ms);
+
 void disp_backlight_delete(disp_backlight_h bckl);
 
 #ifdef __cplusplus
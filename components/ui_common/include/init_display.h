@@ -2,11 +2,25 @@
 #define INIT_DISPLAY_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef enum {
+  // Two 40-line draw buffers in internal DMA RAM, flushed straight to SPI.
+  DISP_RENDER_PARTIAL_DMA = 0,
+  // Two full-frame draw buffers in PSRAM so every dirty area renders in a
+  // single pass. Areas are streamed to the panel through small internal DMA
+  // bounce buffers, which costs far less internal RAM than PARTIAL_DMA.
+  DISP_RENDER_FULL_PSRAM,
+} disp_render_mode_t;
+
 // Board-specific display wiring/orientation, provided by each app's shim.
 typedef struct {
   int pin_mosi;
@@ -16,13 +30,61 @@ typedef struct {
   // false: landscape; true: landscape inverted (180deg). Drives both the panel
   // MADCTL mirror and the touch coordinate transform.
   bool landscape_inverted;
+  // Falls back to DISP_RENDER_PARTIAL_DMA if PSRAM allocation fails.
+  disp_render_mode_t render_mode;
+  // Touch controller INT line, or -1 to poll the controller on every LVGL
+  // input read. Must be set explicitly since 0 is a valid GPIO.
+  int pin_touch_int;
 } display_config_t;
 
+// Rendering statistics accumulated since the last reset, for comparing the
+// render modes.
+typedef struct {
+  disp_render_mode_t mode;
+  uint32_t window_ms;
+  uint32_t frames;       // LVGL refreshes that redrew something
+  uint32_t frame_ms_avg; // Render + flush time per refresh, from LVGL
+  uint32_t frame_ms_max;
+  uint32_t flush_us_avg; // Flush start until the draw buffer is released
+  uint32_t flush_us_max;
+  uint32_t px;           // Pixels redrawn
+  size_t internal_free;
+  size_t internal_min_free;
+  size_t dma_largest_block;
+  bool touch_irq;        // Touch is interrupt driven rather than polled
+  uint32_t touch_irqs;
+  uint32_t touch_reads;  // I2C reads of the touch controller
+  uint32_t taps;         // Presses followed by a redraw
+  uint32_t tap_ms_avg;   // Press detected until that redraw finished
+  uint32_t tap_ms_max;
+  uint32_t wakes;        // As taps, for presses that woke the display
+  uint32_t wake_ms_avg;
+  uint32_t wake_ms_max;
+} disp_stats_t;
+
 // Initializes LVGL, the ILI9341 display (via esp_lcd) and the FT6X36 touch
 // input (via esp_lcd_touch over the shared i2c_master bus). Must be called
 // after i2c_bus_init() so the touch panel can share the bus.
 void init_display(const display_config_t *cfg);
 
+void disp_get_stats(disp_stats_t *out, bool reset);
+
+// Task to notify (xTaskNotifyGive) when the touch IRQ fires, normally the
+// task running the LVGL handler so it can block while nothing is happening.
+void disp_touch_set_wake_task(TaskHandle_t task);
+
+// True if a touch raises the IRQ, so the LVGL handler needn't run to notice
+// it.
+bool disp_touch_irq_enabled(void);
+
+// Marks the current press as the one that woke the display, so its latency is
+// tracked separately from ordinary taps.
+void disp_touch_mark_wake(void);
+
+// Logs the current stats at WARN, so they reach the remote logger, and resets
+// them.
+void disp_log_stats(void);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -1,6 +1,8 @@
 #include "MessageManager.h"
 #include "ui_utils.h"
 
+#include <algorithm>
+
 #include "esp_log.h"
 
 #define MSG_SCROLL_MS 5 * 1000
@@ -12,28 +14,42 @@ void pauseTimer(lv_event_t *e) { lv_timer_pause((lv_timer_t *)e->user_data); }
 void messageTimerCb(lv_timer_t *timer) { ((MessageManager *)timer->user_data)->scrollNext(); }
 
 void msgClickCb(lv_event_t *e) { ((MessageManager *)lv_event_get_user_data(e))->onMessageClick(); }
-void msgCancelCb(lv_event_t *e) { (*(__intCancelCbFn_t *)lv_event_get_user_data(e))(); }
 
 MessageManager::MessageManager(size_t nMsgIds, lv_obj_t *msgsContainer,
-                               const lv_font_t *closeSymbolFont, cancelCbFn_t *cancelCb)
-    : msgsContainer_(msgsContainer), cancelCb_(cancelCb) {
-    nMsgIds_ = nMsgIds;
-    messages_ = new MessageContainer *[nMsgIds_];
-
-    for (int i = 0; i < nMsgIds; i++) {
-        messages_[i] =
-            new MessageContainer(this, msgsContainer_, closeSymbolFont,
-                                 new __intCancelCbFn_t([this, i]() { this->onCancelMessage(i); }));
-    }
+                               const lv_font_t *closeSymbolFont, cancelCbFn_t *cancelCb,
+                               size_t maxLive)
+    : msgsContainer_(msgsContainer), closeSymbolFont_(closeSymbolFont), cancelCb_(cancelCb),
+      nMsgIds_(nMsgIds), maxLive_(maxLive) {
+    byId_ = new MessageContainer *[nMsgIds_]();
+    waiting_ = new WaitingMessage[nMsgIds_]();
+    live_.reserve(maxLive_);
+    pool_.reserve(maxLive_);
 
     lv_obj_set_scroll_snap_y(msgsContainer_, LV_SCROLL_SNAP_START);
-    msgHeight_ = messages_[0]->getHeight();
     msgTimer_ = lv_timer_create(messageTimerCb, MSG_SCROLL_MS, this);
 }
 
-void MessageManager::setMessage(uint8_t msgID, bool allowCancel, const char *msg) {
-    MessageContainer *msgContainer = messages_[msgID];
+// Returns a hidden container, or nullptr if maxLive_ are already showing
+MessageManager::MessageContainer *MessageManager::acquireContainer() {
+    if (!pool_.empty()) {
+        MessageContainer *msgContainer = pool_.back();
+        pool_.pop_back();
+        return msgContainer;
+    }
+    if (live_.size() >= maxLive_) {
+        return nullptr;
+    }
+
+    MessageContainer *msgContainer = new MessageContainer(this, msgsContainer_, closeSymbolFont_);
+    if (msgHeight_ == 0) {
+        msgHeight_ = msgContainer->getHeight();
+    }
+    return msgContainer;
+}
 
+void MessageManager::show(MessageContainer *msgContainer, uint8_t msgID, bool allowCancel,
+                          const char *msg) {
+    msgContainer->setMsgID(msgID);
     msgContainer->setText(msg);
     msgContainer->setCancelable(allowCancel);
 
@@ -49,7 +65,67 @@ void MessageManager::setMessage(uint8_t msgID, bool allowCancel, const char *msg
     msgContainer->setVisibility(true);
 }
 
-void MessageManager::clearMessage(uint8_t msgID) { messages_[msgID]->setVisibility(false); }
+void MessageManager::setMessage(uint8_t msgID, bool allowCancel, const char *msg) {
+    if (msgID >= nMsgIds_) {
+        ESP_LOGE(TAG, "invalid msg ID: %d", msgID);
+        return;
+    }
+
+    MessageContainer *msgContainer = byId_[msgID];
+    if (msgContainer == nullptr) {
+        msgContainer = acquireContainer();
+        if (msgContainer == nullptr) {
+            WaitingMessage *w = &waiting_[msgID];
+            if (!w->waiting) {
+                nWaiting_++;
+            }
+            w->waiting = true;
+            w->allowCancel = allowCancel;
+            snprintf(w->text, sizeof(w->text), "%s", msg);
+            return;
+        }
+        byId_[msgID] = msgContainer;
+        live_.push_back(msgContainer);
+    }
+
+    show(msgContainer, msgID, allowCancel, msg);
+}
+
+void MessageManager::clearMessage(uint8_t msgID) {
+    if (msgID >= nMsgIds_) {
+        return;
+    }
+
+    if (waiting_[msgID].waiting) {
+        waiting_[msgID].waiting = false;
+        nWaiting_--;
+    }
+
+    MessageContainer *msgContainer = byId_[msgID];
+    if (msgContainer == nullptr) {
+        return;
+    }
+    byId_[msgID] = nullptr;
+
+    // Hand the container straight to the lowest waiting message if there is
+    // one, otherwise hide it and keep it for reuse.
+    if (nWaiting_ > 0) {
+        for (uint8_t id = 0; id < nMsgIds_; id++) {
+            WaitingMessage *w = &waiting_[id];
+            if (w->waiting) {
+                w->waiting = false;
+                nWaiting_--;
+                byId_[id] = msgContainer;
+                show(msgContainer, id, w->allowCancel, w->text);
+                return;
+            }
+        }
+    }
+
+    msgContainer->setVisibility(false);
+    live_.erase(std::find(live_.begin(), live_.end(), msgContainer));
+    pool_.push_back(msgContainer);
+}
 
 void MessageManager::onMessageClick() {
     lv_timer_reset(msgTimer_);
@@ -61,15 +137,8 @@ void MessageManager::scrollNext() {
     // TODO(future): It'd be nicer to make this a circular scroll
     lv_coord_t currY = lv_obj_get_scroll_y(msgsContainer_);
 
-    int nVisible = 0;
-    for (int i = 0; i < nMsgIds_; i++) {
-        if (messages_[i]->isVisible()) {
-            nVisible++;
-        }
-    }
-
     lv_coord_t newY = currY + msgHeight_;
-    if (newY > (nVisible - 1) * msgHeight_) {
+    if (newY > ((lv_coord_t)live_.size() - 1) * msgHeight_) {
         newY = 0;
     }
 
@@ -77,9 +146,9 @@ void MessageManager::scrollNext() {
 }
 
 MessageManager::MessageContainer *MessageManager::focusedMessage() {
-    for (int i = 0; i < nMsgIds_; i++) {
-        if (messages_[i]->isFocused()) {
-            return messages_[i];
+    for (MessageContainer *msg : live_) {
+        if (msg->isFocused()) {
+            return msg;
         }
     }
 
@@ -94,10 +163,14 @@ void MessageManager::onCancelMessage(uint8_t msgID) {
     }
 }
 
+void MessageManager::MessageContainer::cancelEventCb(lv_event_t *e) {
+    MessageContainer *msg = (MessageContainer *)lv_event_get_user_data(e);
+    msg->manager_->onCancelMessage(msg->msgID_);
+}
+
 MessageManager::MessageContainer::MessageContainer(MessageManager *manager, lv_obj_t *parent,
-                                                   const lv_font_t *closeSymbolFont,
-                                                   __intCancelCbFn_t *cancelCb)
-    : parent_(parent), cancelCb_(cancelCb) {
+                                                   const lv_font_t *closeSymbolFont)
+    : manager_(manager), parent_(parent) {
 
     // BEGIN copy-paste from ui_Home.c
     container_ = lv_obj_create(parent);
@@ -148,7 +221,7 @@ MessageManager::MessageContainer::MessageContainer(MessageManager *manager, lv_o
     lv_obj_set_align(text_, LV_ALIGN_CENTER);
     lv_label_set_text(text_, "MESSAGE");
 
-    lv_obj_add_event_cb(cancel_, msgCancelCb, LV_EVENT_CLICKED, (void *)cancelCb_);
+    lv_obj_add_event_cb(cancel_, cancelEventCb, LV_EVENT_CLICKED, this);
     lv_obj_add_event_cb(textContainer_, msgClickCb, LV_EVENT_CLICKED, (void *)manager);
 
     setVisibility(false);
@@ -1,8 +1,35 @@
 #include "SleepManager.h"
 
 #include <cassert>
+#include <cinttypes>
 
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "init_display.h"
+
+#include "Metrics.h"
+
+#define DISP_DIM_SECS 20
 #define DISP_SLEEP_SECS 30
+#define DIM_PCT_OF_BRIGHTNESS 25
+#define DIM_MIN_PCT 5
+
+// Backlight fades run on the LEDC hardware so none of them cost UI time
+#define FADE_WAKE_MS 250 // Matches the home screen fade in
+#define FADE_UNDIM_MS 150
+#define FADE_DIM_MS 1000
+#define FADE_SLEEP_MS 1000
+#define FADE_LEVEL_MS 2000
+
+static const char *TAG = "SLEEP";
+
+// Indexed by SleepManager::State
+static MetricCounter stateSecsMetrics[] = {
+    {"display_state_seconds_total", "Time the display spent in each state", "state=\"awake\""},
+    {"display_state_seconds_total", "Time the display spent in each state", "state=\"dimmed\""},
+    {"display_state_seconds_total", "Time the display spent in each state", "state=\"asleep\""},
+};
+static MetricCounter sleepsMetric("display_sleeps_total", "Times the display went to sleep");
 
 SleepManager::SleepManager(lv_obj_t *homeScr, int bcklGpio) : homeScr_(homeScr) {
     const disp_backlight_config_t bckl_config = {
@@ -13,26 +40,161 @@ SleepManager::SleepManager(lv_obj_t *homeScr, int bcklGpio) : homeScr_(homeScr)
         .channel_idx = 0,
     };
     backlight_ = disp_backlight_new(&bckl_config);
-    disp_backlight_set(backlight_, 100);
     assert(backlight_);
 
     sleepScreen_ = lv_obj_create(NULL);
+    stateStartMs_ = blSinceMs_ = lv_tick_get();
+    fadeTo(brightnessPct_, 0);
 }
 
 void SleepManager::update() {
-    if (lv_disp_get_inactive_time(NULL) < (DISP_SLEEP_SECS * 1000)) {
-        if (!displayAwake_) {
+    uint32_t inactiveMs = lv_disp_get_inactive_time(NULL);
+    State target = inactiveMs < DISP_DIM_SECS * 1000     ? State::Awake
+                   : inactiveMs < DISP_SLEEP_SECS * 1000 ? State::Dimmed
+                                                         : State::Asleep;
+    if (target == state_) {
+        return;
+    }
+
+    switch (target) {
+    case State::Awake:
+        if (state_ == State::Asleep) {
+            // Timers first so the fade animation and the overdue clock and
+            // message timers all run on the next handler call
+            setState(State::Awake);
+            disp_touch_mark_wake();
+
             // Go to homescreen
             lv_indev_wait_release(lv_indev_get_next(NULL));
             lv_scr_load_anim(homeScr_, LV_SCR_LOAD_ANIM_FADE_IN, 250, 0, false);
-            disp_backlight_set(backlight_, 100);
-            displayAwake_ = true;
+            fadeTo(brightnessPct_, FADE_WAKE_MS);
+        } else {
+            // A tap on a dimmed screen only brightens it
+            setState(State::Awake);
+            lv_indev_wait_release(lv_indev_get_next(NULL));
+            fadeTo(brightnessPct_, FADE_UNDIM_MS);
+        }
+        break;
+    case State::Dimmed:
+        if (state_ == State::Awake) {
+            setState(State::Dimmed);
+            fadeTo(dimPct(), FADE_DIM_MS);
         }
+        break;
+    default:
+        // The panel keeps showing the last frame while the backlight fades
+        // out since nothing renders once asleep
+        fadeTo(0, FADE_SLEEP_MS);
+        lv_scr_load_anim(sleepScreen_, LV_SCR_LOAD_ANIM_NONE, 0, 0, false);
+        setState(State::Asleep);
+        sleeps_++;
+        sleepsMetric.inc();
+        break;
+    }
+}
+
+void SleepManager::setBrightness(uint8_t pct) {
+    if (pct == brightnessPct_) {
+        return;
+    }
+    brightnessPct_ = pct;
+
+    if (state_ == State::Awake) {
+        fadeTo(brightnessPct_, FADE_LEVEL_MS);
+    } else if (state_ == State::Dimmed) {
+        fadeTo(dimPct(), FADE_LEVEL_MS);
+    }
+}
+
+uint8_t SleepManager::dimPct() const {
+    uint8_t pct = brightnessPct_ * DIM_PCT_OF_BRIGHTNESS / 100;
+    return pct < DIM_MIN_PCT ? DIM_MIN_PCT : pct;
+}
+
+// Fold elapsed time into the current state and backlight level
+void SleepManager::accountTime() {
+    uint32_t now = lv_tick_get();
+    stats_[state_].ms += now - stateStartMs_;
+    stateStartMs_ = now;
+    uint32_t secs = stats_[state_].ms / 1000;
+    stateSecsMetrics[state_].inc(secs - publishedSecs_[state_]);
+    publishedSecs_[state_] = secs;
+    blPctMs_ += (uint64_t)blPct_ * (now - blSinceMs_);
+    blSinceMs_ = now;
+}
+
+void SleepManager::setState(State state) {
+    accountTime();
+    state_ = state;
+    lv_timer_enable(state != State::Asleep);
+}
+
+void SleepManager::fadeTo(uint8_t pct, int fadeMs) {
+    accountTime();
+    blPct_ = pct;
+    disp_backlight_fade(backlight_, pct, fadeMs);
+}
+
+// Read the touch input without running the LVGL timers. A press updates the
+// display's activity time, which wakes us on the next update().
+void SleepManager::pollTouch() {
+    for (lv_indev_t *indev = lv_indev_get_next(NULL); indev; indev = lv_indev_get_next(indev)) {
+        if (indev->driver->type == LV_INDEV_TYPE_POINTER && indev->driver->read_timer) {
+            lv_indev_read_timer_cb(indev->driver->read_timer);
+        }
+    }
+}
+
+uint32_t SleepManager::handleTimers() {
+    int64_t startUs = esp_timer_get_time();
+
+    uint32_t rv;
+    if (state_ != State::Asleep) {
+        rv = lv_timer_handler();
     } else {
-        if (displayAwake_) {
-            disp_backlight_set(backlight_, 0);
-            lv_scr_load_anim(sleepScreen_, LV_SCR_LOAD_ANIM_NONE, 0, 0, false);
-            displayAwake_ = false;
+        pollTouch();
+        if (lv_disp_get_inactive_time(NULL) < (DISP_SLEEP_SECS * 1000)) {
+            rv = 0; // Touched, wake on the next update()
+        } else {
+            rv = disp_touch_irq_enabled() ? SLEEP_TOUCH_IRQ_WAIT_MS : SLEEP_TOUCH_POLL_MS;
         }
     }
+
+    StateStats &s = stats_[state_];
+    s.busyUs += esp_timer_get_time() - startUs;
+    s.loops++;
+    // Keeps the residency metrics current, even in a long stay in one state
+    accountTime();
+    return rv;
+}
+
+// NB: Only call while holding the UI mutex
+void SleepManager::logStats() {
+    accountTime();
+
+    uint64_t totalMs = 0;
+    for (const StateStats &s : stats_) {
+        totalMs += s.ms;
+    }
+    if (totalMs == 0) {
+        return;
+    }
+
+    auto pct = [totalMs](const StateStats &s) { return s.ms * 100 / totalMs; };
+    auto busy = [](const StateStats &s) { return s.ms ? s.busyUs * 1000 / s.ms : 0; };
+    const StateStats &awake = stats_[State::Awake], &dimmed = stats_[State::Dimmed],
+                     &asleep = stats_[State::Asleep];
+
+    // avg_bl is the mean backlight level across all states; 100% would be
+    // always on at full brightness
+    ESP_LOGW(TAG,
+             "residency awake=%" PRIu64 "%% dimmed=%" PRIu64 "%% asleep=%" PRIu64
+             "%% sleeps=%lu avg_bl=%" PRIu64 "%% brightness=%u%%",
+             pct(awake), pct(dimmed), pct(asleep), sleeps_, blPctMs_ / totalMs,
+             brightnessPct_);
+    ESP_LOGW(TAG,
+             "ui busy awake=%" PRIu64 "us/s (%lu loops) dimmed=%" PRIu64
+             "us/s (%lu loops) asleep=%" PRIu64 "us/s (%lu loops)",
+             busy(awake), awake.loops, busy(dimmed), dimmed.loops, busy(asleep),
+             asleep.loops);
 }
@@ -19,6 +19,18 @@ typedef struct {
   int index;  // LEDC channel when pwm_control, else GPIO number
 } disp_backlight_t;
 
+// The LEDC fade ISR is shared by all channels and left installed
+static bool fade_installed;
+
+static int clamp_percent(int brightness_percent) {
+  if (brightness_percent > 100) {
+    return 100;
+  } else if (brightness_percent < 0) {
+    return 0;
+  }
+  return brightness_percent;
+}
+
 disp_backlight_h disp_backlight_new(const disp_backlight_config_t *config) {
   if (config == NULL || !GPIO_IS_VALID_OUTPUT_GPIO(config->gpio_num)) {
     ESP_LOGW(TAG, "Invalid backlight config");
@@ -51,6 +63,10 @@ disp_backlight_h disp_backlight_new(const disp_backlight_config_t *config) {
     };
     ESP_ERROR_CHECK(ledc_timer_config(&timer));
     ESP_ERROR_CHECK(ledc_channel_config(&channel));
+    if (!fade_installed) {
+      ESP_ERROR_CHECK(ledc_fade_func_install(0));
+      fade_installed = true;
+    }
     esp_rom_gpio_connect_out_signal(
         config->gpio_num,
         ledc_periph_signal[LEDC_LOW_SPEED_MODE].sig_out0_idx +
@@ -71,15 +87,13 @@ void disp_backlight_set(disp_backlight_h handle, int brightness_percent) {
   if (handle == NULL) {
     return;
   }
-  if (brightness_percent > 100) {
-    brightness_percent = 100;
-  } else if (brightness_percent < 0) {
-    brightness_percent = 0;
-  }
+  brightness_percent = clamp_percent(brightness_percent);
 
   disp_backlight_t *bckl = (disp_backlight_t *)handle;
   if (bckl->pwm_control) {
     uint32_t duty = (BACKLIGHT_LEDC_MAX_DUTY * brightness_percent) / 100;
+    // A running fade would otherwise overwrite the new duty
+    ESP_ERROR_CHECK(ledc_fade_stop(LEDC_LOW_SPEED_MODE, bckl->index));
     ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, bckl->index, duty));
     ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, bckl->index));
   } else {
@@ -87,12 +101,33 @@ void disp_backlight_set(disp_backlight_h handle, int brightness_percent) {
   }
 }
 
+void disp_backlight_fade(disp_backlight_h handle, int brightness_percent,
+                         int fade_ms) {
+  if (handle == NULL) {
+    return;
+  }
+  disp_backlight_t *bckl = (disp_backlight_t *)handle;
+  if (!bckl->pwm_control || fade_ms <= 0) {
+    disp_backlight_set(handle, brightness_percent);
+    return;
+  }
+
+  uint32_t duty =
+      (BACKLIGHT_LEDC_MAX_DUTY * clamp_percent(brightness_percent)) / 100;
+  ESP_ERROR_CHECK(ledc_fade_stop(LEDC_LOW_SPEED_MODE, bckl->index));
+  ESP_ERROR_CHECK(ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, bckl->index,
+                                          duty, fade_ms));
+  ESP_ERROR_CHECK(
+      ledc_fade_start(LEDC_LOW_SPEED_MODE, bckl->index, LEDC_FADE_NO_WAIT));
+}
+
 void disp_backlight_delete(disp_backlight_h handle) {
   if (handle == NULL) {
     return;
   }
   disp_backlight_t *bckl = (disp_backlight_t *)handle;
   if (bckl->pwm_control) {
+    ledc_fade_stop(LEDC_LOW_SPEED_MODE, bckl->index);
     ledc_stop(LEDC_LOW_SPEED_MODE, bckl->index, 0);
   } else {
     gpio_reset_pin(bckl->index);
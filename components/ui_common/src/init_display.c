@@ -1,11 +1,16 @@
 #include "init_display.h"
 
+#include <string.h>
+#include <sys/param.h>
+
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
 #include "driver/spi_master.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "esp_lcd_ili9341.h"
 #include "esp_lcd_panel_io.h"
@@ -25,38 +30,159 @@
 #define LCD_V_RES 240
 // Partial buffer of 40 lines.
 #define DISP_BUF_SIZE (LCD_H_RES * 40)
+#define FULL_FRAME_SIZE (LCD_H_RES * LCD_V_RES)
+// DISP_RENDER_FULL_PSRAM streams through two 20-line internal bounce buffers,
+// half the internal RAM of the partial mode's draw buffers.
+#define BOUNCE_BUF_SIZE (LCD_H_RES * 20)
+#define N_BOUNCE_BUFS 2
 
 #define LCD_HOST SPI2_HOST
 // CS is tied low in hardware.
 #define LCD_PIN_CS (-1)
 #define LCD_PIXEL_CLOCK_HZ (40 * 1000 * 1000)
 
+// With the touch IRQ the controller is still read this often when idle, in
+// case an edge was missed.
+#define TOUCH_FALLBACK_POLL_US (1000 * 1000)
+// A redraw later than this isn't counted as the response to a press.
+#define TAP_MAX_LATENCY_US (1000 * 1000)
+
 static lv_disp_drv_t disp_drv;
 static lv_disp_draw_buf_t disp_buf;
 static lv_indev_drv_t indev_drv;
 static esp_lcd_panel_handle_t panel_handle = NULL;
 static esp_lcd_touch_handle_t tp_handle = NULL;
 
+static disp_render_mode_t render_mode;
+static lv_color_t *bounce_bufs[N_BOUNCE_BUFS];
+static int next_bounce;
+static SemaphoreHandle_t bounce_free;
+
+static int touch_int_gpio = -1;
+static TaskHandle_t touch_wake_task;
+static volatile bool touch_irq_pending;
+static volatile int64_t touch_irq_us;
+static bool touch_pressed;
+static int64_t touch_last_read_us;
+// When the current press was first seen, until a redraw follows it
+static int64_t tap_start_us;
+static bool tap_is_wake;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct {
+  int64_t window_start_us;
+  int64_t flush_start_us;
+  uint32_t frames;
+  uint32_t frame_ms_total;
+  uint32_t frame_ms_max;
+  uint32_t flushes;
+  uint64_t flush_us_total;
+  uint32_t flush_us_max;
+  uint32_t px;
+  uint32_t touch_irqs;
+  uint32_t touch_reads;
+  uint32_t taps;
+  uint32_t tap_ms_total;
+  uint32_t tap_ms_max;
+  uint32_t wakes;
+  uint32_t wake_ms_total;
+  uint32_t wake_ms_max;
+} stats;
+
 static void disp_log_cb(const char *buf) { ESP_LOGI("LV", "%s", buf); }
 
 static void disp_wait_cb(struct _lv_disp_drv_t *drv) { taskYIELD(); }
 
-// esp_lcd signals completion of the async DMA transfer here; tell LVGL the
-// flush is done so it can reuse the draw buffer.
+// Called after each LVGL refresh that drew something
+static void disp_monitor_cb(lv_disp_drv_t *drv, uint32_t time_ms,
+                            uint32_t px) {
+  taskENTER_CRITICAL(&stats_lock);
+  stats.frames++;
+  stats.frame_ms_total += time_ms;
+  stats.frame_ms_max = MAX(stats.frame_ms_max, time_ms);
+  stats.px += px;
+  if (tap_start_us) {
+    int64_t us = esp_timer_get_time() - tap_start_us;
+    if (us <= TAP_MAX_LATENCY_US) {
+      uint32_t ms = us / 1000;
+      if (tap_is_wake) {
+        stats.wakes++;
+        stats.wake_ms_total += ms;
+        stats.wake_ms_max = MAX(stats.wake_ms_max, ms);
+      } else {
+        stats.taps++;
+        stats.tap_ms_total += ms;
+        stats.tap_ms_max = MAX(stats.tap_ms_max, ms);
+      }
+    }
+    tap_start_us = 0;
+  }
+  taskEXIT_CRITICAL(&stats_lock);
+}
+
+// May be called from the SPI ISR
+static void record_flush_done(void) {
+  uint32_t us = esp_timer_get_time() - stats.flush_start_us;
+  taskENTER_CRITICAL_SAFE(&stats_lock);
+  stats.flushes++;
+  stats.flush_us_total += us;
+  stats.flush_us_max = MAX(stats.flush_us_max, us);
+  taskEXIT_CRITICAL_SAFE(&stats_lock);
+}
+
+// esp_lcd signals completion of the async DMA transfer here. In partial mode
+// tell LVGL the flush is done so it can reuse the draw buffer; in PSRAM mode
+// the draw buffer was released already and this frees a bounce buffer.
 static bool notify_flush_ready(esp_lcd_panel_io_handle_t io,
                                esp_lcd_panel_io_event_data_t *edata,
                                void *user_ctx) {
+  if (render_mode == DISP_RENDER_FULL_PSRAM) {
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(bounce_free, &woken);
+    return woken == pdTRUE;
+  }
+
+  record_flush_done();
   lv_disp_flush_ready((lv_disp_drv_t *)user_ctx);
   return false;
 }
 
 static void disp_flush(lv_disp_drv_t *drv, const lv_area_t *area,
                        lv_color_t *color_map) {
+  stats.flush_start_us = esp_timer_get_time();
+
   // esp_lcd uses an exclusive end coordinate, LVGL an inclusive one.
   esp_lcd_panel_draw_bitmap(panel_handle, area->x1, area->y1, area->x2 + 1,
                             area->y2 + 1, color_map);
 }
 
+// The PSRAM draw buffer can't be handed to SPI DMA directly, so copy the area
+// out in bands through the bounce buffers. LVGL can start rendering the next
+// area as soon as the last band is copied; the DMA of the final bands
+// overlaps with that.
+static void disp_flush_bounce(lv_disp_drv_t *drv, const lv_area_t *area,
+                              lv_color_t *color_map) {
+  stats.flush_start_us = esp_timer_get_time();
+
+  int32_t w = lv_area_get_width(area);
+  int32_t band_lines = BOUNCE_BUF_SIZE / w;
+  for (int32_t y = area->y1; y <= area->y2; y += band_lines) {
+    int32_t y_end = MIN(y + band_lines, area->y2 + 1);
+
+    xSemaphoreTake(bounce_free, portMAX_DELAY);
+    lv_color_t *bounce = bounce_bufs[next_bounce];
+    next_bounce = (next_bounce + 1) % N_BOUNCE_BUFS;
+
+    memcpy(bounce, color_map + (y - area->y1) * w,
+           (y_end - y) * w * sizeof(lv_color_t));
+    esp_lcd_panel_draw_bitmap(panel_handle, area->x1, y, area->x2 + 1, y_end,
+                              bounce);
+  }
+
+  record_flush_done();
+  lv_disp_flush_ready(drv);
+}
+
 static void init_panel(const display_config_t *cfg) {
   spi_bus_config_t buscfg = {
       .mosi_io_num = cfg->pin_mosi,
@@ -64,7 +190,10 @@ static void init_panel(const display_config_t *cfg) {
       .sclk_io_num = cfg->pin_clk,
       .quadwp_io_num = -1,
       .quadhd_io_num = -1,
-      .max_transfer_sz = DISP_BUF_SIZE * sizeof(lv_color_t),
+      .max_transfer_sz = (render_mode == DISP_RENDER_FULL_PSRAM
+                              ? BOUNCE_BUF_SIZE
+                              : DISP_BUF_SIZE) *
+                         sizeof(lv_color_t),
   };
   ESP_ERROR_CHECK(spi_bus_initialize(LCD_HOST, &buscfg, SPI_DMA_CH_AUTO));
 
@@ -103,18 +232,56 @@ static void init_panel(const display_config_t *cfg) {
   ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_handle, true));
 }
 
+static void touch_isr(esp_lcd_touch_handle_t tp) {
+  touch_irq_us = esp_timer_get_time();
+  touch_irq_pending = true;
+
+  taskENTER_CRITICAL_ISR(&stats_lock);
+  stats.touch_irqs++;
+  taskEXIT_CRITICAL_ISR(&stats_lock);
+
+  if (touch_wake_task) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(touch_wake_task, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
 static void touch_read_cb(lv_indev_drv_t *drv, lv_indev_data_t *data) {
+  int64_t now = esp_timer_get_time();
+
+  // With the IRQ, only read the controller once it signals a touch and for
+  // as long as the press lasts. LVGL keeps the last point on release.
+  if (touch_int_gpio >= 0 && !touch_irq_pending && !touch_pressed &&
+      now - touch_last_read_us < TOUCH_FALLBACK_POLL_US) {
+    data->state = LV_INDEV_STATE_REL;
+    return;
+  }
+  int64_t detect_us = touch_irq_pending ? touch_irq_us : now;
+  touch_irq_pending = false;
+  touch_last_read_us = now;
+
   uint16_t x = 0, y = 0;
   uint8_t cnt = 0;
   esp_lcd_touch_read_data(tp_handle);
   bool pressed = esp_lcd_touch_get_coordinates(tp_handle, &x, &y, NULL, &cnt, 1);
-  if (pressed && cnt > 0) {
+  pressed = pressed && cnt > 0;
+  if (pressed) {
     data->point.x = x;
     data->point.y = y;
     data->state = LV_INDEV_STATE_PR;
   } else {
     data->state = LV_INDEV_STATE_REL;
   }
+
+  taskENTER_CRITICAL(&stats_lock);
+  stats.touch_reads++;
+  if (pressed && !touch_pressed) {
+    tap_start_us = detect_us;
+    tap_is_wake = false;
+  }
+  taskEXIT_CRITICAL(&stats_lock);
+  touch_pressed = pressed;
 }
 
 static void init_touch(const display_config_t *cfg) {
@@ -132,7 +299,7 @@ static void init_touch(const display_config_t *cfg) {
       .x_max = LCD_V_RES,
       .y_max = LCD_H_RES,
       .rst_gpio_num = -1,
-      .int_gpio_num = -1,
+      .int_gpio_num = cfg->pin_touch_int,
       // Old ft6x36 transform was swap, then invert X (landscape) / invert Y
       // (landscape-inverted). With the swap applied last here, the pre-swap
       // invert becomes mirror_y (landscape) / mirror_x (landscape-inverted).
@@ -142,7 +309,9 @@ static void init_touch(const display_config_t *cfg) {
               .mirror_x = cfg->landscape_inverted,
               .mirror_y = !cfg->landscape_inverted,
           },
+      .interrupt_callback = cfg->pin_touch_int >= 0 ? touch_isr : NULL,
   };
+  touch_int_gpio = cfg->pin_touch_int;
   ESP_ERROR_CHECK(esp_lcd_touch_new_i2c_ft5x06(tp_io, &tp_cfg, &tp_handle));
 
   lv_indev_drv_init(&indev_drv);
@@ -151,11 +320,33 @@ static void init_touch(const display_config_t *cfg) {
   assert(lv_indev_drv_register(&indev_drv) != NULL);
 }
 
-void init_display(const display_config_t *cfg) {
-  lv_log_register_print_cb(disp_log_cb);
-  lv_init();
-  init_panel(cfg);
+// Returns false if the PSRAM frame buffers can't be allocated, leaving
+// nothing allocated.
+static bool init_psram_buffers(void) {
+  lv_color_t *buf1 = heap_caps_malloc(FULL_FRAME_SIZE * sizeof(lv_color_t),
+                                      MALLOC_CAP_SPIRAM);
+  lv_color_t *buf2 = heap_caps_malloc(FULL_FRAME_SIZE * sizeof(lv_color_t),
+                                      MALLOC_CAP_SPIRAM);
+  if (!buf1 || !buf2) {
+    ESP_LOGE(TAG, "Unable to allocate PSRAM frame buffers");
+    heap_caps_free(buf1);
+    heap_caps_free(buf2);
+    return false;
+  }
+
+  for (int i = 0; i < N_BOUNCE_BUFS; i++) {
+    bounce_bufs[i] =
+        heap_caps_malloc(BOUNCE_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA);
+    assert(bounce_bufs[i]);
+  }
+  bounce_free = xSemaphoreCreateCounting(N_BOUNCE_BUFS, N_BOUNCE_BUFS);
+  assert(bounce_free);
+
+  lv_disp_draw_buf_init(&disp_buf, buf1, buf2, FULL_FRAME_SIZE);
+  return true;
+}
 
+static void init_dma_buffers(void) {
   lv_color_t *buf1 =
       heap_caps_malloc(DISP_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA);
   assert(buf1);
@@ -163,14 +354,100 @@ void init_display(const display_config_t *cfg) {
       heap_caps_malloc(DISP_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA);
   assert(buf2);
   lv_disp_draw_buf_init(&disp_buf, buf1, buf2, DISP_BUF_SIZE);
+}
+
+void init_display(const display_config_t *cfg) {
+  lv_log_register_print_cb(disp_log_cb);
+  lv_init();
+
+  // Allocate first: the SPI bus max transfer size depends on the mode
+  render_mode = cfg->render_mode;
+  if (render_mode == DISP_RENDER_FULL_PSRAM && !init_psram_buffers()) {
+    render_mode = DISP_RENDER_PARTIAL_DMA;
+  }
+  if (render_mode == DISP_RENDER_PARTIAL_DMA) {
+    init_dma_buffers();
+  }
+  init_panel(cfg);
 
   lv_disp_drv_init(&disp_drv);
   disp_drv.hor_res = LCD_H_RES;
   disp_drv.ver_res = LCD_V_RES;
-  disp_drv.flush_cb = disp_flush;
+  disp_drv.flush_cb =
+      render_mode == DISP_RENDER_FULL_PSRAM ? disp_flush_bounce : disp_flush;
   disp_drv.wait_cb = disp_wait_cb;
+  disp_drv.monitor_cb = disp_monitor_cb;
   disp_drv.draw_buf = &disp_buf;
   lv_disp_drv_register(&disp_drv);
 
+  stats.window_start_us = esp_timer_get_time();
+
   init_touch(cfg);
 }
+
+void disp_get_stats(disp_stats_t *out, bool reset) {
+  int64_t now = esp_timer_get_time();
+
+  taskENTER_CRITICAL(&stats_lock);
+  *out = (disp_stats_t){
+      .mode = render_mode,
+      .window_ms = (now - stats.window_start_us) / 1000,
+      .frames = stats.frames,
+      .frame_ms_avg = stats.frames ? stats.frame_ms_total / stats.frames : 0,
+      .frame_ms_max = stats.frame_ms_max,
+      .flush_us_avg =
+          stats.flushes ? stats.flush_us_total / stats.flushes : 0,
+      .flush_us_max = stats.flush_us_max,
+      .px = stats.px,
+      .touch_irq = touch_int_gpio >= 0,
+      .touch_irqs = stats.touch_irqs,
+      .touch_reads = stats.touch_reads,
+      .taps = stats.taps,
+      .tap_ms_avg = stats.taps ? stats.tap_ms_total / stats.taps : 0,
+      .tap_ms_max = stats.tap_ms_max,
+      .wakes = stats.wakes,
+      .wake_ms_avg = stats.wakes ? stats.wake_ms_total / stats.wakes : 0,
+      .wake_ms_max = stats.wake_ms_max,
+  };
+  if (reset) {
+    int64_t flush_start_us = stats.flush_start_us;
+    memset(&stats, 0, sizeof(stats));
+    stats.flush_start_us = flush_start_us;
+    stats.window_start_us = now;
+  }
+  taskEXIT_CRITICAL(&stats_lock);
+
+  out->internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  out->internal_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  out->dma_largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_DMA);
+}
+
+void disp_log_stats(void) {
+  disp_stats_t s;
+  disp_get_stats(&s, true);
+
+  uint32_t fps_x10 = s.window_ms ? s.frames * 10000ULL / s.window_ms : 0;
+  ESP_LOGW(TAG,
+           "mode=%s frames=%lu fps=%lu.%lu frame_avg=%lums frame_max=%lums "
+           "flush_avg=%luus flush_max=%luus px=%lu internal_free=%ub "
+           "internal_min=%ub dma_largest=%ub",
+           s.mode == DISP_RENDER_FULL_PSRAM ? "psram" : "dma", s.frames,
+           fps_x10 / 10, fps_x10 % 10, s.frame_ms_avg, s.frame_ms_max,
+           s.flush_us_avg, s.flush_us_max, s.px, s.internal_free,
+           s.internal_min_free, s.dma_largest_block);
+  ESP_LOGW(TAG,
+           "touch=%s irqs=%lu reads=%lu taps=%lu tap_avg=%lums tap_max=%lums "
+           "wakes=%lu wake_avg=%lums wake_max=%lums",
+           s.touch_irq ? "irq" : "poll", s.touch_irqs, s.touch_reads, s.taps,
+           s.tap_ms_avg, s.tap_ms_max, s.wakes, s.wake_ms_avg, s.wake_ms_max);
+}
+
+void disp_touch_set_wake_task(TaskHandle_t task) { touch_wake_task = task; }
+
+bool disp_touch_irq_enabled(void) { return touch_int_gpio >= 0; }
+
+void disp_touch_mark_wake(void) {
+  taskENTER_CRITICAL(&stats_lock);
+  tap_is_wake = tap_start_us != 0;
+  taskEXIT_CRITICAL(&stats_lock);
+}
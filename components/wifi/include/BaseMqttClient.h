@@ -1,12 +1,23 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "mqtt_client.h"
 
+#include "TaskHealthSampler.h"
+
 class BaseMqttClient {
   public:
-    virtual ~BaseMqttClient() {}
+    BaseMqttClient();
+    virtual ~BaseMqttClient();
     void start();
 
+    // Publish task health as Home Assistant diagnostic sensors. Like the
+    // other updates this only queues it for the MQTT event loop.
+    void updateHealth(const TaskHealthSampler::Summary &summary);
+
     esp_err_t _handleMQTTEvent(esp_mqtt_event_id_t eventId, esp_mqtt_event_handle_t event);
 
   protected:
@@ -16,8 +27,28 @@ class BaseMqttClient {
     virtual void onConnected() = 0;
     virtual void onUserEvent() {};
 
+    // Home Assistant device the health sensors are attached to. Also names
+    // the topic used to measure round trip latency.
+    void setHealthDevice(const char *deviceId);
+
     esp_mqtt_client_handle_t client_ = nullptr;
     esp_mqtt_client_config_t config_{};
 
   private:
+    SemaphoreHandle_t healthMutex_;
+    TaskHealthSampler::Summary health_ = {};
+    bool haveHealth_ = false, healthPending_ = false, healthDiscoveryPending_ = false;
+    char healthDeviceId_[32] = "", healthTopic_[64], healthDiscoveryTopic_[80];
+
+    // Round trips through the broker on home/<device>/ping, sent with each
+    // health update, measure how long commands take to reach the device
+    char pingTopic_[48] = "";
+    uint32_t pingSeq_ = 0;
+    int64_t pingSentUs_ = 0;
+    int pingPS_ = 0;
+
+    void publishHealth();
+    void sendPing();
+    void onPing(const char *data, int dataLen);
+    int publishHealthDiscovery(const char *deviceId, const char *topic, const char *discoveryTopic);
 };
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NetworkTaskManager.h"
+
+// Failed uploads are retried after this, doubling up to the max
+#define COREDUMP_RETRY_MIN_MS (30 * 1000)
+#define COREDUMP_RETRY_MAX_MS (60 * 60 * 1000)
+
+// Uploads the core dump a panic left in the coredump partition
+// (CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH), along with the crashed firmware's ELF
+// SHA-256 so the collector can match it to the right ELF. The dump stays in
+// flash until the collector accepts it, so it survives failed attempts and
+// further restarts, and is erased afterwards to make room for the next one.
+//
+// A dump holds whatever was in RAM, Wi-Fi and MQTT credentials included, so
+// it's only sent over HTTPS to a collector with a certificate from the same
+// root as the OTA server's (see coredump_server.py at the repo root).
+class CoreDumpUploader {
+  public:
+    // url is the collector's, e.g. https://logs.example.com:8514/coredump
+    CoreDumpUploader(const char *name, const char *url);
+
+    // Checks for a dump and uploads it, or schedules a retry. Run from the
+    // network task, see coreDumpTaskFn.
+    NetworkTaskManager::TaskResult poll();
+
+  private:
+    enum class State { Unchecked, Pending, Done };
+
+    char name_[32];
+    char url_[128];
+    State state_ = State::Unchecked;
+    uint32_t retryMs_ = COREDUMP_RETRY_MIN_MS;
+    uint8_t attempts_ = 0;
+
+    size_t dumpAddr_ = 0, dumpSize_ = 0;
+    char elfSha_[65] = "";
+    char crashTask_[16] = "";
+    uint32_t crashPc_ = 0;
+
+    bool check();
+    // Returns whether the collector was reached, and sets accepted if it
+    // stored the dump
+    bool upload(bool *accepted);
+};
+
+// NetworkTaskManager task for a CoreDumpUploader, passed as `ctx`
+NetworkTaskManager::TaskResult coreDumpTaskFn(void *ctx);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "OtaDownloader.h"
+
+#define DELTA_MAGIC "ESPZ"
+#define DELTA_SHA_LEN 32
+// Source bytes copied per read of the running partition
+#define DELTA_COPY_BUF_SIZE 512
+// Records decompressed per call to the inflater
+#define DELTA_INFLATE_BUF_SIZE 256
+
+// Applies a delta patch as it is downloaded, rebuilding the new image from the
+// running one and writing it to out. Patches are made by make_delta.py:
+//
+//   header:  "ESPZ", target size (u32), source SHA-256, target SHA-256
+//   then a zlib stream of records: op (u8), source offset (u32), length (u32)
+//            'C' copies length bytes from the source at the offset
+//            'A' adds the length bytes that follow to as many from the source
+//                at the offset, bytewise mod 256, as bsdiff does. Code that
+//                moved differs from the old copy only in addresses, so the
+//                bytes are mostly zero and compress well.
+//            'I' inserts the length bytes that follow the record
+//
+// Integers are little endian. A patch can't be resumed part way through, so
+// begin() only accepts offset 0 and OtaDownloader restarts it from scratch.
+class DeltaPatcher : public OtaDownloader::Sink {
+  public:
+    // The image being patched, normally the running partition
+    class Source {
+      public:
+        virtual ~Source() {}
+        virtual esp_err_t read(uint32_t offset, uint8_t *buf, size_t len) = 0;
+        virtual size_t size() = 0;
+        virtual bool hasSha(const uint8_t sha[DELTA_SHA_LEN]) = 0;
+    };
+
+    // Hashes the new image as it's written
+    class Digest {
+      public:
+        virtual ~Digest() {}
+        virtual void reset() = 0;
+        virtual void update(const uint8_t *buf, size_t len) = 0;
+        virtual void finish(uint8_t sha[DELTA_SHA_LEN]) = 0;
+    };
+
+    // Decompresses a zlib stream, the ROM's tinfl on the device
+    class Inflater {
+      public:
+        virtual ~Inflater() {}
+        virtual void reset() = 0;
+        // Decompresses up to outLen bytes from the inLen bytes at in, setting
+        // them to the bytes produced and used. done is set once the stream
+        // has ended and all of its output has been returned.
+        virtual esp_err_t inflate(const uint8_t *in, size_t *inLen, uint8_t *out,
+                                  size_t *outLen, bool *done) = 0;
+    };
+
+    DeltaPatcher(Source &source, Digest &digest, Inflater &inflater, OtaDownloader::Sink &out)
+        : source_(source), digest_(digest), inflater_(inflater), out_(out) {}
+
+    esp_err_t begin(uint32_t offset) override;
+    esp_err_t write(const uint8_t *buf, size_t len) override;
+    esp_err_t finish() override;
+    void abort() override;
+
+    uint32_t targetSize() const { return header_.targetSize; }
+    uint32_t written() const { return written_; }
+
+  private:
+    struct __attribute__((packed)) Header {
+        char magic[4];
+        uint32_t targetSize;
+        uint8_t sourceSha[DELTA_SHA_LEN];
+        uint8_t targetSha[DELTA_SHA_LEN];
+    };
+    struct __attribute__((packed)) Record {
+        uint8_t op;
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    enum class State { Header, Record, Add, Insert, Done, Error };
+
+    Source &source_;
+    Digest &digest_;
+    Inflater &inflater_;
+    OtaDownloader::Sink &out_;
+
+    State state_ = State::Error;
+    Header header_ = {};
+    Record record_ = {};
+    // Bytes of the header or record gathered so far
+    size_t partial_ = 0;
+    // Bytes of the current add or insert left to pass through
+    uint32_t remaining_ = 0;
+    // Source offset of the next byte of the current add
+    uint32_t addOffset_ = 0;
+    uint32_t written_ = 0;
+    // The compressed stream has ended
+    bool streamDone_ = false;
+    uint8_t copyBuf_[DELTA_COPY_BUF_SIZE];
+    uint8_t inflateBuf_[DELTA_INFLATE_BUF_SIZE];
+
+    // Gathers a fixed size struct that may be split across writes
+    bool gather(void *dst, size_t size, const uint8_t *&buf, size_t &len);
+    esp_err_t checkHeader();
+    // Applies decompressed records
+    esp_err_t process(const uint8_t *buf, size_t len);
+    esp_err_t applyRecord();
+    esp_err_t output(const uint8_t *buf, size_t len);
+    esp_err_t fail(esp_err_t err);
+};
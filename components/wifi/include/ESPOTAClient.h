@@ -8,6 +8,10 @@
 #include "esp_err.h"
 #include "esp_http_client.h"
 
+#include "OtaDownloader.h"
+
+class ESPWifi;
+
 class ESPOTAClient : public AbstractOTAClient {
   public:
     typedef void (*msgCb_t)(const char *);
@@ -17,21 +21,47 @@ class ESPOTAClient : public AbstractOTAClient {
     void markValid() override;
     const char *currentVersion() override;
 
+    // Keeps Wi-Fi at full power while downloading an update
+    void setWifi(ESPWifi *wifi) { wifi_ = wifi; }
+    // Caps the download rate so it leaves room for MQTT; 0 for no limit
+    void setRateLimit(uint32_t bytesPerSec) { rateLimit_ = bytesPerSec; }
+
     esp_err_t _handleHTTPEvent(esp_http_client_event_t *evt);
 
   private:
     msgCb_t msgCb_;
     size_t maxMsgLen_;
+    ESPWifi *wifi_ = nullptr;
+    uint32_t rateLimit_ = OTA_RATE_LIMIT_BYTES_PER_SEC;
 
     char url_[256];
     char *pathPart_;
     size_t pathLen_;
 
+    // Kept between checks so the connection and TLS session are reused
+    esp_http_client_handle_t client_ = nullptr;
+    bool connected_ = false;
+
     char outputBuffer_[32];
     size_t outputBufferPos_ = 0;
     bool outputOk_;
+    // Whether response data is the version, not firmware
+    bool collecting_ = false;
+
+    // From the last version response, sent back to only get it if changed
+    char latestVersion_[32] = "";
+    char etag_[64] = "";
+    char lastModified_[40] = "";
+    // Headers of the response being read
+    char respEtag_[64];
+    char respLastModified_[40];
+    char contentRange_[64];
 
     char runningVersion_[32];
 
     void setErrMessageF(const char *fmt, ...);
+    esp_http_client_handle_t httpClient();
+    // Downloads url_ into sink, returning the last HTTP status in status
+    OtaDownloader::Result download(OtaDownloader::Sink &sink, OtaDownloader::Store &store,
+                                   uint8_t *buf, int *status);
 };
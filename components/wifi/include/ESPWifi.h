@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstring>
 
 #include "AbstractWifi.h"
@@ -11,6 +12,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
+// Idle power save may delay traffic to the device by up to this long. A
+// second is enough for max modem, and nobody waits on the thermostat while
+// its screen is off.
+#define WIFI_PS_LATENCY_BUDGET_MS 1000
+// The usual 100 TU
+#define WIFI_BEACON_INTERVAL_MS 102
+// Below this many beacons, waking for every DTIM (min modem) is as good
+#define WIFI_PS_MAX_MODEM_MIN_BEACONS 3
+
 // NB: Maybe need to set CONFIG_ESP_SYSTEM_EVENT_TASK_STACK_SIZE >= 3584?
 class ESPWifi : public AbstractWifi {
   public:
@@ -24,6 +34,18 @@ class ESPWifi : public AbstractWifi {
 
     void setSNTPCallback(esp_sntp_time_cb_t cb) { sntpCb_ = cb; }
 
+    // While idle the modem sleeps between beacons, as long as traffic to the
+    // device is delayed by no more than the latency budget: min modem wakes
+    // for each DTIM, max modem with a longer budget sleeps through beacons.
+    // It stays awake while anything holds full power.
+    enum FullPowerHold : uint8_t {
+        HoldUI = 1 << 0,
+        HoldOTA = 1 << 1,
+    };
+    void holdFullPower(FullPowerHold hold, bool held);
+    // 0 disables power save. Takes effect on the next connect.
+    void setLatencyBudget(uint32_t ms) { latencyBudgetMs_ = ms; }
+
     // Force a re-association from the Connected state. The resulting
     // DISCONNECTED event drives the normal reconnect path. Used by the
     // connectivity watchdog when associated but L3 connectivity is dead.
@@ -57,6 +79,19 @@ class ESPWifi : public AbstractWifi {
     esp_netif_t *netif_ = nullptr;
     SemaphoreHandle_t mutex_;
 
+    // The AP last connected to, kept in NVS so the next connection can skip
+    // the scan and go straight to it. Falls back to a full scan if that fails.
+    struct APCache {
+        char ssid[33];
+        uint8_t bssid[6];
+        uint8_t channel;
+    };
+    APCache apCache_ = {};
+    bool apCacheValid_ = false;
+    bool usingAPCache_ = false;
+    // When the current attempt to connect started, 0 once connected
+    int64_t connectStartUs_ = 0;
+
     // Diagnostics counters, updated from event handlers.
     uint32_t disconnectCount_ = 0;
     int lastDisconnectReason_ = 0;
@@ -67,6 +102,18 @@ class ESPWifi : public AbstractWifi {
 
     esp_sntp_time_cb_t sntpCb_ = nullptr;
 
+    uint32_t latencyBudgetMs_ = WIFI_PS_LATENCY_BUDGET_MS;
+    wifi_ps_type_t idlePS_ = WIFI_PS_MIN_MODEM;
+    // Read without the mutex so callers can check every loop cheaply
+    std::atomic<uint8_t> fullPowerHolds_ = 0;
+    bool started_ = false;
+
+    void loadAPCache();
+    void saveAPCache();
+    // Points the config at the cached AP, or back to scanning for the SSID
+    void useAPCache(bool use);
+    // Call with mutex_ held
+    void applyPowerSave();
     void doRetry(int reason = 0);
     static void retryTimerCb(void *arg);
     void setState(State state, const char *msg, int reason = 0);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_http_client.h"
+
+#include "OtaDownloader.h"
+
+// Fetches each chunk with a Range request on the OTA client's connection,
+// which carries on from the update check while the server keeps it alive.
+//
+// A server that ignores Range answers 200 with the whole image. That body is
+// then read in order across fetches rather than requested again per chunk.
+// Resuming part way through on such a server fails with
+// ESP_ERR_NOT_SUPPORTED, and OtaDownloader starts over on the same response.
+class HttpRangeTransport : public OtaDownloader::Transport {
+  public:
+    // contentRange is filled in from the response headers by the client's
+    // event handler
+    HttpRangeTransport(esp_http_client_handle_t client, char *contentRange)
+        : client_(client), contentRange_(contentRange) {}
+
+    // HTTP status of the last response
+    int status() const { return status_; }
+
+    esp_err_t fetch(uint32_t offset, uint32_t len, uint8_t *buf, uint32_t *got,
+                    uint32_t *total) override;
+
+  private:
+    esp_http_client_handle_t client_;
+    char *contentRange_;
+    int status_ = 0;
+
+    // Reading a 200 response, at streamPos_ of streamTotal_
+    bool streaming_ = false;
+    uint32_t streamPos_ = 0, streamTotal_ = 0;
+
+    esp_err_t request(uint32_t offset, uint32_t len, uint32_t *want, uint32_t *total);
+    esp_err_t close(esp_err_t err);
+};
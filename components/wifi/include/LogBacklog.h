@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+// Segment files are deleted whole, oldest first, once read or to stay under
+// LOG_BACKLOG_MAX_SEGMENTS
+#define LOG_BACKLOG_SEGMENT_BYTES (64 * 1024)
+#define LOG_BACKLOG_MAX_SEGMENTS 8
+// Buffered messages are written once they've waited this long
+#define LOG_BACKLOG_FLUSH_MS (60 * 1000)
+// or, when one is urgent, this long since the last write
+#define LOG_BACKLOG_URGENT_FLUSH_MS (20 * 1000)
+// The LittleFS block, the unit flash wears in
+#define LOG_BACKLOG_BLOCK_BYTES 4096
+// Flash wear allowed, see LogBacklog
+#define LOG_BACKLOG_WRITE_BYTES_PER_HOUR (128 * LOG_BACKLOG_BLOCK_BYTES)
+#define LOG_BACKLOG_BUDGET_MAGIC 0x6c6f6762
+
+// Keeps log messages in a directory of segment files (on the "logs" LittleFS
+// partition) while they can't be sent, until they're read back to send.
+//
+// Flash endurance: segments are only appended to and are deleted whole, never
+// rewritten, but every write is synced, and LittleFS then copies the file's
+// partly filled last block and commits its metadata. So a write is charged a
+// whole block for each block of data it touches, plus one for the metadata.
+// Messages are buffered in RAM and written once they've waited
+// LOG_BACKLOG_FLUSH_MS, when the buffer fills, or for urgent ones (errors that
+// may explain a restart) at most every LOG_BACKLOG_URGENT_FLUSH_MS. Charges
+// come out of a token bucket holding up to an hour's writeBytesPerHour; a
+// write waits until it's covered, and messages that don't fit the buffer
+// meanwhile are dropped. The bucket survives restarts (see Budget), so a
+// crash loop can't refill it, and a cold boot starts with two blocks' worth.
+// With the defaults that's at most 128 block erases an hour, so a 1MB
+// partition (256 blocks of 100k erase cycles) lasts over 20 years of
+// continuous outage.
+//
+// Each boot starts a new segment. A segment being read when the device
+// restarts is read again from its start. Not thread safe.
+class LogBacklog {
+  public:
+    struct Record {
+        int64_t timeUs; // Wall clock time if wallTime, else esp_timer time
+        uint32_t boot;  // Which boot logged it
+        bool wallTime;
+    };
+
+    struct Stats {
+        uint32_t appended;
+        uint32_t read;
+        uint32_t dropped;         // Over the write budget
+        uint32_t segmentsDropped; // Deleted unread to stay under the cap, or corrupt
+        uint32_t bytesWritten;
+    };
+
+    // The write budget left. Kept in memory that survives a restart (RTC
+    // memory on the device); anything without the magic is taken as a cold
+    // boot.
+    struct Budget {
+        uint32_t magic;
+        uint32_t bytes;
+    };
+
+    typedef uint64_t (*nowMsFn_t)();
+
+    // buf holds messages until they're written, so it bounds a message's size
+    LogBacklog(const char *dir, uint8_t *buf, size_t bufSize, nowMsFn_t nowMsFn, Budget *budget,
+               uint32_t segmentBytes = LOG_BACKLOG_SEGMENT_BYTES,
+               uint32_t maxSegments = LOG_BACKLOG_MAX_SEGMENTS,
+               uint32_t writeBytesPerHour = LOG_BACKLOG_WRITE_BYTES_PER_HOUR,
+               uint32_t blockBytes = LOG_BACKLOG_BLOCK_BYTES);
+    ~LogBacklog();
+
+    // Finds the segments left from earlier boots
+    esp_err_t open();
+
+    // Returns false if msg was dropped, the buffer being full and the write
+    // budget used up. An urgent message is written sooner.
+    bool append(const Record &record, const char *msg, size_t len, bool urgent = false);
+    // Writes buffered messages once they're due
+    void poll();
+    // Writes buffered messages if the budget covers it, returning whether
+    // it did
+    bool flush();
+
+    // Reads the oldest message into msg, truncating it to size, without
+    // taking it off the backlog. Returns false when there are none. Messages
+    // not yet written are read from the buffer.
+    bool peek(Record *record, char *msg, size_t size, size_t *len);
+    // Takes the message just peeked off the backlog, once it's been sent
+    void pop();
+    bool empty() const;
+
+    const Stats &stats() const { return stats_; }
+
+  private:
+    struct Header {
+        uint8_t magic;
+        uint8_t flags;
+        uint16_t len;
+        uint32_t boot;
+        int64_t timeUs;
+    };
+
+    char dir_[32];
+    uint8_t *buf_;
+    size_t bufSize_;
+    size_t bufUsed_ = 0;
+    // Start of the messages in buf_ not yet popped
+    size_t bufRead_ = 0;
+    uint64_t bufferedAtMs_ = 0;
+    bool urgent_ = false;
+    nowMsFn_t nowMsFn_;
+    uint32_t segmentBytes_;
+    uint32_t maxSegments_;
+    uint32_t writeBytesPerHour_;
+    uint32_t blockBytes_;
+
+    // Segments readSeq_ to lastSeq_ exist, lastSeq_ being written to if
+    // writeFile_ is open
+    uint32_t readSeq_ = 1;
+    uint32_t lastSeq_ = 0;
+    FILE *writeFile_ = nullptr;
+    uint32_t writeSize_ = 0;
+    FILE *readFile_ = nullptr;
+    long readPos_ = 0;
+    // Size of the record peeked, 0 if there's none to pop
+    size_t peeked_ = 0;
+
+    Budget *budget_;
+    uint64_t budgetAtMs_;
+    bool flushed_ = false;
+    uint64_t flushedAtMs_ = 0;
+
+    Stats stats_ = {};
+
+    void path(uint32_t seq, char *buf, size_t size) const;
+    void refill(uint64_t nowMs);
+    bool peekBuffer(Record *record, char *msg, size_t size, size_t *len);
+    void closeWrite();
+    void deleteOldest();
+};
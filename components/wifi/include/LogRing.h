@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// A lock-free ring of fixed size log message slots, written by the code
+// running on one core and read by the remote logger's task on either.
+//
+// Writers reserve a slot, format into it and commit it. Only reserve() must
+// be serialized between the writers on a core, which remote_logger does by
+// masking interrupts on that core around it, so an interrupt can log while a
+// task is part way through formatting. Slots are read in the order they were
+// reserved, each once it's committed.
+class LogRing {
+  public:
+    struct Entry {
+        uint64_t timeUs;
+        const char *msg;
+        size_t len;
+    };
+
+    static size_t storageSize(size_t slots, size_t slotSize) {
+        return slots * (sizeof(Slot) + slotSize);
+    }
+
+    // slots must be a power of two. storage holds storageSize() bytes.
+    void init(void *storage, size_t slots, size_t slotSize);
+
+    // Returns a slotSize buffer to format a message logged at timeUs into, or
+    // nullptr if the ring is full. wasEmpty tells the writer to wake the
+    // reader.
+    char *reserve(uint64_t timeUs, bool *wasEmpty);
+    void commit(char *buf, size_t len);
+
+    // The oldest message if it has been committed
+    bool peek(Entry *entry) const;
+    void pop();
+
+    // The ring with the earliest message ready to read, nullptr if none
+    static LogRing *oldest(LogRing *rings, size_t n, Entry *entry);
+
+  private:
+    struct Slot {
+        uint64_t timeUs;
+        uint32_t len;
+        std::atomic<bool> ready;
+    };
+
+    Slot *slots_ = nullptr;
+    char *data_ = nullptr;
+    uint32_t mask_ = 0;
+    size_t slotSize_ = 0;
+    // Slots reserved and read, wrapping at 2^32
+    std::atomic<uint32_t> head_{0}, tail_{0};
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define METRICS_HTTP_PORT 80
+// Room for values to grow between measuring and rendering the output
+#define METRICS_RENDER_SLACK 512
+
+// Serves every registered Metric at GET /metrics for Prometheus to scrape,
+// along with heap and uptime gauges.
+class MetricsServer {
+  public:
+    ~MetricsServer() { stop(); }
+
+    esp_err_t start(uint16_t port = METRICS_HTTP_PORT);
+    void stop();
+
+    esp_err_t _handleMetrics(httpd_req_t *req);
+
+  private:
+    httpd_handle_t server_ = nullptr;
+};
@@ -7,7 +7,17 @@
 #include "freertos/semphr.h"
 
 #include "ESPWifi.h"
+#include "NetJobQueue.h"
 
+// Workers running the tasks; at most one runs a long task at a time
+#define NET_TASK_WORKERS 2
+// Each task's next run is pushed back by up to this much of its delay, so
+// devices that booted together don't hit the servers in lockstep
+#define NET_TASK_JITTER_PCT 10
+
+// Runs periodic network tasks once wifi is connected, on a small pool of
+// workers ordered by deadline, and exports each task's run time and lateness
+// as the net_task_* metrics.
 class NetworkTaskManager {
   public:
     // Returned by each task: when it should next run, and whether a network
@@ -21,30 +31,59 @@ class NetworkTaskManager {
     // associated state (e.g. the OTA client) without a per-app wrapper.
     typedef TaskResult (*taskFn_t)(void *ctx);
 
+    // Long tasks may block for minutes (an OTA download, an upload) and are
+    // kept off one of the workers so they can't delay the short ones
+    using TaskClass = NetJobQueue::JobClass;
+
+    struct TaskStats {
+        const char *name;
+        uint32_t runs;
+        uint64_t lastRunMs, lastLateMs;
+    };
+
     NetworkTaskManager(ESPWifi &wifi) : wifi_(wifi) {}
 
-    void poll();
     void start(uint32_t stackDepth = 4096, uint priority = ESP_TASK_PRIO_MIN);
 
-    // NB: All tasks must be added before calling `start` or `poll`
-    // since this isn't threadsafe.
-    void addTask(taskFn_t taskFn, void *ctx = nullptr);
+    // NB: All tasks must be added before calling `start` since this isn't
+    // threadsafe.
+    void addTask(taskFn_t taskFn, void *ctx, const char *name,
+                 TaskClass cls = TaskClass::Short);
+
+    size_t numTasks() const { return tasks_.size(); }
+    TaskStats stats(size_t i);
+
+    // The started manager exporting metrics
+    static NetworkTaskManager *active() { return active_; }
+
+    void _work(size_t worker);
 
   private:
     struct Task {
         taskFn_t fn;
-        uint64_t dueMs;
         void *ctx;
+        TaskStats stats;
     };
 
+    // Waits for a connection before running any tasks. The first worker
+    // retries the connection if it failed.
+    void waitForWifi(bool retry);
+
     // Detects the "associated but no working path" failure: if no task reports
     // a successful network op for too long while wifi reports Connected, force
     // a reconnect, then restart if that doesn't help.
     void checkConnectivityWatchdog(uint64_t now_ms);
 
     std::vector<Task> tasks_;
+    NetJobQueue queue_;
     ESPWifi &wifi_;
+    // Guards queue_, each task's stats and the watchdog state
+    SemaphoreHandle_t mutex_ = nullptr;
+    // Given whenever a task is rescheduled to wake workers waiting for one
+    SemaphoreHandle_t wake_ = nullptr;
 
     uint64_t lastNetSuccessMs_ = 0;
     bool forcedReconnect_ = false;
+
+    static NetworkTaskManager *active_;
 };
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Bytes fetched per Range request. A multiple of OTA_RESUME_ALIGN.
+#define OTA_CHUNK_SIZE (16 * 1024)
+// Resumes restart at a flash sector boundary, since resuming erases the
+// sector it starts in
+#define OTA_RESUME_ALIGN 4096
+// Leaves room on the link for MQTT while downloading; 0 for no limit
+#define OTA_RATE_LIMIT_BYTES_PER_SEC (48 * 1024)
+
+// Downloads a firmware image in chunks with HTTP Range requests, saving how
+// far it got after each one so an interrupted download resumes from there,
+// even after a restart. The HTTP client, the OTA partition and where progress
+// is saved are supplied by the caller, see ESPOTAClient.
+class OtaDownloader {
+  public:
+    struct Progress {
+        char version[32];
+        uint32_t offset; // Bytes written to the partition
+        uint32_t total;  // Image size, 0 until known
+    };
+
+    class Transport {
+      public:
+        virtual ~Transport() {}
+        // Fetches up to len bytes from offset into buf, setting got to the
+        // bytes received and total to the image size. An error after some
+        // bytes arrived (a dropped connection) still sets got.
+        // ESP_ERR_NOT_SUPPORTED means the server can't start at offset, and
+        // the download starts over from 0.
+        virtual esp_err_t fetch(uint32_t offset, uint32_t len, uint8_t *buf, uint32_t *got,
+                                uint32_t *total) = 0;
+    };
+
+    class Sink {
+      public:
+        virtual ~Sink() {}
+        // Starts writing the image, continuing from offset if it isn't 0
+        virtual esp_err_t begin(uint32_t offset) = 0;
+        virtual esp_err_t write(const uint8_t *buf, size_t len) = 0;
+        // Validates the complete image and makes it the one to boot
+        virtual esp_err_t finish() = 0;
+        virtual void abort() = 0;
+    };
+
+    class Store {
+      public:
+        virtual ~Store() {}
+        virtual bool load(Progress *progress) = 0;
+        virtual void save(const Progress &progress) = 0;
+        virtual void clear() = 0;
+    };
+
+    typedef void (*sleepFn_t)(uint32_t ms);
+    typedef uint64_t (*nowMsFn_t)();
+
+    enum class Result {
+        Done,
+        Interrupted, // The connection failed, progress is saved to resume from
+        Failed,      // The image or the partition was bad, progress is discarded
+    };
+
+    // buf must hold chunkSize bytes
+    OtaDownloader(Transport &transport, Sink &sink, Store &store, uint8_t *buf,
+                  uint32_t chunkSize, sleepFn_t sleepFn, nowMsFn_t nowMsFn)
+        : transport_(transport), sink_(sink), store_(store), buf_(buf), chunkSize_(chunkSize),
+          sleepFn_(sleepFn), nowMsFn_(nowMsFn) {}
+
+    void setRateLimit(uint32_t bytesPerSec) { rateLimit_ = bytesPerSec; }
+
+    // Downloads version, resuming saved progress if it was for the same version
+    Result download(const char *version);
+
+    const Progress &progress() const { return progress_; }
+
+    // Parses a "bytes <first>-<last>/<total>" Content-Range header
+    static bool parseContentRange(const char *header, uint32_t *first, uint32_t *total);
+
+  private:
+    Transport &transport_;
+    Sink &sink_;
+    Store &store_;
+    uint8_t *buf_;
+    uint32_t chunkSize_;
+    sleepFn_t sleepFn_;
+    nowMsFn_t nowMsFn_;
+    uint32_t rateLimit_ = OTA_RATE_LIMIT_BYTES_PER_SEC;
+    Progress progress_ = {};
+
+    Result fail();
+};
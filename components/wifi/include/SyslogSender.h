@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "lwip/sockets.h"
+#else
+#include <netinet/in.h>
+#endif
+
+// Largest datagram sent, leaving room for IP and UDP headers in a 1500 byte
+// MTU
+#define SYSLOG_MAX_PACKET 1400
+// Room for the "<len> " of a TCP frame, plus its null terminator
+#define SYSLOG_MAX_FRAME_PREFIX 8
+// A partly filled batch is sent after waiting this long for more messages
+#define SYSLOG_FLUSH_DELAY_MS 200
+// Wait between attempts to connect over TCP
+#define SYSLOG_RECONNECT_MS 5000
+#define SYSLOG_SOCKET_TIMEOUT_MS 1000
+
+// Sends syslog messages to one host, used by the remote logger's task:
+//
+//   Udp:        one message per datagram, as most syslog servers expect
+//   UdpBatched: messages separated by newlines, packed into datagrams of up
+//               to SYSLOG_MAX_PACKET bytes. The server must split datagrams
+//               on newlines.
+//   Tcp:        RFC 6587 octet counted frames ("<len> <msg>"), batched the
+//               same way and reconnecting when the connection drops. A batch
+//               that fails to send is kept and sent again on reconnect.
+//
+// Messages that can't be sent or held are counted as dropped. Not thread
+// safe.
+class SyslogSender {
+  public:
+    enum class Transport { Udp, UdpBatched, Tcp };
+
+    struct Stats {
+        uint32_t messages; // Sent
+        uint32_t packets;  // Datagrams or TCP writes
+        uint32_t dropped;
+        uint32_t connects; // TCP connections made
+    };
+
+    typedef uint64_t (*nowMsFn_t)();
+
+    SyslogSender(Transport transport, nowMsFn_t nowMsFn)
+        : transport_(transport), nowMsFn_(nowMsFn) {}
+    ~SyslogSender() { closeSocket(); }
+
+    Transport transport() const { return transport_; }
+    // Closes the socket so the next send opens one to the new address
+    void setDest(const struct sockaddr_in &addr);
+
+    // Queues msg, sending the batch first if msg doesn't fit. Returns false
+    // if msg was dropped.
+    bool add(const char *msg, size_t len);
+    // Sends a partly filled batch once it has waited SYSLOG_FLUSH_DELAY_MS
+    void poll();
+    void flush();
+    // How long until poll() has something to do, UINT32_MAX if nothing
+    uint32_t nextPollMs();
+    // Over TCP, the last attempt to connect or send failed and the batch is
+    // held for the reconnect, so messages added now wait or are dropped
+    bool down() const { return down_; }
+
+    void closeSocket();
+
+    const Stats &stats() const { return stats_; }
+
+  private:
+    Transport transport_;
+    nowMsFn_t nowMsFn_;
+    struct sockaddr_in dest_ = {};
+    int socket_ = -1;
+    uint64_t lastConnectMs_ = 0;
+    bool connectTried_ = false;
+    bool down_ = false;
+
+    char batch_[SYSLOG_MAX_PACKET];
+    size_t batchLen_ = 0;
+    uint32_t batchMessages_ = 0;
+    uint64_t batchStartMs_ = 0;
+    Stats stats_ = {};
+
+    size_t framedLen(size_t len) const;
+    bool openSocket();
+    bool send();
+    void dropBatch();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define HEALTH_MAX_TASKS 32
+// A task whose stack has come within this many bytes of overflowing
+#define HEALTH_STACK_WARN_BYTES 512
+// A task other than idle using more than this share of one core
+#define HEALTH_CPU_WARN_PCT 50
+
+// Samples every task's stack high water mark and CPU share from the FreeRTOS
+// run time stats (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS). CPU shares cover
+// the window since the previous sample, as a percentage of one core.
+class TaskHealthSampler {
+  public:
+    struct Summary {
+        uint8_t nTasks;
+        uint8_t coreLoadPct[portNUM_PROCESSORS]; // 100 minus the core's idle share
+        char busiestTask[configMAX_TASK_NAME_LEN];
+        uint8_t busiestPct;
+        char minStackTask[configMAX_TASK_NAME_LEN];
+        uint32_t minStackFree; // Bytes
+        uint8_t alerts;        // Tasks over a threshold
+    };
+
+    TaskHealthSampler();
+    ~TaskHealthSampler();
+
+    // Takes a sample, logs a warning for each task that newly crossed a
+    // threshold and returns the summary.
+    const Summary &sample();
+    const Summary &summary() const { return summary_; }
+
+    // Logs the summary at WARN so it reaches the remote logger, and each
+    // task's numbers from the last sample at INFO.
+    void log() const;
+
+  private:
+    struct TaskRecord {
+        TaskHandle_t handle;
+        char name[configMAX_TASK_NAME_LEN];
+        configRUN_TIME_COUNTER_TYPE runTime;
+        uint32_t stackFree;
+        uint8_t cpuPct;
+        bool alerting;
+    };
+
+    // Sample buffers live in PSRAM; records_ and prevRecords_ swap each sample
+    TaskStatus_t *status_;
+    TaskRecord *records_, *prevRecords_;
+    size_t nRecords_ = 0, nPrevRecords_ = 0;
+    configRUN_TIME_COUNTER_TYPE lastTotalRunTime_ = 0;
+    Summary summary_ = {};
+
+    const TaskRecord *findPrev(TaskHandle_t handle) const;
+};
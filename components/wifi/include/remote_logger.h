@@ -2,10 +2,20 @@
 
 #include "esp_log.h"
 
+#include "SyslogSender.h"
+
 #define REMOTE_LOG_MESSAGE_LEN 512
 #define REMOTE_LOG_IP_TTL_MS 60 * 60 * 1000 // 1 hour TTL
 
-void remote_logger_init(const char *name, const char *dest_host);
+// Batching (UdpBatched) needs a server that splits datagrams on newlines, and
+// Tcp one that accepts RFC 6587 octet counted frames on the syslog port.
+//
+// With backlog_partition (a LittleFS data partition), messages logged while
+// the server can't be reached are kept in flash, across restarts, and sent
+// with the time they were logged once it can. See LogBacklog.
+void remote_logger_init(const char *name, const char *dest_host,
+                        SyslogSender::Transport transport = SyslogSender::Transport::Udp,
+                        const char *backlog_partition = NULL);
 void remote_logger_set_name(const char *name);
 
 // Report network connectivity so the logger only drains its buffer when the
@@ -57,5 +57,17 @@ fi
 ssh "${REMOTE_SPEC}" "sudo mkdir -p ${REMOTE_PATH} && sudo chown -R www-data:adm ${REMOTE_ROOT}"
 scp "${FIRMWARE_PATH}" "${REMOTE_SPEC}:/tmp/${version}.bin"
 ssh "${REMOTE_SPEC}" "sudo mv /tmp/${version}.bin ${REMOTE_PATH}/${version}.bin"
+
+# Devices on the previous release fetch a patch against it instead of the
+# full image (see make_delta.py)
+prev_version=$(ssh "${REMOTE_SPEC}" "sudo cat ${VERSION_PATH} 2>/dev/null" || true)
+if [[ -n "${prev_version}" && "${prev_version}" != "${version}" ]] &&
+    scp "${REMOTE_SPEC}:${REMOTE_PATH}/${prev_version}.bin" "/tmp/${prev_version}.bin"; then
+    delta="${version}.from-${prev_version}.delta"
+    python3 "${SCRIPT_DIR}/../../make_delta.py" "/tmp/${prev_version}.bin" "${FIRMWARE_PATH}" "/tmp/${delta}"
+    scp "/tmp/${delta}" "${REMOTE_SPEC}:/tmp/${delta}"
+    ssh "${REMOTE_SPEC}" "sudo mv /tmp/${delta} ${REMOTE_PATH}/${delta}"
+fi
+
 ssh "${REMOTE_SPEC}" "echo -n ${version} | sudo tee ${VERSION_PATH}"
 ssh "${REMOTE_SPEC}" "sudo chmod a+r ${VERSION_PATH}"
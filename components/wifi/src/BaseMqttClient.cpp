@@ -1,10 +1,47 @@
 #include "BaseMqttClient.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
 #include "wifi_credentials.h"
 
+#include "Metrics.h"
+
+#define HEALTH_DISCOVERY_MAX_LEN 2048
+
 static const char *TAG = "MQTT";
 
+// Indexed by wifi_ps_type_t, so the latency of each power save mode is visible
+static MetricGauge rttMetrics[] = {
+    {"mqtt_rtt_seconds", "Last round trip through the broker", "wifi_ps=\"none\""},
+    {"mqtt_rtt_seconds", "Last round trip through the broker", "wifi_ps=\"min_modem\""},
+    {"mqtt_rtt_seconds", "Last round trip through the broker", "wifi_ps=\"max_modem\""},
+};
+
+static_assert(portNUM_PROCESSORS == 2, "Health sensors report two cores");
+
+#define PCT_EXTRA "\"unit_of_measurement\":\"%\",\"state_class\":\"measurement\","
+
+// Health sensors, all read from one JSON state message keyed by id
+static const struct {
+    const char *id, *name, *extra;
+} healthSensors[] = {
+    {"cpu0_load", "CPU Load Core 0", PCT_EXTRA},
+    {"cpu1_load", "CPU Load Core 1", PCT_EXTRA},
+    {"busiest_task", "Busiest Task", ""},
+    {"busiest_task_cpu", "Busiest Task CPU", PCT_EXTRA},
+    {"min_stack_task", "Lowest Stack Task", ""},
+    {"min_stack_free", "Lowest Stack Free",
+     "\"unit_of_measurement\":\"B\",\"state_class\":\"measurement\","},
+    {"health_alerts", "Task Health Alerts", "\"state_class\":\"measurement\","},
+};
+
 extern const uint8_t server_root_pem[] asm("_binary_isrgrootx1_pem_start");
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id,
@@ -19,11 +56,24 @@ esp_err_t BaseMqttClient::_handleMQTTEvent(esp_mqtt_event_id_t eventId,
     switch (eventId) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGD(TAG, "connected, subscribing to topics");
+        xSemaphoreTake(healthMutex_, portMAX_DELAY);
+        healthDiscoveryPending_ = true;
+        healthPending_ = haveHealth_;
+        xSemaphoreGive(healthMutex_);
+        if (pingTopic_[0]) {
+            esp_mqtt_client_subscribe(client_, pingTopic_, 0);
+        }
+        // Subclasses dispatch a user event here, which publishes health too
         onConnected();
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGD(TAG, "MQTT_EVENT_DATA, topic=%.*s, data=%.*s", event->topic_len, event->topic,
                  event->data_len, event->data);
+        if (pingTopic_[0] && event->topic_len == (int)strlen(pingTopic_) &&
+            !strncmp(event->topic, pingTopic_, event->topic_len)) {
+            onPing(event->data, event->data_len);
+            break;
+        }
         onMsg(event->topic, event->topic_len, event->data, event->data_len);
         break;
     case MQTT_EVENT_ERROR:
@@ -32,6 +82,7 @@ esp_err_t BaseMqttClient::_handleMQTTEvent(esp_mqtt_event_id_t eventId,
         break;
     case MQTT_USER_EVENT:
         ESP_LOGD(TAG, "MQTT_USER_EVENT");
+        publishHealth();
         onUserEvent();
         break;
     default:
@@ -42,6 +93,145 @@ esp_err_t BaseMqttClient::_handleMQTTEvent(esp_mqtt_event_id_t eventId,
     return ESP_OK;
 }
 
+BaseMqttClient::BaseMqttClient() { healthMutex_ = xSemaphoreCreateMutex(); }
+
+BaseMqttClient::~BaseMqttClient() { vSemaphoreDelete(healthMutex_); }
+
+void BaseMqttClient::setHealthDevice(const char *deviceId) {
+    xSemaphoreTake(healthMutex_, portMAX_DELAY);
+    strlcpy(healthDeviceId_, deviceId, sizeof(healthDeviceId_));
+    snprintf(healthTopic_, sizeof(healthTopic_), "home/%s/health/state", deviceId);
+    snprintf(healthDiscoveryTopic_, sizeof(healthDiscoveryTopic_),
+             "homeassistant/device/%s_health/config", deviceId);
+    snprintf(pingTopic_, sizeof(pingTopic_), "home/%s/ping", deviceId);
+    healthDiscoveryPending_ = true;
+    healthPending_ = haveHealth_;
+    xSemaphoreGive(healthMutex_);
+}
+
+void BaseMqttClient::updateHealth(const TaskHealthSampler::Summary &summary) {
+    xSemaphoreTake(healthMutex_, portMAX_DELAY);
+    health_ = summary;
+    haveHealth_ = true;
+    healthPending_ = true;
+    xSemaphoreGive(healthMutex_);
+
+    if (client_ == nullptr) {
+        return; // Published on connect
+    }
+    esp_mqtt_dispatch_custom_event(client_, nullptr);
+}
+
+// Called from the MQTT event loop
+void BaseMqttClient::sendPing() {
+    if (!pingTopic_[0]) {
+        return;
+    }
+    if (pingSentUs_) {
+        ESP_LOGD(TAG, "ping %lu lost", pingSeq_);
+    }
+
+    wifi_ps_type_t ps = WIFI_PS_NONE;
+    esp_wifi_get_ps(&ps);
+    char buf[12];
+    int len = snprintf(buf, sizeof(buf), "%lu", ++pingSeq_);
+    pingPS_ = ps;
+    pingSentUs_ = esp_timer_get_time();
+    if (esp_mqtt_client_publish(client_, pingTopic_, buf, len, 0, false) < 0) {
+        pingSentUs_ = 0;
+    }
+}
+
+// Called from the MQTT event loop
+void BaseMqttClient::onPing(const char *data, int dataLen) {
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%.*s", dataLen, data);
+    // Ignore a late reply to an earlier ping
+    if (!pingSentUs_ || strtoul(buf, nullptr, 10) != pingSeq_) {
+        return;
+    }
+
+    int64_t rttUs = esp_timer_get_time() - pingSentUs_;
+    pingSentUs_ = 0;
+    if (pingPS_ >= 0 && pingPS_ < (int)std::size(rttMetrics)) {
+        rttMetrics[pingPS_].set(rttUs / 1e6f);
+    }
+    ESP_LOGD(TAG, "ping rtt=%lldms ps=%d", rttUs / 1000, pingPS_);
+}
+
+// Called from the MQTT event loop
+void BaseMqttClient::publishHealth() {
+    xSemaphoreTake(healthMutex_, portMAX_DELAY);
+    bool discovery = healthDiscoveryPending_ && healthDeviceId_[0];
+    bool state = healthPending_ && healthDeviceId_[0];
+    TaskHealthSampler::Summary h = health_;
+    char deviceId[sizeof(healthDeviceId_)], topic[sizeof(healthTopic_)],
+        discoveryTopic[sizeof(healthDiscoveryTopic_)];
+    strcpy(deviceId, healthDeviceId_);
+    strcpy(topic, healthTopic_);
+    strcpy(discoveryTopic, healthDiscoveryTopic_);
+    xSemaphoreGive(healthMutex_);
+
+    if (discovery && publishHealthDiscovery(deviceId, topic, discoveryTopic) >= 0) {
+        xSemaphoreTake(healthMutex_, portMAX_DELAY);
+        healthDiscoveryPending_ = false;
+        xSemaphoreGive(healthMutex_);
+    }
+
+    if (state) {
+        char buf[256];
+        int len = snprintf(buf, sizeof(buf),
+                           R"({"cpu0_load":%u,"cpu1_load":%u,"busiest_task":"%s",)"
+                           R"("busiest_task_cpu":%u,"min_stack_task":"%s",)"
+                           R"("min_stack_free":%lu,"health_alerts":%u})",
+                           h.coreLoadPct[0], h.coreLoadPct[1], h.busiestTask, h.busiestPct,
+                           h.minStackTask, h.minStackFree, h.alerts);
+        if (esp_mqtt_client_publish(client_, topic, buf, len, 0, true) >= 0) {
+            xSemaphoreTake(healthMutex_, portMAX_DELAY);
+            healthPending_ = false;
+            xSemaphoreGive(healthMutex_);
+        }
+        sendPing();
+    }
+}
+
+int BaseMqttClient::publishHealthDiscovery(const char *deviceId, const char *topic,
+                                           const char *discoveryTopic) {
+    // Only sent on connect, so build it in PSRAM rather than keeping it around
+    char *buf = (char *)heap_caps_malloc(HEALTH_DISCOVERY_MAX_LEN, MALLOC_CAP_SPIRAM);
+    if (!buf) {
+        return -1;
+    }
+
+    // A second device discovery message with the same ids adds these
+    // sensors to the existing device
+    size_t pos = snprintf(buf, HEALTH_DISCOVERY_MAX_LEN,
+                          R"({"device":{"ids":"%s"},"o":{"name":"hvac_control"},"cmps":{)",
+                          deviceId);
+    for (size_t i = 0; i < std::size(healthSensors) && pos < HEALTH_DISCOVERY_MAX_LEN; i++) {
+        const auto &sensor = healthSensors[i];
+        pos += snprintf(buf + pos, HEALTH_DISCOVERY_MAX_LEN - pos,
+                        R"(%s"%s":{"p":"sensor","name":"%s","unique_id":"%s_%s",)"
+                        R"("entity_category":"diagnostic",)"
+                        "%s"
+                        R"("state_topic":"%s","value_template":"{{ value_json.%s }}"})",
+                        i ? "," : "", sensor.id, sensor.name, deviceId, sensor.id, sensor.extra,
+                        topic, sensor.id);
+    }
+    if (pos < HEALTH_DISCOVERY_MAX_LEN) {
+        pos += snprintf(buf + pos, HEALTH_DISCOVERY_MAX_LEN - pos, "}}");
+    }
+
+    int rv = -1;
+    if (pos < HEALTH_DISCOVERY_MAX_LEN) {
+        rv = esp_mqtt_client_publish(client_, discoveryTopic, buf, pos, 0, true);
+    } else {
+        ESP_LOGE(TAG, "Health discovery message too long");
+    }
+    heap_caps_free(buf);
+    return rv;
+}
+
 void BaseMqttClient::start() {
     config_.broker.address.uri = default_mqtt_uri;
     config_.broker.verification.certificate = (const char *)server_root_pem;
@@ -0,0 +1,175 @@
+#include "CoreDumpUploader.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_app_desc.h"
+#include "esp_core_dump.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "Metrics.h"
+
+// Nothing left to do this boot, so don't come back for a long time
+#define COREDUMP_DONE_INTERVAL_MS (24ULL * 60 * 60 * 1000)
+#define COREDUMP_CHUNK_SIZE 1024
+#define COREDUMP_HTTP_TIMEOUT_MS 10000
+
+static const char *TAG = "COREDUMP";
+
+static MetricGauge pendingMetric("coredump_pending", "Core dump waiting to be uploaded");
+static MetricCounter uploadErrMetric("coredump_upload_errors_total",
+                                     "Failed core dump upload attempts");
+
+extern const uint8_t server_root_pem[] asm("_binary_isrgrootx1_pem_start");
+
+CoreDumpUploader::CoreDumpUploader(const char *name, const char *url) {
+    strlcpy(name_, name, sizeof(name_));
+    strlcpy(url_, url, sizeof(url_));
+    if (strncmp(url_, "https://", strlen("https://"))) {
+        ESP_LOGE(TAG, "Not uploading core dumps unencrypted to %s", url_);
+        state_ = State::Done;
+    }
+}
+
+bool CoreDumpUploader::check() {
+    esp_err_t err = esp_core_dump_image_check();
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGI(TAG, "no core dump");
+        pendingMetric.set(0);
+        return false;
+    }
+    if (err != ESP_OK) {
+        // Erase it so it doesn't block the next crash's dump
+        ESP_LOGE(TAG, "Invalid core dump, erasing: %s", esp_err_to_name(err));
+        esp_core_dump_image_erase();
+        pendingMetric.set(0);
+        return false;
+    }
+
+    err = esp_core_dump_image_get(&dumpAddr_, &dumpSize_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to locate core dump: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    esp_core_dump_summary_t *summary = new esp_core_dump_summary_t;
+    if (esp_core_dump_get_summary(summary) == ESP_OK) {
+        strlcpy(elfSha_, (const char *)summary->app_elf_sha256, sizeof(elfSha_));
+        strlcpy(crashTask_, summary->exc_task, sizeof(crashTask_));
+        crashPc_ = summary->exc_pc;
+    } else {
+        // Most likely the firmware that crashed, unless an OTA update has
+        // been applied since
+        ESP_LOGW(TAG, "No core dump summary, assuming the running firmware");
+        esp_app_get_elf_sha256(elfSha_, sizeof(elfSha_));
+    }
+    delete summary;
+
+    ESP_LOGW(TAG, "core dump found: size=%ub task=%s pc=0x%08" PRIx32 " elf=%s", dumpSize_,
+             crashTask_, crashPc_, elfSha_);
+    pendingMetric.set(1);
+    return true;
+}
+
+bool CoreDumpUploader::upload(bool *accepted) {
+    *accepted = false;
+
+    const esp_partition_t *part = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, nullptr);
+    if (!part) {
+        ESP_LOGE(TAG, "No coredump partition");
+        return false;
+    }
+
+    esp_http_client_config_t httpConfig = {
+        .url = url_,
+        .cert_pem = (const char *)server_root_pem,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = COREDUMP_HTTP_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&httpConfig);
+    if (!client) {
+        return false;
+    }
+
+    char pc[12];
+    snprintf(pc, sizeof(pc), "0x%08" PRIx32, crashPc_);
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    esp_http_client_set_header(client, "X-Device", name_);
+    esp_http_client_set_header(client, "X-Elf-Sha256", elfSha_);
+    esp_http_client_set_header(client, "X-Firmware-Version", esp_app_get_description()->version);
+    esp_http_client_set_header(client, "X-Crash-Task", crashTask_);
+    esp_http_client_set_header(client, "X-Crash-Pc", pc);
+
+    esp_err_t err = esp_http_client_open(client, dumpSize_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to connect to %s: %s", url_, esp_err_to_name(err));
+        esp_http_client_cleanup(client);
+        return false;
+    }
+
+    // Streamed from flash so the dump never has to fit in RAM
+    char *buf = new char[COREDUMP_CHUNK_SIZE];
+    bool sent = true;
+    for (size_t off = 0; sent && off < dumpSize_; off += COREDUMP_CHUNK_SIZE) {
+        size_t len = std::min<size_t>(COREDUMP_CHUNK_SIZE, dumpSize_ - off);
+        err = esp_partition_read(part, dumpAddr_ - part->address + off, buf, len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error reading core dump: %s", esp_err_to_name(err));
+            sent = false;
+        } else if (esp_http_client_write(client, buf, len) != (int)len) {
+            ESP_LOGE(TAG, "Error sending core dump");
+            sent = false;
+        }
+    }
+    delete[] buf;
+
+    bool reached = false;
+    if (sent && esp_http_client_fetch_headers(client) >= 0) {
+        reached = true;
+        int status = esp_http_client_get_status_code(client);
+        *accepted = status >= 200 && status < 300;
+        if (!*accepted) {
+            ESP_LOGE(TAG, "Collector rejected core dump: %d", status);
+        }
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return reached;
+}
+
+NetworkTaskManager::TaskResult CoreDumpUploader::poll() {
+    if (state_ == State::Unchecked) {
+        state_ = check() ? State::Pending : State::Done;
+    }
+    if (state_ == State::Done) {
+        return {COREDUMP_DONE_INTERVAL_MS, false};
+    }
+
+    attempts_++;
+    bool accepted;
+    bool reached = upload(&accepted);
+    if (accepted) {
+        ESP_LOGW(TAG, "core dump uploaded after %u attempt(s), erasing", attempts_);
+        esp_core_dump_image_erase();
+        pendingMetric.set(0);
+        state_ = State::Done;
+        return {COREDUMP_DONE_INTERVAL_MS, true};
+    }
+
+    uploadErrMetric.inc();
+    uint32_t delayMs = retryMs_;
+    retryMs_ = std::min<uint32_t>(retryMs_ * 2, COREDUMP_RETRY_MAX_MS);
+    ESP_LOGW(TAG, "core dump upload attempt %u failed, retrying in %lus", attempts_,
+             delayMs / 1000);
+    return {delayMs, reached};
+}
+
+NetworkTaskManager::TaskResult coreDumpTaskFn(void *ctx) {
+    return static_cast<CoreDumpUploader *>(ctx)->poll();
+}
@@ -0,0 +1,234 @@
+#include "DeltaPatcher.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+static const char *TAG = "delta";
+
+esp_err_t DeltaPatcher::begin(uint32_t offset) {
+    if (offset) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    state_ = State::Header;
+    header_ = {};
+    partial_ = 0;
+    remaining_ = 0;
+    written_ = 0;
+    streamDone_ = false;
+    digest_.reset();
+    inflater_.reset();
+    esp_err_t err = out_.begin(0);
+    if (err != ESP_OK) {
+        state_ = State::Error;
+    }
+    return err;
+}
+
+bool DeltaPatcher::gather(void *dst, size_t size, const uint8_t *&buf, size_t &len) {
+    size_t n = std::min(size - partial_, len);
+    memcpy((uint8_t *)dst + partial_, buf, n);
+    partial_ += n;
+    buf += n;
+    len -= n;
+    if (partial_ < size) {
+        return false;
+    }
+    partial_ = 0;
+    return true;
+}
+
+esp_err_t DeltaPatcher::write(const uint8_t *buf, size_t len) {
+    if (state_ == State::Error) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (state_ == State::Header) {
+        if (!gather(&header_, sizeof(header_), buf, len)) {
+            return ESP_OK;
+        }
+        esp_err_t err = checkHeader();
+        if (err != ESP_OK) {
+            return fail(err);
+        }
+        state_ = header_.targetSize ? State::Record : State::Done;
+    }
+
+    // Until the piece is used up and no more output is held back
+    size_t produced;
+    do {
+        if (streamDone_) {
+            if (!len) {
+                break;
+            }
+            ESP_LOGE(TAG, "Data past the end of the patch");
+            return fail(ESP_ERR_INVALID_SIZE);
+        }
+        size_t used = len;
+        produced = sizeof(inflateBuf_);
+        esp_err_t err = inflater_.inflate(buf, &used, inflateBuf_, &produced, &streamDone_);
+        if (err == ESP_OK && !used && !produced && len) {
+            err = ESP_FAIL;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Bad compressed records");
+            return fail(ESP_ERR_INVALID_RESPONSE);
+        }
+        buf += used;
+        len -= used;
+        err = process(inflateBuf_, produced);
+        if (err != ESP_OK) {
+            return err;
+        }
+    } while (len || produced == sizeof(inflateBuf_));
+    return ESP_OK;
+}
+
+esp_err_t DeltaPatcher::process(const uint8_t *buf, size_t len) {
+    while (len) {
+        switch (state_) {
+        case State::Header:
+            return fail(ESP_ERR_INVALID_STATE);
+        case State::Record:
+            if (gather(&record_, sizeof(record_), buf, len)) {
+                esp_err_t err = applyRecord();
+                if (err != ESP_OK) {
+                    return fail(err);
+                }
+            }
+            break;
+        case State::Add: {
+            size_t n = std::min({(size_t)remaining_, len, sizeof(copyBuf_)});
+            esp_err_t err = source_.read(addOffset_, copyBuf_, n);
+            if (err != ESP_OK) {
+                return fail(err);
+            }
+            for (size_t i = 0; i < n; i++) {
+                copyBuf_[i] += buf[i];
+            }
+            err = output(copyBuf_, n);
+            if (err != ESP_OK) {
+                return fail(err);
+            }
+            buf += n;
+            len -= n;
+            addOffset_ += n;
+            remaining_ -= n;
+            if (!remaining_) {
+                state_ = written_ < header_.targetSize ? State::Record : State::Done;
+            }
+            break;
+        }
+        case State::Insert: {
+            size_t n = std::min((size_t)remaining_, len);
+            esp_err_t err = output(buf, n);
+            if (err != ESP_OK) {
+                return fail(err);
+            }
+            buf += n;
+            len -= n;
+            remaining_ -= n;
+            if (!remaining_) {
+                state_ = written_ < header_.targetSize ? State::Record : State::Done;
+            }
+            break;
+        }
+        case State::Done:
+            ESP_LOGE(TAG, "Data past the end of the patch");
+            return fail(ESP_ERR_INVALID_SIZE);
+        case State::Error:
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t DeltaPatcher::checkHeader() {
+    if (memcmp(header_.magic, DELTA_MAGIC, sizeof(header_.magic))) {
+        ESP_LOGE(TAG, "Not a delta patch");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (!source_.hasSha(header_.sourceSha)) {
+        ESP_LOGE(TAG, "Patch is for a different running image");
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(TAG, "Patching to a %lu byte image", (unsigned long)header_.targetSize);
+    return ESP_OK;
+}
+
+esp_err_t DeltaPatcher::applyRecord() {
+    if (record_.len > header_.targetSize - written_) {
+        ESP_LOGE(TAG, "Record past the end of the image");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if ((record_.op == 'C' || record_.op == 'A') &&
+        (record_.offset > source_.size() || record_.len > source_.size() - record_.offset)) {
+        ESP_LOGE(TAG, "Copy past the end of the source");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    switch (record_.op) {
+    case 'C': {
+        for (uint32_t done = 0; done < record_.len;) {
+            size_t n = std::min((size_t)(record_.len - done), sizeof(copyBuf_));
+            esp_err_t err = source_.read(record_.offset + done, copyBuf_, n);
+            if (err == ESP_OK) {
+                err = output(copyBuf_, n);
+            }
+            if (err != ESP_OK) {
+                return err;
+            }
+            done += n;
+        }
+        state_ = written_ < header_.targetSize ? State::Record : State::Done;
+        return ESP_OK;
+    }
+    case 'A':
+        remaining_ = record_.len;
+        addOffset_ = record_.offset;
+        state_ = remaining_ ? State::Add : State::Record;
+        return ESP_OK;
+    case 'I':
+        remaining_ = record_.len;
+        state_ = remaining_ ? State::Insert : State::Record;
+        return ESP_OK;
+    default:
+        ESP_LOGE(TAG, "Unknown record %02x", record_.op);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+}
+
+esp_err_t DeltaPatcher::output(const uint8_t *buf, size_t len) {
+    digest_.update(buf, len);
+    written_ += len;
+    return out_.write(buf, len);
+}
+
+esp_err_t DeltaPatcher::finish() {
+    if (state_ != State::Done || !streamDone_) {
+        ESP_LOGE(TAG, "Patch ended at %lu/%lu", (unsigned long)written_,
+                 (unsigned long)header_.targetSize);
+        return fail(ESP_ERR_INVALID_SIZE);
+    }
+    uint8_t sha[DELTA_SHA_LEN];
+    digest_.finish(sha);
+    if (memcmp(sha, header_.targetSha, sizeof(sha))) {
+        ESP_LOGE(TAG, "Patched image SHA-256 mismatch");
+        return fail(ESP_ERR_INVALID_CRC);
+    }
+    state_ = State::Error;
+    return out_.finish();
+}
+
+void DeltaPatcher::abort() {
+    if (state_ != State::Error) {
+        out_.abort();
+    }
+    state_ = State::Error;
+}
+
+esp_err_t DeltaPatcher::fail(esp_err_t err) {
+    abort();
+    return err;
+}
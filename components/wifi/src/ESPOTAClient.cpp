@@ -1,22 +1,231 @@
 #include "ESPOTAClient.h"
 
+#include <algorithm>
 #include <stdio.h>
+#include <strings.h>
 
 #include "esp_app_desc.h"
-#include "esp_https_ota.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "rom/miniz.h"
 
+#include "DeltaPatcher.h"
+#include "ESPWifi.h"
+#include "HttpRangeTransport.h"
+#include "Metrics.h"
+#include "OtaDownloader.h"
 #include "wifi_credentials.h"
 
+#define OTA_NVS_NAMESPACE "ota"
+#define OTA_HTTP_TIMEOUT_MS 5000
+
 static const char *TAG = "OTA";
 
+static MetricCounter handshakeMetric("ota_tls_handshakes_total",
+                                     "Connections (TLS handshakes) made by the OTA client");
+static MetricCounter notModifiedMetric("ota_check_not_modified_total",
+                                       "Update checks answered with 304 Not Modified");
+static MetricGauge checkCpuMetric("ota_check_cpu_seconds", "CPU time of the last update check");
+
 extern const uint8_t server_root_pem[] asm("_binary_isrgrootx1_pem_start");
 
 static esp_err_t _http_event_handler(esp_http_client_event_t *evt) {
     return ((ESPOTAClient *)evt->user_data)->_handleHTTPEvent(evt);
 }
 
+namespace {
+
+// Writes to the next OTA partition, resuming a partly written one with
+// esp_ota_resume
+class OtaPartitionSink : public OtaDownloader::Sink {
+  public:
+    OtaPartitionSink() : partition_(esp_ota_get_next_update_partition(nullptr)) {}
+
+    const esp_partition_t *partition() const { return partition_; }
+
+    esp_err_t begin(uint32_t offset) override {
+        if (!partition_) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (offset) {
+            return esp_ota_resume(partition_, OTA_WITH_SEQUENTIAL_WRITES, offset, &handle_);
+        }
+        return esp_ota_begin(partition_, OTA_WITH_SEQUENTIAL_WRITES, &handle_);
+    }
+    esp_err_t write(const uint8_t *buf, size_t len) override {
+        return esp_ota_write(handle_, buf, len);
+    }
+    esp_err_t finish() override {
+        esp_err_t err = esp_ota_end(handle_);
+        handle_ = 0;
+        if (err != ESP_OK) {
+            return err;
+        }
+        return esp_ota_set_boot_partition(partition_);
+    }
+    void abort() override {
+        if (handle_) {
+            esp_ota_abort(handle_);
+            handle_ = 0;
+        }
+    }
+
+  private:
+    const esp_partition_t *partition_;
+    esp_ota_handle_t handle_ = 0;
+};
+
+// Progress is kept per partition, so it's never resumed into the other one
+class NvsProgressStore : public OtaDownloader::Store {
+  public:
+    NvsProgressStore(const esp_partition_t *partition)
+        : key_(partition ? partition->label : "none") {}
+
+    bool load(OtaDownloader::Progress *progress) override {
+        nvs_handle_t handle;
+        if (nvs_open(OTA_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+            return false;
+        }
+        size_t len = sizeof(*progress);
+        bool ok =
+            nvs_get_blob(handle, key_, progress, &len) == ESP_OK && len == sizeof(*progress);
+        nvs_close(handle);
+        return ok;
+    }
+    void save(const OtaDownloader::Progress &progress) override {
+        nvs_handle_t handle;
+        if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+            return;
+        }
+        nvs_set_blob(handle, key_, &progress, sizeof(progress));
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    void clear() override {
+        nvs_handle_t handle;
+        if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+            return;
+        }
+        nvs_erase_key(handle, key_);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+
+  private:
+    const char *key_;
+};
+
+// A patch can't be resumed, so there's no progress to keep
+class NoProgressStore : public OtaDownloader::Store {
+  public:
+    bool load(OtaDownloader::Progress *progress) override { return false; }
+    void save(const OtaDownloader::Progress &progress) override {}
+    void clear() override {}
+};
+
+// The running image, which delta patches are made against
+class RunningPartitionSource : public DeltaPatcher::Source {
+  public:
+    RunningPartitionSource() : partition_(esp_ota_get_running_partition()) {}
+
+    esp_err_t read(uint32_t offset, uint8_t *buf, size_t len) override {
+        return esp_partition_read(partition_, offset, buf, len);
+    }
+    size_t size() override { return partition_->size; }
+    bool hasSha(const uint8_t sha[DELTA_SHA_LEN]) override {
+        uint8_t own[DELTA_SHA_LEN];
+        return esp_partition_get_sha256(partition_, own) == ESP_OK &&
+               !memcmp(own, sha, sizeof(own));
+    }
+
+  private:
+    const esp_partition_t *partition_;
+};
+
+class Sha256Digest : public DeltaPatcher::Digest {
+  public:
+    Sha256Digest() { mbedtls_sha256_init(&ctx_); }
+    ~Sha256Digest() { mbedtls_sha256_free(&ctx_); }
+
+    void reset() override { mbedtls_sha256_starts(&ctx_, 0); }
+    void update(const uint8_t *buf, size_t len) override { mbedtls_sha256_update(&ctx_, buf, len); }
+    void finish(uint8_t sha[DELTA_SHA_LEN]) override { mbedtls_sha256_finish(&ctx_, sha); }
+
+  private:
+    mbedtls_sha256_context ctx_;
+};
+
+// Inflates patch records with the copy of miniz in ROM. tinfl needs its whole
+// 32 KiB window as the output buffer, so it lives in PSRAM and what it
+// produces is handed out from there.
+class TinflInflater : public DeltaPatcher::Inflater {
+  public:
+    TinflInflater()
+        : tinfl_((tinfl_decompressor *)heap_caps_malloc(sizeof(tinfl_decompressor),
+                                                        MALLOC_CAP_SPIRAM)),
+          dict_((uint8_t *)heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_SPIRAM)) {}
+    ~TinflInflater() {
+        heap_caps_free(tinfl_);
+        heap_caps_free(dict_);
+    }
+
+    void reset() override {
+        if (tinfl_) {
+            tinfl_init(tinfl_);
+        }
+        status_ = TINFL_STATUS_NEEDS_MORE_INPUT;
+        dictPos_ = pendingPos_ = pending_ = 0;
+    }
+    esp_err_t inflate(const uint8_t *in, size_t *inLen, uint8_t *out, size_t *outLen,
+                      bool *done) override {
+        if (!tinfl_ || !dict_) {
+            return ESP_ERR_NO_MEM;
+        }
+        size_t used = 0;
+        if (!pending_ && status_ != TINFL_STATUS_DONE) {
+            // Up to the end of the window, tinfl wraps back to the start
+            size_t produced = TINFL_LZ_DICT_SIZE - dictPos_;
+            used = *inLen;
+            status_ = tinfl_decompress(tinfl_, in, &used, dict_, dict_ + dictPos_, &produced,
+                                       TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+            if (status_ < TINFL_STATUS_DONE) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            pendingPos_ = dictPos_;
+            pending_ = produced;
+            dictPos_ = (dictPos_ + produced) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        size_t n = std::min(pending_, *outLen);
+        memcpy(out, dict_ + pendingPos_, n);
+        pendingPos_ += n;
+        pending_ -= n;
+        *inLen = used;
+        *outLen = n;
+        *done = status_ == TINFL_STATUS_DONE && !pending_;
+        return ESP_OK;
+    }
+
+  private:
+    tinfl_decompressor *tinfl_;
+    uint8_t *dict_;
+    tinfl_status status_ = TINFL_STATUS_NEEDS_MORE_INPUT;
+    size_t dictPos_ = 0;
+    // Output in the window not yet handed out
+    size_t pendingPos_ = 0, pending_ = 0;
+};
+
+void sleepMs(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+uint64_t nowMs() { return esp_timer_get_time() / 1000; }
+
+} // namespace
+
 ESPOTAClient::ESPOTAClient(const char *name, msgCb_t msgCb, size_t maxMsgLen)
     : msgCb_(msgCb), maxMsgLen_(maxMsgLen) {
     int written = snprintf(url_, std::size(url_), default_ota_url_prefix_tmpl, name);
@@ -28,67 +237,161 @@ ESPOTAClient::ESPOTAClient(const char *name, msgCb_t msgCb, size_t maxMsgLen)
     strncpy(runningVersion_, esp_app_get_description()->version, std::size(runningVersion_));
 }
 
+esp_http_client_handle_t ESPOTAClient::httpClient() {
+    if (!client_) {
+        esp_http_client_config_t httpConfig = {
+            .url = url_,
+            .cert_pem = (const char *)server_root_pem,
+            .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+            .event_handler = _http_event_handler,
+            .user_data = this,
+            // Notices when the connection kept between checks has died
+            .keep_alive_enable = true,
+        };
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // Reconnects resume the TLS session instead of a full handshake
+        httpConfig.save_client_session = true;
+#endif
+        client_ = esp_http_client_init(&httpConfig);
+    }
+    return client_;
+}
+
+static void setOrDeleteHeader(esp_http_client_handle_t client, const char *key,
+                              const char *value) {
+    if (value[0]) {
+        esp_http_client_set_header(client, key, value);
+    } else {
+        esp_http_client_delete_header(client, key);
+    }
+}
+
 AbstractOTAClient::Error ESPOTAClient::update() {
     snprintf(pathPart_, pathLen_ - 1, "latest_version");
     ESP_LOGI(TAG, "Downloading version from %s", url_);
 
-    esp_http_client_config_t httpConfig = {
-        .url = url_,
-        .cert_pem = (const char *)server_root_pem,
-        .timeout_ms = 5000,
-        .event_handler = _http_event_handler,
-        .user_data = this,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&httpConfig);
-    outputBufferPos_ = 0;
-    outputOk_ = true;
+    esp_http_client_handle_t client = httpClient();
+    esp_http_client_set_url(client, url_);
+    esp_http_client_delete_header(client, "Range");
+    // The server only sends the version again when it has changed
+    setOrDeleteHeader(client, "If-None-Match", etag_);
+    setOrDeleteHeader(client, "If-Modified-Since", lastModified_);
 
-    esp_err_t err = esp_http_client_perform(client);
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    configRUN_TIME_COUNTER_TYPE cpuStart = ulTaskGetRunTimeCounter(task);
+    esp_err_t err = ESP_FAIL;
+    for (int attempt = 0; attempt < 2 && err != ESP_OK; attempt++) {
+        respEtag_[0] = respLastModified_[0] = '\0';
+        outputBufferPos_ = 0;
+        outputOk_ = true;
+        collecting_ = true;
+        bool reused = connected_;
+        err = esp_http_client_perform(client);
+        collecting_ = false;
+        if (err != ESP_OK) {
+            esp_http_client_close(client);
+            // A failure on the connection kept since the last check may just
+            // be the server having closed it, so try once on a new one
+            if (!reused) {
+                break;
+            }
+        }
+    }
+    // Run time stats count in microseconds
+    checkCpuMetric.set((ulTaskGetRunTimeCounter(task) - cpuStart) / 1e6f);
 
     int status = esp_http_client_get_status_code(client);
-    esp_http_client_cleanup(client);
 
     if (err != ESP_OK) {
         setErrMessageF("OTA version err: %s", esp_err_to_name(err));
         return Error::FetchError;
     }
-    if (status != 200) {
-        setErrMessageF("OTA version err: %d", status);
-        return Error::HttpError;
-    }
-    if (!outputOk_) {
-        // Reached the server (200) but the body was chunked or too long for
-        // outputBuffer_, so the version string is unusable.
-        setErrMessageF("OTA version response invalid");
-        return Error::HttpError;
-    }
+    if (status == 304 && latestVersion_[0]) {
+        notModifiedMetric.inc();
+        ESP_LOGD(TAG, "latest version unchanged: %s", latestVersion_);
+    } else {
+        if (status != 200) {
+            setErrMessageF("OTA version err: %d", status);
+            return Error::HttpError;
+        }
+        if (!outputOk_) {
+            // Reached the server (200) but the body was chunked or too long for
+            // outputBuffer_, so the version string is unusable.
+            setErrMessageF("OTA version response invalid");
+            return Error::HttpError;
+        }
 
-    outputBuffer_[outputBufferPos_] = '\0';
-    ESP_LOGI(TAG, "latest version: %s", outputBuffer_);
+        outputBuffer_[outputBufferPos_] = '\0';
+        ESP_LOGI(TAG, "latest version: %s", outputBuffer_);
+        strlcpy(latestVersion_, outputBuffer_, sizeof(latestVersion_));
+        strlcpy(etag_, respEtag_, sizeof(etag_));
+        strlcpy(lastModified_, respLastModified_, sizeof(lastModified_));
+    }
 
-    if (!strncmp(outputBuffer_, runningVersion_, std::size(outputBuffer_))) {
+    if (!strncmp(latestVersion_, runningVersion_, std::size(latestVersion_))) {
         msgCb_("");
-        ESP_LOGI(TAG, "already running version %s", outputBuffer_);
+        ESP_LOGI(TAG, "already running version %s", latestVersion_);
         return Error::NoUpdateAvailable;
     } else {
-        setErrMessageF("Downloading update %s", outputBuffer_);
-        ESP_LOGI(TAG, "new version `%s` found, upgrading from `%s`", outputBuffer_,
+        setErrMessageF("Downloading update %s", latestVersion_);
+        ESP_LOGI(TAG, "new version `%s` found, upgrading from `%s`", latestVersion_,
                  runningVersion_);
     }
 
-    // Update URL to point to the versioned firmware
-    snprintf(pathPart_, pathLen_ - 1, "%s.bin", outputBuffer_);
-    ESP_LOGD(TAG, "Downloading firmware from %s", url_);
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(OTA_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
+    if (!buf) {
+        setErrMessageF("Upgrade failed: no memory");
+        return Error::UpgradeFailed;
+    }
+    OtaPartitionSink partition;
+    NvsProgressStore store(partition.partition());
 
-    httpConfig.event_handler = NULL;
-    esp_https_ota_config_t otaConfig = {
-        .http_config = &httpConfig,
-    };
-    esp_err_t ret = esp_https_ota(&otaConfig);
-    if (ret == ESP_OK) {
+    // A full download already under way is cheaper to finish than a patch
+    OtaDownloader::Progress saved;
+    bool resuming = store.load(&saved) && saved.offset &&
+                    !strncmp(saved.version, latestVersion_, sizeof(saved.version));
+
+    OtaDownloader::Result result = OtaDownloader::Result::Failed;
+    int fetchStatus = 0;
+    if (!resuming) {
+        // The patch overwrites anything a full download left in the partition
+        store.clear();
+        RunningPartitionSource source;
+        Sha256Digest digest;
+        TinflInflater inflater;
+        DeltaPatcher patcher(source, digest, inflater, partition);
+        NoProgressStore noStore;
+        snprintf(pathPart_, pathLen_ - 1, "%s.from-%s.delta", latestVersion_, runningVersion_);
+        result = download(patcher, noStore, buf, &fetchStatus);
+        // Only a dropped connection is worth retrying, for a missing patch or
+        // other HTTP error the full image is fetched
+        if (result == OtaDownloader::Result::Interrupted && fetchStatus < 400) {
+            heap_caps_free(buf);
+            setErrMessageF("Update paused");
+            return Error::FetchError;
+        }
+        if (result != OtaDownloader::Result::Done) {
+            ESP_LOGW(TAG, "No usable delta from %s (%d), downloading full image",
+                     runningVersion_, fetchStatus);
+        }
+    }
+
+    if (result != OtaDownloader::Result::Done) {
+        snprintf(pathPart_, pathLen_ - 1, "%s.bin", latestVersion_);
+        result = download(partition, store, buf, &fetchStatus);
+    }
+    heap_caps_free(buf);
+
+    switch (result) {
+    case OtaDownloader::Result::Done:
         ESP_LOGI(TAG, "OTA Succeed, Rebooting...");
         esp_restart();
-    } else {
+        break;
+    case OtaDownloader::Result::Interrupted:
+        // Retried soon, carrying on from the saved progress
+        setErrMessageF("Update paused");
+        return Error::FetchError;
+    case OtaDownloader::Result::Failed:
         ESP_LOGE(TAG, "Firmware upgrade failed");
         setErrMessageF("Upgrade failed");
         return Error::UpgradeFailed;
@@ -97,6 +400,39 @@ AbstractOTAClient::Error ESPOTAClient::update() {
     return Error::OK;
 }
 
+OtaDownloader::Result ESPOTAClient::download(OtaDownloader::Sink &sink,
+                                             OtaDownloader::Store &store, uint8_t *buf,
+                                             int *status) {
+    ESP_LOGD(TAG, "Downloading firmware from %s", url_);
+    esp_http_client_handle_t client = httpClient();
+    esp_http_client_set_url(client, url_);
+    esp_http_client_delete_header(client, "If-None-Match");
+    esp_http_client_delete_header(client, "If-Modified-Since");
+    HttpRangeTransport transport(client, contentRange_);
+    OtaDownloader downloader(transport, sink, store, buf, OTA_CHUNK_SIZE, sleepMs, nowMs);
+    downloader.setRateLimit(rateLimit_);
+
+    if (wifi_) {
+        wifi_->holdFullPower(ESPWifi::HoldOTA, true);
+    }
+    uint64_t startMs = nowMs();
+    OtaDownloader::Result result = downloader.download(latestVersion_);
+    if (wifi_) {
+        wifi_->holdFullPower(ESPWifi::HoldOTA, false);
+    }
+    // The next check starts on a clean connection rather than one left part
+    // way through a streamed response
+    esp_http_client_delete_header(client, "Range");
+    esp_http_client_close(client);
+
+    *status = transport.status();
+    if (result == OtaDownloader::Result::Done) {
+        ESP_LOGI(TAG, "Downloaded %lu bytes in %llu ms", (unsigned long)downloader.progress().total,
+                 nowMs() - startMs);
+    }
+    return result;
+}
+
 void ESPOTAClient::markValid() { esp_ota_mark_app_valid_cancel_rollback(); }
 
 const char *ESPOTAClient::currentVersion() { return esp_app_get_description()->version; }
@@ -110,15 +446,28 @@ esp_err_t ESPOTAClient::_handleHTTPEvent(esp_http_client_event_t *evt) {
         return ESP_FAIL;
     case HTTP_EVENT_ON_CONNECTED:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+        handshakeMetric.inc();
+        connected_ = true;
         break;
     case HTTP_EVENT_HEADER_SENT:
         ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
         break;
     case HTTP_EVENT_ON_HEADER:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+        if (!strcasecmp(evt->header_key, "ETag")) {
+            strlcpy(respEtag_, evt->header_value, sizeof(respEtag_));
+        } else if (!strcasecmp(evt->header_key, "Last-Modified")) {
+            strlcpy(respLastModified_, evt->header_value, sizeof(respLastModified_));
+        } else if (!strcasecmp(evt->header_key, "Content-Range")) {
+            strlcpy(contentRange_, evt->header_value, sizeof(contentRange_));
+        }
         break;
     case HTTP_EVENT_ON_DATA:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+        if (!collecting_) {
+            // Firmware data, read by HttpRangeTransport
+            break;
+        }
         /*
          *  Check for chunked encoding is added as the URL for chunked encoding
          * used in this example returns binary data. However, event handler can
@@ -145,6 +494,7 @@ esp_err_t ESPOTAClient::_handleHTTPEvent(esp_http_client_event_t *evt) {
     }
     case HTTP_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+        connected_ = false;
         break;
     case HTTP_EVENT_REDIRECT:
         ESP_LOGE(TAG, "HTTP_EVENT_REDIRECT");
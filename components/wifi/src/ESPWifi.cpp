@@ -9,8 +9,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "nvs.h"
 #include "time.h"
 
+#include "Metrics.h"
 #include "remote_logger.h"
 
 #define MAX_RETRIES 5
@@ -20,9 +22,20 @@
 #define WIFI_ACTIVE_BIT BIT0
 #define WIFI_CONNECTED_BIT BIT1
 #define WIFI_FAIL_BIT BIT2
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_AP_KEY "ap"
 
 const static char *TAG = "wifi";
 
+static MetricGauge connectMetric("wifi_connect_seconds",
+                                 "Time from starting to connect to getting an IP, last connection");
+static MetricCounter cachedConnectMetric("wifi_cached_ap_connects_total",
+                                         "Connections made to the cached AP without a scan");
+static MetricGauge psMetric("wifi_power_save",
+                            "Wi-Fi power save in use: 0 none, 1 min modem, 2 max modem");
+static MetricCounter scanFallbackMetric("wifi_scan_fallbacks_total",
+                                        "Connections to the cached AP that failed, so it scanned");
+
 void eventHandler(void *arg, esp_event_base_t eventBase, int32_t eventId, void *eventData) {
     if (eventBase == WIFI_EVENT) {
         ((ESPWifi *)arg)->onWifiEvent(eventId, eventData);
@@ -41,11 +54,33 @@ void ESPWifi::connect(const char *ssid, const char *password) {
 
     config_.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
     config_.sta.pmf_cfg = {.capable = true, .required = false};
+    config_.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+
+    usingAPCache_ = apCacheValid_ && strncmp(apCache_.ssid, ssid, sizeof(apCache_.ssid)) == 0;
+    useAPCache(usingAPCache_);
+    connectStartUs_ = esp_timer_get_time();
+
+    uint32_t beacons = latencyBudgetMs_ / WIFI_BEACON_INTERVAL_MS;
+    if (latencyBudgetMs_ == 0) {
+        idlePS_ = WIFI_PS_NONE;
+        config_.sta.listen_interval = 0;
+    } else if (beacons >= WIFI_PS_MAX_MODEM_MIN_BEACONS) {
+        idlePS_ = WIFI_PS_MAX_MODEM;
+        config_.sta.listen_interval = beacons;
+    } else {
+        idlePS_ = WIFI_PS_MIN_MODEM;
+        config_.sta.listen_interval = 0;
+    }
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &config_));
     ESP_ERROR_CHECK(esp_wifi_start());
 
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    started_ = true;
+    applyPowerSave();
+    xSemaphoreGive(mutex_);
+
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 }
 
@@ -71,6 +106,63 @@ void ESPWifi::init(const char *name) {
         .name = "wifiRetry",
     };
     ESP_ERROR_CHECK(esp_timer_create(&retryTimerArgs, &retryTimer_));
+
+    loadAPCache();
+}
+
+void ESPWifi::loadAPCache() {
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(apCache_);
+    apCacheValid_ = nvs_get_blob(handle, WIFI_NVS_AP_KEY, &apCache_, &len) == ESP_OK &&
+                    len == sizeof(apCache_) && apCache_.channel != 0;
+    nvs_close(handle);
+
+    if (apCacheValid_) {
+        ESP_LOGI(TAG, "cached AP %02x:%02x:%02x:%02x:%02x:%02x ch=%d", apCache_.bssid[0],
+                 apCache_.bssid[1], apCache_.bssid[2], apCache_.bssid[3], apCache_.bssid[4],
+                 apCache_.bssid[5], apCache_.channel);
+    }
+}
+
+void ESPWifi::saveAPCache() {
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+
+    APCache cache = {};
+    strncpy(cache.ssid, (const char *)config_.sta.ssid, sizeof(cache.ssid) - 1);
+    memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+    cache.channel = ap.primary;
+    // Only written when it changes to spare the flash
+    if (apCacheValid_ && memcmp(&cache, &apCache_, sizeof(cache)) == 0) {
+        return;
+    }
+    apCache_ = cache;
+    apCacheValid_ = true;
+
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    nvs_set_blob(handle, WIFI_NVS_AP_KEY, &apCache_, sizeof(apCache_));
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+void ESPWifi::useAPCache(bool use) {
+    config_.sta.bssid_set = use;
+    if (use) {
+        memcpy(config_.sta.bssid, apCache_.bssid, sizeof(config_.sta.bssid));
+        config_.sta.channel = apCache_.channel;
+        config_.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        config_.sta.channel = 0;
+        config_.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
 }
 
 void ESPWifi::disconnect() {
@@ -79,9 +171,41 @@ void ESPWifi::disconnect() {
     }
     ESP_ERROR_CHECK(esp_wifi_stop());
 
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    started_ = false;
+    xSemaphoreGive(mutex_);
     setState(State::Inactive, "");
 }
 
+void ESPWifi::holdFullPower(FullPowerHold hold, bool held) {
+    if (((fullPowerHolds_ & hold) != 0) == held) {
+        return;
+    }
+
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint8_t before = held ? fullPowerHolds_.fetch_or(hold) : fullPowerHolds_.fetch_and(~hold);
+    uint8_t after = fullPowerHolds_;
+    // Only the first hold and the last release change anything
+    if ((before == 0) != (after == 0)) {
+        applyPowerSave();
+    }
+    xSemaphoreGive(mutex_);
+}
+
+void ESPWifi::applyPowerSave() {
+    if (!started_) {
+        return;
+    }
+    wifi_ps_type_t ps = fullPowerHolds_ ? WIFI_PS_NONE : idlePS_;
+    esp_err_t err = esp_wifi_set_ps(ps);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to set power save %d: %s", ps, esp_err_to_name(err));
+        return;
+    }
+    psMetric.set(ps);
+    ESP_LOGD(TAG, "power save %d (holds=%x)", ps, fullPowerHolds_.load());
+}
+
 void ESPWifi::reconnect() {
     ESP_LOGW(TAG, "forcing reconnect");
     esp_wifi_disconnect();
@@ -137,6 +261,25 @@ void ESPWifi::onWifiEvent(int32_t eventId, void *eventData) {
         remote_logger_set_connected(false);
         disconnectCount_++;
         lastDisconnectReason_ = reason;
+
+        bool changed = false;
+        if (connectStartUs_ == 0) {
+            // Lost a working connection, try going straight back to that AP
+            connectStartUs_ = esp_timer_get_time();
+            changed = usingAPCache_ != apCacheValid_;
+            usingAPCache_ = apCacheValid_;
+        } else if (usingAPCache_) {
+            // It may have moved channel or be gone, so find the SSID's best AP
+            ESP_LOGW(TAG, "cached AP failed (%d), scanning", reason);
+            scanFallbackMetric.inc();
+            usingAPCache_ = false;
+            changed = true;
+        }
+        if (changed) {
+            useAPCache(usingAPCache_);
+            esp_wifi_set_config(WIFI_IF_STA, &config_);
+        }
+
         if (retryNum_ < MAX_RETRIES) {
             retryNum_++;
             doRetry(reason);
@@ -156,6 +299,18 @@ void ESPWifi::onIPEvent(int32_t eventId, void *eventData) {
         retryNum_ = 0;
         remote_logger_set_connected(true);
 
+        if (connectStartUs_ != 0) {
+            int64_t connectUs = esp_timer_get_time() - connectStartUs_;
+            connectMetric.set(connectUs / 1e6f);
+            if (usingAPCache_) {
+                cachedConnectMetric.inc();
+            }
+            ESP_LOGI(TAG, "connected in %lldms (%s)", connectUs / 1000,
+                     usingAPCache_ ? "cached AP" : "scan");
+            connectStartUs_ = 0;
+        }
+        saveAPCache();
+
         // Restart SNTP every time we reconnect to reset the polling timeout
         esp_netif_sntp_deinit();
         esp_sntp_config_t sntpConfig = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
@@ -0,0 +1,96 @@
+#include "HttpRangeTransport.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "OTA";
+
+esp_err_t HttpRangeTransport::fetch(uint32_t offset, uint32_t len, uint8_t *buf, uint32_t *got,
+                                    uint32_t *total) {
+    *got = 0;
+    if (streaming_ && offset != streamPos_) {
+        close(ESP_OK);
+    }
+
+    uint32_t want = len;
+    if (streaming_) {
+        *total = streamTotal_;
+        want = std::min(len, streamTotal_ - offset);
+    } else {
+        esp_err_t err = request(offset, len, &want, total);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    while (*got < want) {
+        int n = esp_http_client_read(client_, (char *)buf + *got, want - *got);
+        if (n <= 0) {
+            // Dropped or timed out, keeping what arrived
+            return close(ESP_FAIL);
+        }
+        *got += n;
+    }
+
+    if (streaming_) {
+        streamPos_ += *got;
+        if (streamPos_ >= streamTotal_) {
+            close(ESP_OK);
+        }
+    } else if (!esp_http_client_is_complete_data_received(client_)) {
+        close(ESP_OK);
+    }
+    return ESP_OK;
+}
+
+esp_err_t HttpRangeTransport::request(uint32_t offset, uint32_t len, uint32_t *want,
+                                      uint32_t *total) {
+    contentRange_[0] = '\0';
+
+    char range[48];
+    snprintf(range, sizeof(range), "bytes=%lu-%lu", (unsigned long)offset,
+             (unsigned long)(offset + len - 1));
+    esp_http_client_set_header(client_, "Range", range);
+
+    esp_err_t err = esp_http_client_open(client_, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    int64_t contentLen = esp_http_client_fetch_headers(client_);
+    status_ = esp_http_client_get_status_code(client_);
+
+    if (status_ == 206) {
+        uint32_t first;
+        if (!OtaDownloader::parseContentRange(contentRange_, &first, total) ||
+            first != offset) {
+            ESP_LOGE(TAG, "Bad Content-Range for %s: %s", range, contentRange_);
+            return close(ESP_ERR_INVALID_RESPONSE);
+        }
+        if (contentLen >= 0) {
+            *want = std::min(*want, (uint32_t)contentLen);
+        }
+        return ESP_OK;
+    }
+
+    if (status_ == 200 && contentLen > 0) {
+        ESP_LOGW(TAG, "Server ignored Range, reading the whole image");
+        streaming_ = true;
+        streamPos_ = 0;
+        streamTotal_ = *total = contentLen;
+        *want = std::min(len, streamTotal_);
+        // Rather than skipping to offset, which wouldn't count towards the
+        // rate limit, the download starts over on this response
+        return offset ? ESP_ERR_NOT_SUPPORTED : ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "Firmware fetch failed: %d", status_);
+    return close(ESP_ERR_INVALID_RESPONSE);
+}
+
+esp_err_t HttpRangeTransport::close(esp_err_t err) {
+    streaming_ = false;
+    esp_http_client_close(client_);
+    return err;
+}
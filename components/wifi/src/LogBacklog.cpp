@@ -0,0 +1,268 @@
+#include "LogBacklog.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#define RECORD_MAGIC 0xb1
+#define FLAG_WALL_TIME 0x01
+#define MS_PER_HOUR (60 * 60 * 1000)
+
+static const char *TAG = "BACKLOG";
+
+LogBacklog::LogBacklog(const char *dir, uint8_t *buf, size_t bufSize, nowMsFn_t nowMsFn,
+                       Budget *budget, uint32_t segmentBytes, uint32_t maxSegments,
+                       uint32_t writeBytesPerHour, uint32_t blockBytes)
+    : buf_(buf), bufSize_(bufSize), nowMsFn_(nowMsFn), segmentBytes_(segmentBytes),
+      maxSegments_(maxSegments), writeBytesPerHour_(writeBytesPerHour), blockBytes_(blockBytes),
+      budget_(budget), budgetAtMs_(nowMsFn()) {
+    strncpy(dir_, dir, sizeof(dir_) - 1);
+    dir_[sizeof(dir_) - 1] = '\0';
+    if (budget_->magic != LOG_BACKLOG_BUDGET_MAGIC || budget_->bytes > writeBytesPerHour_) {
+        budget_->magic = LOG_BACKLOG_BUDGET_MAGIC;
+        budget_->bytes = std::min(2 * blockBytes_, writeBytesPerHour_);
+    }
+}
+
+LogBacklog::~LogBacklog() {
+    flush();
+    closeWrite();
+    if (readFile_) {
+        fclose(readFile_);
+    }
+}
+
+void LogBacklog::path(uint32_t seq, char *buf, size_t size) const {
+    snprintf(buf, size, "%s/%08lu.log", dir_, (unsigned long)seq);
+}
+
+esp_err_t LogBacklog::open() {
+    DIR *dir = opendir(dir_);
+    if (!dir) {
+        ESP_LOGE(TAG, "Unable to open %s", dir_);
+        return ESP_FAIL;
+    }
+
+    uint32_t first = UINT32_MAX, last = 0;
+    while (struct dirent *entry = readdir(dir)) {
+        unsigned long seq;
+        char ext[8];
+        if (sscanf(entry->d_name, "%lu.%7s", &seq, ext) == 2 && !strcmp(ext, "log") && seq) {
+            first = std::min(first, (uint32_t)seq);
+            last = std::max(last, (uint32_t)seq);
+        }
+    }
+    closedir(dir);
+
+    if (last) {
+        readSeq_ = first;
+        lastSeq_ = last;
+        ESP_LOGI(TAG, "%lu segments to send", (unsigned long)(last - first + 1));
+    }
+    return ESP_OK;
+}
+
+bool LogBacklog::append(const Record &record, const char *msg, size_t len, bool urgent) {
+    len = std::min(len, bufSize_ - sizeof(Header));
+    size_t size = sizeof(Header) + len;
+
+    if (bufUsed_ + size > bufSize_ && bufRead_) {
+        memmove(buf_, buf_ + bufRead_, bufUsed_ - bufRead_);
+        bufUsed_ -= bufRead_;
+        bufRead_ = 0;
+    }
+    if (bufUsed_ + size > bufSize_ && !flush()) {
+        stats_.dropped++;
+        return false;
+    }
+    if (bufUsed_ == 0) {
+        bufferedAtMs_ = nowMsFn_();
+    }
+    urgent_ |= urgent;
+
+    Header header = {RECORD_MAGIC, (uint8_t)(record.wallTime ? FLAG_WALL_TIME : 0),
+                     (uint16_t)len, record.boot, record.timeUs};
+    memcpy(buf_ + bufUsed_, &header, sizeof(header));
+    memcpy(buf_ + bufUsed_ + sizeof(header), msg, len);
+    bufUsed_ += size;
+    stats_.appended++;
+    return true;
+}
+
+void LogBacklog::poll() {
+    uint64_t nowMs = nowMsFn_();
+    bool due = nowMs - bufferedAtMs_ >= LOG_BACKLOG_FLUSH_MS;
+    // A burst of errors is still written together
+    due |= urgent_ && (!flushed_ || nowMs - flushedAtMs_ >= LOG_BACKLOG_URGENT_FLUSH_MS);
+    if (bufUsed_ && due) {
+        flush();
+    }
+}
+
+void LogBacklog::refill(uint64_t nowMs) {
+    uint64_t gained = (nowMs - budgetAtMs_) * writeBytesPerHour_ / MS_PER_HOUR;
+    if (budget_->bytes + gained >= writeBytesPerHour_) {
+        budget_->bytes = writeBytesPerHour_;
+        budgetAtMs_ = nowMs;
+        return;
+    }
+    // Keeping the time the fraction of a byte not yet gained took
+    budget_->bytes += gained;
+    budgetAtMs_ += gained * MS_PER_HOUR / writeBytesPerHour_;
+}
+
+bool LogBacklog::flush() {
+    size_t pending = bufUsed_ - bufRead_;
+    if (pending == 0) {
+        bufUsed_ = bufRead_ = 0;
+        return true;
+    }
+
+    uint64_t nowMs = nowMsFn_();
+    refill(nowMs);
+    uint32_t cost = ((pending + blockBytes_ - 1) / blockBytes_ + 1) * blockBytes_;
+    if (budget_->bytes < cost) {
+        return false;
+    }
+    budget_->bytes -= cost;
+    flushed_ = true;
+    flushedAtMs_ = nowMs;
+    urgent_ = false;
+
+    if (!readFile_) {
+        // Whatever was peeked from the buffer is written again
+        peeked_ = 0;
+    }
+    if (writeFile_ && writeSize_ + pending > segmentBytes_) {
+        closeWrite();
+    }
+    if (!writeFile_) {
+        lastSeq_++;
+        while (lastSeq_ - readSeq_ + 1 > maxSegments_) {
+            ESP_LOGW(TAG, "Backlog full, dropping segment %lu", (unsigned long)readSeq_);
+            stats_.segmentsDropped++;
+            deleteOldest();
+        }
+        char name[48];
+        path(lastSeq_, name, sizeof(name));
+        writeFile_ = fopen(name, "ab");
+        writeSize_ = 0;
+        if (!writeFile_) {
+            ESP_LOGE(TAG, "Unable to create %s", name);
+            lastSeq_--;
+            bufUsed_ = bufRead_ = 0;
+            return true;
+        }
+    }
+
+    size_t written = fwrite(buf_ + bufRead_, 1, pending, writeFile_);
+    fflush(writeFile_);
+    fsync(fileno(writeFile_));
+    if (written != pending) {
+        ESP_LOGE(TAG, "Wrote %u of %u bytes", (unsigned)written, (unsigned)pending);
+    }
+    writeSize_ += written;
+    stats_.bytesWritten += written;
+    bufUsed_ = bufRead_ = 0;
+    return true;
+}
+
+void LogBacklog::closeWrite() {
+    if (writeFile_) {
+        fclose(writeFile_);
+        writeFile_ = nullptr;
+    }
+}
+
+void LogBacklog::deleteOldest() {
+    if (readFile_) {
+        fclose(readFile_);
+        readFile_ = nullptr;
+    }
+    char name[48];
+    path(readSeq_, name, sizeof(name));
+    unlink(name);
+    readSeq_++;
+    peeked_ = 0;
+}
+
+bool LogBacklog::peek(Record *record, char *msg, size_t size, size_t *len) {
+    while (true) {
+        if (!readFile_) {
+            if (readSeq_ == lastSeq_ && writeFile_) {
+                // Only read the segment being written once it's closed
+                closeWrite();
+            }
+            if (readSeq_ > lastSeq_) {
+                return peekBuffer(record, msg, size, len);
+            }
+            char name[48];
+            path(readSeq_, name, sizeof(name));
+            readFile_ = fopen(name, "rb");
+            readPos_ = 0;
+            if (!readFile_) {
+                readSeq_++;
+                continue;
+            }
+        }
+
+        Header header;
+        fseek(readFile_, readPos_, SEEK_SET);
+        size_t got = fread(&header, 1, sizeof(header), readFile_);
+        bool ended = got == 0 && feof(readFile_);
+        if (got == sizeof(header) && header.magic == RECORD_MAGIC) {
+            size_t keep = std::min((size_t)header.len, size);
+            if (fread(msg, 1, keep, readFile_) == keep &&
+                fseek(readFile_, header.len - keep, SEEK_CUR) == 0) {
+                *record = {header.timeUs, header.boot, (header.flags & FLAG_WALL_TIME) != 0};
+                *len = keep;
+                peeked_ = sizeof(header) + header.len;
+                return true;
+            }
+        }
+
+        if (!ended) {
+            // A write cut short by a restart, or worse
+            ESP_LOGW(TAG, "Discarding the rest of segment %lu", (unsigned long)readSeq_);
+            stats_.segmentsDropped++;
+        }
+        deleteOldest();
+    }
+}
+
+bool LogBacklog::peekBuffer(Record *record, char *msg, size_t size, size_t *len) {
+    if (bufRead_ == bufUsed_) {
+        return false;
+    }
+    Header header;
+    memcpy(&header, buf_ + bufRead_, sizeof(header));
+    size_t keep = std::min((size_t)header.len, size);
+    memcpy(msg, buf_ + bufRead_ + sizeof(header), keep);
+    *record = {header.timeUs, header.boot, (header.flags & FLAG_WALL_TIME) != 0};
+    *len = keep;
+    peeked_ = sizeof(header) + header.len;
+    return true;
+}
+
+void LogBacklog::pop() {
+    if (!peeked_) {
+        return;
+    }
+    if (readFile_) {
+        readPos_ += peeked_;
+    } else {
+        bufRead_ += peeked_;
+        if (bufRead_ == bufUsed_) {
+            bufRead_ = bufUsed_ = 0;
+        }
+    }
+    peeked_ = 0;
+    stats_.read++;
+}
+
+bool LogBacklog::empty() const {
+    return !readFile_ && readSeq_ > lastSeq_ && bufRead_ == bufUsed_;
+}
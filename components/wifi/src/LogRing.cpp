@@ -0,0 +1,64 @@
+#include "LogRing.h"
+
+#include <assert.h>
+#include <new>
+
+void LogRing::init(void *storage, size_t slots, size_t slotSize) {
+    assert(slots && (slots & (slots - 1)) == 0);
+    slots_ = new (storage) Slot[slots];
+    data_ = (char *)(slots_ + slots);
+    mask_ = slots - 1;
+    slotSize_ = slotSize;
+    head_ = tail_ = 0;
+}
+
+char *LogRing::reserve(uint64_t timeUs, bool *wasEmpty) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail > mask_) {
+        return nullptr;
+    }
+    Slot &slot = slots_[head & mask_];
+    slot.timeUs = timeUs;
+    slot.ready.store(false, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+    *wasEmpty = head == tail;
+    return data_ + (head & mask_) * slotSize_;
+}
+
+void LogRing::commit(char *buf, size_t len) {
+    Slot &slot = slots_[(buf - data_) / slotSize_];
+    slot.len = len;
+    slot.ready.store(true, std::memory_order_release);
+}
+
+bool LogRing::peek(Entry *entry) const {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    const Slot &slot = slots_[tail & mask_];
+    if (!slot.ready.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *entry = Entry{slot.timeUs, data_ + (tail & mask_) * slotSize_, slot.len};
+    return true;
+}
+
+void LogRing::pop() {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    slots_[tail & mask_].ready.store(false, std::memory_order_relaxed);
+    tail_.store(tail + 1, std::memory_order_release);
+}
+
+LogRing *LogRing::oldest(LogRing *rings, size_t n, Entry *entry) {
+    LogRing *best = nullptr;
+    for (size_t i = 0; i < n; i++) {
+        Entry e;
+        if (rings[i].peek(&e) && (!best || e.timeUs < entry->timeUs)) {
+            best = &rings[i];
+            *entry = e;
+        }
+    }
+    return best;
+}
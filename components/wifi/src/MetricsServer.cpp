@@ -0,0 +1,96 @@
+#include "MetricsServer.h"
+
+#include "Metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "METRICS";
+
+static MetricGaugeFn heapFreeInternal(
+    "esp_heap_free_bytes", "Free heap",
+    [] { return (float)heap_caps_get_free_size(MALLOC_CAP_INTERNAL); }, "caps=\"internal\"");
+static MetricGaugeFn heapFreeSpiram(
+    "esp_heap_free_bytes", "Free heap",
+    [] { return (float)heap_caps_get_free_size(MALLOC_CAP_SPIRAM); }, "caps=\"spiram\"");
+static MetricGaugeFn heapMinFreeInternal(
+    "esp_heap_min_free_bytes", "Lowest free heap since boot",
+    [] { return (float)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL); },
+    "caps=\"internal\"");
+static MetricGaugeFn heapLargestInternal(
+    "esp_heap_largest_free_block_bytes", "Largest free heap block",
+    [] { return (float)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL); },
+    "caps=\"internal\"");
+static MetricGaugeFn uptime("esp_uptime_seconds", "Time since boot",
+                            [] { return esp_timer_get_time() / 1e6f; });
+static MetricCounter scrapes("metrics_scrapes_total", "Requests for the metrics");
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+    return ((MetricsServer *)req->user_ctx)->_handleMetrics(req);
+}
+
+esp_err_t MetricsServer::start(uint16_t port) {
+    if (server_) {
+        return ESP_OK;
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.max_uri_handlers = 1;
+    config.lru_purge_enable = true;
+
+    esp_err_t err = httpd_start(&server_, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start server: %s", esp_err_to_name(err));
+        server_ = nullptr;
+        return err;
+    }
+
+    const httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+        .user_ctx = this,
+    };
+    err = httpd_register_uri_handler(server_, &uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register handler: %s", esp_err_to_name(err));
+        stop();
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Serving metrics on port %u", port);
+    return ESP_OK;
+}
+
+void MetricsServer::stop() {
+    if (server_) {
+        httpd_stop(server_);
+        server_ = nullptr;
+    }
+}
+
+esp_err_t MetricsServer::_handleMetrics(httpd_req_t *req) {
+    scrapes.inc();
+
+    // Only needed for the request, so render into PSRAM
+    size_t size = Metric::render(nullptr, 0) + METRICS_RENDER_SLACK;
+    char *buf = (char *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!buf) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    size_t len = Metric::render(buf, size);
+    esp_err_t err;
+    if (len < size) {
+        httpd_resp_set_type(req, "text/plain; version=0.0.4");
+        err = httpd_resp_send(req, buf, len);
+    } else {
+        ESP_LOGE(TAG, "Metrics grew past %zu bytes while rendering", size);
+        err = httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Metrics too long");
+    }
+
+    heap_caps_free(buf);
+    return err;
+}
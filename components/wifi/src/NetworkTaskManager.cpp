@@ -1,15 +1,22 @@
 #include "NetworkTaskManager.h"
 
+#include <algorithm>
+#include <cstdio>
+
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "AbstractWifi.h"
+#include "Metrics.h"
 
 #define WIFI_POLL_INTERVAL_TICKS pdMS_TO_TICKS(1000)
 #define WIFI_RETRY_INTERVAL_TICKS pdMS_TO_TICKS(60 * 1000)
+// Idle workers wake at least this often to run the watchdog
+#define NET_TASK_MAX_WAIT_MS (10 * 1000)
 
 // Connectivity watchdog thresholds. Comfortably above the OTA poll interval
 // (60s healthy / 30s on error) so normal gaps between successes never trip it.
@@ -18,15 +25,58 @@
 
 static const char *TAG = "NTM";
 
-static void netTaskFn(void *netTaskMgr) {
-    while (1) {
-        ((NetworkTaskManager *)netTaskMgr)->poll();
+NetworkTaskManager *NetworkTaskManager::active_ = nullptr;
+
+namespace {
+// One sample per task of the active manager
+class TaskMetric : public Metric {
+  public:
+    typedef float (*valueFn_t)(const NetworkTaskManager::TaskStats &stats);
+
+    TaskMetric(const char *name, const char *help, Type type, valueFn_t fn)
+        : Metric(name, help, nullptr, type), fn_(fn) {}
+
+  protected:
+    void writeSamples(Writer &w) const override {
+        NetworkTaskManager *mgr = NetworkTaskManager::active();
+        if (!mgr) {
+            return;
+        }
+        char label[48];
+        for (size_t i = 0; i < mgr->numTasks(); i++) {
+            NetworkTaskManager::TaskStats stats = mgr->stats(i);
+            snprintf(label, sizeof(label), "task=\"%s\"", stats.name);
+            w.sample(*this, "", label, fn_(stats));
+        }
     }
+
+  private:
+    valueFn_t fn_;
+};
+} // namespace
+
+static TaskMetric runsMetric("net_task_runs_total", "Network task runs", Metric::Type::Counter,
+                             [](const NetworkTaskManager::TaskStats &s) { return (float)s.runs; });
+static TaskMetric runTimeMetric(
+    "net_task_run_seconds", "How long a network task's last run took", Metric::Type::Gauge,
+    [](const NetworkTaskManager::TaskStats &s) { return s.lastRunMs / 1e3f; });
+static TaskMetric lateMetric("net_task_lateness_seconds",
+                             "How long after it was due a network task last started",
+                             Metric::Type::Gauge, [](const NetworkTaskManager::TaskStats &s) {
+                                 return s.lastLateMs / 1e3f;
+                             });
+
+struct WorkerArg {
+    NetworkTaskManager *mgr;
+    size_t worker;
+};
+
+static void netTaskFn(void *arg) {
+    WorkerArg *worker = (WorkerArg *)arg;
+    worker->mgr->_work(worker->worker);
 }
 
-void NetworkTaskManager::poll() {
-    // Ensure we have a connection before executing any tasks. Reconnect if
-    // needed.
+void NetworkTaskManager::waitForWifi(bool retry) {
     AbstractWifi::State wifi_state;
     while ((wifi_state = wifi_.getState()) != AbstractWifi::State::Connected) {
         ESP_LOGD(TAG, "wifi: %d", static_cast<int>(wifi_state));
@@ -40,38 +90,74 @@ void NetworkTaskManager::poll() {
         case AbstractWifi::State::Connected:
             __builtin_unreachable();
         case AbstractWifi::State::Err:
+            if (!retry) {
+                vTaskDelay(WIFI_POLL_INTERVAL_TICKS);
+                break;
+            }
             vTaskDelay(WIFI_RETRY_INTERVAL_TICKS);
             ESP_LOGI(TAG, "retrying wifi connection");
             wifi_.retry();
             break;
         }
     }
+}
 
-    // Wait until a task is due
-    uint64_t next_due_ms = UINT64_MAX;
-    for (Task &task : tasks_) {
-        next_due_ms = std::min(next_due_ms, task.dueMs);
-    }
-    int64_t wait_ms = next_due_ms - esp_timer_get_time() / 1000;
-    ESP_LOGD(TAG, "wait: %lld", wait_ms);
-    if (wait_ms > 0) {
-        vTaskDelay(pdMS_TO_TICKS(wait_ms) + 1);
-    }
+void NetworkTaskManager::_work(size_t worker) {
+    while (1) {
+        // Ensure we have a connection before executing any tasks. Reconnect if
+        // needed.
+        waitForWifi(worker == 0);
 
-    // Execute any due tasks and update their next due times
-    uint64_t now_ms = esp_timer_get_time() / 1000;
-    for (Task &task : tasks_) {
-        if (task.dueMs <= now_ms) {
-            TaskResult result = task.fn(task.ctx);
-            task.dueMs = now_ms + result.delayMs;
-            if (result.networkSucceeded) {
-                lastNetSuccessMs_ = now_ms;
-                forcedReconnect_ = false;
-            }
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        uint64_t now_ms = esp_timer_get_time() / 1000;
+        int task = queue_.claim(now_ms);
+        uint64_t due_ms = task == NetJobQueue::NONE ? queue_.nextDueMs() : queue_.dueMs(task);
+        xSemaphoreGive(mutex_);
+
+        if (task == NetJobQueue::NONE) {
+            // Wait until a task is due, or another worker reschedules one
+            uint64_t wait_ms = std::min<uint64_t>(due_ms - now_ms, NET_TASK_MAX_WAIT_MS);
+            ESP_LOGD(TAG, "worker %u wait: %llu", worker, wait_ms);
+            xSemaphoreTake(wake_, pdMS_TO_TICKS(wait_ms) + 1);
+            checkConnectivityWatchdog(esp_timer_get_time() / 1000);
+            continue;
         }
+
+        Task &t = tasks_[task];
+        TaskResult result = t.fn(t.ctx);
+        uint64_t end_ms = esp_timer_get_time() / 1000;
+
+        uint64_t jitter_ms = result.delayMs * NET_TASK_JITTER_PCT / 100;
+        if (jitter_ms) {
+            jitter_ms = esp_random() % (jitter_ms + 1);
+        }
+
+        xSemaphoreTake(mutex_, portMAX_DELAY);
+        queue_.finish(task, end_ms + result.delayMs + jitter_ms);
+        t.stats.runs++;
+        t.stats.lastRunMs = end_ms - now_ms;
+        // Tasks are first due at 0, i.e. as soon as there's a connection
+        t.stats.lastLateMs = due_ms ? now_ms - due_ms : 0;
+        if (result.networkSucceeded) {
+            lastNetSuccessMs_ = end_ms;
+            forcedReconnect_ = false;
+        }
+        xSemaphoreGive(mutex_);
+
+        // The task may now be due before whatever the others are waiting for
+        for (size_t i = 0; i < NET_TASK_WORKERS; i++) {
+            xSemaphoreGive(wake_);
+        }
+
+        checkConnectivityWatchdog(end_ms);
     }
+}
 
-    checkConnectivityWatchdog(now_ms);
+NetworkTaskManager::TaskStats NetworkTaskManager::stats(size_t i) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    TaskStats stats = tasks_[i].stats;
+    xSemaphoreGive(mutex_);
+    return stats;
 }
 
 void NetworkTaskManager::checkConnectivityWatchdog(uint64_t now_ms) {
@@ -81,28 +167,50 @@ void NetworkTaskManager::checkConnectivityWatchdog(uint64_t now_ms) {
         return;
     }
 
+    xSemaphoreTake(mutex_, portMAX_DELAY);
     // Start the clock on the first connected poll so a freshly-booted or
     // freshly-reconnected device gets a full window for its first success.
     if (lastNetSuccessMs_ == 0) {
         lastNetSuccessMs_ = now_ms;
-        return;
     }
+    // Another worker may have recorded a success after now_ms was read
+    uint64_t staleMs = now_ms > lastNetSuccessMs_ ? now_ms - lastNetSuccessMs_ : 0;
+    bool reconnect = staleMs >= WIFI_WATCHDOG_RECONNECT_MS && !forcedReconnect_;
+    if (reconnect) {
+        forcedReconnect_ = true;
+    }
+    xSemaphoreGive(mutex_);
 
-    uint64_t staleMs = now_ms - lastNetSuccessMs_;
     if (staleMs >= WIFI_WATCHDOG_RESTART_MS) {
         ESP_LOGE(TAG, "no network success for %llums while connected; restarting", staleMs);
         esp_restart();
-    } else if (staleMs >= WIFI_WATCHDOG_RECONNECT_MS && !forcedReconnect_) {
+    } else if (reconnect) {
         ESP_LOGW(TAG, "no network success for %llums while connected; forcing reconnect", staleMs);
-        forcedReconnect_ = true;
         wifi_.reconnect();
     }
 }
 
 void NetworkTaskManager::start(uint32_t stackDepth, uint priority) {
-    xTaskCreate(netTaskFn, "netTask", stackDepth, this, priority, NULL);
+    mutex_ = xSemaphoreCreateMutex();
+    wake_ = xSemaphoreCreateCounting(NET_TASK_WORKERS, 0);
+    assert(mutex_ && wake_);
+    active_ = this;
+
+    static WorkerArg args[NET_TASK_WORKERS];
+    char name[configMAX_TASK_NAME_LEN];
+    for (size_t i = 0; i < NET_TASK_WORKERS; i++) {
+        args[i] = WorkerArg{this, i};
+        // The first keeps the original name so existing dashboards still match
+        if (i == 0) {
+            snprintf(name, sizeof(name), "netTask");
+        } else {
+            snprintf(name, sizeof(name), "netTask%u", i);
+        }
+        xTaskCreate(netTaskFn, name, stackDepth, &args[i], priority, NULL);
+    }
 }
 
-void NetworkTaskManager::addTask(taskFn_t taskFn, void *ctx) {
-    tasks_.push_back(Task{fn : taskFn, dueMs : 0, ctx : ctx});
+void NetworkTaskManager::addTask(taskFn_t taskFn, void *ctx, const char *name, TaskClass cls) {
+    queue_.add(cls);
+    tasks_.push_back(Task{taskFn, ctx, TaskStats{name, 0, 0, 0}});
 }
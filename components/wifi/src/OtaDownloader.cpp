@@ -0,0 +1,131 @@
+#include "OtaDownloader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_log.h"
+
+static const char *TAG = "OTA";
+
+bool OtaDownloader::parseContentRange(const char *header, uint32_t *first, uint32_t *total) {
+    unsigned long f, l, t;
+    if (!header || sscanf(header, "bytes %lu-%lu/%lu", &f, &l, &t) != 3 || f > l || l >= t) {
+        return false;
+    }
+    *first = f;
+    *total = t;
+    return true;
+}
+
+OtaDownloader::Result OtaDownloader::fail() {
+    sink_.abort();
+    store_.clear();
+    progress_ = {};
+    return Result::Failed;
+}
+
+OtaDownloader::Result OtaDownloader::download(const char *version) {
+    if (!store_.load(&progress_) ||
+        strncmp(progress_.version, version, sizeof(progress_.version))) {
+        progress_ = {};
+        strncpy(progress_.version, version, sizeof(progress_.version) - 1);
+    }
+    progress_.offset -= progress_.offset % OTA_RESUME_ALIGN;
+
+    esp_err_t err = sink_.begin(progress_.offset);
+    if (err != ESP_OK && progress_.offset) {
+        ESP_LOGW(TAG, "Unable to resume at %lu, restarting download",
+                 (unsigned long)progress_.offset);
+        progress_.offset = progress_.total = 0;
+        err = sink_.begin(0);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start OTA: %d", err);
+        return fail();
+    }
+    if (progress_.offset) {
+        ESP_LOGI(TAG, "Resuming %s at %lu/%lu", version, (unsigned long)progress_.offset,
+                 (unsigned long)progress_.total);
+    }
+
+    uint64_t startMs = nowMsFn_();
+    uint64_t sent = 0;
+    bool restarted = false;
+    while (progress_.total == 0 || progress_.offset < progress_.total) {
+        uint32_t len = chunkSize_;
+        if (progress_.total) {
+            len = std::min(len, progress_.total - progress_.offset);
+        }
+
+        uint32_t got = 0, total = 0;
+        esp_err_t fetchErr = transport_.fetch(progress_.offset, len, buf_, &got, &total);
+        if (fetchErr == ESP_ERR_NOT_SUPPORTED && progress_.offset && !restarted) {
+            // The server can't resume, so start again from the beginning
+            ESP_LOGW(TAG, "Unable to resume at %lu, restarting download",
+                     (unsigned long)progress_.offset);
+            restarted = true;
+            sink_.abort();
+            store_.clear();
+            progress_.offset = 0;
+            err = sink_.begin(0);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Unable to start OTA: %d", err);
+                return fail();
+            }
+            continue;
+        }
+        if (total && progress_.total && total != progress_.total) {
+            // Same version name but a different image, e.g. rebuilt
+            ESP_LOGE(TAG, "Image size changed from %lu to %lu", (unsigned long)progress_.total,
+                     (unsigned long)total);
+            return fail();
+        }
+        if (total) {
+            progress_.total = total;
+        }
+
+        if (got) {
+            err = sink_.write(buf_, got);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Error writing OTA data: %d", err);
+                return fail();
+            }
+            progress_.offset += got;
+            sent += got;
+        }
+
+        if (fetchErr != ESP_OK) {
+            // Anything past the last sector boundary is written again on resume
+            Progress saved = progress_;
+            saved.offset -= saved.offset % OTA_RESUME_ALIGN;
+            store_.save(saved);
+            sink_.abort();
+            ESP_LOGW(TAG, "Download interrupted at %lu/%lu: %d", (unsigned long)progress_.offset,
+                     (unsigned long)progress_.total, fetchErr);
+            return Result::Interrupted;
+        }
+        if (progress_.total == 0 || got == 0) {
+            ESP_LOGE(TAG, "Server sent no data or size");
+            return fail();
+        }
+        store_.save(progress_);
+
+        if (rateLimit_ && progress_.offset < progress_.total) {
+            uint64_t dueMs = startMs + sent * 1000 / rateLimit_;
+            uint64_t nowMs = nowMsFn_();
+            if (dueMs > nowMs) {
+                sleepFn_(dueMs - nowMs);
+            }
+        }
+    }
+
+    err = sink_.finish();
+    store_.clear();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Downloaded image invalid: %d", err);
+        progress_ = {};
+        return Result::Failed;
+    }
+    return Result::Done;
+}
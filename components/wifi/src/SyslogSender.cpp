@@ -0,0 +1,187 @@
+#include "SyslogSender.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Only printed locally, logging to the remote logger from itself would recurse
+#define SYSLOG_LOGD(fmt, ...) ESP_LOGD("RLOG", fmt, ##__VA_ARGS__)
+
+void SyslogSender::setDest(const struct sockaddr_in &addr) {
+    if (memcmp(&addr, &dest_, sizeof(addr))) {
+        dest_ = addr;
+        closeSocket();
+        connectTried_ = false;
+        down_ = false;
+    }
+}
+
+void SyslogSender::closeSocket() {
+    if (socket_ >= 0) {
+        close(socket_);
+        socket_ = -1;
+    }
+}
+
+bool SyslogSender::openSocket() {
+    if (socket_ >= 0) {
+        return true;
+    }
+    bool tcp = transport_ == Transport::Tcp;
+    uint64_t nowMs = nowMsFn_();
+    if (tcp && connectTried_ && nowMs - lastConnectMs_ < SYSLOG_RECONNECT_MS) {
+        return false;
+    }
+
+    socket_ = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, tcp ? IPPROTO_TCP : IPPROTO_UDP);
+    if (socket_ < 0) {
+        SYSLOG_LOGD("Failed to create socket: errno %d", errno);
+        return false;
+    }
+    struct timeval timeout = {
+        .tv_sec = SYSLOG_SOCKET_TIMEOUT_MS / 1000,
+        .tv_usec = (SYSLOG_SOCKET_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (tcp) {
+        connectTried_ = true;
+        lastConnectMs_ = nowMs;
+        if (connect(socket_, (struct sockaddr *)&dest_, sizeof(dest_)) < 0) {
+            SYSLOG_LOGD("Failed to connect: errno %d", errno);
+            closeSocket();
+            down_ = true;
+            return false;
+        }
+        stats_.connects++;
+    }
+    return true;
+}
+
+size_t SyslogSender::framedLen(size_t len) const {
+    switch (transport_) {
+    case Transport::Tcp:
+        return snprintf(nullptr, 0, "%u ", (unsigned)len) + len;
+    case Transport::UdpBatched:
+        return (batchLen_ ? 1 : 0) + len;
+    default:
+        return len;
+    }
+}
+
+bool SyslogSender::add(const char *msg, size_t len) {
+    // Longer messages are cut to fit a packet on their own
+    len = std::min(len, sizeof(batch_) - SYSLOG_MAX_FRAME_PREFIX);
+
+    if (batchLen_ && batchLen_ + framedLen(len) > sizeof(batch_) && !send() && batchLen_) {
+        // Hold the unsent batch rather than lose older messages
+        stats_.dropped++;
+        return false;
+    }
+
+    if (!batchLen_) {
+        batchStartMs_ = nowMsFn_();
+    }
+    if (transport_ == Transport::Tcp) {
+        batchLen_ += snprintf(batch_ + batchLen_, sizeof(batch_) - batchLen_, "%u ", (unsigned)len);
+    } else if (transport_ == Transport::UdpBatched && batchLen_) {
+        batch_[batchLen_++] = '\n';
+    }
+    memcpy(batch_ + batchLen_, msg, len);
+    batchLen_ += len;
+    batchMessages_++;
+
+    return transport_ != Transport::Udp || send();
+}
+
+bool SyslogSender::send() {
+    if (!openSocket()) {
+        if (transport_ != Transport::Tcp) {
+            dropBatch();
+        }
+        return false;
+    }
+
+    ssize_t sent;
+    if (transport_ == Transport::Tcp) {
+        size_t off = 0;
+        for (sent = 0; off < batchLen_; off += sent) {
+            sent = ::send(socket_, batch_ + off, batchLen_ - off, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                break;
+            }
+        }
+        if (off < batchLen_) {
+            // The whole batch goes again on the next connection, as any part
+            // written may not have arrived either
+            SYSLOG_LOGD("Failed to send: errno %d", errno);
+            closeSocket();
+            down_ = true;
+            return false;
+        }
+    } else {
+        sent = sendto(socket_, batch_, batchLen_, 0, (struct sockaddr *)&dest_, sizeof(dest_));
+        if (sent < 0) {
+            SYSLOG_LOGD("Failed to send: errno %d", errno);
+            // Socket might be bad, recreate it on the next attempt
+            closeSocket();
+            dropBatch();
+            return false;
+        }
+    }
+
+    stats_.messages += batchMessages_;
+    stats_.packets++;
+    down_ = false;
+    batchLen_ = 0;
+    batchMessages_ = 0;
+    return true;
+}
+
+void SyslogSender::dropBatch() {
+    stats_.dropped += batchMessages_;
+    batchLen_ = 0;
+    batchMessages_ = 0;
+}
+
+void SyslogSender::poll() {
+    if (batchLen_ && nowMsFn_() - batchStartMs_ >= SYSLOG_FLUSH_DELAY_MS) {
+        send();
+    }
+}
+
+void SyslogSender::flush() {
+    if (batchLen_) {
+        send();
+    }
+}
+
+uint32_t SyslogSender::nextPollMs() {
+    if (!batchLen_) {
+        return UINT32_MAX;
+    }
+    uint64_t waited = nowMsFn_() - batchStartMs_;
+    uint32_t wait = waited >= SYSLOG_FLUSH_DELAY_MS ? 0 : SYSLOG_FLUSH_DELAY_MS - waited;
+    if (socket_ < 0 && transport_ == Transport::Tcp && connectTried_) {
+        // Retrying a failed batch waits for the reconnect
+        uint64_t sinceConnect = nowMsFn_() - lastConnectMs_;
+        if (sinceConnect < SYSLOG_RECONNECT_MS) {
+            wait = std::max(wait, (uint32_t)(SYSLOG_RECONNECT_MS - sinceConnect));
+        }
+    }
+    return wait;
+}
@@ -0,0 +1,132 @@
+#include "TaskHealthSampler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "HEALTH";
+
+TaskHealthSampler::TaskHealthSampler() {
+    status_ = (TaskStatus_t *)heap_caps_calloc(HEALTH_MAX_TASKS, sizeof(TaskStatus_t),
+                                               MALLOC_CAP_SPIRAM);
+    records_ =
+        (TaskRecord *)heap_caps_calloc(HEALTH_MAX_TASKS, sizeof(TaskRecord), MALLOC_CAP_SPIRAM);
+    prevRecords_ =
+        (TaskRecord *)heap_caps_calloc(HEALTH_MAX_TASKS, sizeof(TaskRecord), MALLOC_CAP_SPIRAM);
+    if (!status_ || !records_ || !prevRecords_) {
+        ESP_LOGE(TAG, "Unable to allocate task health buffers");
+    }
+}
+
+TaskHealthSampler::~TaskHealthSampler() {
+    heap_caps_free(status_);
+    heap_caps_free(records_);
+    heap_caps_free(prevRecords_);
+}
+
+const TaskHealthSampler::TaskRecord *TaskHealthSampler::findPrev(TaskHandle_t handle) const {
+    for (size_t i = 0; i < nPrevRecords_; i++) {
+        if (prevRecords_[i].handle == handle) {
+            return &prevRecords_[i];
+        }
+    }
+    return nullptr;
+}
+
+const TaskHealthSampler::Summary &TaskHealthSampler::sample() {
+    if (!status_ || !records_ || !prevRecords_) {
+        return summary_;
+    }
+
+    configRUN_TIME_COUNTER_TYPE totalRunTime;
+    UBaseType_t n = uxTaskGetSystemState(status_, HEALTH_MAX_TASKS, &totalRunTime);
+    if (n == 0) {
+        ESP_LOGE(TAG, "More than %d tasks, not sampled", HEALTH_MAX_TASKS);
+        return summary_;
+    }
+
+    std::swap(records_, prevRecords_);
+    nPrevRecords_ = nRecords_;
+    nRecords_ = n;
+
+    // The run time counter is wall time, so shares are of one core
+    configRUN_TIME_COUNTER_TYPE window = totalRunTime - lastTotalRunTime_;
+    bool haveWindow = nPrevRecords_ > 0 && window > 0;
+    lastTotalRunTime_ = totalRunTime;
+
+    Summary s = {};
+    s.nTasks = n;
+    s.minStackFree = UINT32_MAX;
+    for (UBaseType_t i = 0; i < n; i++) {
+        const TaskStatus_t &t = status_[i];
+        const TaskRecord *prev = findPrev(t.xHandle);
+        TaskRecord &r = records_[i];
+
+        r.handle = t.xHandle;
+        strlcpy(r.name, t.pcTaskName, sizeof(r.name));
+        r.runTime = t.ulRunTimeCounter;
+        r.stackFree = t.usStackHighWaterMark; // Bytes on ESP-IDF
+        r.cpuPct = 0;
+        if (haveWindow) {
+            // New tasks are charged their whole run time
+            uint64_t used = r.runTime - (prev ? prev->runTime : 0);
+            r.cpuPct = std::min<uint64_t>(100, used * 100 / window);
+        }
+
+        bool idle = false;
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            if (t.xHandle == xTaskGetIdleTaskHandleForCore(core)) {
+                idle = true;
+                if (haveWindow) {
+                    s.coreLoadPct[core] = 100 - r.cpuPct;
+                }
+            }
+        }
+
+        if (!idle && r.cpuPct > s.busiestPct) {
+            s.busiestPct = r.cpuPct;
+            strlcpy(s.busiestTask, r.name, sizeof(s.busiestTask));
+        }
+        if (r.stackFree < s.minStackFree) {
+            s.minStackFree = r.stackFree;
+            strlcpy(s.minStackTask, r.name, sizeof(s.minStackTask));
+        }
+
+        // Only warn as a task crosses a threshold so a persistent condition
+        // doesn't flood the log
+        r.alerting =
+            r.stackFree < HEALTH_STACK_WARN_BYTES || (!idle && r.cpuPct > HEALTH_CPU_WARN_PCT);
+        if (r.alerting) {
+            s.alerts++;
+            if (!prev || !prev->alerting) {
+                ESP_LOGW(TAG, "task %s over threshold: stack_free=%lub cpu=%u%%", r.name,
+                         r.stackFree, r.cpuPct);
+            }
+        }
+    }
+
+    summary_ = s;
+    return summary_;
+}
+
+void TaskHealthSampler::log() const {
+    const Summary &s = summary_;
+
+    char loads[16 * portNUM_PROCESSORS] = "";
+    size_t pos = 0;
+    for (int core = 0; core < portNUM_PROCESSORS && pos < sizeof(loads); core++) {
+        pos += snprintf(loads + pos, sizeof(loads) - pos, " core%d=%u%%", core,
+                        s.coreLoadPct[core]);
+    }
+    ESP_LOGW(TAG, "tasks=%u load%s busiest=%s(%u%%) min_stack=%s(%lub) alerts=%u", s.nTasks,
+             loads, s.busiestTask, s.busiestPct, s.minStackTask, s.minStackFree, s.alerts);
+
+    for (size_t i = 0; i < nRecords_; i++) {
+        const TaskRecord &r = records_[i];
+        ESP_LOGI(TAG, "%-16s cpu=%3u%% stack_free=%5lub%s", r.name, r.cpuPct, r.stackFree,
+                 r.alerting ? " !" : "");
+    }
+}
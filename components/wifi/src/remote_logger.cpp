@@ -1,36 +1,66 @@
 #include "remote_logger.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 
+#include "esp_attr.h"
+#include "esp_littlefs.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_random.h"
+#include "esp_rom_sys.h"
 #include "esp_timer.h"
-#include "freertos/ringbuf.h"
 #include "freertos/task.h"
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
 
+#include "LogBacklog.h"
+#include "LogRing.h"
+#include "Metrics.h"
+
 #define MAX_TAG_LENGTH 32
 #define SYSLOG_PORT 514
 #define FACILITY 16 // local0
 #define DNS_CACHE_DURATION std::chrono::hours(60)
 #define RESOLVE_RETRY_INTERVAL_MS 1000
-#define SOCKET_TIMEOUT_MS 1000
-#define TASK_STACK_SIZE 4092
-#define RING_BUFFER_SIZE (REMOTE_LOG_MESSAGE_LEN + 8) * 64 // 8 byte header per item
+#define TASK_STACK_SIZE 6144 // LittleFS needs about 2K
+#define LOG_RING_SLOTS 32 // per core, must be a power of two
+// Upper bound on how long a message can wait if its writer didn't wake the task
+#define LOG_POLL_MS 100
+#define LOG_BACKLOG_PATH "/logs"
+#define LOG_BACKLOG_BUFFER_BYTES 4096
+// Rate backlogged messages are sent at once connected, alongside new ones
+#define LOG_BACKLOG_SEND_PER_SEC 50
+// Before this the clock hasn't been set from the RTC or SNTP (Nov 2023)
+#define MIN_VALID_TIME 1700000000
 
 static char name_[64], dest_host_[256];
 
-static int syslog_socket_ = -1;
+static SyslogSender *sender_ = NULL;
 struct sockaddr_in resolved_addr_;
 static std::chrono::steady_clock::time_point last_resolve_time_{};
-static RingbufHandle_t ring_buffer_ = NULL;
+static TaskHandle_t task_ = NULL;
+
+// One ring per core so logging never contends across cores, merged by time in
+// remote_logger_task
+static LogRing rings_[portNUM_PROCESSORS];
+
+// Holds messages while the syslog server can't be reached, NULL if disabled.
+// Owned by the logger task.
+static LogBacklog *backlog_ = NULL;
+// Survives a restart, so a crash loop can't write the flash any faster
+static RTC_NOINIT_ATTR LogBacklog::Budget backlog_budget_;
+// Marks this boot's backlogged messages, whose esp_timer times can still be
+// converted to wall clock time
+static uint32_t boot_id_;
 
 // Authoritative network connectivity, driven by wifi events via
 // remote_logger_set_connected(). Only this atomic crosses task boundaries;
@@ -39,6 +69,25 @@ static std::atomic<bool> connected_{false};
 
 static const char *TAG = "RLOG";
 
+static MetricCounter messagesMetric("remote_log_messages_total", "Log messages sent to syslog");
+static MetricCounter packetsMetric("remote_log_packets_total",
+                                   "Datagrams or TCP writes sent to syslog");
+static MetricCounter bufferDropsMetric("remote_log_dropped_total",
+                                       "Log messages not sent to syslog", "reason=\"buffer_full\"");
+static MetricCounter sendDropsMetric("remote_log_dropped_total", "Log messages not sent to syslog",
+                                     "reason=\"send_failed\"");
+static MetricCounter connectsMetric("remote_log_tcp_connects_total",
+                                    "Connections made to syslog over TCP");
+static MetricCounter backlogDropsMetric("remote_log_dropped_total",
+                                        "Log messages not sent to syslog",
+                                        "reason=\"backlog_budget\"");
+static MetricCounter backlogMessagesMetric("remote_log_backlog_messages_total",
+                                           "Log messages saved to flash while offline");
+static MetricCounter backlogBytesMetric("remote_log_backlog_written_bytes_total",
+                                        "Bytes of log messages written to flash");
+static MetricCounter backlogSegmentsMetric("remote_log_backlog_segments_dropped_total",
+                                           "Backlog segments deleted unsent, when full or corrupt");
+
 static esp_err_t resolve_syslog_server(void) {
     std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
@@ -69,30 +118,6 @@ static esp_err_t resolve_syslog_server(void) {
     return ESP_OK;
 }
 
-// Initialize UDP socket for syslog
-static esp_err_t init_syslog_socket(void) {
-    if (syslog_socket_ >= 0) {
-        return ESP_OK; // Already initialized
-    }
-
-    syslog_socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (syslog_socket_ < 0) {
-        ESP_LOGI(TAG, "Failed to create socket: errno %d", errno);
-        return ESP_FAIL;
-    }
-
-    struct timeval timeout = {
-        .tv_sec = SOCKET_TIMEOUT_MS / 1000,
-        .tv_usec = (SOCKET_TIMEOUT_MS % 1000) * 1000,
-    };
-
-    if (setsockopt(syslog_socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
-        ESP_LOGI(TAG, "Failed to set socket timeout: errno %d", errno);
-    }
-
-    return ESP_OK;
-}
-
 // Convert ESP log level to syslog severity
 static int get_syslog_severity(esp_log_level_t level) {
     switch (level) {
@@ -111,40 +136,125 @@ static int get_syslog_severity(esp_log_level_t level) {
     }
 }
 
-// Send message to syslog server
-static void send_to_syslog(const char *msg, const size_t len) {
-    if (syslog_socket_ < 0) {
-        if (init_syslog_socket() != ESP_OK) {
-            return;
-        }
+// Brings the metrics up to date with the sender's counts
+static void update_metrics(void) {
+    static SyslogSender::Stats last = {};
+    const SyslogSender::Stats &stats = sender_->stats();
+    messagesMetric.inc(stats.messages - last.messages);
+    packetsMetric.inc(stats.packets - last.packets);
+    sendDropsMetric.inc(stats.dropped - last.dropped);
+    connectsMetric.inc(stats.connects - last.connects);
+    last = stats;
+
+    if (backlog_ != NULL) {
+        static LogBacklog::Stats last_backlog = {};
+        const LogBacklog::Stats &backlog = backlog_->stats();
+        backlogDropsMetric.inc(backlog.dropped - last_backlog.dropped);
+        backlogMessagesMetric.inc(backlog.appended - last_backlog.appended);
+        backlogBytesMetric.inc(backlog.bytesWritten - last_backlog.bytesWritten);
+        backlogSegmentsMetric.inc(backlog.segmentsDropped - last_backlog.segmentsDropped);
+        last_backlog = backlog;
     }
+}
 
+// Send message to syslog server, returning false if it was dropped
+static bool send_to_syslog(const char *msg, const size_t len) {
     // Re-resolve if cache has expired, we duplicate this here from the task loop
     // since receiving from the ring buffer could have blocked for awhile.
     resolve_syslog_server();
     if (last_resolve_time_ == std::chrono::steady_clock::time_point{}) {
-        return;
+        return false;
     }
 
-    ssize_t sent = sendto(syslog_socket_, msg, len, 0, (struct sockaddr *)&resolved_addr_,
-                          sizeof(resolved_addr_));
+    sender_->setDest(resolved_addr_);
+    return sender_->add(msg, len);
+}
+
+static uint64_t now_ms(void) { return esp_timer_get_time() / 1000; }
 
-    if (sent < 0) {
-        ESP_LOGI(TAG, "Failed to send syslog message: errno %d", errno);
-        // Socket might be bad - force recreation on next attempt
-        close(syslog_socket_);
-        syslog_socket_ = -1;
+// The wall clock time a message logged at esp_timer time timer_us was logged
+// at, or 0 if the clock isn't set
+static int64_t wall_time_us(int64_t timer_us) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < MIN_VALID_TIME) {
+        return 0;
     }
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (esp_timer_get_time() - timer_us);
 }
 
-static void queue_for_syslog(esp_log_level_t level, const char *fmt, va_list args) {
-    if (xPortInIsrContext()) {
-        // Until there's a
-        // xRingbufferSendAcquireFromISR/xRingbufferSendCompleteFromISR we just
-        // won't support this.
-        printf("RLOG: Cannot queue to remote logger from ISR\n");
+static void add_to_backlog(const LogRing::Entry &entry) {
+    int64_t wall_us = wall_time_us(entry.timeUs);
+    LogBacklog::Record record = {wall_us ? wall_us : (int64_t)entry.timeUs, boot_id_,
+                                 wall_us != 0};
+    // Errors are written sooner, they may explain a restart
+    bool error = atoi(entry.msg + 1) % 8 <= get_syslog_severity(ESP_LOG_ERROR);
+    backlog_->append(record, entry.msg, entry.len, error);
+}
+
+// Moves messages from the rings to the backlog while syslog can't be reached
+static void save_to_backlog(void) {
+    LogRing::Entry entry;
+    while (LogRing *ring = LogRing::oldest(rings_, portNUM_PROCESSORS, &entry)) {
+        if (entry.len > 0) {
+            add_to_backlog(entry);
+        }
+        ring->pop();
+    }
+    backlog_->poll();
+}
+
+// Sends backlogged messages, at most LOG_BACKLOG_SEND_PER_SEC. Each is only
+// taken off the backlog once the sender has it.
+static void send_backlog(void) {
+    static uint64_t last_ms = 0;
+    static char msg[REMOTE_LOG_MESSAGE_LEN], timestamped[REMOTE_LOG_MESSAGE_LEN + 32];
+
+    uint64_t now = now_ms();
+    uint64_t allowed = (now - last_ms) * LOG_BACKLOG_SEND_PER_SEC / 1000;
+    if (allowed == 0) {
         return;
     }
+    last_ms = now;
+    allowed = std::min<uint64_t>(allowed, LOG_BACKLOG_SEND_PER_SEC);
+
+    LogBacklog::Record record;
+    size_t len;
+    while (allowed-- && backlog_->peek(&record, msg, sizeof(msg) - 1, &len)) {
+        msg[len] = '\0';
+        const char *rest = strchr(msg, '>');
+        if (!record.wallTime && record.boot == boot_id_) {
+            int64_t wall_us = wall_time_us(record.timeUs);
+            record = {wall_us, record.boot, wall_us != 0};
+        }
+        if (!record.wallTime || rest == NULL) {
+            // Logged before the clock was set on an earlier boot, so the
+            // server's receive time will have to do
+            if (!send_to_syslog(msg, len)) {
+                return;
+            }
+            backlog_->pop();
+            continue;
+        }
+
+        // An RFC 3339 time in the RFC 3164 timestamp field, which rsyslog
+        // accepts
+        time_t sec = record.timeUs / 1000000;
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        int n = snprintf(timestamped, sizeof(timestamped),
+                         "%.*s%04d-%02d-%02dT%02d:%02d:%02d.%03dZ %s", (int)(rest - msg + 1), msg,
+                         tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+                         tm.tm_sec, (int)(record.timeUs / 1000 % 1000), rest + 1);
+        if (!send_to_syslog(timestamped, std::min<size_t>(n, sizeof(timestamped) - 1))) {
+            return;
+        }
+        backlog_->pop();
+    }
+}
+
+static void queue_for_syslog(esp_log_level_t level, const char *fmt, va_list args) {
+    bool in_isr = xPortInIsrContext();
 
     // Extract the tag and advance the format string to after the tag
     const char *fmt_after_tag = strstr(fmt, ": ") + 2;
@@ -153,40 +263,45 @@ static void queue_for_syslog(esp_log_level_t level, const char *fmt, va_list arg
 
     int priority = (FACILITY * 8) + get_syslog_severity(level);
 
-    // NB: We use xRingbufferSendAcquire here instead of a stack-allocated
-    // buffer since we don't know how much stack the caller has available.
-    char *item;
-    if (!xRingbufferSendAcquire(ring_buffer_, (void **)&item, REMOTE_LOG_MESSAGE_LEN, 0)) {
-        printf("RLOG: Failed to acquire memory for item\n");
+    // NB: We format into the ring instead of a stack-allocated buffer since we
+    // don't know how much stack the caller has available. Masking interrupts
+    // makes this core's task and ISRs take turns reserving slots, the only
+    // step that has to; nothing here waits on the other core. It doesn't mask
+    // high priority interrupts, which mustn't log.
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    LogRing &ring = rings_[xPortGetCoreID()];
+    bool was_empty;
+    char *item = ring.reserve(esp_timer_get_time(), &was_empty);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+    if (item == NULL) {
+        bufferDropsMetric.inc();
         return;
     }
 
     // Minimal rsyslog format, time is inserted server-side
     int prefix_written =
         snprintf(item, REMOTE_LOG_MESSAGE_LEN, "<%d>%s %s: ", priority, name_, tag);
-
-    if (prefix_written <= 0 || prefix_written >= REMOTE_LOG_MESSAGE_LEN - 1) {
-        // Write an empty message to indicate an error
-        item[0] = '\0';
-        ESP_LOGI(TAG, "Failed to format syslog message");
-        if (!xRingbufferSendComplete(ring_buffer_, &item)) {
-            ESP_LOGI(TAG, "failed to enqueue aborted message");
-        }
-        return;
-    }
-
-    int msg_written = vsnprintf(item + prefix_written, REMOTE_LOG_MESSAGE_LEN - prefix_written,
+    int msg_written = 0;
+    if (prefix_written > 0 && prefix_written < REMOTE_LOG_MESSAGE_LEN - 1) {
+        msg_written = vsnprintf(item + prefix_written, REMOTE_LOG_MESSAGE_LEN - prefix_written,
                                 fmt_after_tag, args);
-
-    if (msg_written <= 0) {
-        // Write an empty message to indicate an error. Note we do not treat
-        // message truncation as an error here since it's still useful to send
-        // truncated messages.
-        item[0] = '\0';
     }
 
-    if (!xRingbufferSendComplete(ring_buffer_, item)) {
-        ESP_LOGI(TAG, "failed to enqueue message");
+    // Commit an empty message on error so the slot is freed. Note we do not
+    // treat message truncation as an error here since it's still useful to
+    // send truncated messages.
+    ring.commit(item, msg_written > 0 ? strnlen(item, REMOTE_LOG_MESSAGE_LEN) : 0);
+
+    // The task drains every ring once woken, so only the first message needs
+    // to wake it
+    if (was_empty) {
+        if (in_isr) {
+            BaseType_t woken = pdFALSE;
+            vTaskNotifyGiveFromISR(task_, &woken);
+            portYIELD_FROM_ISR(woken);
+        } else {
+            xTaskNotifyGive(task_);
+        }
     }
 }
 
@@ -197,7 +312,7 @@ static int custom_log_vprintf(const char *fmt, va_list args) {
     char log_level_char = fmt[0];
 
     if (log_level_char == 27) {
-        printf("RLOG: Must disable log coloring\n");
+        esp_rom_printf("RLOG: Must disable log coloring\n");
     }
 
     // Convert ESP log level character to enum
@@ -227,21 +342,18 @@ static int custom_log_vprintf(const char *fmt, va_list args) {
         queue_for_syslog(level, fmt, args);
     }
 
+    // stdout takes a lock, which an ISR can't
+    if (xPortInIsrContext()) {
+        return esp_rom_vprintf(fmt, args);
+    }
     return vprintf(fmt, args);
 }
 
 static void remote_logger_task(void *) {
-    esp_err_t err;
-
-    err = init_syslog_socket();
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize socket: %d", err);
-    }
-
     bool was_connected = false;
 
     while (1) {
-        // Don't pull messages off the ring buffer until the network is actually
+        // Don't pull messages off the rings until the network is actually
         // reachable. Otherwise we'd dequeue (and free) messages logged before
         // wifi is connected, or while it's disconnected, and silently drop them
         // in send_to_syslog. Gating here lets those messages buffer until we can
@@ -254,35 +366,79 @@ static void remote_logger_task(void *) {
             // or the syslog host's address may have changed. Also drop the
             // socket so it's recreated against the current interface/source IP.
             // Done here, in the logger task, so last_resolve_time_ and
-            // syslog_socket_ stay single-threaded (closing the fd from the wifi
+            // sender_ stay single-threaded (closing the fd from the wifi
             // event task could race an in-flight sendto).
             last_resolve_time_ = {};
-            if (syslog_socket_ >= 0) {
-                close(syslog_socket_);
-                syslog_socket_ = -1;
-            }
+            sender_->closeSocket();
         }
         was_connected = connected;
 
         if (!connected || resolve_syslog_server() != ESP_OK) {
+            if (backlog_ != NULL) {
+                save_to_backlog();
+                update_metrics();
+            }
+            vTaskDelay(pdMS_TO_TICKS(RESOLVE_RETRY_INTERVAL_MS));
+            continue;
+        }
+        if (backlog_ != NULL && sender_->down()) {
+            // The syslog host is down too, the sender retries its held batch
+            // until it's back
+            save_to_backlog();
+            sender_->poll();
+            update_metrics();
             vTaskDelay(pdMS_TO_TICKS(RESOLVE_RETRY_INTERVAL_MS));
             continue;
         }
 
-        size_t size;
-        char *item = (char *)xRingbufferReceive(ring_buffer_, &size, portMAX_DELAY);
-        if (item != NULL && size > 0) {
-            size_t len = strnlen(item, size);
-            if (len > 0) {
-                send_to_syslog(item, len);
+        LogRing::Entry entry;
+        while (LogRing *ring = LogRing::oldest(rings_, portNUM_PROCESSORS, &entry)) {
+            if (entry.len > 0 && !send_to_syslog(entry.msg, entry.len) && backlog_ != NULL) {
+                add_to_backlog(entry);
             }
+            ring->pop();
+        }
+        if (backlog_ != NULL) {
+            send_backlog();
         }
-        vRingbufferReturnItem(ring_buffer_, item);
+        sender_->poll();
+        update_metrics();
+
+        // Wake up for the next message, or in time to send a partly filled batch
+        uint32_t wait_ms = std::min<uint32_t>(sender_->nextPollMs(), LOG_POLL_MS);
+        if (backlog_ != NULL && !backlog_->empty()) {
+            wait_ms = std::min<uint32_t>(wait_ms, 1000 / LOG_BACKLOG_SEND_PER_SEC);
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+    }
+}
+
+// Mounts the backlog partition, formatting it if it's new
+static void init_backlog(const char *partition) {
+    esp_vfs_littlefs_conf_t conf = {};
+    conf.base_path = LOG_BACKLOG_PATH;
+    conf.partition_label = partition;
+    conf.format_if_mount_failed = true;
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to mount %s, not keeping a backlog: %d", partition, err);
+        return;
+    }
+
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(LOG_BACKLOG_BUFFER_BYTES, MALLOC_CAP_SPIRAM);
+    assert(buf != NULL);
+    backlog_ =
+        new LogBacklog(LOG_BACKLOG_PATH, buf, LOG_BACKLOG_BUFFER_BYTES, now_ms, &backlog_budget_);
+    if (backlog_->open() != ESP_OK) {
+        delete backlog_;
+        backlog_ = NULL;
+        free(buf);
     }
 }
 
 // Function to initialize the custom logging backend
-void remote_logger_init(const char *name, const char *dest_host) {
+void remote_logger_init(const char *name, const char *dest_host,
+                        SyslogSender::Transport transport, const char *backlog_partition) {
     if (strlen(dest_host) >= sizeof(dest_host_)) {
         ESP_LOGW(TAG, "Hostname is too long, cannot initialize remote logger");
         return;
@@ -292,21 +448,25 @@ void remote_logger_init(const char *name, const char *dest_host) {
     last_resolve_time_ = {};
 
     remote_logger_set_name(name);
+    sender_ = new SyslogSender(transport, now_ms);
 
-    // Allocate ring buffer data structure and storage area into external RAM
-    StaticRingbuffer_t *buffer_struct =
-        (StaticRingbuffer_t *)heap_caps_malloc(sizeof(StaticRingbuffer_t), MALLOC_CAP_SPIRAM);
-    uint8_t *buffer_storage =
-        (uint8_t *)heap_caps_malloc(sizeof(uint8_t) * RING_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+    boot_id_ = esp_random();
+    if (backlog_partition != NULL) {
+        init_backlog(backlog_partition);
+    }
+
+    // Allocate the rings in external RAM
+    size_t ring_size = LogRing::storageSize(LOG_RING_SLOTS, REMOTE_LOG_MESSAGE_LEN);
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        void *storage = heap_caps_malloc(ring_size, MALLOC_CAP_SPIRAM);
+        assert(storage != NULL);
+        rings_[i].init(storage, LOG_RING_SLOTS, REMOTE_LOG_MESSAGE_LEN);
+    }
 
-    // Create a ring buffer with manually allocated memory
-    ring_buffer_ = xRingbufferCreateStatic(RING_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT, buffer_storage,
-                                           buffer_struct);
-    assert(ring_buffer_ != NULL);
+    xTaskCreate(remote_logger_task, "remoteLogger", TASK_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN,
+                &task_);
 
     esp_log_set_vprintf(custom_log_vprintf);
-
-    xTaskCreate(remote_logger_task, "remoteLogger", TASK_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN, NULL);
 }
 
 void remote_logger_set_name(const char *name) { strncpy(name_, name, sizeof(name_)); }
@@ -29,6 +29,8 @@ class AbstractHomeClient {
                                     double highTempC, double lowTempC) {};
     virtual void updateStaticPressure(uint32_t pressurePa) {};
     virtual void updateName(const char *name) {};
+    // Publishes a chunk of a decision trace dump, one entry per line
+    virtual void publishDecisionTrace(const char *text, size_t len) {};
 
   protected:
     HomeState state_{.err = Error::NotRun};
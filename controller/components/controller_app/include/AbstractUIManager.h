@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cmath>
+
 #include "ControllerDomain.h"
 
 #define UI_MAX_MSG_LEN 18 * 2
@@ -25,6 +27,11 @@ class AbstractUIManager {
         double inTempOffsetC, outTempOffsetC;
     };
 
+    struct DecisionTraceDump {
+        uint16_t count; // Most recent entries to dump
+        bool serial;    // Log to the console instead of publishing
+    };
+
     enum class EventType {
         SetSchedule,
         SetCO2Target,
@@ -39,6 +46,7 @@ class AbstractUIManager {
         ACOverride,
         MsgCancel,
         Restart,
+        DumpDecisionTrace,
     };
 
     union EventPayload {
@@ -54,6 +62,7 @@ class AbstractUIManager {
         uint8_t continuousFanSpeed;
         ACOverride acOverride;
         uint8_t msgID;
+        DecisionTraceDump decisionTraceDump;
     };
 
     struct Event {
@@ -61,18 +70,25 @@ class AbstractUIManager {
         EventPayload payload;
     };
 
+    // Everything the app shows on the home screen. The app publishes a
+    // complete copy after each control pass; the UI task applies it once per
+    // frame and only touches widgets whose displayed value changed.
+    struct ViewModel {
+        int16_t aqi = -1;
+        uint8_t fanSpeed = 0;
+        double outTempC = NAN;
+        double inTempC = NAN;
+        uint16_t inCO2 = 0;
+        ControllerDomain::HVACState hvacState = ControllerDomain::HVACState::Off;
+        double heatC = NAN, coolC = NAN;
+        bool systemOn = true;
+    };
+
     virtual ~AbstractUIManager() {}
 
     typedef void (*eventCb_t)(Event &);
 
-    virtual void setAQI(int16_t aqi) = 0;
-    virtual void setCurrentFanSpeed(uint8_t speed) = 0;
-    virtual void setOutTempC(double tc) = 0;
-    virtual void setInTempC(double tc) = 0;
-    virtual void setInCO2(uint16_t ppm) = 0;
-    virtual void setHVACState(ControllerDomain::HVACState state) = 0;
-    virtual void setCurrentSetpoints(double heatC, double coolC) = 0;
-    virtual void setSystemPower(bool on) = 0;
+    virtual void publishState(const ViewModel &vm) = 0;
 
     virtual void setMessage(uint8_t msgID, bool allowCancel, const char *msg) = 0;
     virtual void clearMessage(uint8_t msgID) = 0;
@@ -13,9 +13,11 @@
 #include "AbstractValveCtrl.h"
 #include "AbstractWifi.h"
 #include "ControllerDomain.h"
+#include "DecisionTrace.h"
 #include "FanCoolLimitAlgorithm.h"
 #include "LinearFanCoolAlgorithm.h"
 #include "LinearVentAlgorithm.h"
+#include "LoopMonitor.h"
 #include "NullAlgorithm.h"
 #include "PIDAlgorithm.h"
 #include "SetpointHandler.h"
@@ -52,6 +54,10 @@
 // Turn exhaust fan off when fan speed drops below this (hysteresis)
 // Note that the fan has a built-in 20m timer after we turn off the relay
 #define FAN_SPEED_EXHAUST_OFF_THRESHOLD (ControllerDomain::FanSpeed)140
+// A control loop iteration's work should finish within this time of it being due
+#define APP_LOOP_DEADLINE_MS 1000
+// Decision trace dumps are published in chunks of at most this many bytes
+#define DECISION_TRACE_CHUNK_LEN 1024
 
 class ControllerApp {
   public:
@@ -92,6 +98,9 @@ class ControllerApp {
 
     void task(bool firstTime = false);
     void bootErr(const char *msg);
+    void logLoopStats() const { loopMon_.log(); }
+    // Optional, each loop's decision is recorded here when set
+    void setDecisionTrace(DecisionTrace *trace) { trace_ = trace; }
 
     static size_t nMsgIds() { return static_cast<size_t>(ControllerApp::MsgID::_Last); }
     bool clockReady() {
@@ -287,6 +296,12 @@ class ControllerApp {
                   const ControllerDomain::Setpoints &setpoints,
                   const ControllerDomain::HVACState hvacState, const FanSpeed fanSpeed,
                   const bool exhaustOn);
+    void recordDecision(const ControllerDomain::SensorData &sensorData, double ventDemand,
+                        double fanCoolDemand, double heatDemand, double coolDemand,
+                        const ControllerDomain::Setpoints &setpoints,
+                        const ControllerDomain::HVACState hvacState, const FanSpeed fanSpeed);
+    int formatDecision(const DecisionTrace::Entry &entry, char *buf, size_t size) const;
+    void dumpDecisionTrace(uint16_t count, bool serial);
     void checkWifiState();
     double outdoorTempC() const;
     AbstractDemandAlgorithm *getAlgoForEquipment(ControllerDomain::Config::HVACType type,
@@ -305,6 +320,7 @@ class ControllerApp {
     Config config_;
     bool vacationOn_ = false;
     AbstractUIManager *uiManager_;
+    AbstractUIManager::ViewModel viewModel_;
     AbstractModbusController *modbusController_;
     AbstractSensors *sensors_;
     AbstractValveCtrl *valveCtrl_;
@@ -343,6 +359,13 @@ class ControllerApp {
     Setpoints lastSetpoints_{};
     FancoilSpeed lastHvacSpeed_ = FancoilSpeed::Off; // High == valve on
 
+    enum LoopPhase { LoopSensors, LoopAlgorithms, LoopModbus, LoopUI, LoopLogging, NumLoopPhases };
+    static const LoopMonitor::Phase loopPhases_[NumLoopPhases];
+    LoopMonitor loopMon_{"ctrl", APP_LOOP_DEADLINE_MS, loopPhases_, NumLoopPhases};
+
+    DecisionTrace *trace_ = nullptr;
+    char traceChunk_[DECISION_TRACE_CHUNK_LEN];
+
     // Delta from setpoint in the direction we're aiming to correct
     // e.g. when heating, the amount by which the indoor temp is below the setpoint
     class FancoilSetpointHandler : public SetpointHandler<FancoilSpeed, double> {
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Record an unchanged decision at least this often so the trace shows the
+// inputs drifting towards the next change
+#define DECISION_TRACE_HEARTBEAT_SECS 60
+
+// Ring of the control loop's decisions: the inputs, each algorithm's demand,
+// the reasons for the chosen setpoints and fan speed, and the outputs. Entries
+// are packed integers (~28 bytes) so days of history fit in PSRAM, and the
+// storage is supplied by the caller.
+//
+// Loop iterations that reach the same decision as the last recorded entry
+// are only recorded once per heartbeat, so a change is never missed but a
+// steady state doesn't flush the history.
+class DecisionTrace {
+  public:
+    static constexpr int16_t INVALID_TEMP = INT16_MIN;
+
+    enum Flags : uint8_t {
+        SystemOn = 1 << 0,
+        Exhaust = 1 << 1,
+        Vacation = 1 << 2,
+        SensorErr = 1 << 3,
+    };
+
+    // Enums are stored as their values; the app owning them formats them
+    struct Entry {
+        uint32_t time; // Unix seconds
+        int16_t inTempCx100;
+        int16_t outTempCx100;
+        int16_t heatCx100;
+        int16_t coolCx100;
+        uint16_t co2;
+        uint8_t ventPct;
+        uint8_t fanCoolPct;
+        uint8_t heatPct;
+        uint8_t coolPct;
+        uint8_t fanSpeed;
+        uint8_t fanSpeedReason;
+        uint8_t setpointReason;
+        uint8_t hvacState;
+        uint8_t fancoilSpeed;
+        uint8_t acMode;
+        uint8_t flags;
+    };
+
+    DecisionTrace(Entry *buf, size_t capacity) : buf_(buf), capacity_(buf ? capacity : 0) {}
+
+    static int16_t packTemp(double tc);
+    // Demands are clamped to 0-1 and stored as a percentage
+    static uint8_t packDemand(double demand);
+
+    void add(const Entry &entry);
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    // Oldest first
+    const Entry &get(size_t i) const { return buf_[(head_ + capacity_ - size_ + i) % capacity_]; }
+
+  private:
+    Entry *buf_;
+    size_t capacity_;
+    size_t head_ = 0; // Next write position
+    size_t size_ = 0;
+
+    static bool sameDecision(const Entry &a, const Entry &b);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+#include "RtcDrift.h"
+
+// A little over a second so a tick is always seen
+#define RTC_EDGE_TIMEOUT_US (1200 * 1000)
+
+// Reads an RTC that only counts whole seconds, timing reads to when its
+// seconds tick over so they're good to a few milliseconds.
+class RtcClock {
+  public:
+    typedef esp_err_t (*getTimeFn_t)(struct tm *dt);
+    typedef int64_t (*nowUsFn_t)();
+    // Waits briefly between reads
+    typedef void (*pollWaitFn_t)();
+
+    RtcClock(getTimeFn_t getTime, nowUsFn_t nowUs, pollWaitFn_t pollWait)
+        : getTime_(getTime), nowUs_(nowUs), pollWait_(pollWait) {}
+
+    // Waits for the seconds to tick over, then returns the second that started
+    // and nowUs() when it was seen. ESP_ERR_TIMEOUT if the RTC isn't ticking.
+    esp_err_t readEdge(int64_t *rtcSec, int64_t *timerUs);
+
+    // The time to restore at boot in us since the epoch, corrected for the
+    // drift since the RTC was set. Sets ticking false and leaves us alone if
+    // the RTC has stopped, as its time can't be trusted then.
+    esp_err_t bootTimeUs(const RtcDrift &drift, int64_t *us, bool *ticking);
+
+  private:
+    getTimeFn_t getTime_;
+    nowUsFn_t nowUs_;
+    pollWaitFn_t pollWait_;
+};
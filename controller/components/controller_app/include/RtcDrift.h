@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Measurements over a shorter time since the RTC was set are too noisy to
+// estimate its drift
+#define RTC_DRIFT_MIN_BASELINE_SECS (30 * 60)
+// Beyond this the RTC or the system clock was set by something else, so the
+// difference isn't drift. Crystals are good to tens of ppm.
+#define RTC_DRIFT_MAX_PPB 500000
+// Each measurement moves the estimate this fraction of the way (1/N)
+#define RTC_DRIFT_SMOOTHING 4
+
+// Tracks how far the RTC's crystal drifts from network time, so time restored
+// from the RTC at boot can be corrected for the drift since it was last set.
+// The RTC is written back after every SNTP sync; the difference measured just
+// before writing it, over the time since the previous write, gives the drift.
+class RtcDrift {
+  public:
+    // Seconds since the epoch for a UTC date and time, as the RTC stores it.
+    // Unlike mktime() this doesn't depend on the local time zone.
+    static int64_t toEpoch(const struct tm &dt);
+
+    RtcDrift(int64_t setAt = 0, int32_t ppb = 0) : setAt_(setAt), ppb_(ppb) {}
+
+    // How far ahead the RTC is expected to be when it reads rtcSec, from the
+    // drift since it was set
+    int64_t errorUs(int64_t rtcSec) const;
+
+    // Records a measurement of the RTC minus network time, taken at nowSec.
+    // Returns whether it was used to update the drift estimate.
+    bool measured(int64_t nowSec, int64_t offsetUs);
+
+    // The RTC was set to network time at nowSec
+    void set(int64_t nowSec) { setAt_ = nowSec; }
+
+    int64_t setAt() const { return setAt_; }
+    int32_t ppb() const { return ppb_; }
+
+  private:
+    int64_t setAt_; // 0 until the RTC has been set from network time
+    int32_t ppb_;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-interval ring of the values plotted on the trend screen. Samples are
+// packed integers so a full day of one-minute samples fits in ~14KB, and the
+// storage is supplied by the caller so it can live in PSRAM.
+class TrendHistory {
+  public:
+    static constexpr int16_t INVALID_TEMP = INT16_MIN;
+    static constexpr uint16_t INVALID_CO2 = 0;
+    static constexpr uint8_t INVALID_FAN = UINT8_MAX;
+
+    struct Sample {
+        int16_t inTempCx100;
+        int16_t heatCx100;
+        int16_t coolCx100;
+        uint16_t co2;
+        uint8_t fanPct;
+    };
+
+    TrendHistory(Sample *buf, size_t capacity) : buf_(buf), capacity_(buf ? capacity : 0) {}
+
+    // NaN temperatures, a zero CO2 reading, or a fan percentage over 100 are
+    // recorded as missing.
+    void add(double inTempC, double heatC, double coolC, uint16_t co2, uint8_t fanPct);
+
+    // Reduce the full window (capacity samples, oldest first) into nOut
+    // buckets by averaging the valid samples in each. Fields with no valid
+    // samples in a bucket, including the not-yet-filled part of the window,
+    // are set to their INVALID_* value.
+    void downsample(Sample *out, size_t nOut) const;
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+
+    // Total samples ever added, for cheap "has anything changed" checks
+    uint32_t generation() const { return generation_; }
+
+  private:
+    Sample *buf_;
+    size_t capacity_;
+    size_t head_ = 0; // Next write position
+    size_t size_ = 0;
+    uint32_t generation_ = 0;
+};
@@ -1,10 +1,12 @@
 #include "ControllerApp.h"
 
 #include <algorithm>
+#include <cstdarg>
 #include <cstring>
 #include <inttypes.h>
 
 #include "LinearFancoilAlgorithm.h"
+#include "Metrics.h"
 #include "ValveAlgorithm.h"
 
 #include "esp_err.h"
@@ -43,6 +45,32 @@
 
 static const char *TAG = "CTRL";
 
+// Set from logState each loop
+static MetricCounter loopsMetric("controller_loops_total", "Control loop iterations");
+static MetricGauge inTempMetric("controller_temp_celsius", "Temperature", "sensor=\"indoor\"");
+static MetricGauge outTempMetric("controller_temp_celsius", "Temperature", "sensor=\"outdoor\"");
+static MetricGauge coilTempMetric("controller_temp_celsius", "Temperature", "sensor=\"coil\"");
+static MetricGauge humidityMetric("controller_humidity_percent", "Indoor relative humidity");
+static MetricGauge co2Metric("controller_co2_ppm", "Indoor CO2");
+static MetricGauge pressureMetric("controller_pressure_pascals", "Fresh air static pressure");
+static MetricGauge heatSetpointMetric("controller_setpoint_celsius", "Setpoint", "mode=\"heat\"");
+static MetricGauge coolSetpointMetric("controller_setpoint_celsius", "Setpoint", "mode=\"cool\"");
+static MetricGauge ventDemandMetric("controller_demand_ratio", "Algorithm demand",
+                                   "algo=\"vent\"");
+static MetricGauge fanCoolDemandMetric("controller_demand_ratio", "Algorithm demand",
+                                      "algo=\"fan_cool\"");
+static MetricGauge heatDemandMetric("controller_demand_ratio", "Algorithm demand",
+                                   "algo=\"heat\"");
+static MetricGauge coolDemandMetric("controller_demand_ratio", "Algorithm demand",
+                                   "algo=\"cool\"");
+static MetricGauge fanSpeedMetric("controller_fan_speed", "Fresh air fan target speed, 0-255");
+static MetricGauge fanRpmMetric("controller_fan_rpm", "Fresh air fan speed");
+static MetricGauge hvacStateMetric("controller_hvac_state", "0 off, 1 heat, 2 A/C cool");
+static MetricGauge fancoilSpeedMetric("controller_fancoil_speed", "Fancoil speed, 0 off");
+static MetricGauge exhaustMetric("controller_exhaust_on", "Exhaust fan on");
+static MetricGauge fancoilErrMetric("controller_fancoil_error",
+                                    "Last fancoil control error, 0 if none");
+
 using FanSpeed = ControllerDomain::FanSpeed;
 using Setpoints = ControllerDomain::Setpoints;
 
@@ -189,7 +217,7 @@ void ControllerApp::setFanSpeed(FanSpeed speed) {
         speed = 0;
     }
 
-    uiManager_->setCurrentFanSpeed(speed);
+    viewModel_.fanSpeed = speed;
     modbusController_->setFreshAirSpeed(speed);
     fanIsOn_ = speed > 0;
 }
@@ -364,6 +392,10 @@ bool ControllerApp::pollUIEvent(bool wait) {
         ESP_LOGI(TAG, "Restart requested");
         restartCb_();
         break;
+    case EventType::DumpDecisionTrace:
+        dumpDecisionTrace(uiEvent.payload.decisionTraceDump.count,
+                          uiEvent.payload.decisionTraceDump.serial);
+        break;
     default:
         ESP_LOGE(TAG, "Unexpected UI event: %d", static_cast<int>(uiEvent.type));
         break;
@@ -376,7 +408,8 @@ void ControllerApp::handleCancelMessage(MsgID id) {
     switch (id) {
     case MsgID::SystemOff:
         config_.systemOn = true;
-        uiManager_->setSystemPower(true);
+        viewModel_.systemOn = true;
+        uiManager_->publishState(viewModel_);
         cfgStore_->store(config_);
         break;
     case MsgID::FanOverride:
@@ -429,7 +462,7 @@ ControllerDomain::HVACState ControllerApp::setHVAC(const double heatDemand, cons
     } else {
         state = HVACState::Off;
     }
-    uiManager_->setHVACState(state);
+    viewModel_.hvacState = state;
 
     Config::HVACType hvacType, otherType;
     if (cool) {
@@ -484,6 +517,7 @@ ControllerDomain::HVACState ControllerApp::setHVAC(const double heatDemand, cons
 
 void ControllerApp::checkModbusErrors() {
     esp_err_t err = modbusController_->lastSetFancoilErr();
+    fancoilErrMetric.set(err);
     if (err == ESP_OK) {
         clearMessage(MsgID::SetFancoilErr);
     } else {
@@ -500,12 +534,12 @@ void ControllerApp::handleHomeClient() {
 
     clearMessage(MsgID::HomeClientErr);
     setVacation(state.vacationOn);
-    uiManager_->setAQI(state.aqi);
+    viewModel_.aqi = state.aqi;
 
     if (state.weatherTempC != 0 &&
         (std::chrono::system_clock::now() - state.weatherObsTime < OUTDOOR_TEMP_MAX_AGE)) {
         rawOutdoorTempC_ = state.weatherTempC;
-        uiManager_->setOutTempC(outdoorTempC());
+        viewModel_.outTempC = outdoorTempC();
         lastOutdoorTempUpdate_ = steadyNow() + (state.weatherObsTime - realNow());
     }
 }
@@ -534,7 +568,8 @@ void ControllerApp::setSystemPower(bool on) {
         tempOverrideUntilScheduleIdx_ = -1;
         clearMessage(MsgID::TempOverride);
     }
-    uiManager_->setSystemPower(on);
+    viewModel_.systemOn = on;
+    uiManager_->publishState(viewModel_);
 }
 
 bool ControllerApp::allowHVACChange(bool cool, bool on) {
@@ -640,8 +675,27 @@ void ControllerApp::logState(const ControllerDomain::FreshAirState &freshAirStat
         // Though we return it as a double, the fancoil only returns integral values
         // round anyway just in case that changes.
         coilTempC = int(round(fcState.coilTempC));
+        coilTempMetric.set(fcState.coilTempC);
     }
 
+    loopsMetric.inc();
+    inTempMetric.set(sensorData.tempC);
+    outTempMetric.set(outdoorTempC());
+    humidityMetric.set(sensorData.humidity);
+    co2Metric.set(sensorData.co2);
+    pressureMetric.set(freshAirState.pressurePa);
+    heatSetpointMetric.set(setpoints.heatTempC);
+    coolSetpointMetric.set(setpoints.coolTempC);
+    ventDemandMetric.set(ventDemand);
+    fanCoolDemandMetric.set(fanCoolDemand);
+    heatDemandMetric.set(heatDemand);
+    coolDemandMetric.set(coolDemand);
+    fanSpeedMetric.set(fanSpeed);
+    fanRpmMetric.set(freshAirState.fanRpm);
+    hvacStateMetric.set(static_cast<int>(hvacState));
+    fancoilSpeedMetric.set(static_cast<int>(lastHvacSpeed_));
+    exhaustMetric.set(exhaustOn);
+
     ESP_LOG_LEVEL(statusLevel, TAG,
                   "FreshAir: t=%.1f t_off=%0.1f h=%.1f p=%" PRIu32 " rpm=%u"
                   " target_speed=%u reason=%s",
@@ -673,6 +727,120 @@ void ControllerApp::logState(const ControllerDomain::FreshAirState &freshAirStat
         exhaustOn ? 1 : 0);
 }
 
+void ControllerApp::recordDecision(const ControllerDomain::SensorData &sensorData,
+                                   double ventDemand, double fanCoolDemand, double heatDemand,
+                                   double coolDemand, const ControllerDomain::Setpoints &setpoints,
+                                   const ControllerDomain::HVACState hvacState,
+                                   const FanSpeed fanSpeed) {
+    if (trace_ == nullptr) {
+        return;
+    }
+
+    uint8_t flags = 0;
+    if (config_.systemOn) {
+        flags |= DecisionTrace::SystemOn;
+    }
+    if (exhaustFanOn_) {
+        flags |= DecisionTrace::Exhaust;
+    }
+    if (vacationOn_) {
+        flags |= DecisionTrace::Vacation;
+    }
+    if (strlen(sensorData.errMsg) > 0) {
+        flags |= DecisionTrace::SensorErr;
+    }
+
+    trace_->add({
+        .time = (uint32_t)std::chrono::system_clock::to_time_t(realNow()),
+        .inTempCx100 = DecisionTrace::packTemp(sensorData.tempC),
+        .outTempCx100 = DecisionTrace::packTemp(outdoorTempC()),
+        .heatCx100 = DecisionTrace::packTemp(setpoints.heatTempC),
+        .coolCx100 = DecisionTrace::packTemp(setpoints.coolTempC),
+        .co2 = sensorData.co2,
+        .ventPct = DecisionTrace::packDemand(ventDemand),
+        .fanCoolPct = DecisionTrace::packDemand(fanCoolDemand),
+        .heatPct = DecisionTrace::packDemand(heatDemand),
+        .coolPct = DecisionTrace::packDemand(coolDemand),
+        .fanSpeed = fanSpeed,
+        .fanSpeedReason = static_cast<uint8_t>(fanSpeedReason_),
+        .setpointReason = static_cast<uint8_t>(setpointReason_),
+        .hvacState = static_cast<uint8_t>(hvacState),
+        .fancoilSpeed = static_cast<uint8_t>(lastHvacSpeed_),
+        .acMode = static_cast<uint8_t>(acMode_),
+        .flags = flags,
+    });
+}
+
+static double unpackTemp(int16_t cx100) {
+    return cx100 == DecisionTrace::INVALID_TEMP ? std::nan("") : cx100 / 100.0;
+}
+
+int ControllerApp::formatDecision(const DecisionTrace::Entry &entry, char *buf,
+                                  size_t size) const {
+    struct tm localTm;
+    time_t t = entry.time;
+    localtime_r(&t, &localTm);
+    char timeStr[24];
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &localTm);
+
+    // Keys match the ctrl status log line
+    return snprintf(
+        buf, size,
+        "%s in_t=%.2f out_t=%.2f co2=%u"
+        " set_h=%.2f set_c=%.2f set_r=%s"
+        " vent_d=%.2f fancool_d=%.2f heat_d=%.2f cool_d=%.2f"
+        " speed=%u speed_r=%s hvac=%s fancoil=%s ac=%s"
+        " on=%d exhaust=%d vacation=%d sensor_err=%d\n",
+        timeStr, unpackTemp(entry.inTempCx100), unpackTemp(entry.outTempCx100), entry.co2,
+        unpackTemp(entry.heatCx100), unpackTemp(entry.coolCx100),
+        setpointReasonToS(static_cast<SetpointReason>(entry.setpointReason)),
+        entry.ventPct / 100.0, entry.fanCoolPct / 100.0, entry.heatPct / 100.0,
+        entry.coolPct / 100.0, entry.fanSpeed,
+        fanSpeedReasonToS(static_cast<FanSpeedReason>(entry.fanSpeedReason)),
+        ControllerDomain::hvacStateToS(static_cast<HVACState>(entry.hvacState)),
+        ControllerDomain::fancoilSpeedToS(static_cast<FancoilSpeed>(entry.fancoilSpeed)),
+        acModeToS(static_cast<ACMode>(entry.acMode)), (entry.flags & DecisionTrace::SystemOn) != 0,
+        (entry.flags & DecisionTrace::Exhaust) != 0, (entry.flags & DecisionTrace::Vacation) != 0,
+        (entry.flags & DecisionTrace::SensorErr) != 0);
+}
+
+void ControllerApp::dumpDecisionTrace(uint16_t count, bool serial) {
+    if (trace_ == nullptr) {
+        ESP_LOGW(TAG, "No decision trace to dump");
+        return;
+    }
+
+    size_t n = std::min<size_t>(count, trace_->size());
+    ESP_LOGI(TAG, "Dumping %u of %u decision trace entries to %s", (unsigned)n,
+             (unsigned)trace_->size(), serial ? "serial" : "MQTT");
+
+    char line[256];
+    size_t chunkLen = 0;
+    for (size_t i = trace_->size() - n; i < trace_->size(); i++) {
+        int len = formatDecision(trace_->get(i), line, sizeof(line));
+        if (len <= 0) {
+            continue;
+        }
+        len = std::min<int>(len, sizeof(line) - 1);
+
+        if (serial) {
+            ESP_LOGI(TAG, "trace: %.*s", len - 1, line);
+            continue;
+        }
+
+        if (chunkLen + len > sizeof(traceChunk_)) {
+            homeCli_->publishDecisionTrace(traceChunk_, chunkLen);
+            chunkLen = 0;
+        }
+        memcpy(traceChunk_ + chunkLen, line, len);
+        chunkLen += len;
+    }
+
+    if (chunkLen > 0) {
+        homeCli_->publishDecisionTrace(traceChunk_, chunkLen);
+    }
+}
+
 void ControllerApp::checkWifiState() {
     const char *stateMsg = "", *sep;
     char wifiMsg_[UI_MAX_MSG_LEN] = "";
@@ -918,7 +1086,7 @@ ControllerDomain::FreshAirState ControllerApp::getFreshAirState() {
             //             ControllerDomain::FreshAirModel::SP) &&
             //            now - fanLastStarted_ > OUTDOOR_TEMP_MIN_FAN_TIME) {
             //     rawOutdoorTempC_ = freshAirState.tempC;
-            //     uiManager_->setOutTempC(outdoorTempC());
+            //     viewModel_.outTempC = outdoorTempC();
             //     lastOutdoorTempUpdate_ = fasTime;
             // }
         } else if (freshAirState.fanRpm == 0) {
@@ -964,7 +1132,7 @@ ControllerDomain::FreshAirState ControllerApp::getFreshAirState() {
 
     if (now - lastOutdoorTempUpdate_ > OUTDOOR_TEMP_MAX_AGE) {
         rawOutdoorTempC_ = std::nan("");
-        uiManager_->setOutTempC(outdoorTempC());
+        viewModel_.outTempC = outdoorTempC();
     }
 
     return freshAirState;
@@ -1005,7 +1173,14 @@ void ControllerApp::setConfig(ControllerDomain::Config config) {
     config_ = config;
 }
 
+// Budgets in ms for each LoopPhase. Modbus calls are handed off to the Modbus task, so all
+// of them should be quick.
+const LoopMonitor::Phase ControllerApp::loopPhases_[] = {
+    {"sensors", 20}, {"algorithms", 20}, {"modbus", 100}, {"ui", 20}, {"logging", 100},
+};
+
 void ControllerApp::task(bool firstTime) {
+    loopMon_.start();
     handleHomeClient();
     ControllerDomain::FreshAirState freshAirState = getFreshAirState();
 
@@ -1019,7 +1194,9 @@ void ControllerApp::task(bool firstTime) {
         resetHVACChangeLimit();
     }
     lastSetpoints_ = setpoints;
-    uiManager_->setCurrentSetpoints(setpoints.heatTempC, setpoints.coolTempC);
+    viewModel_.heatC = setpoints.heatTempC;
+    viewModel_.coolC = setpoints.coolTempC;
+    loopMon_.endPhase(LoopSensors);
 
     double ventDemand = 0, fanCoolDemand = 0, heatDemand = 0, coolDemand = 0;
 
@@ -1037,8 +1214,8 @@ void ControllerApp::task(bool firstTime) {
 
         clearMessage(MsgID::SensorErr);
 
-        uiManager_->setInTempC(sensorData.tempC);
-        uiManager_->setInCO2(sensorData.co2);
+        viewModel_.inTempC = sensorData.tempC;
+        viewModel_.inCO2 = sensorData.co2;
     } else {
         setMessage(MsgID::SensorErr, false, sensorData.errMsg);
     }
@@ -1051,6 +1228,8 @@ void ControllerApp::task(bool firstTime) {
     //                                                        OUTDOOR_TEMP_UPDATE_INTERVAL));
 
     FanSpeed fanSpeed = computeFanSpeed(ventDemand, fanCoolDemand, wantOutdoorTemp);
+    loopMon_.endPhase(LoopAlgorithms);
+
     setFanSpeed(fanSpeed);
 
     handleExhaustControlButton();
@@ -1060,16 +1239,23 @@ void ControllerApp::task(bool firstTime) {
     HVACState hvacState = setHVAC(heatDemand, coolDemand, fanSpeed);
 
     checkModbusErrors();
+    loopMon_.endPhase(LoopModbus);
 
+    uiManager_->publishState(viewModel_);
     if (firstTime) {
         uiManager_->bootDone();
     }
+    loopMon_.endPhase(LoopUI);
 
     logState(freshAirState, sensorData, ventDemand, fanCoolDemand, heatDemand, coolDemand,
              setpoints, hvacState, fanSpeed, exhaustFanOn_);
+    recordDecision(sensorData, ventDemand, fanCoolDemand, heatDemand, coolDemand, setpoints,
+                   hvacState, fanSpeed);
 
     homeCli_->updateClimateState(config_.systemOn, hvacState, fanSpeed, sensorData.tempC,
                                  setpoints.coolTempC, setpoints.heatTempC);
+    loopMon_.endPhase(LoopLogging);
+    loopMon_.finish(APP_LOOP_INTERVAL_SECS * 1000);
 
     if (pollUIEvent(true)) {
         // If we found something in the queue, clear the queue before proceeeding with
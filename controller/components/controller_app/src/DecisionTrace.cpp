@@ -0,0 +1,49 @@
+#include "DecisionTrace.h"
+
+#include <cmath>
+
+int16_t DecisionTrace::packTemp(double tc) {
+    if (std::isnan(tc) || tc < -300 || tc > 300) {
+        return INVALID_TEMP;
+    }
+    return (int16_t)std::lround(tc * 100);
+}
+
+uint8_t DecisionTrace::packDemand(double demand) {
+    if (std::isnan(demand) || demand <= 0) {
+        return 0;
+    }
+    if (demand >= 1) {
+        return 100;
+    }
+    return (uint8_t)std::lround(demand * 100);
+}
+
+bool DecisionTrace::sameDecision(const Entry &a, const Entry &b) {
+    // Inputs and demands are left out since they change slightly every loop
+    return a.heatCx100 == b.heatCx100 && a.coolCx100 == b.coolCx100 &&
+           a.fanSpeed == b.fanSpeed && a.fanSpeedReason == b.fanSpeedReason &&
+           a.setpointReason == b.setpointReason && a.hvacState == b.hvacState &&
+           a.fancoilSpeed == b.fancoilSpeed && a.acMode == b.acMode && a.flags == b.flags;
+}
+
+void DecisionTrace::add(const Entry &entry) {
+    if (capacity_ == 0) {
+        return;
+    }
+
+    if (size_ > 0) {
+        const Entry &last = get(size_ - 1);
+        // A clock step backwards also gets recorded
+        if (sameDecision(last, entry) && entry.time >= last.time &&
+            entry.time - last.time < DECISION_TRACE_HEARTBEAT_SECS) {
+            return;
+        }
+    }
+
+    buf_[head_] = entry;
+    head_ = (head_ + 1) % capacity_;
+    if (size_ < capacity_) {
+        size_++;
+    }
+}
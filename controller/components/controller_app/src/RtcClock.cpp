@@ -0,0 +1,38 @@
+#include "RtcClock.h"
+
+esp_err_t RtcClock::readEdge(int64_t *rtcSec, int64_t *timerUs) {
+    struct tm dt;
+    esp_err_t err = getTime_(&dt);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int startSec = dt.tm_sec;
+    int64_t deadline = nowUs_() + RTC_EDGE_TIMEOUT_US;
+    while (nowUs_() < deadline) {
+        pollWait_();
+        err = getTime_(&dt);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (dt.tm_sec != startSec) {
+            *timerUs = nowUs_();
+            *rtcSec = RtcDrift::toEpoch(dt);
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t RtcClock::bootTimeUs(const RtcDrift &drift, int64_t *us, bool *ticking) {
+    int64_t rtcSec, timerUs;
+    esp_err_t err = readEdge(&rtcSec, &timerUs);
+    *ticking = err != ESP_ERR_TIMEOUT;
+    if (err != ESP_OK) {
+        return *ticking ? err : ESP_OK;
+    }
+
+    *us = rtcSec * 1000000 - drift.errorUs(rtcSec) + (nowUs_() - timerUs);
+    return ESP_OK;
+}
@@ -0,0 +1,41 @@
+#include "RtcDrift.h"
+
+#include <cstdlib>
+
+int64_t RtcDrift::toEpoch(const struct tm &dt) {
+    // Days from civil, proleptic Gregorian calendar
+    int64_t y = dt.tm_year + 1900;
+    int64_t m = dt.tm_mon + 1;
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + dt.tm_mday - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+
+    return days * 86400 + dt.tm_hour * 3600 + dt.tm_min * 60 + dt.tm_sec;
+}
+
+int64_t RtcDrift::errorUs(int64_t rtcSec) const {
+    if (setAt_ == 0 || rtcSec <= setAt_) {
+        return 0;
+    }
+    // ppb of a second is a microsecond every 1000 seconds
+    return (rtcSec - setAt_) * ppb_ / 1000;
+}
+
+bool RtcDrift::measured(int64_t nowSec, int64_t offsetUs) {
+    int64_t elapsed = nowSec - setAt_;
+    if (setAt_ == 0 || elapsed < RTC_DRIFT_MIN_BASELINE_SECS) {
+        return false;
+    }
+
+    int64_t ppb = offsetUs * 1000 / elapsed;
+    if (std::llabs(ppb) > RTC_DRIFT_MAX_PPB) {
+        return false;
+    }
+
+    // Starts from no correction and settles over a few hourly syncs
+    ppb_ += (ppb - ppb_) / RTC_DRIFT_SMOOTHING;
+    return true;
+}
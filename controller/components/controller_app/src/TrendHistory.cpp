@@ -0,0 +1,86 @@
+#include "TrendHistory.h"
+
+#include <cmath>
+
+static int16_t packTemp(double tc) {
+    if (std::isnan(tc) || tc < -300 || tc > 300) {
+        return TrendHistory::INVALID_TEMP;
+    }
+    return (int16_t)std::lround(tc * 100);
+}
+
+void TrendHistory::add(double inTempC, double heatC, double coolC, uint16_t co2, uint8_t fanPct) {
+    if (capacity_ == 0) {
+        return;
+    }
+
+    buf_[head_] = {
+        .inTempCx100 = packTemp(inTempC),
+        .heatCx100 = packTemp(heatC),
+        .coolCx100 = packTemp(coolC),
+        .co2 = co2,
+        .fanPct = fanPct > 100 ? INVALID_FAN : fanPct,
+    };
+
+    head_ = (head_ + 1) % capacity_;
+    if (size_ < capacity_) {
+        size_++;
+    }
+    generation_++;
+}
+
+namespace {
+struct Accum {
+    int32_t sum = 0;
+    uint16_t n = 0;
+
+    void add(int32_t v) {
+        sum += v;
+        n++;
+    }
+    int32_t avg() const { return (sum + (sum >= 0 ? n / 2 : -(int32_t)(n / 2))) / n; }
+};
+} // namespace
+
+void TrendHistory::downsample(Sample *out, size_t nOut) const {
+    // The window always spans the full capacity so the time axis is stable
+    // while the buffer is filling. Virtual index v (0 = oldest slot in the
+    // window) holds data once v >= capacity_ - size_.
+    size_t firstValid = capacity_ - size_;
+
+    for (size_t b = 0; b < nOut; b++) {
+        size_t start = b * capacity_ / nOut;
+        size_t end = (b + 1) * capacity_ / nOut;
+        if (start < firstValid) {
+            start = firstValid;
+        }
+
+        Accum inTemp, heat, cool, co2, fan;
+        for (size_t v = start; v < end; v++) {
+            const Sample &s = buf_[(head_ + v) % capacity_];
+            if (s.inTempCx100 != INVALID_TEMP) {
+                inTemp.add(s.inTempCx100);
+            }
+            if (s.heatCx100 != INVALID_TEMP) {
+                heat.add(s.heatCx100);
+            }
+            if (s.coolCx100 != INVALID_TEMP) {
+                cool.add(s.coolCx100);
+            }
+            if (s.co2 != INVALID_CO2) {
+                co2.add(s.co2);
+            }
+            if (s.fanPct != INVALID_FAN) {
+                fan.add(s.fanPct);
+            }
+        }
+
+        out[b] = {
+            .inTempCx100 = inTemp.n ? (int16_t)inTemp.avg() : INVALID_TEMP,
+            .heatCx100 = heat.n ? (int16_t)heat.avg() : INVALID_TEMP,
+            .coolCx100 = cool.n ? (int16_t)cool.avg() : INVALID_TEMP,
+            .co2 = co2.n ? (uint16_t)co2.avg() : INVALID_CO2,
+            .fanPct = fan.n ? (uint8_t)fan.avg() : INVALID_FAN,
+        };
+    }
+}
@@ -20,6 +20,7 @@ class MqttHomeClient : public BaseMqttClient, public AbstractHomeClient {
                             double lowTempF) override;
     void updateStaticPressure(uint32_t pressurePa) override;
     void updateName(const char *name) override;
+    void publishDecisionTrace(const char *text, size_t len) override;
 
   protected:
     void onMsg(char *topic, int topicLen, char *data, int dataLen) override;
@@ -61,15 +62,16 @@ class MqttHomeClient : public BaseMqttClient, public AbstractHomeClient {
     char discoveryStr_[3072] = "", discoveryTopic_[64], availabilityTopic_[64],
          currentTempTopic_[64], modeStateTopic_[64], modeCmdTopic_[64], highTempTopic_[64],
          highTempCmdTopic_[64], lowTempTopic_[64], lowTempCmdTopic_[64], actionTopic_[64],
-         staticPressureTopic_[64];
+         staticPressureTopic_[64], traceTopic_[64], traceCmdTopic_[64];
 
-    esp_mqtt_topic_t topics_[6] = {
+    esp_mqtt_topic_t topics_[7] = {
         {.filter = vacationTopic_, .qos = 0},
         {.filter = outdoorTempTopic_, .qos = 0},
         {.filter = airQualityTopic_, .qos = 0},
         {}, // Mode command
         {}, // Temp High command
         {}, // Temp Low command
+        {}, // Decision trace command
     };
 
     static const char *climateModeToS(ClimateMode mode);
@@ -86,6 +88,7 @@ class MqttHomeClient : public BaseMqttClient, public AbstractHomeClient {
 
     void parseModeCmdMessage(const char *data, int dataLen);
     void parseTempCmdMessage(bool high, const char *data, int dataLen);
+    void parseTraceCmdMessage(const char *data, int dataLen);
     void parseVacationMessage(const char *data, int dataLen);
     void parseOutdoorTempMessage(const char *data, int dataLen);
     void parseAirQualityMessage(const char *data, int dataLen);
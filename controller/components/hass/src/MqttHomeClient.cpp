@@ -11,6 +11,12 @@
 
 static const char *TAG = "MQTT";
 
+// Decision trace dumps to MQTT are capped to keep them from filling the outbox,
+// which is in internal RAM: at up to ~230 bytes an entry this is ~11KB
+#define TRACE_DUMP_MAX_ENTRIES 50
+// Serial dumps only cost time
+#define TRACE_SERIAL_DUMP_MAX_ENTRIES 500
+
 static const char *discoveryTmpl = R"({
   "device": {
     "ids": "%s"
@@ -190,6 +196,14 @@ void MqttHomeClient::updateName(const char *name) {
     esp_mqtt_client_reconnect(client_);
 }
 
+void MqttHomeClient::publishDecisionTrace(const char *text, size_t len) {
+    // Enqueue rather than publish so the control loop never blocks on the network
+    int res = esp_mqtt_client_enqueue(client_, traceTopic_, text, len, 0, false, true);
+    if (res < 0) {
+        ESP_LOGE(TAG, "Error enqueuing decision trace (%d)", res);
+    }
+}
+
 namespace {
 bool matchesTopic(const char *receivedTopic, int receivedTopicLen, const char *expectedTopic) {
     return receivedTopicLen == strlen(expectedTopic) &&
@@ -210,6 +224,8 @@ void MqttHomeClient::onMsg(char *topic, int topicLen, char *data, int dataLen) {
         parseTempCmdMessage(true, data, dataLen);
     } else if (matchesTopic(topic, topicLen, lowTempCmdTopic_)) {
         parseTempCmdMessage(false, data, dataLen);
+    } else if (matchesTopic(topic, topicLen, traceCmdTopic_)) {
+        parseTraceCmdMessage(data, dataLen);
     } else {
         ESP_LOGW(TAG, "Received message on unknown topic: %.*s", topicLen, topic);
     }
@@ -339,6 +355,8 @@ void MqttHomeClient::updateTopics(const char *name) {
     snprintf(actionTopic_, sizeof(actionTopic_), "home/%s/action", name);
     snprintf(staticPressureTopic_, sizeof(staticPressureTopic_), "home/%s/static_pressure_pa/state",
              name);
+    snprintf(traceTopic_, sizeof(traceTopic_), "home/%s/trace", name);
+    snprintf(traceCmdTopic_, sizeof(traceCmdTopic_), "home/%s/trace/cmd", name);
 
     snprintf(discoveryTopic_, sizeof(discoveryTopic_), "homeassistant/device/%s/config", name);
     snprintf(discoveryStr_, sizeof(discoveryStr_), discoveryTmpl, name, name, availabilityTopic_,
@@ -346,6 +364,8 @@ void MqttHomeClient::updateTopics(const char *name) {
              lowTempTopic_, lowTempCmdTopic_, actionTopic_, name, currentTempTopic_, name,
              staticPressureTopic_);
 
+    setHealthDevice(name);
+
     config_.session.last_will.msg = "0";
     config_.session.last_will.topic = availabilityTopic_;
     config_.session.last_will.retain = true;
@@ -353,6 +373,7 @@ void MqttHomeClient::updateTopics(const char *name) {
     topics_[3].filter = modeCmdTopic_;
     topics_[4].filter = highTempCmdTopic_;
     topics_[5].filter = lowTempCmdTopic_;
+    topics_[6].filter = traceCmdTopic_;
 }
 
 int MqttHomeClient::publishDiscoveryMessage() {
@@ -426,6 +447,39 @@ void MqttHomeClient::parseTempCmdMessage(bool high, const char *data, int dataLe
     eventCb_(evt);
 }
 
+// "<count>" publishes the most recent entries to the trace topic and
+// "serial <count>" logs them to the console instead
+void MqttHomeClient::parseTraceCmdMessage(const char *data, int dataLen) {
+    char buffer[dataLen + 1];
+    memcpy(buffer, data, dataLen);
+    buffer[dataLen] = '\0';
+
+    bool serial = false;
+    const char *countStr = buffer;
+    if (strncmp(buffer, "serial ", 7) == 0) {
+        serial = true;
+        countStr += 7;
+    }
+
+    unsigned count;
+    if (sscanf(countStr, "%u", &count) != 1 || count == 0) {
+        ESP_LOGW(TAG, "Failed to parse trace command: %.*s", dataLen, data);
+        return;
+    }
+
+    unsigned maxCount = serial ? TRACE_SERIAL_DUMP_MAX_ENTRIES : TRACE_DUMP_MAX_ENTRIES;
+    AbstractUIManager::Event evt{
+        .type = AbstractUIManager::EventType::DumpDecisionTrace,
+        .payload{.decisionTraceDump =
+                     {
+                         .count = (uint16_t)std::min(count, maxCount),
+                         .serial = serial,
+                     }},
+    };
+
+    eventCb_(evt);
+}
+
 void MqttHomeClient::parseVacationMessage(const char *data, int dataLen) {
     xSemaphoreTake(mutex_, portMAX_DELAY);
 
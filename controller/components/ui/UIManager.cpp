@@ -1,10 +1,14 @@
 #include "UIManager.h"
 
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <cmath>
+#include <cstring>
 
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "ui_utils.h"
 
 using HVACState = ControllerDomain::HVACState;
@@ -17,6 +21,25 @@ using Config = ControllerDomain::Config;
 #define MIN_HEAT_COOL_DELTA_DEG 2
 #define MIN_HEAT_COOL_DELTA_C ABS_F_TO_C(MIN_HEAT_COOL_DELTA_DEG)
 
+// One sample a minute for 24h, shown as 10 minute averages
+#define TREND_SAMPLE_MS (60 * 1000)
+#define TREND_HISTORY_LEN (24 * 60)
+#define TREND_CHART_POINTS 144
+#define TREND_N_SERIES 5
+#define TREND_DEFAULT_MIN_DECI_F 600
+#define TREND_DEFAULT_MAX_DECI_F 800
+#define TREND_MIN_CO2_RANGE 1200
+
+// Backlight level through the day and night schedule periods, ramped over
+// the first BRIGHTNESS_RAMP_MINS of each period
+#define DAY_BRIGHTNESS_PCT 100
+#define NIGHT_BRIGHTNESS_PCT 35
+#define BRIGHTNESS_RAMP_MINS 30
+
+static_assert(NUM_SCHEDULE_TIMES == 2, "One brightness level per schedule period");
+static const uint8_t scheduleBrightnessPct[NUM_SCHEDULE_TIMES] = {DAY_BRIGHTNESS_PCT,
+                                                                  NIGHT_BRIGHTNESS_PCT};
+
 static const char *TAG = "UI";
 
 lv_obj_t **wifiTextareas[] = {
@@ -32,12 +55,65 @@ lv_obj_t **wifiContainers[] = {
 
 size_t nWifiTextareas = std::size(wifiTextareas);
 
+// Heat/cool setpoint roller pairs that share the temp limits
+lv_obj_t **tempRollerPairs[][2] = {
+    {&ui_Heat_override_setpoint, &ui_Cool_override_setpoint},
+    {&ui_Day_heat_setpoint, &ui_Day_cool_setpoint},
+    {&ui_Night_heat_setpoint, &ui_Night_cool_setpoint},
+};
+
+// Roller options for every whole degree, "1\n2\n...\n99", built at compile
+// time. Any range of degrees is a substring, so setting up a roller is a copy
+// rather than formatting each value.
+struct TempRollerOptions {
+    static constexpr int MAX_DEG = 99;
+
+    char text[9 * 2 + 90 * 3];
+    uint16_t start[MAX_DEG + 1]; // Offset of each degree's text
+
+    constexpr TempRollerOptions() : text(), start() {
+        size_t pos = 0;
+        for (int deg = 1; deg <= MAX_DEG; deg++) {
+            start[deg] = pos;
+            if (deg >= 10) {
+                text[pos++] = '0' + deg / 10;
+            }
+            text[pos++] = '0' + deg % 10;
+            text[pos++] = '\n';
+        }
+    }
+
+    // Length of the options from minDeg to maxDeg, without the trailing newline
+    constexpr size_t len(uint8_t minDeg, uint8_t maxDeg) const {
+        return start[maxDeg] + (maxDeg >= 10 ? 2 : 1) - start[minDeg];
+    }
+};
+static constexpr TempRollerOptions tempRollerOptions;
+static_assert(tempRollerOptions.len(1, 99) == sizeof(tempRollerOptions.text) - 1);
+
+// Bytes LVGL has allocated. lv_mem_monitor only sees LVGL's own pool, with
+// LV_MEM_CUSTOM its objects come from the heap instead.
+static size_t lvglUsedBytes() {
+#if LV_MEM_CUSTOM
+    return heap_caps_get_total_size(MALLOC_CAP_DEFAULT) -
+           heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+#else
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+    return mon.total_size - mon.free_size;
+#endif
+}
+
 uint8_t getTempOffsetTenthDeg(lv_obj_t *roller) { return lv_roller_get_selected(roller) - 50; }
 
 double getTempOffsetF(lv_obj_t *roller) { return ((double)getTempOffsetTenthDeg(roller)) / 10; }
 
 uint16_t tempOffsetRollerOpt(double tempOffsetC) { return REL_C_TO_F(tempOffsetC) * 10 + 50; }
 
+static int displayDegF(double tc) { return std::isnan(tc) ? INT_MIN : std::round(ABS_C_TO_F(tc)); }
+
+static int displayFanPct(uint8_t speed) { return std::round(speed / 255.0 * 100); }
+
 void updateClk() {
     struct tm dt;
     time_t nowUTC = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
@@ -74,6 +150,58 @@ void coolRollerChangeCb(lv_event_t *e) {
 
 void restartCb(lv_event_t *e) { ((UIManager *)lv_event_get_user_data(e))->eRestart(); }
 
+void trendTimerCb(lv_timer_t *timer) { ((UIManager *)timer->user_data)->recordTrendSample(); }
+
+void homeGestureCb(lv_event_t *e) {
+    if (lv_indev_get_gesture_dir(lv_indev_get_act()) == LV_DIR_LEFT) {
+        lv_indev_wait_release(lv_indev_get_act());
+        ((UIManager *)lv_event_get_user_data(e))->eShowTrends();
+    }
+}
+
+void trendScreenEventCb(lv_event_t *e) {
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_SCREEN_LOAD_START) {
+        ((UIManager *)lv_event_get_user_data(e))->eTrendsLoadStart();
+    } else if (code == LV_EVENT_GESTURE &&
+               lv_indev_get_gesture_dir(lv_indev_get_act()) == LV_DIR_RIGHT) {
+        lv_indev_wait_release(lv_indev_get_act());
+        _ui_screen_change(&ui_Home, LV_SCR_LOAD_ANIM_NONE, 0, 0, &ui_Home_screen_init);
+    }
+}
+
+void trendBackCb(lv_event_t *e) {
+    _ui_screen_change(&ui_Home, LV_SCR_LOAD_ANIM_NONE, 0, 0, &ui_Home_screen_init);
+}
+
+// Tick labels: temps are plotted in tenths of a degree F, time as hours ago
+void trendTickLabelCb(lv_event_t *e) {
+    lv_obj_draw_part_dsc_t *dsc = lv_event_get_draw_part_dsc(e);
+    if (!lv_obj_draw_part_check_type(dsc, &lv_chart_class, LV_CHART_DRAW_PART_TICK_LABEL) ||
+        !dsc->text) {
+        return;
+    }
+
+    static const char *hourLabels[] = {"-24h", "-18h", "-12h", "-6h", "now"};
+    int32_t divisor = (intptr_t)lv_event_get_user_data(e);
+    if (dsc->id == LV_CHART_AXIS_PRIMARY_X) {
+        if (dsc->value >= 0 && dsc->value < (int32_t)std::size(hourLabels)) {
+            lv_snprintf(dsc->text, dsc->text_length, "%s", hourLabels[dsc->value]);
+        }
+    } else if (dsc->id == LV_CHART_AXIS_SECONDARY_Y) {
+        lv_snprintf(dsc->text, dsc->text_length, "%d%%", (int)dsc->value);
+    } else if (dsc->id == LV_CHART_AXIS_PRIMARY_Y) {
+        lv_snprintf(dsc->text, dsc->text_length, "%d", (int)(dsc->value / divisor));
+    }
+}
+
+static lv_coord_t trendDeciF(int16_t cx100) {
+    if (cx100 == TrendHistory::INVALID_TEMP) {
+        return LV_CHART_POINT_NONE;
+    }
+    return std::lround(ABS_C_TO_F(cx100 / 100.0) * 10);
+}
+
 void UIManager::bootDone() {
     xSemaphoreTake(mutex_, portMAX_DELAY);
     booted_ = true;
@@ -120,9 +248,6 @@ double UIManager::getCoolRollerValueC(lv_obj_t *roller) {
 void UIManager::setupTempRollerPair(lv_obj_t *heatRoller, lv_obj_t *coolRoller) {
     setupTempRoller(heatRoller, MIN_HEAT_DEG, maxHeatDeg_);
     setupTempRoller(coolRoller, minCoolDeg_, MAX_COOL_DEG);
-
-    lv_obj_add_event_cb(heatRoller, heatRollerChangeCb, LV_EVENT_VALUE_CHANGED, coolRoller);
-    lv_obj_add_event_cb(coolRoller, coolRollerChangeCb, LV_EVENT_VALUE_CHANGED, heatRoller);
 }
 
 // Maintain the minimum separation between heat/cool setpoints as rollers update
@@ -149,13 +274,19 @@ void UIManager::setupTempRoller(lv_obj_t *roller, uint8_t minDeg, uint8_t maxDeg
         minDeg = 70;
     }
 
-    char opts[300] = "";
-    size_t pos = 0;
-    for (uint8_t currDeg = minDeg; currDeg < maxDeg; currDeg++) {
-        pos += snprintf(opts + pos, sizeof(opts) - pos, "%u\n", currDeg);
+    const char *rangeOpts = tempRollerOptions.text + tempRollerOptions.start[minDeg];
+    size_t len = tempRollerOptions.len(minDeg, maxDeg);
+
+    // Setting options reallocates the roller's text and resets its selection,
+    // so leave it alone if the range hasn't changed
+    const char *currOpts = lv_roller_get_options(roller);
+    if (strlen(currOpts) == len && memcmp(currOpts, rangeOpts, len) == 0) {
+        return;
     }
-    sprintf(opts + pos, "%u", maxDeg); // No trailing newline on the last element
 
+    char opts[sizeof(tempRollerOptions.text)];
+    memcpy(opts, rangeOpts, len);
+    opts[len] = '\0'; // No trailing newline on the last element
     lv_roller_set_options(roller, opts, LV_ROLLER_MODE_NORMAL);
 }
 
@@ -467,9 +598,9 @@ void UIManager::updateTempLimits(uint8_t maxHeatDeg, uint8_t minCoolDeg) {
     maxHeatDeg_ = maxHeatDeg;
     minCoolDeg_ = minCoolDeg;
 
-    setupTempRollerPair(ui_Heat_override_setpoint, ui_Cool_override_setpoint);
-    setupTempRollerPair(ui_Day_heat_setpoint, ui_Day_cool_setpoint);
-    setupTempRollerPair(ui_Night_heat_setpoint, ui_Night_cool_setpoint);
+    for (auto &pair : tempRollerPairs) {
+        setupTempRollerPair(*pair[0], *pair[1]);
+    }
 }
 
 void UIManager::updateUIForEquipment() {
@@ -570,6 +701,205 @@ void UIManager::initExtraWidgets() {
     lv_obj_add_flag(continuousFanDropdown_, LV_OBJ_FLAG_SCROLL_ON_FOCUS); /// Flags
 }
 
+void UIManager::initTrends() {
+    // Everything here is sized at compile time and goes to PSRAM. If that
+    // fails we run without history rather than eat into internal RAM.
+    trendSamples_ = (TrendHistory::Sample *)heap_caps_calloc(
+        TREND_HISTORY_LEN, sizeof(TrendHistory::Sample), MALLOC_CAP_SPIRAM);
+    trendBuckets_ = (TrendHistory::Sample *)heap_caps_calloc(
+        TREND_CHART_POINTS, sizeof(TrendHistory::Sample), MALLOC_CAP_SPIRAM);
+    trendPoints_ = (lv_coord_t *)heap_caps_calloc(TREND_CHART_POINTS * TREND_N_SERIES,
+                                                  sizeof(lv_coord_t), MALLOC_CAP_SPIRAM);
+    if (!trendSamples_ || !trendBuckets_ || !trendPoints_) {
+        ESP_LOGE(TAG, "Unable to allocate trend history");
+        heap_caps_free(trendSamples_);
+        heap_caps_free(trendBuckets_);
+        heap_caps_free(trendPoints_);
+        trendSamples_ = trendBuckets_ = nullptr;
+        trendPoints_ = nullptr;
+    }
+    trendHistory_ = new TrendHistory(trendSamples_, TREND_HISTORY_LEN);
+
+    for (int i = 0; trendPoints_ && i < TREND_CHART_POINTS * TREND_N_SERIES; i++) {
+        trendPoints_[i] = LV_CHART_POINT_NONE;
+    }
+
+    lv_obj_add_event_cb(ui_Home, homeGestureCb, LV_EVENT_GESTURE, this);
+    trendTimer_ = lv_timer_create(trendTimerCb, TREND_SAMPLE_MS, this);
+}
+
+// Charts sit in a fixed container that leaves room around the plot for
+// tick labels, since flex layout ignores the chart's own offset.
+static lv_obj_t *createTrendChart(lv_obj_t *parent, lv_coord_t height, intptr_t yDivisor,
+                                  bool timeAxis) {
+    lv_obj_t *container = lv_obj_create(parent);
+    lv_obj_remove_style_all(container);
+    lv_obj_set_width(container, 300);
+    lv_obj_set_height(container, height + 16 + (timeAxis ? 20 : 0));
+    lv_obj_clear_flag(container, LV_OBJ_FLAG_SCROLLABLE); /// Flags
+
+    lv_obj_t *chart = lv_chart_create(container);
+    lv_obj_set_width(chart, 230);
+    lv_obj_set_height(chart, height);
+    lv_obj_set_x(chart, 40);
+    lv_obj_set_y(chart, 8);
+    lv_chart_set_type(chart, LV_CHART_TYPE_LINE);
+    lv_chart_set_point_count(chart, TREND_CHART_POINTS);
+    lv_chart_set_div_line_count(chart, 3, 3);
+    lv_obj_clear_flag(chart, LV_OBJ_FLAG_SCROLLABLE | LV_OBJ_FLAG_CLICKABLE);
+
+    lv_obj_set_style_bg_opa(chart, 0, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_border_color(chart, lv_color_hex(0x444444), LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_line_color(chart, lv_color_hex(0x333333), LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_pad_all(chart, 0, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_line_width(chart, 2, LV_PART_ITEMS | LV_STATE_DEFAULT);
+    lv_obj_set_style_size(chart, 0, LV_PART_INDICATOR | LV_STATE_DEFAULT); // No point markers
+    lv_obj_set_style_text_font(chart, &lv_font_montserrat_14, LV_PART_TICKS | LV_STATE_DEFAULT);
+    lv_obj_set_style_text_color(chart, lv_color_hex(0x808080), LV_PART_TICKS | LV_STATE_DEFAULT);
+    lv_obj_set_style_line_color(chart, lv_color_hex(0x444444), LV_PART_TICKS | LV_STATE_DEFAULT);
+
+    lv_chart_set_axis_tick(chart, LV_CHART_AXIS_PRIMARY_Y, 4, 0, 3, 1, true, 40);
+    if (timeAxis) {
+        lv_chart_set_axis_tick(chart, LV_CHART_AXIS_PRIMARY_X, 4, 0, 5, 1, true, 20);
+    }
+    lv_obj_add_event_cb(chart, trendTickLabelCb, LV_EVENT_DRAW_PART_BEGIN, (void *)yDivisor);
+    return chart;
+}
+
+// Built on first use so the screen costs nothing for users who never open it
+void UIManager::initTrendScreen() {
+    trendScreen_ = lv_obj_create(NULL);
+    lv_obj_clear_flag(trendScreen_, LV_OBJ_FLAG_SCROLLABLE); /// Flags
+    lv_obj_set_flex_flow(trendScreen_, LV_FLEX_FLOW_COLUMN);
+    lv_obj_set_flex_align(trendScreen_, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START,
+                          LV_FLEX_ALIGN_START);
+    lv_obj_set_style_pad_left(trendScreen_, 10, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_pad_right(trendScreen_, 10, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_pad_top(trendScreen_, 0, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_pad_bottom(trendScreen_, 0, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_pad_row(trendScreen_, 4, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_add_event_cb(trendScreen_, trendScreenEventCb, LV_EVENT_ALL, this);
+
+    lv_obj_t *header = ui_Setting_header_create(trendScreen_);
+    lv_label_set_text(ui_comp_get_child(header, UI_COMP_SETTING_HEADER_SETTING_TITLE), "24H TRENDS");
+    lv_obj_add_flag(ui_comp_get_child(header, UI_COMP_SETTING_HEADER_SETTING_ACCEPT_BUTTON),
+                    LV_OBJ_FLAG_HIDDEN);
+    lv_obj_add_event_cb(ui_comp_get_child(header, UI_COMP_SETTING_HEADER_SETTING_BACK_BUTTON),
+                        trendBackCb, LV_EVENT_CLICKED, this);
+
+    lv_obj_t *legend = lv_label_create(trendScreen_);
+    lv_obj_set_width(legend, 300);
+    lv_obj_set_height(legend, LV_SIZE_CONTENT); /// 1
+    lv_label_set_recolor(legend, true);
+    lv_label_set_text(legend, "#FFFFFF IN#   #FF9040 HEAT#   #4CAFFF COOL#   #80E080 CO2#   "
+                              "#A0A0A0 FAN#");
+    lv_obj_set_style_text_align(legend, LV_TEXT_ALIGN_CENTER, LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_text_font(legend, &lv_font_montserrat_14, LV_PART_MAIN | LV_STATE_DEFAULT);
+
+    trendTempChart_ = createTrendChart(trendScreen_, 70, 10, false);
+    trendHeatSer_ =
+        lv_chart_add_series(trendTempChart_, lv_color_hex(0xFF9040), LV_CHART_AXIS_PRIMARY_Y);
+    trendCoolSer_ =
+        lv_chart_add_series(trendTempChart_, lv_color_hex(0x4CAFFF), LV_CHART_AXIS_PRIMARY_Y);
+    trendInSer_ =
+        lv_chart_add_series(trendTempChart_, lv_color_hex(0xFFFFFF), LV_CHART_AXIS_PRIMARY_Y);
+
+    trendAirChart_ = createTrendChart(trendScreen_, 45, 1, true);
+    lv_chart_set_range(trendAirChart_, LV_CHART_AXIS_SECONDARY_Y, 0, 100);
+    lv_chart_set_axis_tick(trendAirChart_, LV_CHART_AXIS_SECONDARY_Y, 4, 0, 2, 1, true, 30);
+    trendFanSer_ =
+        lv_chart_add_series(trendAirChart_, lv_color_hex(0xA0A0A0), LV_CHART_AXIS_SECONDARY_Y);
+    trendCO2Ser_ =
+        lv_chart_add_series(trendAirChart_, lv_color_hex(0x80E080), LV_CHART_AXIS_PRIMARY_Y);
+
+    // The charts draw straight from the PSRAM point arrays filled by drawTrends
+    if (trendPoints_) {
+        lv_chart_series_t *series[TREND_N_SERIES] = {trendInSer_, trendHeatSer_, trendCoolSer_,
+                                                     trendCO2Ser_, trendFanSer_};
+        for (int i = 0; i < TREND_N_SERIES; i++) {
+            lv_obj_t *chart = i < 3 ? trendTempChart_ : trendAirChart_;
+            lv_chart_set_ext_y_array(chart, series[i], trendPoints_ + i * TREND_CHART_POINTS);
+        }
+    }
+    trendDrawnGen_ = UINT32_MAX; // Force the first draw
+}
+
+// Reduce the history to chart resolution. Only runs while the trend screen is
+// showing and a new sample has arrived since the last draw.
+void UIManager::drawTrends() {
+    if (!trendPoints_ || trendHistory_->generation() == trendDrawnGen_) {
+        return;
+    }
+    trendDrawnGen_ = trendHistory_->generation();
+
+    trendHistory_->downsample(trendBuckets_, TREND_CHART_POINTS);
+
+    lv_coord_t *inPts = trendPoints_;
+    lv_coord_t *heatPts = inPts + TREND_CHART_POINTS;
+    lv_coord_t *coolPts = heatPts + TREND_CHART_POINTS;
+    lv_coord_t *co2Pts = coolPts + TREND_CHART_POINTS;
+    lv_coord_t *fanPts = co2Pts + TREND_CHART_POINTS;
+
+    lv_coord_t minT = INT16_MAX, maxT = INT16_MIN, maxCO2 = 0;
+    for (int i = 0; i < TREND_CHART_POINTS; i++) {
+        const TrendHistory::Sample &b = trendBuckets_[i];
+        inPts[i] = trendDeciF(b.inTempCx100);
+        heatPts[i] = trendDeciF(b.heatCx100);
+        coolPts[i] = trendDeciF(b.coolCx100);
+        co2Pts[i] = b.co2 == TrendHistory::INVALID_CO2 ? LV_CHART_POINT_NONE : b.co2;
+        fanPts[i] = b.fanPct == TrendHistory::INVALID_FAN ? LV_CHART_POINT_NONE : b.fanPct;
+
+        for (lv_coord_t t : {inPts[i], heatPts[i], coolPts[i]}) {
+            if (t != LV_CHART_POINT_NONE) {
+                minT = std::min(minT, t);
+                maxT = std::max(maxT, t);
+            }
+        }
+        if (co2Pts[i] != LV_CHART_POINT_NONE) {
+            maxCO2 = std::max(maxCO2, co2Pts[i]);
+        }
+    }
+
+    // Whole-degree bounds with a degree of headroom either side
+    if (minT > maxT) {
+        minT = TREND_DEFAULT_MIN_DECI_F;
+        maxT = TREND_DEFAULT_MAX_DECI_F;
+    } else {
+        minT = (minT / 10 - 1) * 10;
+        maxT = (maxT / 10 + 2) * 10;
+    }
+    lv_chart_set_range(trendTempChart_, LV_CHART_AXIS_PRIMARY_Y, minT, maxT);
+    lv_chart_set_range(trendAirChart_, LV_CHART_AXIS_PRIMARY_Y, 400,
+                       std::max<lv_coord_t>(TREND_MIN_CO2_RANGE, (maxCO2 / 200 + 1) * 200));
+
+    lv_chart_refresh(trendTempChart_);
+    lv_chart_refresh(trendAirChart_);
+}
+
+void UIManager::recordTrendSample() {
+    if (!booted_) {
+        return;
+    }
+
+    const ViewModel &vm = appliedVM_;
+    trendHistory_->add(vm.inTempC, vm.heatC, vm.coolC, vm.inCO2, displayFanPct(vm.fanSpeed));
+    if (trendScreen_ && lv_scr_act() == trendScreen_) {
+        drawTrends();
+    }
+}
+
+void UIManager::eShowTrends() {
+    if (!trendScreen_) {
+        initTrendScreen();
+    }
+    lv_scr_load_anim(trendScreen_, LV_SCR_LOAD_ANIM_NONE, 0, 0, false);
+}
+
+void UIManager::eTrendsLoadStart() {
+    ESP_LOGD(TAG, "trendsLoadStart");
+    drawTrends();
+}
+
 void UIManager::sendEvent(Event &evt) {
     // Release the mutex while calling the event callback to avoid deadlock.
     // Usually this thread will be holding the mutex via handleTasks
@@ -586,6 +916,7 @@ void UIManager::sendEvent(Event &evt) {
 UIManager::UIManager(ControllerDomain::Config config, size_t nMsgIds, eventCb_t eventCb)
     : eventCb_(eventCb) {
     mutex_ = xSemaphoreCreateMutex();
+    vmMutex_ = xSemaphoreCreateMutex();
 
     inTempOffsetC_ = config.inTempOffsetC;
     outTempOffsetC_ = config.outTempOffsetC;
@@ -596,13 +927,13 @@ UIManager::UIManager(ControllerDomain::Config config, size_t nMsgIds, eventCb_t
 
     ui_init();
     initExtraWidgets();
+    initTrends();
 
     sleepMgr_ = new SleepManager(ui_Home, GPIO_NUM_48);
 
-    setAQI(-1);
-    setInTempC(std::nan(""));
-    setOutTempC(std::nan(""));
-    setSystemPowerInternal(config.systemOn);
+    pendingVM_.systemOn = config.systemOn;
+    vmPending_ = true;
+    applyViewModel();
 
     for (int i = 0; i < nWifiTextareas; i++) {
         lv_obj_add_event_cb(*wifiTextareas[i], wifiTextareaEventCb, LV_EVENT_ALL, this);
@@ -611,10 +942,20 @@ UIManager::UIManager(ControllerDomain::Config config, size_t nMsgIds, eventCb_t
     for (int i = 0; i < NUM_SCHEDULE_TIMES; i++) {
         currSchedules_[i] = config.schedules[i];
     }
+
+    int64_t rollerStartUs = esp_timer_get_time();
+    size_t rollerStartUsed = lvglUsedBytes();
+    for (auto &pair : tempRollerPairs) {
+        lv_obj_add_event_cb(*pair[0], heatRollerChangeCb, LV_EVENT_VALUE_CHANGED, *pair[1]);
+        lv_obj_add_event_cb(*pair[1], coolRollerChangeCb, LV_EVENT_VALUE_CHANGED, *pair[0]);
+    }
     updateTempLimits(std::round(ABS_C_TO_F(config.maxHeatC)),
                      std::round(ABS_C_TO_F(config.minCoolC)));
     setupTempRoller(ui_heat_limit, TEMP_LIMIT_ROLLER_START, TEMP_LIMIT_ROLLER_END);
     setupTempRoller(ui_cool_limit, TEMP_LIMIT_ROLLER_START, TEMP_LIMIT_ROLLER_END);
+    ESP_LOGI(TAG, "temp rollers set up in %lldus using %db heap",
+             esp_timer_get_time() - rollerStartUs,
+             (int)(lvglUsedBytes() - rollerStartUsed));
 
     lv_label_set_text_fmt(ui_co2_target_value, "%u", config.co2Target);
 
@@ -631,17 +972,143 @@ UIManager::UIManager(ControllerDomain::Config config, size_t nMsgIds, eventCb_t
 
 uint32_t UIManager::handleTasks() {
     xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (!uiTask_) {
+        uiTask_ = xTaskGetCurrentTaskHandle();
+    }
 
+    applyViewModel();
+    updateBrightness();
     if (booted_) {
         sleepMgr_->update();
     }
-    auto rv = lv_timer_handler();
+    uint32_t rv = sleepMgr_->handleTimers();
+
+    if (sleepMgr_->asleep()) {
+        // LVGL timers are paused while the display sleeps but the trend
+        // history should keep its one minute cadence
+        uint32_t elapsed = lv_tick_elaps(trendTimer_->last_run);
+        if (elapsed >= trendTimer_->period) {
+            lv_timer_reset(trendTimer_);
+            recordTrendSample();
+        } else {
+            rv = std::min(rv, trendTimer_->period - elapsed);
+        }
+    }
     xSemaphoreGive(mutex_);
     return rv;
 }
 
-void UIManager::setAQI(int16_t aqi) {
+// Follow the schedule periods, re-evaluated once a minute
+void UIManager::updateBrightness() {
+    time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if (now / 60 == brightnessMin_) {
+        return;
+    }
+    brightnessMin_ = now / 60;
+
+    struct tm dt;
+    localtime_r(&now, &dt);
+    if (dt.tm_year < 120) {
+        // Before 2020--time must be invalid
+        sleepMgr_->setBrightness(DAY_BRIGHTNESS_PCT);
+        return;
+    }
+
+    // Schedules are in order from midnight, so before the first start time
+    // the last period from the previous day is still active
+    int minOfDay = dt.tm_hour * 60 + dt.tm_min;
+    int curr = NUM_SCHEDULE_TIMES - 1;
+    for (int i = 0; i < NUM_SCHEDULE_TIMES; i++) {
+        if (currSchedules_[i].startMinOfDay() <= minOfDay) {
+            curr = i;
+        }
+    }
+    int prev = (curr + NUM_SCHEDULE_TIMES - 1) % NUM_SCHEDULE_TIMES;
+    int minsIn = (minOfDay - currSchedules_[curr].startMinOfDay() + 24 * 60) % (24 * 60);
+
+    int pct = scheduleBrightnessPct[curr];
+    if (minsIn < BRIGHTNESS_RAMP_MINS) {
+        pct = scheduleBrightnessPct[prev] +
+              (pct - scheduleBrightnessPct[prev]) * minsIn / BRIGHTNESS_RAMP_MINS;
+    }
+    sleepMgr_->setBrightness(pct);
+}
+
+void UIManager::publishState(const ViewModel &vm) {
+    xSemaphoreTake(vmMutex_, portMAX_DELAY);
+    vmPublishes_++;
+    bool wasPending = vmPending_;
+    if (wasPending) {
+        vmCoalesced_++;
+    }
+    pendingVM_ = vm;
+    vmPending_ = true;
+    xSemaphoreGive(vmMutex_);
+
+    // Wake the UI task so the change is applied without waiting out its
+    // delay, which can be long while the display sleeps
+    if (!wasPending && uiTask_) {
+        xTaskNotifyGive(uiTask_);
+    }
+}
+
+// NB: Only call while holding mutex_
+void UIManager::applyViewModel() {
+    xSemaphoreTake(vmMutex_, portMAX_DELAY);
+    if (!vmPending_) {
+        xSemaphoreGive(vmMutex_);
+        return;
+    }
+    ViewModel vm = pendingVM_;
+    vmPending_ = false;
+    xSemaphoreGive(vmMutex_);
+
+    // Compare what would be displayed rather than raw values so sensor noise
+    // below the display resolution doesn't invalidate anything.
+    const ViewModel &prev = appliedVM_;
+    bool all = !vmApplied_;
+    auto apply = [this](bool changed, auto fn) {
+        if (changed) {
+            fn();
+            vmFieldUpdates_++;
+        } else {
+            vmFieldSkips_++;
+        }
+    };
+
+    apply(all || vm.aqi != prev.aqi, [&] { setAQI(vm.aqi); });
+    apply(all || displayFanPct(vm.fanSpeed) != displayFanPct(prev.fanSpeed),
+          [&] { setCurrentFanSpeed(vm.fanSpeed); });
+    apply(all || displayDegF(vm.outTempC) != displayDegF(prev.outTempC),
+          [&] { setOutTempC(vm.outTempC); });
+    apply(all || displayDegF(vm.inTempC) != displayDegF(prev.inTempC),
+          [&] { setInTempC(vm.inTempC); });
+    apply(all || vm.inCO2 != prev.inCO2, [&] { setInCO2(vm.inCO2); });
+    apply(all || vm.hvacState != prev.hvacState, [&] { setHVACState(vm.hvacState); });
+    apply(all || displayDegF(vm.heatC) != displayDegF(prev.heatC) ||
+              displayDegF(vm.coolC) != displayDegF(prev.coolC),
+          [&] { setCurrentSetpoints(vm.heatC, vm.coolC); });
+    apply(all || vm.systemOn != prev.systemOn, [&] { setSystemPowerInternal(vm.systemOn); });
+
+    // Raw values are kept for the offsets screen and trend history
+    currInTempC_ = vm.inTempC;
+    currOutTempC_ = vm.outTempC;
+    appliedVM_ = vm;
+    vmApplied_ = true;
+}
+
+void UIManager::logStats() {
+    xSemaphoreTake(vmMutex_, portMAX_DELAY);
+    ESP_LOGW(TAG, "view model publishes=%lu coalesced=%lu field_updates=%lu field_skips=%lu",
+             vmPublishes_, vmCoalesced_, vmFieldUpdates_, vmFieldSkips_);
+    xSemaphoreGive(vmMutex_);
+
     xSemaphoreTake(mutex_, portMAX_DELAY);
+    sleepMgr_->logStats();
+    xSemaphoreGive(mutex_);
+}
+
+void UIManager::setAQI(int16_t aqi) {
     if (aqi > 999 || aqi < 0) {
         lv_label_set_text(ui_AQI_value, "---");
     } else {
@@ -663,55 +1130,41 @@ void UIManager::setAQI(int16_t aqi) {
                                 LV_PART_MAIN | LV_STATE_DEFAULT);
     lv_obj_set_style_text_color(ui_AQI_value, lv_color_hex(color),
                                 LV_PART_MAIN | LV_STATE_DEFAULT);
-
-    xSemaphoreGive(mutex_);
 }
 
 void UIManager::setCurrentFanSpeed(uint8_t speed) {
-    xSemaphoreTake(mutex_, portMAX_DELAY);
     if (speed == 0) {
         lv_label_set_text(ui_Fan_value, "OFF");
     } else {
-        lv_label_set_text_fmt(ui_Fan_value, "%u%%", (uint)std::round(speed / 255.0 * 100));
+        lv_label_set_text_fmt(ui_Fan_value, "%u%%", displayFanPct(speed));
     }
-    xSemaphoreGive(mutex_);
 }
 
 void UIManager::setOutTempC(double tc) {
-    xSemaphoreTake(mutex_, portMAX_DELAY);
-    currOutTempC_ = tc;
     if (std::isnan(tc)) {
         lv_label_set_text(ui_Out_temp_value, "--°");
     } else {
         lv_label_set_text_fmt(ui_Out_temp_value, "%u°", (uint)std::round(ABS_C_TO_F(tc)));
     }
-    xSemaphoreGive(mutex_);
 }
 
 void UIManager::setInTempC(double tc) {
-    xSemaphoreTake(mutex_, portMAX_DELAY);
-    currInTempC_ = tc;
     if (std::isnan(tc)) {
         lv_label_set_text(ui_Indoor_temp_value, "--");
     } else {
         lv_label_set_text_fmt(ui_Indoor_temp_value, "%u", (uint)std::round(ABS_C_TO_F(tc)));
     }
-    xSemaphoreGive(mutex_);
 }
 
 void UIManager::setInCO2(uint16_t ppm) {
-    xSemaphoreTake(mutex_, portMAX_DELAY);
     if (ppm == 0) {
         lv_label_set_text(ui_co2_value, "--");
     } else {
         lv_label_set_text_fmt(ui_co2_value, "%u", ppm);
     }
-
-    xSemaphoreGive(mutex_);
 }
 
 void UIManager::setHVACState(ControllerDomain::HVACState state) {
-    xSemaphoreTake(mutex_, portMAX_DELAY);
     if (state == HVACState::Off) {
         lv_obj_set_style_border_side(ui_Indoor_temp_value, LV_BORDER_SIDE_NONE, 0);
     } else {
@@ -722,18 +1175,21 @@ void UIManager::setHVACState(ControllerDomain::HVACState state) {
             lv_obj_set_style_border_color(ui_Indoor_temp_value, lv_color_hex(0x4CAFFF), 0);
         }
     }
-
-    xSemaphoreGive(mutex_);
 }
 
 void UIManager::setCurrentSetpoints(double heatC, double coolC) {
+    // Nothing to show until the app has computed its first setpoints
+    if (std::isnan(heatC) || std::isnan(coolC)) {
+        lv_label_set_text(ui_Heat_setpoint, "--");
+        lv_label_set_text(ui_Cool_setpoint, "--");
+        return;
+    }
+
     currHeatDeg_ = std::round(ABS_C_TO_F(heatC));
     currCoolDeg_ = std::round(ABS_C_TO_F(coolC));
 
-    xSemaphoreTake(mutex_, portMAX_DELAY);
     lv_label_set_text_fmt(ui_Heat_setpoint, "%u", currHeatDeg_);
     lv_label_set_text_fmt(ui_Cool_setpoint, "%u", currCoolDeg_);
-    xSemaphoreGive(mutex_);
 }
 
 // NB: Only call while holding mutex_ (or during single-threaded setup)
@@ -754,9 +1210,3 @@ void UIManager::setSystemPowerInternal(bool on) {
     objSetVisibility(!on, ui_on_button);
     objSetVisibility(on, ui_off_button);
 }
-
-void UIManager::setSystemPower(bool on) {
-    xSemaphoreTake(mutex_, portMAX_DELAY);
-    setSystemPowerInternal(on);
-    xSemaphoreGive(mutex_);
-}
@@ -1,14 +1,18 @@
 #pragma once
 
+#include <cmath>
 #include <stdint.h>
 
+#include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #include "AbstractUIManager.h"
 #include "ControllerDomain.h"
 #include "MessageManager.h"
 #include "SleepManager.h"
+#include "TrendHistory.h"
 #include "export/ui.h"
 #include "export/ui_events.h"
 
@@ -17,21 +21,26 @@ class UIManager : public AbstractUIManager {
     UIManager(ControllerDomain::Config config, size_t nMsgIds, eventCb_t eventCb);
     ~UIManager() {
         lv_timer_del(clkTimer_);
+        lv_timer_del(trendTimer_);
+        if (trendScreen_) {
+            lv_obj_del(trendScreen_);
+        }
+        heap_caps_free(trendSamples_);
+        heap_caps_free(trendBuckets_);
+        heap_caps_free(trendPoints_);
+        delete trendHistory_;
         delete msgMgr_;
         delete sleepMgr_;
+        vSemaphoreDelete(vmMutex_);
         vSemaphoreDelete(mutex_);
     }
 
     uint32_t handleTasks();
+    // Someone is using the display. Only call from the UI task.
+    bool interactive() const { return sleepMgr_->awake(); }
 
-    void setAQI(int16_t aqi) override;
-    void setCurrentFanSpeed(uint8_t speed) override;
-    void setOutTempC(double tc) override;
-    void setInTempC(double tc) override;
-    void setInCO2(uint16_t ppm) override;
-    void setHVACState(ControllerDomain::HVACState state) override;
-    void setCurrentSetpoints(double heatC, double coolC) override;
-    void setSystemPower(bool on) override;
+    void publishState(const ViewModel &vm) override;
+    void logStats();
 
     void setFirmwareVersion(const char *version) {
         lv_label_set_text(firmwareVersionLabel_, version);
@@ -53,6 +62,9 @@ class UIManager : public AbstractUIManager {
 
     // Hooks called by event/timer callbacks
     void handleTempRollerChange(bool heatChanged, lv_obj_t *heatRoller, lv_obj_t *coolRoller);
+    void recordTrendSample();
+    void eShowTrends();
+    void eTrendsLoadStart();
 
     // Event hooks called by ui_events.cpp
     void eFanOverride();
@@ -99,7 +111,19 @@ class UIManager : public AbstractUIManager {
     void updateUIForEquipment();
     void onCancelMsg(uint8_t msgID);
     void initExtraWidgets();
+    void initTrends();
+    void initTrendScreen();
+    void drawTrends();
     void sendEvent(Event &evt);
+    void applyViewModel();
+    void updateBrightness();
+    void setAQI(int16_t aqi);
+    void setCurrentFanSpeed(uint8_t speed);
+    void setOutTempC(double tc);
+    void setInTempC(double tc);
+    void setInCO2(uint16_t ppm);
+    void setHVACState(ControllerDomain::HVACState state);
+    void setCurrentSetpoints(double heatC, double coolC);
     void setSystemPowerInternal(bool on);
 
     inline static UIManager *eventsInst_;
@@ -107,12 +131,21 @@ class UIManager : public AbstractUIManager {
     lv_obj_t *firmwareVersionLabel_, *restartButton_, *continuousFanDropdown_, *exhaustCheckbox_;
 
     SemaphoreHandle_t mutex_;
+    TaskHandle_t uiTask_ = nullptr;
+
+    // Published by the app, applied by the UI task. vmMutex_ only guards
+    // the copy so publishing never waits on LVGL rendering.
+    SemaphoreHandle_t vmMutex_;
+    ViewModel pendingVM_, appliedVM_;
+    bool vmPending_ = false, vmApplied_ = false;
+    uint32_t vmPublishes_ = 0, vmCoalesced_ = 0, vmFieldUpdates_ = 0, vmFieldSkips_ = 0;
     MessageManager *msgMgr_;
     SleepManager *sleepMgr_;
 
-    lv_timer_t *clkTimer_;
+    lv_timer_t *clkTimer_, *trendTimer_;
     eventCb_t eventCb_;
     bool booted_ = false;
+    int64_t brightnessMin_ = -1; // Minute the brightness was last evaluated
 
     uint16_t co2Target_;
     uint8_t maxHeatDeg_, minCoolDeg_, currHeatDeg_ = 0, currCoolDeg_ = 0;
@@ -121,4 +154,13 @@ class UIManager : public AbstractUIManager {
     ControllerDomain::Config::Schedule currSchedules_[NUM_SCHEDULE_TIMES];
     ControllerDomain::Config::Equipment equipment_;
     ControllerDomain::Config::Wifi wifi_;
+
+    // Trend screen. History and chart point storage live in PSRAM so the
+    // chart costs no internal RAM beyond its LVGL objects.
+    TrendHistory *trendHistory_ = nullptr;
+    TrendHistory::Sample *trendSamples_ = nullptr, *trendBuckets_ = nullptr;
+    lv_coord_t *trendPoints_ = nullptr;
+    uint32_t trendDrawnGen_ = 0;
+    lv_obj_t *trendScreen_ = nullptr, *trendTempChart_, *trendAirChart_;
+    lv_chart_series_t *trendInSer_, *trendHeatSer_, *trendCoolSer_, *trendCO2Ser_, *trendFanSer_;
 };
@@ -2,9 +2,11 @@
 
 #include <unordered_map>
 
+#include "ModbusMetrics.h"
 #include "cxi_client.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #define MB_PORT_NUM UART_NUM_1 // Number of UART port used for Modbus connection
 #define MB_DEV_SPEED 9600      // The communication speed of the UART
@@ -19,6 +21,8 @@ using SensorData = ControllerDomain::SensorData;
 
 static const char *TAG = "MBC";
 
+static ModbusMetrics metrics("mbc");
+
 enum class CID {
     FreshAirState,
     FreshAirModelId,
@@ -97,8 +101,11 @@ void initParams() {
 esp_err_t getParam(CID cid, uint8_t *buf) {
     uint8_t type = 0; // throwaway
     char *name = (char *)registerNames_.at(cid);
+    int64_t startUs = esp_timer_get_time();
     esp_err_t err = mbc_master_get_parameter(static_cast<uint16_t>(cid), name, buf, &type);
+    metrics.request(ModbusMetrics::Op::Read, (esp_timer_get_time() - startUs) / 1000);
     if (err != ESP_OK) {
+        metrics.error(ModbusMetrics::Op::Read);
         ESP_LOGE(TAG, "CID %u (%s) read fail, err = 0x%x (%s).", static_cast<uint8_t>(cid), name,
                  (int)err, (char *)esp_err_to_name(err));
     }
@@ -108,8 +115,11 @@ esp_err_t getParam(CID cid, uint8_t *buf) {
 esp_err_t setParam(CID cid, uint8_t *buf) {
     uint8_t type = 0; // throwaway
     char *name = (char *)registerNames_.at(cid);
+    int64_t startUs = esp_timer_get_time();
     esp_err_t err = mbc_master_set_parameter(static_cast<uint16_t>(cid), name, buf, &type);
+    metrics.request(ModbusMetrics::Op::Write, (esp_timer_get_time() - startUs) / 1000);
     if (err != ESP_OK) {
+        metrics.error(ModbusMetrics::Op::Write);
         ESP_LOGE(TAG, "CID %u (%s) write fail, err = 0x%x (%s).", static_cast<uint8_t>(cid), name,
                  (int)err, (char *)esp_err_to_name(err));
     }
@@ -0,0 +1,182 @@
+#include "RtcSync.h"
+
+#include <sys/time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+
+#include "Metrics.h"
+#include "rtc-rx8111.h"
+
+#define RTC_BOOT_TIME_TICKS pdMS_TO_TICKS(40)
+#define RTC_EDGE_POLL_TICKS 1
+// Spin rather than sleep for the last part of the wait for a second boundary
+#define RTC_WRITE_SPIN_US (5 * 1000)
+#define RTC_SYNC_POLL_MS (60 * 1000)
+
+#define RTC_NVS_NAMESPACE "rtc"
+
+static const char *TAG = "RTC";
+
+static MetricGauge offsetMetric("rtc_offset_seconds",
+                                "RTC minus network time before it was last written back");
+static MetricGauge driftMetric("rtc_drift_ppm", "Estimated RTC drift, positive when it runs fast");
+static MetricCounter errMetric("rtc_sync_errors_total", "Failed RTC reads and writes after SNTP");
+
+static void pollWait() { vTaskDelay(RTC_EDGE_POLL_TICKS); }
+
+RtcSync::RtcSync() : clock_(rtc_rx8111_get_time, esp_timer_get_time, pollWait) {}
+
+esp_err_t RtcSync::init() {
+    TickType_t ticks = xTaskGetTickCount();
+    if (RTC_BOOT_TIME_TICKS > ticks) {
+        ESP_LOGI(TAG, "Waiting for RTC to start");
+        vTaskDelay(RTC_BOOT_TIME_TICKS - ticks);
+    }
+
+    bool hasTime = false;
+    esp_err_t err = rtc_rx8111_init_client(&hasTime);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    load();
+    driftMetric.set(drift_.ppb() / 1000.0f);
+    if (!hasTime) {
+        // It lost power, so the time it was set no longer applies
+        ESP_LOGI(TAG, "RTC doesn't have valid time");
+        drift_.set(0);
+        return ESP_OK;
+    }
+
+    int64_t us;
+    bool ticking;
+    err = clock_.bootTimeUs(drift_, &us, &ticking);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error retrieving time from RTC: %d", err);
+        return err;
+    }
+    if (!ticking) {
+        // Its time stopped some time ago, so it's wrong by an unknown amount.
+        // SNTP sets the time and writes it back, restarting it.
+        ESP_LOGW(TAG, "RTC isn't ticking, not restoring time from it");
+        drift_.set(0);
+        return ESP_OK;
+    }
+
+    int64_t correctionUs = drift_.errorUs(us / 1000000);
+    timeval tv = {
+        .tv_sec = (time_t)(us / 1000000),
+        .tv_usec = (suseconds_t)(us % 1000000),
+    };
+    settimeofday(&tv, NULL);
+
+    struct tm dt;
+    gmtime_r(&tv.tv_sec, &dt);
+    ESP_LOGI(TAG, "Loaded time from RTC (%04d-%02d-%02d %02d:%02d:%02d UTC), corrected %lldms",
+             dt.tm_year + 1900, dt.tm_mon + 1, dt.tm_mday, dt.tm_hour, dt.tm_min, dt.tm_sec,
+             correctionUs / 1000);
+
+    return ESP_OK;
+}
+
+esp_err_t RtcSync::write() {
+    // The RTC starts counting a second when it's written, so write it as the
+    // system clock starts one
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    time_t sec = tv.tv_sec + 1;
+    int64_t waitUs = 1000000 - tv.tv_usec;
+    if (waitUs > RTC_WRITE_SPIN_US) {
+        vTaskDelay(pdMS_TO_TICKS((waitUs - RTC_WRITE_SPIN_US) / 1000));
+    }
+    do {
+        gettimeofday(&tv, NULL);
+    } while (tv.tv_sec < sec);
+
+    struct tm dt;
+    gmtime_r(&tv.tv_sec, &dt);
+    esp_err_t err = rtc_rx8111_set_time(&dt);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGD(TAG, "Set RTC time(%04d-%02d-%02d %02d:%02d:%02d)", dt.tm_year + 1900, dt.tm_mon + 1,
+             dt.tm_mday, dt.tm_hour, dt.tm_min, dt.tm_sec);
+
+    drift_.set(tv.tv_sec);
+    save();
+    return ESP_OK;
+}
+
+NetworkTaskManager::TaskResult RtcSync::poll() {
+    if (!syncPending_.exchange(false)) {
+        return {RTC_SYNC_POLL_MS, false};
+    }
+
+    int64_t rtcSec, timerUs;
+    if (drift_.setAt() != 0) {
+        esp_err_t err = clock_.readEdge(&rtcSec, &timerUs);
+        if (err == ESP_OK) {
+            timeval tv;
+            gettimeofday(&tv, NULL);
+            int64_t sysUs = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec -
+                            (esp_timer_get_time() - timerUs);
+            int64_t offsetUs = rtcSec * 1000000 - sysUs;
+            int64_t elapsed = sysUs / 1000000 - drift_.setAt();
+
+            offsetMetric.set(offsetUs / 1e6f);
+            bool used = drift_.measured(sysUs / 1000000, offsetUs);
+            driftMetric.set(drift_.ppb() / 1000.0f);
+            ESP_LOGI(TAG, "RTC offset %lldms after %llds, drift %.2fppm%s", offsetUs / 1000,
+                     elapsed, drift_.ppb() / 1000.0, used ? "" : " (not updated)");
+        } else {
+            ESP_LOGE(TAG, "Error reading RTC: %d", err);
+            errMetric.inc();
+        }
+    }
+
+    esp_err_t err = write();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error setting RTC time: %d", err);
+        errMetric.inc();
+    }
+
+    // The sync itself reached the network
+    return {RTC_SYNC_POLL_MS, true};
+}
+
+void RtcSync::load() {
+    nvs_handle_t handle;
+    if (nvs_open(RTC_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+
+    int64_t setAt = 0;
+    int32_t ppb = 0;
+    nvs_get_i64(handle, "set_at", &setAt);
+    nvs_get_i32(handle, "drift_ppb", &ppb);
+    nvs_close(handle);
+
+    drift_ = RtcDrift(setAt, ppb);
+}
+
+void RtcSync::save() {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(RTC_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save RTC drift: %d", err);
+        return;
+    }
+
+    nvs_set_i64(handle, "set_at", drift_.setAt());
+    nvs_set_i32(handle, "drift_ppb", drift_.ppb());
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+NetworkTaskManager::TaskResult rtcSyncTaskFn(void *ctx) {
+    return static_cast<RtcSync *>(ctx)->poll();
+}
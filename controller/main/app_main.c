@@ -32,6 +32,8 @@ void app_main() {
         .pin_dc = 13,
         .pin_rst = 12,
         .landscape_inverted = false,
+        .render_mode = DISP_RENDER_FULL_PSRAM,
+        .pin_touch_int = 11, // TS_INT on the rev2 board
     };
     init_display(&disp_cfg);
 
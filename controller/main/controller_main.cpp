@@ -1,7 +1,9 @@
 #include "controller_main.h"
 
+#include <iterator>
 #include <time.h>
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_netif_sntp.h"
 #include "esp_task.h"
@@ -12,18 +14,25 @@
 #include "nvs_flash.h"
 
 #include "AppConfigStore.h"
+#include "BootPhases.h"
+#include "BootRunner.h"
 #include "ControllerApp.h"
+#include "CoreDumpUploader.h"
 #include "ESPOTAClient.h"
 #include "ESPWifi.h"
+#include "HeapAccounting.h"
+#include "MetricsServer.h"
 #include "ModbusController.h"
 #include "MqttHomeClient.h"
 #include "NetworkTaskManager.h"
 #include "OtaTask.h"
+#include "RtcSync.h"
 #include "Sensors.h"
+#include "TaskHealthSampler.h"
 #include "UIManager.h"
 #include "ValveCtrl.h"
+#include "init_display.h"
 #include "remote_logger.h"
-#include "rtc-rx8111.h"
 
 #define INIT_ERR_RESTART_DELAY_TICKS pdMS_TO_TICKS(60 * 1000)
 
@@ -41,9 +50,11 @@
 #define SENSOR_UPDATE_INTERVAL_TICKS pdMS_TO_TICKS(30 * 1000)
 #define CLOCK_POLL_PERIOD_TICKS pdMS_TO_TICKS(100)
 #define CLOCK_WAIT_TICKS pdMS_TO_TICKS(10 * 1000)
-#define RTC_BOOT_TIME_TICKS pdMS_TO_TICKS(40)
 #define CONNECT_WAIT_INTERVAL_TICKS pdMS_TO_TICKS(10 * 1000)
 #define HEAP_LOG_INTERVAL std::chrono::minutes(15)
+#define HEALTH_SAMPLE_INTERVAL std::chrono::minutes(1)
+// ~112KB of PSRAM, at least 2.8 days of history at the trace's heartbeat
+#define DECISION_TRACE_LEN 4096
 
 #define POSIX_TZ_STR "PST8PDT,M3.2.0/2:00:00,M11.1.0/2:00:00"
 
@@ -62,6 +73,28 @@ static AppConfigStore appConfigStore_;
 static MqttHomeClient *homeCli_;
 static ESPOTAClient *ota_;
 static NetworkTaskManager *netTaskMgr_;
+static TaskHealthSampler taskHealth_;
+static MetricsServer metricsServer_;
+static DecisionTrace *decisionTrace_;
+static CoreDumpUploader *coreDump_;
+static BootGraph bootGraph_(bootPhases, NumBootPhases);
+static BootRunner bootRunner_(bootGraph_);
+static Config config_;
+static RtcSync rtcSync_;
+// Reported once the app can show it
+static esp_err_t rtcErr_ = ESP_OK;
+
+static const HeapAccounting::Subsystem heapSubsystems_[] = {
+    {"lvgl", {"uiTask"}},
+    {"mqtt", {"mqtt_task"}},
+    {"modbus", {"modbusTask"}},
+    {"remote_logger", {"remoteLogger"}},
+    {"net_tasks", {"netTask", "netTask1"}},
+    {"app", {"mainTask"}},
+    {"sensors", {"sensorTask"}},
+    {"network", {"tiT", "wifi", "sys_evt"}},
+};
+static HeapAccounting heapAccounting_(heapSubsystems_, std::size(heapSubsystems_));
 
 void sensorTask(void *sensors) {
     while (1) {
@@ -74,12 +107,17 @@ void sensorTask(void *sensors) {
 }
 
 void uiTask(void *uiManager) {
+    disp_touch_set_wake_task(xTaskGetCurrentTaskHandle());
     while (1) {
         uint32_t delayMs = ((UIManager *)uiManager)->handleTasks();
+        // Someone at the screen may be using Home Assistant too, don't make its
+        // commands wait on power save
+        wifi_.holdFullPower(ESPWifi::HoldUI, ((UIManager *)uiManager)->interactive());
         if (delayMs < portTICK_PERIOD_MS) {
             taskYIELD();
         } else {
-            vTaskDelay(pdMS_TO_TICKS(delayMs));
+            // Touch IRQs and published state changes cut the wait short
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delayMs));
         }
     }
 }
@@ -88,8 +126,12 @@ void mainTask(void *app) {
     bool first = true;
 
     log_heap_stats();
+    disp_log_stats();
     wifi_.logDiagnostics();
     std::chrono::steady_clock::time_point last_logged_heap = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_health_sample = last_logged_heap;
+    taskHealth_.sample();
+    heapAccounting_.sample();
 
     // Wait a bit of time to get a valid clock before loading
     for (int i = 0; i < (CLOCK_WAIT_TICKS / CLOCK_POLL_PERIOD_TICKS); i++) {
@@ -105,8 +147,18 @@ void mainTask(void *app) {
         first = false;
 
         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if ((now - last_health_sample) > HEALTH_SAMPLE_INTERVAL) {
+            homeCli_->updateHealth(taskHealth_.sample());
+            last_health_sample = now;
+        }
         if ((now - last_logged_heap) > HEAP_LOG_INTERVAL) {
             log_heap_stats();
+            heapAccounting_.sample();
+            heapAccounting_.log();
+            taskHealth_.log();
+            ((ControllerApp *)app)->logLoopStats();
+            disp_log_stats();
+            uiManager_->logStats();
             wifi_.logDiagnostics();
             last_logged_heap = now;
         }
@@ -129,53 +181,7 @@ bool uiEvtRcv(UIManager::Event *evt, uint waitMs) {
     return xQueueReceive(uiEvtQueue_, evt, pdMS_TO_TICKS(waitMs)) == pdTRUE;
 }
 
-void setRTC(struct timeval *tv) {
-    struct tm dt;
-    gmtime_r(&tv->tv_sec, &dt);
-    esp_err_t err = rtc_rx8111_set_time(&dt);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error setting RTC time: %d", err);
-    } else {
-        ESP_LOGD(TAG, "Set RTC time(%04d-%02d-%02d %02d:%02d:%02d)", dt.tm_year + 1900,
-                 dt.tm_mon + 1, dt.tm_mday, dt.tm_hour, dt.tm_min, dt.tm_sec);
-    }
-}
-
-esp_err_t setupRTC() {
-    bool hasTime = false;
-
-    TickType_t ticks = xTaskGetTickCount();
-    if (RTC_BOOT_TIME_TICKS > ticks) {
-        ESP_LOGI(TAG, "Waiting for RTC to start");
-        vTaskDelay(RTC_BOOT_TIME_TICKS - ticks);
-    }
-
-    esp_err_t err = rtc_rx8111_init_client(&hasTime);
-    if (err != ESP_OK) {
-        return err;
-    }
-
-    if (hasTime) {
-        struct tm dt;
-        err = rtc_rx8111_get_time(&dt);
-        if (err != ESP_OK) {
-            ESP_LOGD(TAG, "Error retrieving time from RTC");
-            return err;
-        }
-        ESP_LOGI(TAG, "Loaded time from RTC (%04d-%02d-%02d %02d:%02d:%02d)", dt.tm_year + 1900,
-                 dt.tm_mon + 1, dt.tm_mday, dt.tm_hour, dt.tm_min, dt.tm_sec);
-
-        timeval tv;
-        tv.tv_sec = mktime(&dt);
-        settimeofday(&tv, NULL);
-    } else {
-        ESP_LOGI(TAG, "RTC doesn't have valid time");
-    }
-
-    wifi_.setSNTPCallback(setRTC);
-
-    return ESP_OK;
-}
+void rtcSyncCb(struct timeval *tv) { rtcSync_.synced(); }
 
 void __attribute__((format(printf, 1, 2))) bootErr(const char *fmt, ...) {
     char bootErrMsg[UI_MAX_MSG_LEN];
@@ -185,79 +191,119 @@ void __attribute__((format(printf, 1, 2))) bootErr(const char *fmt, ...) {
     vsnprintf(bootErrMsg, sizeof(bootErrMsg), fmt, args);
     va_end(args);
 
-    app_->bootErr(bootErrMsg);
+    // Phases before the app exists can only log it
+    if (app_) {
+        app_->bootErr(bootErrMsg);
+    } else {
+        ESP_LOGE(TAG, "%s", bootErrMsg);
+    }
     vTaskDelay(INIT_ERR_RESTART_DELAY_TICKS);
     esp_restart();
 }
 
-extern "C" void controller_main() {
-    esp_err_t err;
-
-    // Initialize NVS
-    err = nvs_flash_init();
+void bootNVS() {
+    esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+}
 
+void bootConfig() {
     uiEvtQueue_ = xQueueCreate(10, sizeof(UIManager::Event));
 
-    Config config;
-    err = appConfigStore_.load(&config);
+    esp_err_t err = appConfigStore_.load(&config_);
     if (err != ESP_OK) {
         bootErr("Failed to load config: %d", err);
     }
+}
+
+void bootUI() {
     ota_ = new ESPOTAClient("controller", otaMsgCb, UI_MAX_MSG_LEN);
-    uiManager_ = new UIManager(config, ControllerApp::nMsgIds(), uiEvtCb);
+    ota_->setWifi(&wifi_);
+    uiManager_ = new UIManager(config_, ControllerApp::nMsgIds(), uiEvtCb);
     UIManager::setEventsInst(uiManager_);
     uiManager_->setFirmwareVersion(ota_->currentVersion());
+    xTaskCreate(uiTask, "uiTask", UI_TASK_STACK_SIZE, uiManager_, UI_TASK_PRIO, NULL);
+}
+
+void bootApp() {
     modbusController_ = new ModbusController();
     valveCtrl_.init();
 
-    homeCli_ = new MqttHomeClient(config.wifi.logName, uiEvtCb);
+    homeCli_ = new MqttHomeClient(config_.wifi.logName, uiEvtCb);
 
-    app_ = new ControllerApp(config, uiManager_, modbusController_, &sensors_, &valveCtrl_, &wifi_,
+    app_ = new ControllerApp(config_, uiManager_, modbusController_, &sensors_, &valveCtrl_, &wifi_,
                              &appConfigStore_, homeCli_, ota_, uiEvtRcv, esp_restart);
-    xTaskCreate(uiTask, "uiTask", UI_TASK_STACK_SIZE, uiManager_, UI_TASK_PRIO, NULL);
+    // Runs without a trace rather than using internal RAM if PSRAM is short
+    DecisionTrace::Entry *traceBuf = (DecisionTrace::Entry *)heap_caps_calloc(
+        DECISION_TRACE_LEN, sizeof(DecisionTrace::Entry), MALLOC_CAP_SPIRAM);
+    if (traceBuf == nullptr) {
+        ESP_LOGE(TAG, "Unable to allocate decision trace");
+    }
+    decisionTrace_ = new DecisionTrace(traceBuf, DECISION_TRACE_LEN);
+    app_->setDecisionTrace(decisionTrace_);
+}
 
+void bootRTC() {
     setenv("TZ", POSIX_TZ_STR, 1);
     tzset();
 
-    err = setupRTC(); // Do this before starting wifi to avoid races with NTP
-    if (err != ESP_OK) {
-        bootErr("RTC init error: %d", err);
+    // Restore the time before SNTP can set it
+    rtcErr_ = rtcSync_.init();
+    if (rtcErr_ == ESP_OK) {
+        wifi_.setSNTPCallback(rtcSyncCb);
+    }
+}
+
+void bootNetwork() {
+    if (rtcErr_ != ESP_OK) {
+        bootErr("RTC init error: %d", rtcErr_);
     }
 
-    wifi_.init(config.wifi.logName);
-    wifi_.connect(config.wifi.ssid, config.wifi.password);
-    remote_logger_init(config.wifi.logName, default_log_host);
+    wifi_.init(config_.wifi.logName);
+    wifi_.connect(config_.wifi.ssid, config_.wifi.password);
+    remote_logger_init(config_.wifi.logName, default_log_host, SyslogSender::Transport::Udp,
+                       "logs");
     // LOGW immediately after remote_logger_init gives us an early remote log line
     // to note a restart
     ESP_LOGW(TAG, "Wifi started, booting app");
+    metricsServer_.start();
     netTaskMgr_ = new NetworkTaskManager(wifi_);
-    netTaskMgr_->addTask(otaTaskFn, ota_);
+    netTaskMgr_->addTask(otaTaskFn, ota_, "ota", NetworkTaskManager::TaskClass::Long);
+    coreDump_ = new CoreDumpUploader(config_.wifi.logName, default_coredump_url);
+    netTaskMgr_->addTask(coreDumpTaskFn, coreDump_, "coredump",
+                         NetworkTaskManager::TaskClass::Long);
+    netTaskMgr_->addTask(rtcSyncTaskFn, &rtcSync_, "rtc_sync");
 
     // Start MQTT client
     homeCli_->start();
+    netTaskMgr_->start();
+}
 
+void bootSensors() {
     if (!sensors_.init()) {
         bootErr("Sensor init error");
     }
     ESP_LOGI(TAG, "sensors initialized");
 
-    err = modbusController_->init();
+    xTaskCreate(sensorTask, "sensorTask", SENSOR_TASK_STACK_SIZE, &sensors_, SENSOR_TASK_PRIO,
+                NULL);
+}
+
+void bootModbus() {
+    esp_err_t err = modbusController_->init();
     if (err != ESP_OK) {
         bootErr("Modbus init error: %d", err);
     }
     ESP_LOGI(TAG, "modbus initialized");
 
-    xTaskCreate(sensorTask, "sensorTask", SENSOR_TASK_STACK_SIZE, &sensors_, SENSOR_TASK_PRIO,
-                NULL);
     xTaskCreate(modbusTask, "modbusTask", MODBUS_TASK_STACK_SIZE, modbusController_,
                 MODBUS_TASK_PRIO, NULL);
-    netTaskMgr_->start();
+}
 
+void bootControl() {
     // Wait for sensors to have valid data
     while (std::isnan(sensors_.getLatest().tempC)) {
         vTaskDelay(pdMS_TO_TICKS(100));
@@ -265,3 +311,8 @@ extern "C" void controller_main() {
 
     xTaskCreate(mainTask, "mainTask", MAIN_TASK_STACK_SIZE, app_, MAIN_TASK_PRIO, NULL);
 }
+
+extern "C" void controller_main() {
+    bootRunner_.run();
+    bootRunner_.log();
+}
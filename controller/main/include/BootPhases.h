@@ -0,0 +1,48 @@
+#pragma once
+
+#include "BootGraph.h"
+
+// The controller's boot, as phases that run as soon as their dependencies
+// have finished. Sensors, modbus and the network come up concurrently, and
+// the UI task starts before any of them. The clock is restored from the RTC
+// alongside loading the config.
+enum BootPhase {
+    BootNVS,
+    BootConfig,
+    BootUI,
+    BootApp,
+    BootRTC,
+    BootNetwork,
+    BootSensors,
+    BootModbus,
+    BootControl,
+    NumBootPhases,
+};
+
+// Defined in controller_main.cpp
+void bootNVS();
+void bootConfig();
+void bootUI();
+void bootApp();
+void bootRTC();
+void bootNetwork();
+void bootSensors();
+void bootModbus();
+void bootControl();
+
+// Indexed by BootPhase. Later phases depend on BootApp so a boot error can be
+// shown on the display; the RTC's error is reported by the network phase.
+inline const BootGraph::Phase bootPhases[NumBootPhases] = {
+    {"nvs", bootNVS, 0},
+    {"config", bootConfig, BOOT_DEP(BootNVS)},
+    {"ui", bootUI, BOOT_DEP(BootConfig)},
+    {"app", bootApp, BOOT_DEP(BootConfig) | BOOT_DEP(BootUI)},
+    {"rtc", bootRTC, BOOT_DEP(BootNVS)},
+    // The RTC sets the clock before SNTP can
+    {"network", bootNetwork, BOOT_DEP(BootApp) | BOOT_DEP(BootRTC)},
+    {"sensors", bootSensors, BOOT_DEP(BootApp)},
+    {"modbus", bootModbus, BOOT_DEP(BootApp)},
+    // The control loop publishes through the MQTT client started with the network
+    {"control", bootControl,
+     BOOT_DEP(BootSensors) | BOOT_DEP(BootModbus) | BOOT_DEP(BootNetwork)},
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "NetworkTaskManager.h"
+#include "RtcClock.h"
+#include "RtcDrift.h"
+
+// Keeps system time and the RX8111 RTC in step. At boot the system clock is
+// restored from the RTC, corrected for its drift, so schedules are right
+// before Wi-Fi connects. After each SNTP sync the RTC's drift is measured and
+// it's written back from the network task, since the I2C reads can take up
+// to a second.
+//
+// The RTC only counts whole seconds, so reads wait for the seconds to tick
+// over and writes happen on a system second boundary; that keeps both within
+// a few milliseconds.
+class RtcSync {
+  public:
+    RtcSync();
+
+    // Initializes the RTC and restores system time from it if it kept time.
+    // An RTC that has stopped ticking is left for the next SNTP sync to set.
+    esp_err_t init();
+
+    // SNTP sync callback
+    void synced() { syncPending_ = true; }
+
+    // Measures drift and writes the RTC back after a sync. Run from the
+    // network task, see rtcSyncTaskFn.
+    NetworkTaskManager::TaskResult poll();
+
+  private:
+    RtcClock clock_;
+    RtcDrift drift_;
+    std::atomic<bool> syncPending_ = false;
+
+    esp_err_t write();
+
+    void load();
+    void save();
+};
+
+// NetworkTaskManager task for an RtcSync, passed as `ctx`
+NetworkTaskManager::TaskResult rtcSyncTaskFn(void *ctx);
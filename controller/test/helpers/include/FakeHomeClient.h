@@ -1,9 +1,17 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "AbstractHomeClient.h"
 
 class FakeHomeClient : public AbstractHomeClient {
   public:
     void setState(HomeState state) { state_ = state; }
     HomeState state() override { return state_; };
+    void publishDecisionTrace(const char *text, size_t len) override {
+        traceChunks_.emplace_back(text, len);
+    }
+
+    std::vector<std::string> traceChunks_;
 };
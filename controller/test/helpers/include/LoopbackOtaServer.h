@@ -0,0 +1,213 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <strings.h>
+
+#include "esp_http_client.h"
+
+#include "HttpRangeTransport.h"
+
+// Firmware server for host tests, serving an in-memory image over HTTP on a
+// loopback port. Answers Range requests with a 206 and a Content-Range header
+// as the real server does, keeps connections alive, and can drop the
+// connection part way through a response.
+class LoopbackOtaServer {
+  public:
+    explicit LoopbackOtaServer(const std::vector<uint8_t> &image) : image_(image) {
+        listen_ = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_, (sockaddr *)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(listen_, (sockaddr *)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        listen(listen_, 4);
+        acceptThread_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~LoopbackOtaServer() {
+        stopping_ = true;
+        shutdown(listen_, SHUT_RDWR);
+        close(listen_);
+        acceptThread_.join();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int conn : conns_) {
+            shutdown(conn, SHUT_RDWR);
+        }
+        for (std::thread &t : connThreads_) {
+            t.join();
+        }
+    }
+
+    std::string url(const char *path = "/fw.bin") const {
+        return "http://127.0.0.1:" + std::to_string(port_) + path;
+    }
+
+    // Drops the connection after afterBytes of the body of the nth request
+    // from now
+    void dropAfter(int nthRequest, uint32_t afterBytes) {
+        dropRequest_ = requests_ + nthRequest;
+        dropAfter_ = afterBytes;
+    }
+    // Answers with the whole image and a 200, as servers without Range
+    // support do
+    void setIgnoreRange(bool ignore) { ignoreRange_ = ignore; }
+    void setImage(const std::vector<uint8_t> &image) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        image_ = image;
+    }
+
+    int requests() const { return requests_; }
+    int connections() const { return connections_; }
+    uint64_t bytesServed() const { return bytesServed_; }
+
+  private:
+    std::vector<uint8_t> image_;
+    int listen_, port_;
+    std::atomic<bool> stopping_{false}, ignoreRange_{false};
+    std::atomic<int> requests_{0}, connections_{0}, dropRequest_{0};
+    std::atomic<uint32_t> dropAfter_{0};
+    std::atomic<uint64_t> bytesServed_{0};
+    std::thread acceptThread_;
+    std::mutex mutex_;
+    std::vector<int> conns_;
+    std::vector<std::thread> connThreads_;
+
+    void acceptLoop() {
+        while (!stopping_) {
+            int conn = accept(listen_, nullptr, nullptr);
+            if (conn < 0) {
+                continue;
+            }
+            connections_++;
+            std::lock_guard<std::mutex> lock(mutex_);
+            conns_.push_back(conn);
+            connThreads_.emplace_back([this, conn] { serve(conn); });
+        }
+    }
+
+    void serve(int conn) {
+        std::string in;
+        char buf[1024];
+        while (true) {
+            size_t end;
+            while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(conn, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    close(conn);
+                    return;
+                }
+                in.append(buf, n);
+            }
+            std::string head = in.substr(0, end);
+            in.erase(0, end + 4);
+            if (!respond(conn, head)) {
+                shutdown(conn, SHUT_RDWR);
+                close(conn);
+                return;
+            }
+        }
+    }
+
+    // Returns false when the connection was dropped
+    bool respond(int conn, const std::string &head) {
+        int request = ++requests_;
+        std::vector<uint8_t> image;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            image = image_;
+        }
+
+        unsigned long first = 0, last = image.size() - 1;
+        bool ranged = false;
+        size_t rangePos = head.find("\r\nRange: bytes=");
+        if (!ignoreRange_ && rangePos != std::string::npos &&
+            sscanf(head.c_str() + rangePos, "\r\nRange: bytes=%lu-%lu", &first, &last) == 2) {
+            ranged = true;
+            if (first >= image.size()) {
+                std::string resp = "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                                   "Content-Length: 0\r\n\r\n";
+                return send(conn, resp.data(), resp.size(), MSG_NOSIGNAL) > 0;
+            }
+            last = std::min(last, (unsigned long)image.size() - 1);
+        }
+
+        char resp[256];
+        int n = snprintf(resp, sizeof(resp), "HTTP/1.1 %s\r\nContent-Length: %lu\r\n",
+                         ranged ? "206 Partial Content" : "200 OK", last + 1 - first);
+        if (ranged) {
+            n += snprintf(resp + n, sizeof(resp) - n, "Content-Range: bytes %lu-%lu/%lu\r\n",
+                          first, last, (unsigned long)image.size());
+        }
+        n += snprintf(resp + n, sizeof(resp) - n, "\r\n");
+        if (send(conn, resp, n, MSG_NOSIGNAL) != n) {
+            return false;
+        }
+
+        size_t len = last + 1 - first;
+        bool drop = request == dropRequest_ && dropAfter_ < len;
+        if (drop) {
+            len = dropAfter_;
+        }
+        // Counted before sending, so the count is complete by the time the
+        // client has read the bytes
+        bytesServed_ += len;
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t w = send(conn, image.data() + first + sent, len - sent, MSG_NOSIGNAL);
+            if (w <= 0) {
+                bytesServed_ -= len - sent;
+                return false;
+            }
+            sent += w;
+        }
+        return !drop;
+    }
+};
+
+// The OTA client's side: an HTTP client with its event handler keeping the
+// Content-Range header, as ESPOTAClient's does, and the transport on it
+class LoopbackOtaClient {
+  private:
+    char contentRange_[64] = "";
+    esp_http_client_handle_t client_;
+
+  public:
+    explicit LoopbackOtaClient(const LoopbackOtaServer &server)
+        : client_(makeClient(server.url(), contentRange_)), transport(client_, contentRange_) {}
+    ~LoopbackOtaClient() { esp_http_client_cleanup(client_); }
+
+    HttpRangeTransport transport;
+
+  private:
+    static esp_http_client_handle_t makeClient(const std::string &url, char *contentRange) {
+        esp_http_client_config_t config = {};
+        config.url = url.c_str();
+        config.timeout_ms = 2000;
+        config.event_handler = onEvent;
+        config.user_data = contentRange;
+        config.keep_alive_enable = true;
+        return esp_http_client_init(&config);
+    }
+
+    static esp_err_t onEvent(esp_http_client_event_t *evt) {
+        if (evt->event_id == HTTP_EVENT_ON_HEADER &&
+            !strcasecmp(evt->header_key, "Content-Range")) {
+            snprintf((char *)evt->user_data, 64, "%s", evt->header_value);
+        }
+        return ESP_OK;
+    }
+};
@@ -6,14 +6,7 @@
 
 class MockUIManager : public AbstractUIManager {
   public:
-    MOCK_METHOD(void, setAQI, (int16_t aqi), (override));
-    MOCK_METHOD(void, setCurrentFanSpeed, (uint8_t speed), (override));
-    MOCK_METHOD(void, setOutTempC, (double tc), (override));
-    MOCK_METHOD(void, setInTempC, (double tc), (override));
-    MOCK_METHOD(void, setInCO2, (uint16_t ppm), (override));
-    MOCK_METHOD(void, setHVACState, (ControllerDomain::HVACState state), (override));
-    MOCK_METHOD(void, setCurrentSetpoints, (double heatC, double coolC), (override));
-    MOCK_METHOD(void, setSystemPower, (bool on), (override));
+    MOCK_METHOD(void, publishState, (const ViewModel &vm), (override));
 
     MOCK_METHOD(void, setMessage, (uint8_t msgID, bool allowCancel, const char *msg), (override));
     MOCK_METHOD(void, clearMessage, (uint8_t msgID), (override));
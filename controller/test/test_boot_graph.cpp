@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "BootPhases.h"
+
+// Stand-ins for controller_main.cpp's phases, recording the order they ran in
+static std::vector<int> ran;
+void bootNVS() { ran.push_back(BootNVS); }
+void bootConfig() { ran.push_back(BootConfig); }
+void bootUI() { ran.push_back(BootUI); }
+void bootApp() { ran.push_back(BootApp); }
+void bootRTC() { ran.push_back(BootRTC); }
+void bootNetwork() { ran.push_back(BootNetwork); }
+void bootSensors() { ran.push_back(BootSensors); }
+void bootModbus() { ran.push_back(BootModbus); }
+void bootControl() { ran.push_back(BootControl); }
+
+static void noop() {}
+
+// Runs the graph as if with unlimited workers: each round claims every phase
+// that is ready, then finishes them all. Returns the round each phase ran in.
+static std::vector<int> runRounds(BootGraph &graph) {
+    std::vector<int> rounds(graph.size(), -1);
+    ran.clear();
+    for (int round = 0; !graph.done(); round++) {
+        std::vector<int> claimed;
+        int phase;
+        while ((phase = graph.claim(round * 10)) != BootGraph::NONE) {
+            claimed.push_back(phase);
+        }
+        if (claimed.empty()) {
+            ADD_FAILURE() << "stuck in round " << round;
+            break;
+        }
+        for (int p : claimed) {
+            graph.phase(p).fn();
+            graph.finish(p, round * 10 + 5);
+            rounds[p] = round;
+        }
+    }
+    return rounds;
+}
+
+TEST(BootGraph, Valid) {
+    const BootGraph::Phase phases[] = {
+        {"a", noop, 0},
+        {"b", noop, BOOT_DEP(0)},
+        {"c", noop, BOOT_DEP(0) | BOOT_DEP(1)},
+    };
+    EXPECT_TRUE(BootGraph(phases, 3).valid());
+}
+
+TEST(BootGraph, InvalidCycle) {
+    const BootGraph::Phase phases[] = {
+        {"a", noop, 0},
+        {"b", noop, BOOT_DEP(2)},
+        {"c", noop, BOOT_DEP(1)},
+    };
+    EXPECT_FALSE(BootGraph(phases, 3).valid());
+}
+
+TEST(BootGraph, InvalidMissingDep) {
+    const BootGraph::Phase phases[] = {
+        {"a", noop, 0},
+        {"b", noop, BOOT_DEP(5)},
+    };
+    EXPECT_FALSE(BootGraph(phases, 2).valid());
+}
+
+TEST(BootGraph, ClaimWaitsForDeps) {
+    const BootGraph::Phase phases[] = {
+        {"a", noop, 0},
+        {"b", noop, BOOT_DEP(0)},
+        {"c", noop, 0},
+    };
+    BootGraph graph(phases, 3);
+
+    EXPECT_EQ(graph.claim(100), 0);
+    // b is blocked on a, c isn't
+    EXPECT_EQ(graph.claim(110), 2);
+    EXPECT_EQ(graph.claim(120), BootGraph::NONE);
+
+    graph.finish(0, 200);
+    EXPECT_EQ(graph.claim(210), 1);
+    EXPECT_EQ(graph.claim(220), BootGraph::NONE);
+    EXPECT_FALSE(graph.done());
+
+    graph.finish(2, 300);
+    graph.finish(1, 400);
+    EXPECT_TRUE(graph.done());
+    EXPECT_TRUE(graph.finished(1));
+    EXPECT_EQ(graph.startUs(1), 210);
+    EXPECT_EQ(graph.endUs(1), 400);
+    EXPECT_EQ(graph.startUs(2), 110);
+    EXPECT_EQ(graph.endUs(2), 300);
+}
+
+TEST(BootGraph, ControllerPhasesValid) {
+    BootGraph graph(bootPhases, NumBootPhases);
+    EXPECT_TRUE(graph.valid());
+    for (int i = 0; i < NumBootPhases; i++) {
+        EXPECT_NE(bootPhases[i].fn, nullptr);
+    }
+}
+
+TEST(BootGraph, ControllerPhasesRunInDependencyOrder) {
+    BootGraph graph(bootPhases, NumBootPhases);
+    runRounds(graph);
+    ASSERT_EQ(ran.size(), NumBootPhases);
+
+    std::vector<int> pos(NumBootPhases);
+    for (size_t i = 0; i < ran.size(); i++) {
+        pos[ran[i]] = i;
+    }
+    for (int i = 0; i < NumBootPhases; i++) {
+        for (int dep = 0; dep < NumBootPhases; dep++) {
+            if (bootPhases[i].deps & BOOT_DEP(dep)) {
+                EXPECT_LT(pos[dep], pos[i]) << bootPhases[dep].name << " before "
+                                            << bootPhases[i].name;
+            }
+        }
+    }
+
+    // Orderings the firmware relies on beyond what each phase touches
+    EXPECT_LT(pos[BootRTC], pos[BootNetwork]); // SNTP mustn't race the RTC
+    EXPECT_LT(pos[BootApp], pos[BootSensors]); // bootErr() needs the app
+    EXPECT_LT(pos[BootApp], pos[BootModbus]);
+    EXPECT_LT(pos[BootNetwork], pos[BootControl]); // MQTT client started
+    EXPECT_EQ(ran.back(), BootControl);
+}
+
+TEST(BootGraph, ControllerPhasesRunConcurrently) {
+    BootGraph graph(bootPhases, NumBootPhases);
+    std::vector<int> rounds = runRounds(graph);
+
+    EXPECT_EQ(rounds[BootSensors], rounds[BootModbus]);
+    EXPECT_EQ(rounds[BootSensors], rounds[BootNetwork]);
+    // The clock is restored as early as possible
+    EXPECT_EQ(rounds[BootRTC], rounds[BootConfig]);
+    // nvs, config/rtc, ui, app, sensors/modbus/network, control
+    EXPECT_EQ(rounds[BootControl], 5);
+}
@@ -14,9 +14,11 @@
 
 using ::testing::_;
 using ::testing::AllOf;
+using ::testing::AnyNumber;
 using ::testing::AtMost;
 using ::testing::DoubleNear;
 using ::testing::ExpectationSet;
+using ::testing::Field;
 using ::testing::Ge;
 using ::testing::InSequence;
 using ::testing::IsNan;
@@ -25,6 +27,7 @@ using Config = ControllerDomain::Config;
 using FancoilSpeed = ControllerDomain::FancoilSpeed;
 using SetpointReason = ControllerApp::SetpointReason;
 using FanSpeedReason = ControllerApp::FanSpeedReason;
+using ViewModel = AbstractUIManager::ViewModel;
 
 void configUpdateCb(Config &config) {}
 
@@ -66,6 +69,8 @@ class ControllerAppTest : public testing::Test {
   protected:
     void SetUp() override {
         using namespace std::placeholders;
+        // Tests that care about the published state add narrower expectations
+        EXPECT_CALL(uiManager_, publishState(_)).Times(AnyNumber());
         app_ = new TestControllerApp(
             default_test_config(), &uiManager_, &modbusController_, &sensors_, &valveCtrl_, &wifi_,
             &cfgStore_, &homeCli_, &otaCli_, std::bind(&ControllerAppTest::uiEvtRcv, this, _1, _2),
@@ -154,19 +159,27 @@ TEST_F(ControllerAppTest, Boots) {
     // AtMost is somewhat arbitrary, just making sure it's not crazy high
     EXPECT_CALL(uiManager_, clearMessage(_)).Times(AtMost(10));
     // Should not be called since we don't have a valid measurement
-    //EXPECT_CALL(uiManager_, setOutTempC(_)).Times(0);
+    //EXPECT_CALL(uiManager_, publishState(Field(&ViewModel::outTempC, Not(IsNan())))).Times(0);
 
-    uiInits += EXPECT_CALL(uiManager_, setCurrentFanSpeed(0));
-    uiInits += EXPECT_CALL(uiManager_, setInTempC(20.0));
-    uiInits += EXPECT_CALL(uiManager_, setInCO2(456));
-    uiInits += EXPECT_CALL(uiManager_, setHVACState(ControllerDomain::HVACState::Off));
-    uiInits += EXPECT_CALL(uiManager_, setCurrentSetpoints(19.0, 22.0));
+    uiInits += EXPECT_CALL(
+        uiManager_,
+        publishState(AllOf(Field(&ViewModel::fanSpeed, 0), Field(&ViewModel::inTempC, 20.0),
+                           Field(&ViewModel::inCO2, 456),
+                           Field(&ViewModel::hvacState, ControllerDomain::HVACState::Off),
+                           Field(&ViewModel::heatC, 19.0), Field(&ViewModel::coolC, 22.0))));
 
     EXPECT_CALL(uiManager_, bootDone()).After(uiInits);
 
     app_->task(true);
 }
 
+TEST_F(ControllerAppTest, PublishesStateOncePerTask) {
+    sensors_.setLatest({.tempC = 20.0, .humidity = 2.0, .co2 = 456});
+
+    EXPECT_CALL(uiManager_, publishState(_)).Times(1);
+    app_->task();
+}
+
 TEST_F(ControllerAppTest, CallsForVenting) {
     sensors_.setLatest({.tempC = 20.0, .humidity = 2.0, .co2 = 1150});
 
@@ -196,14 +209,15 @@ TEST_F(ControllerAppTest, UsesFanCoolingWhenOutdoorTempAllows) {
 
     // Fan cooling should come on.
     setOutdoorTempC(22);
-    EXPECT_CALL(uiManager_, setOutTempC(22));
+    EXPECT_CALL(uiManager_, publishState(Field(&ViewModel::outTempC, 22)));
     app_->task();
     EXPECT_EQ(255, modbusController_.getFreshAirSpeed());
     EXPECT_EQ(FanSpeedReason::Cool, app_->fanSpeedReason());
 
     // If the outdoor temp gets too high, demand drops but min-on-time keeps the fan running
     setOutdoorTempC(30);
-    EXPECT_CALL(uiManager_, setOutTempC(30)).Times(testing::AtLeast(1));
+    EXPECT_CALL(uiManager_, publishState(Field(&ViewModel::outTempC, 30)))
+        .Times(testing::AtLeast(1));
     app_->task();
     EXPECT_EQ(MIN_FAN_SPEED_VALUE, modbusController_.getFreshAirSpeed());
     EXPECT_EQ(FanSpeedReason::MinOnTime, app_->fanSpeedReason());
@@ -545,8 +559,8 @@ TEST_F(ControllerAppTest, MakeupDemand) {
 TEST_F(ControllerAppTest, Precooling) {
     sensors_.setLatest({.tempC = 25.5, .humidity = 2.0, .co2 = 456});
     setRealNow(std::tm{
-        .tm_hour = 12,
         .tm_min = 1,
+        .tm_hour = 12,
         .tm_mday = 1,
         .tm_year = 2024,
         .tm_isdst = -1,
@@ -599,8 +613,8 @@ TEST_F(ControllerAppTest, Precooling) {
 TEST_F(ControllerAppTest, PrecoolingOnHotDay) {
     sensors_.setLatest({.tempC = 24, .humidity = 2.0, .co2 = 456});
     setRealNow(std::tm{
-        .tm_hour = 12,
         .tm_min = 1,
+        .tm_hour = 12,
         .tm_mday = 1,
         .tm_year = 2024,
         .tm_isdst = -1,
@@ -632,12 +646,14 @@ TEST_F(ControllerAppTest, VacationSetpoints) {
 
     homeCli_.setState(homeState);
     EXPECT_CALL(uiManager_,
-                setCurrentSetpoints(AllOf(Ge(12.0), Le(17.8)), AllOf(Ge(26.0), Le(37.0))));
+                publishState(AllOf(Field(&ViewModel::heatC, AllOf(Ge(12.0), Le(17.8))),
+                                   Field(&ViewModel::coolC, AllOf(Ge(26.0), Le(37.0))))));
     app_->task();
 }
 
 TEST_F(ControllerAppTest, InvalidTimeSetpoints) {
-    EXPECT_CALL(uiManager_, setCurrentSetpoints(DoubleNear(19.0, 0.1), DoubleNear(25.0, 0.1)));
+    EXPECT_CALL(uiManager_, publishState(AllOf(Field(&ViewModel::heatC, DoubleNear(19.0, 0.1)),
+                                               Field(&ViewModel::coolC, DoubleNear(25.0, 0.1)))));
 
     // Set an invalid time
     app_->realNow_ = std::chrono::system_clock::time_point{};
@@ -758,6 +774,39 @@ TEST_F(ControllerAppTest, ExhaustFanButtonRunsTimed) {
     EXPECT_FALSE(modbusController_.getExhaustFan());
 }
 
+TEST_F(ControllerAppTest, DecisionTraceRecordsAndDumps) {
+    DecisionTrace::Entry buf[8];
+    DecisionTrace trace(buf, std::size(buf));
+    app_->setDecisionTrace(&trace);
+
+    sensors_.setLatest({.tempC = 20.0, .humidity = 2.0, .co2 = 1150});
+    app_->task();
+
+    ASSERT_EQ(trace.size(), 1);
+    const DecisionTrace::Entry &entry = trace.get(0);
+    EXPECT_EQ(entry.fanSpeed, 76);
+    EXPECT_EQ(entry.fanSpeedReason, static_cast<uint8_t>(FanSpeedReason::Vent));
+    EXPECT_EQ(entry.inTempCx100, 2000);
+    EXPECT_EQ(entry.co2, 1150);
+    EXPECT_GT(entry.ventPct, 0);
+    EXPECT_TRUE(entry.flags & DecisionTrace::SystemOn);
+
+    auto evt = AbstractUIManager::Event{
+        AbstractUIManager::EventType::DumpDecisionTrace,
+        {.decisionTraceDump = {.count = 10, .serial = false}},
+    };
+    evt_ = &evt;
+    app_->task();
+
+    // The unchanged decision wasn't recorded again
+    EXPECT_EQ(trace.size(), 1);
+    ASSERT_EQ(homeCli_.traceChunks_.size(), 1);
+    const std::string &dump = homeCli_.traceChunks_[0];
+    EXPECT_NE(dump.find(" in_t=20.00 "), std::string::npos) << dump;
+    EXPECT_NE(dump.find(" speed=76 speed_r=vent "), std::string::npos) << dump;
+    EXPECT_EQ(dump.back(), '\n');
+}
+
 // Indoor and outdoor temp offsets?
 // Separate tests for PID algorithm?
 // static pressure measurement
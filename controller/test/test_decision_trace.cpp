@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "DecisionTrace.h"
+
+using Entry = DecisionTrace::Entry;
+
+class DecisionTraceTest : public testing::Test {
+  protected:
+    static constexpr size_t CAPACITY = 4;
+
+    Entry buf_[CAPACITY];
+    DecisionTrace trace_{buf_, CAPACITY};
+
+    Entry entry(uint32_t time, uint8_t fanSpeed) {
+        return Entry{
+            .time = time,
+            .inTempCx100 = DecisionTrace::packTemp(21.0 + time / 100.0),
+            .heatCx100 = 2000,
+            .coolCx100 = 2400,
+            .fanSpeed = fanSpeed,
+            .flags = DecisionTrace::SystemOn,
+        };
+    }
+};
+
+TEST_F(DecisionTraceTest, Packing) {
+    EXPECT_EQ(DecisionTrace::packTemp(21.456), 2146);
+    EXPECT_EQ(DecisionTrace::packTemp(-5.0), -500);
+    EXPECT_EQ(DecisionTrace::packTemp(std::nan("")), DecisionTrace::INVALID_TEMP);
+
+    EXPECT_EQ(DecisionTrace::packDemand(0.424), 42);
+    EXPECT_EQ(DecisionTrace::packDemand(-0.1), 0);
+    EXPECT_EQ(DecisionTrace::packDemand(1.5), 100);
+    EXPECT_EQ(DecisionTrace::packDemand(std::nan("")), 0);
+}
+
+TEST_F(DecisionTraceTest, SameDecisionOncePerHeartbeat) {
+    trace_.add(entry(1000, 50));
+    // Only the inputs changed
+    trace_.add(entry(1005, 50));
+    trace_.add(entry(1000 + DECISION_TRACE_HEARTBEAT_SECS - 1, 50));
+    EXPECT_EQ(trace_.size(), 1);
+
+    trace_.add(entry(1000 + DECISION_TRACE_HEARTBEAT_SECS, 50));
+    ASSERT_EQ(trace_.size(), 2);
+    EXPECT_EQ(trace_.get(1).time, 1000 + DECISION_TRACE_HEARTBEAT_SECS);
+}
+
+TEST_F(DecisionTraceTest, ChangesAlwaysRecorded) {
+    trace_.add(entry(1000, 50));
+    trace_.add(entry(1005, 60));
+
+    Entry flagged = entry(1010, 60);
+    flagged.flags |= DecisionTrace::Exhaust;
+    trace_.add(flagged);
+
+    // Clock stepped backwards
+    trace_.add(entry(10, 60));
+
+    ASSERT_EQ(trace_.size(), 4);
+    EXPECT_EQ(trace_.get(1).fanSpeed, 60);
+    EXPECT_EQ(trace_.get(2).flags, DecisionTrace::SystemOn | DecisionTrace::Exhaust);
+    EXPECT_EQ(trace_.get(3).time, 10);
+}
+
+TEST_F(DecisionTraceTest, WrapsOldestFirst) {
+    for (uint8_t i = 0; i < 6; i++) {
+        trace_.add(entry(1000 + i, i));
+    }
+
+    ASSERT_EQ(trace_.size(), CAPACITY);
+    for (size_t i = 0; i < CAPACITY; i++) {
+        EXPECT_EQ(trace_.get(i).fanSpeed, i + 2);
+    }
+}
+
+TEST(DecisionTrace, NoStorageRecordsNothing) {
+    DecisionTrace trace(nullptr, 10);
+    trace.add({.time = 1});
+    EXPECT_EQ(trace.size(), 0);
+    EXPECT_EQ(trace.capacity(), 0);
+}
@@ -0,0 +1,308 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+#include "DeltaPatcher.h"
+#include "LoopbackOtaServer.h"
+
+namespace {
+
+// Not SHA-256, but enough to tell images apart
+void fakeSha(const std::vector<uint8_t> &data, uint8_t sha[DELTA_SHA_LEN]) {
+    uint64_t h = 1469598103934665603ull;
+    for (uint8_t b : data) {
+        h = (h ^ b) * 1099511628211ull;
+    }
+    for (size_t i = 0; i < DELTA_SHA_LEN; i++) {
+        sha[i] = (uint8_t)(h >> (8 * (i % 8))) ^ (uint8_t)i;
+    }
+}
+
+class FakeDigest : public DeltaPatcher::Digest {
+  public:
+    std::vector<uint8_t> data;
+    void reset() override { data.clear(); }
+    void update(const uint8_t *buf, size_t len) override {
+        data.insert(data.end(), buf, buf + len);
+    }
+    void finish(uint8_t sha[DELTA_SHA_LEN]) override { fakeSha(data, sha); }
+};
+
+class FakeSource : public DeltaPatcher::Source {
+  public:
+    std::vector<uint8_t> image;
+    int reads = 0;
+
+    esp_err_t read(uint32_t offset, uint8_t *buf, size_t len) override {
+        reads++;
+        memcpy(buf, image.data() + offset, len);
+        return ESP_OK;
+    }
+    size_t size() override { return image.size(); }
+    bool hasSha(const uint8_t sha[DELTA_SHA_LEN]) override {
+        uint8_t own[DELTA_SHA_LEN];
+        fakeSha(image, own);
+        return !memcmp(own, sha, sizeof(own));
+    }
+};
+
+// zlib in place of the ROM's tinfl
+class ZlibInflater : public DeltaPatcher::Inflater {
+  public:
+    ZlibInflater() { inflateInit(&stream_); }
+    ~ZlibInflater() { inflateEnd(&stream_); }
+
+    void reset() override { inflateReset(&stream_); }
+    esp_err_t inflate(const uint8_t *in, size_t *inLen, uint8_t *out, size_t *outLen,
+                      bool *done) override {
+        stream_.next_in = (Bytef *)in;
+        stream_.avail_in = *inLen;
+        stream_.next_out = out;
+        stream_.avail_out = *outLen;
+        int ret = ::inflate(&stream_, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        *inLen -= stream_.avail_in;
+        *outLen -= stream_.avail_out;
+        *done = ret == Z_STREAM_END;
+        return ESP_OK;
+    }
+
+  private:
+    z_stream stream_ = {};
+};
+
+class FakePartition : public OtaDownloader::Sink {
+  public:
+    std::vector<uint8_t> data;
+    bool finished = false, aborted = false;
+
+    esp_err_t begin(uint32_t offset) override {
+        data.resize(offset);
+        finished = aborted = false;
+        return ESP_OK;
+    }
+    esp_err_t write(const uint8_t *buf, size_t len) override {
+        data.insert(data.end(), buf, buf + len);
+        return ESP_OK;
+    }
+    esp_err_t finish() override {
+        finished = true;
+        return ESP_OK;
+    }
+    void abort() override { aborted = true; }
+};
+
+class NoStore : public OtaDownloader::Store {
+  public:
+    bool load(OtaDownloader::Progress *) override { return false; }
+    void save(const OtaDownloader::Progress &) override {}
+    void clear() override {}
+};
+
+void put32(std::vector<uint8_t> &out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((uint8_t)(v >> (8 * i)));
+    }
+}
+
+// Builds a patch the way make_delta.py lays it out
+class PatchBuilder {
+  public:
+    PatchBuilder(const std::vector<uint8_t> &source) : source_(source) {}
+
+    PatchBuilder &copy(uint32_t offset, uint32_t len) {
+        records_.push_back('C');
+        put32(records_, offset);
+        put32(records_, len);
+        target_.insert(target_.end(), source_.begin() + offset, source_.begin() + offset + len);
+        return *this;
+    }
+    PatchBuilder &add(uint32_t offset, const std::vector<uint8_t> &diff) {
+        records_.push_back('A');
+        put32(records_, offset);
+        put32(records_, diff.size());
+        records_.insert(records_.end(), diff.begin(), diff.end());
+        for (size_t i = 0; i < diff.size(); i++) {
+            target_.push_back(source_[offset + i] + diff[i]);
+        }
+        return *this;
+    }
+    PatchBuilder &insert(const std::vector<uint8_t> &data) {
+        records_.push_back('I');
+        put32(records_, 0);
+        put32(records_, data.size());
+        records_.insert(records_.end(), data.begin(), data.end());
+        target_.insert(target_.end(), data.begin(), data.end());
+        return *this;
+    }
+
+    const std::vector<uint8_t> &target() const { return target_; }
+    // The records before compression, for tests to spoil
+    std::vector<uint8_t> &records() { return records_; }
+
+    std::vector<uint8_t> build() const {
+        std::vector<uint8_t> patch(DELTA_MAGIC, DELTA_MAGIC + 4);
+        put32(patch, target_.size());
+        uint8_t sha[DELTA_SHA_LEN];
+        fakeSha(source_, sha);
+        patch.insert(patch.end(), sha, sha + sizeof(sha));
+        fakeSha(target_, sha);
+        patch.insert(patch.end(), sha, sha + sizeof(sha));
+        uLongf len = compressBound(records_.size());
+        std::vector<uint8_t> compressed(len);
+        compress2(compressed.data(), &len, records_.data(), records_.size(), 9);
+        patch.insert(patch.end(), compressed.begin(), compressed.begin() + len);
+        return patch;
+    }
+
+  private:
+    std::vector<uint8_t> source_, target_, records_;
+};
+
+std::vector<uint8_t> makeImage(size_t size) {
+    std::vector<uint8_t> image(size);
+    for (size_t i = 0; i < size; i++) {
+        image[i] = (uint8_t)(i * 13 + i / 251);
+    }
+    return image;
+}
+
+class DeltaPatcherTest : public ::testing::Test {
+  protected:
+    FakeSource source;
+    FakeDigest digest;
+    ZlibInflater inflater;
+    FakePartition partition;
+    DeltaPatcher patcher{source, digest, inflater, partition};
+
+    void SetUp() override { source.image = makeImage(20000); }
+
+    esp_err_t apply(const std::vector<uint8_t> &patch, size_t pieceLen) {
+        esp_err_t err = patcher.begin(0);
+        for (size_t i = 0; err == ESP_OK && i < patch.size(); i += pieceLen) {
+            err = patcher.write(patch.data() + i, std::min(pieceLen, patch.size() - i));
+        }
+        return err == ESP_OK ? patcher.finish() : err;
+    }
+};
+
+} // namespace
+
+TEST_F(DeltaPatcherTest, RebuildsTarget) {
+    PatchBuilder builder(source.image);
+    builder.copy(0, 5000).insert({1, 2, 3, 4, 5}).copy(6000, 9000).insert({9}).copy(19000, 1000);
+    std::vector<uint8_t> patch = builder.build();
+
+    // However the download splits it up
+    for (size_t pieceLen : {patch.size(), (size_t)1, (size_t)7, (size_t)100}) {
+        SCOPED_TRACE(pieceLen);
+        EXPECT_EQ(apply(patch, pieceLen), ESP_OK);
+        EXPECT_TRUE(partition.finished);
+        EXPECT_EQ(partition.data, builder.target());
+    }
+}
+
+TEST_F(DeltaPatcherTest, AddsDifferences) {
+    // Code that moved, with the addresses in it shifted
+    std::vector<uint8_t> diff(4000);
+    for (size_t i = 0; i < diff.size(); i += 40) {
+        diff[i] = 0x20;
+    }
+    PatchBuilder builder(source.image);
+    builder.copy(0, 1000).add(3000, diff).insert({1, 2, 3}).add(12000, {1, 0, 0xff});
+    std::vector<uint8_t> patch = builder.build();
+    // The differences are mostly zero, so compress well
+    EXPECT_LT(patch.size(), 400);
+
+    for (size_t pieceLen : {patch.size(), (size_t)1, (size_t)33}) {
+        SCOPED_TRACE(pieceLen);
+        EXPECT_EQ(apply(patch, pieceLen), ESP_OK);
+        EXPECT_EQ(partition.data, builder.target());
+    }
+
+    // An add can't read past the end of the source either
+    PatchBuilder pastEnd(source.image);
+    pastEnd.add(19990, std::vector<uint8_t>(20));
+    EXPECT_EQ(apply(pastEnd.build(), 64), ESP_ERR_INVALID_SIZE);
+}
+
+TEST_F(DeltaPatcherTest, RejectsPatchForOtherSource) {
+    PatchBuilder builder(makeImage(100));
+    builder.copy(0, 100);
+    EXPECT_EQ(apply(builder.build(), 64), ESP_ERR_INVALID_STATE);
+    EXPECT_TRUE(partition.aborted);
+    EXPECT_FALSE(partition.finished);
+}
+
+TEST_F(DeltaPatcherTest, RejectsMismatchedTarget) {
+    PatchBuilder builder(source.image);
+    builder.copy(0, 100).insert({1, 2, 3});
+    builder.records().back() ^= 0xff;
+    EXPECT_EQ(apply(builder.build(), 64), ESP_ERR_INVALID_CRC);
+    EXPECT_TRUE(partition.aborted);
+    EXPECT_FALSE(partition.finished);
+}
+
+TEST_F(DeltaPatcherTest, RejectsBadRecords) {
+    PatchBuilder builder(source.image);
+    builder.copy(0, 100);
+    std::vector<uint8_t> patch = builder.build();
+
+    // Copy past the end of the source
+    PatchBuilder pastEnd = builder;
+    pastEnd.records()[4] = 0xff;
+    EXPECT_EQ(apply(pastEnd.build(), 64), ESP_ERR_INVALID_SIZE);
+
+    PatchBuilder unknown = builder;
+    unknown.records()[0] = 'X';
+    EXPECT_EQ(apply(unknown.build(), 64), ESP_ERR_INVALID_RESPONSE);
+
+    // Records that aren't compressed
+    std::vector<uint8_t> bad = patch;
+    bad[sizeof(uint32_t) * 2 + DELTA_SHA_LEN * 2] ^= 0xff;
+    EXPECT_EQ(apply(bad, 64), ESP_ERR_INVALID_RESPONSE);
+
+    bad = patch;
+    bad[0] = 'X';
+    EXPECT_EQ(apply(bad, 64), ESP_ERR_INVALID_VERSION);
+
+    // Truncated, then with trailing data
+    bad.assign(patch.begin(), patch.end() - 1);
+    EXPECT_EQ(apply(bad, 64), ESP_ERR_INVALID_SIZE);
+    bad = patch;
+    bad.push_back(0);
+    EXPECT_EQ(apply(bad, 64), ESP_ERR_INVALID_SIZE);
+    EXPECT_FALSE(partition.finished);
+}
+
+TEST_F(DeltaPatcherTest, RestartsInterruptedDownload) {
+    PatchBuilder builder(source.image);
+    // New code, which doesn't compress
+    std::vector<uint8_t> code(3000);
+    uint32_t seed = 1;
+    for (uint8_t &b : code) {
+        seed = seed * 1103515245 + 12345;
+        b = seed >> 24;
+    }
+    builder.copy(0, 8000).insert(code).copy(9000, 11000);
+    std::vector<uint8_t> patch = builder.build();
+    ASSERT_GT(patch.size(), 1000 + sizeof(uint32_t) * 2 + DELTA_SHA_LEN * 2);
+    LoopbackOtaServer server(patch);
+    LoopbackOtaClient client(server);
+    NoStore store;
+    uint8_t buf[OTA_RESUME_ALIGN];
+    OtaDownloader downloader(
+        client.transport, patcher, store, buf, sizeof(buf), [](uint32_t) {}, [] { return (uint64_t)0; });
+    downloader.setRateLimit(0);
+
+    server.dropAfter(1, 1000);
+    EXPECT_EQ(downloader.download("v2"), OtaDownloader::Result::Interrupted);
+    EXPECT_TRUE(partition.aborted);
+    EXPECT_EQ(downloader.download("v2"), OtaDownloader::Result::Done);
+    EXPECT_TRUE(partition.finished);
+    EXPECT_EQ(partition.data, builder.target());
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include "HeapTrend.h"
+
+TEST(HeapTrend, NoSlopeUntilEnoughSamples) {
+    HeapTrend trend;
+    for (int i = 0; i < HEAP_TREND_MIN_SAMPLES - 1; i++) {
+        trend.add(i * 900, 1000 + i * 100);
+    }
+    EXPECT_EQ(trend.slopePerHour(), 0);
+
+    trend.add((HEAP_TREND_MIN_SAMPLES - 1) * 900, 1000 + (HEAP_TREND_MIN_SAMPLES - 1) * 100);
+    // 100 bytes every 15 minutes
+    EXPECT_NEAR(trend.slopePerHour(), 400, 0.01);
+    EXPECT_EQ(trend.latest(), 1000 + (HEAP_TREND_MIN_SAMPLES - 1) * 100);
+}
+
+TEST(HeapTrend, NoiseAroundFlatUsage) {
+    HeapTrend trend;
+    for (int i = 0; i < 40; i++) {
+        trend.add(i * 900, 50000 + (i % 2 ? 2000 : -2000));
+    }
+    // Swings of 4KB leave a slope of ~30b/h, well under a real leak
+    EXPECT_NEAR(trend.slopePerHour(), 0, 50);
+}
+
+TEST(HeapTrend, WindowDropsOldSamples) {
+    HeapTrend trend;
+    // A one-off jump early on...
+    for (int i = 0; i < HEAP_TREND_SAMPLES; i++) {
+        trend.add(i * 60, i < 10 ? 0 : 8000);
+    }
+    EXPECT_GT(trend.slopePerHour(), 0);
+
+    // ...has left the window, leaving a flat line
+    for (int i = HEAP_TREND_SAMPLES; i < HEAP_TREND_SAMPLES + 10; i++) {
+        trend.add(i * 60, 8000);
+    }
+    EXPECT_EQ(trend.size(), HEAP_TREND_SAMPLES);
+    EXPECT_EQ(trend.slopePerHour(), 0);
+}
+
+TEST(HeapTrend, RunsPastTickCountWrap) {
+    // Where seconds from a 1kHz tick count would have wrapped to 0
+    const uint32_t wrap = UINT32_MAX / 1000;
+    HeapTrend trend;
+    for (int i = 0; i < 20; i++) {
+        trend.add(wrap - 10 * 900 + i * 900, 1000 + i * 100);
+    }
+    EXPECT_NEAR(trend.slopePerHour(), 400, 0.01);
+
+    // And across the wrap of the seconds themselves
+    HeapTrend late;
+    for (int i = 0; i < 20; i++) {
+        late.add(UINT32_MAX - 10 * 900 + i * 900, 1000 - i * 100);
+    }
+    EXPECT_NEAR(late.slopePerHour(), -400, 0.01);
+}
+
+TEST(HeapTrend, Shrinking) {
+    HeapTrend trend;
+    for (int i = 0; i < 20; i++) {
+        trend.add(1000 + i * 3600, 100000 - i * 50);
+    }
+    EXPECT_NEAR(trend.slopePerHour(), -50, 0.01);
+}
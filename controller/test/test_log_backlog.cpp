@@ -0,0 +1,251 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "LogBacklog.h"
+
+namespace {
+
+uint64_t fakeNowMs = 0;
+uint64_t fakeNow() { return fakeNowMs; }
+
+class LogBacklogTest : public ::testing::Test {
+  protected:
+    std::string dir;
+    uint8_t buf[128];
+    LogBacklog::Budget budget = {LOG_BACKLOG_BUDGET_MAGIC, 100000};
+
+    void SetUp() override {
+        char tmpl[] = "/tmp/log_backlog_XXXXXX";
+        dir = mkdtemp(tmpl);
+        fakeNowMs = 1000;
+    }
+
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    std::unique_ptr<LogBacklog> make(uint32_t segmentBytes = 100, uint32_t maxSegments = 8,
+                                     uint32_t bytesPerHour = 100000, uint32_t blockBytes = 1) {
+        auto backlog =
+            std::make_unique<LogBacklog>(dir.c_str(), buf, sizeof(buf), fakeNow, &budget,
+                                         segmentBytes, maxSegments, bytesPerHour, blockBytes);
+        EXPECT_EQ(backlog->open(), ESP_OK);
+        return backlog;
+    }
+
+    void append(LogBacklog &backlog, int i) {
+        std::string msg = "message " + std::to_string(i);
+        EXPECT_TRUE(backlog.append({i * 1000, 7, i % 2 == 0}, msg.c_str(), msg.size()));
+    }
+
+    std::vector<std::string> readAll(LogBacklog &backlog) {
+        std::vector<std::string> msgs;
+        LogBacklog::Record record;
+        char msg[64];
+        size_t len;
+        while (backlog.peek(&record, msg, sizeof(msg), &len)) {
+            msgs.push_back(std::string(msg, len));
+            backlog.pop();
+        }
+        return msgs;
+    }
+
+    size_t segments() {
+        size_t n = 0;
+        for (auto &entry : std::filesystem::directory_iterator(dir)) {
+            (void)entry;
+            n++;
+        }
+        return n;
+    }
+};
+
+} // namespace
+
+TEST_F(LogBacklogTest, ReadsBackAcrossSegments) {
+    auto backlog = make();
+    for (int i = 0; i < 10; i++) {
+        append(*backlog, i);
+    }
+    backlog->flush();
+    EXPECT_GT(segments(), 1u);
+
+    LogBacklog::Record record;
+    char msg[64];
+    size_t len;
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(backlog->peek(&record, msg, sizeof(msg), &len));
+        backlog->pop();
+        EXPECT_EQ(std::string(msg, len), "message " + std::to_string(i));
+        EXPECT_EQ(record.timeUs, i * 1000);
+        EXPECT_EQ(record.boot, 7u);
+        EXPECT_EQ(record.wallTime, i % 2 == 0);
+    }
+    EXPECT_FALSE(backlog->peek(&record, msg, sizeof(msg), &len));
+    EXPECT_TRUE(backlog->empty());
+    EXPECT_EQ(segments(), 0u);
+}
+
+TEST_F(LogBacklogTest, ReadsUnflushedMessages) {
+    auto backlog = make();
+    append(*backlog, 1);
+    EXPECT_EQ(backlog->stats().bytesWritten, 0u);
+    EXPECT_FALSE(backlog->empty());
+    EXPECT_EQ(readAll(*backlog), std::vector<std::string>{"message 1"});
+    // Without writing them first
+    EXPECT_EQ(backlog->stats().bytesWritten, 0u);
+    EXPECT_TRUE(backlog->empty());
+}
+
+TEST_F(LogBacklogTest, KeepsMessagesUntilPopped) {
+    {
+        auto backlog = make(1000);
+        append(*backlog, 1);
+        append(*backlog, 2);
+        LogBacklog::Record record;
+        char msg[64];
+        size_t len;
+        // Peeked from the buffer, then written out before it was sent
+        ASSERT_TRUE(backlog->peek(&record, msg, sizeof(msg), &len));
+        EXPECT_TRUE(backlog->flush());
+        backlog->pop();
+        ASSERT_TRUE(backlog->peek(&record, msg, sizeof(msg), &len));
+        EXPECT_EQ(std::string(msg, len), "message 1");
+        backlog->pop();
+        // Peeked from the file but not sent before a restart
+        ASSERT_TRUE(backlog->peek(&record, msg, sizeof(msg), &len));
+        EXPECT_EQ(std::string(msg, len), "message 2");
+        ASSERT_TRUE(backlog->peek(&record, msg, sizeof(msg), &len));
+        EXPECT_EQ(std::string(msg, len), "message 2");
+    }
+    // Its segment is read again from the start
+    auto backlog = make(1000);
+    EXPECT_EQ(readAll(*backlog), (std::vector<std::string>{"message 1", "message 2"}));
+}
+
+TEST_F(LogBacklogTest, KeptAcrossRestarts) {
+    {
+        auto backlog = make();
+        append(*backlog, 1);
+        append(*backlog, 2);
+    }
+    auto backlog = make();
+    append(*backlog, 3);
+    EXPECT_EQ(readAll(*backlog),
+              (std::vector<std::string>{"message 1", "message 2", "message 3"}));
+}
+
+TEST_F(LogBacklogTest, FlushesAfterDelay) {
+    auto backlog = make();
+    append(*backlog, 1);
+    fakeNowMs += LOG_BACKLOG_FLUSH_MS - 1;
+    backlog->poll();
+    EXPECT_EQ(backlog->stats().bytesWritten, 0u);
+    fakeNowMs += 1;
+    backlog->poll();
+    EXPECT_GT(backlog->stats().bytesWritten, 0u);
+}
+
+TEST_F(LogBacklogTest, DropsOldestSegmentsWhenFull) {
+    auto backlog = make(100, 3);
+    for (int i = 0; i < 20; i++) {
+        append(*backlog, i);
+        backlog->flush();
+    }
+    EXPECT_LE(segments(), 3u);
+    EXPECT_GT(backlog->stats().segmentsDropped, 0u);
+
+    std::vector<std::string> msgs = readAll(*backlog);
+    ASSERT_FALSE(msgs.empty());
+    EXPECT_EQ(msgs.back(), "message 19");
+    EXPECT_LT(msgs.size(), 20u);
+}
+
+TEST_F(LogBacklogTest, ChargesWholeBlocks) {
+    // Each write is charged a block of data and one of metadata
+    budget.bytes = 256;
+    auto backlog = make(1000, 8, 256, 64);
+    append(*backlog, 1);
+    EXPECT_TRUE(backlog->flush());
+    append(*backlog, 2);
+    EXPECT_TRUE(backlog->flush());
+    append(*backlog, 3);
+    EXPECT_FALSE(backlog->flush());
+    EXPECT_EQ(backlog->stats().bytesWritten, 50u);
+
+    // Then messages wait in the buffer, and once it's full are dropped
+    for (int i = 4; i < 8; i++) {
+        append(*backlog, i);
+    }
+    EXPECT_FALSE(backlog->append({0, 0, false}, "message 8", 9));
+    EXPECT_EQ(backlog->stats().dropped, 1u);
+
+    // They take two blocks, so three quarters of an hour to refill
+    fakeNowMs += 45 * 60 * 1000 - 1;
+    EXPECT_FALSE(backlog->flush());
+    fakeNowMs += 1;
+    EXPECT_TRUE(backlog->flush());
+    EXPECT_EQ(backlog->stats().bytesWritten, 7 * 25u);
+    EXPECT_EQ(readAll(*backlog).size(), 7u);
+}
+
+TEST_F(LogBacklogTest, LimitsUrgentWrites) {
+    auto backlog = make();
+    EXPECT_TRUE(backlog->append({0, 0, false}, "error 1", 7, true));
+    backlog->poll();
+    EXPECT_EQ(backlog->stats().bytesWritten, 23u);
+
+    // Another soon after waits, with anything else logged meanwhile
+    EXPECT_TRUE(backlog->append({0, 0, false}, "error 2", 7, true));
+    append(*backlog, 3);
+    fakeNowMs += LOG_BACKLOG_URGENT_FLUSH_MS - 1;
+    backlog->poll();
+    EXPECT_EQ(backlog->stats().bytesWritten, 23u);
+    fakeNowMs += 1;
+    backlog->poll();
+    EXPECT_EQ(backlog->stats().bytesWritten, 23u + 23 + 25);
+}
+
+TEST_F(LogBacklogTest, BudgetKeptAcrossRestarts) {
+    // A cold boot allows two blocks, one write
+    budget = {};
+    {
+        auto backlog = make(1000, 8, 100000, 32);
+        append(*backlog, 1);
+        EXPECT_TRUE(backlog->flush());
+        append(*backlog, 2);
+        EXPECT_FALSE(backlog->flush());
+    }
+    // Restarting doesn't add to it
+    {
+        auto backlog = make(1000, 8, 100000, 32);
+        append(*backlog, 3);
+        EXPECT_FALSE(backlog->flush());
+    }
+    budget.magic = 0;
+    auto backlog = make(1000, 8, 100000, 32);
+    append(*backlog, 4);
+    EXPECT_TRUE(backlog->flush());
+    EXPECT_EQ(readAll(*backlog), (std::vector<std::string>{"message 1", "message 4"}));
+}
+
+TEST_F(LogBacklogTest, DiscardsTornWrite) {
+    {
+        auto backlog = make(1000);
+        append(*backlog, 1);
+        append(*backlog, 2);
+    }
+    // A restart part way through writing a record
+    for (auto &entry : std::filesystem::directory_iterator(dir)) {
+        FILE *f = fopen(entry.path().c_str(), "ab");
+        fwrite("\xb1\x00\x40", 1, 3, f);
+        fclose(f);
+    }
+
+    auto backlog = make(1000);
+    EXPECT_EQ(readAll(*backlog), (std::vector<std::string>{"message 1", "message 2"}));
+    EXPECT_EQ(backlog->stats().segmentsDropped, 1u);
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LogRing.h"
+
+namespace {
+
+constexpr size_t SLOTS = 4;
+constexpr size_t SLOT_SIZE = 32;
+
+class LogRingTest : public ::testing::Test {
+  protected:
+    std::vector<uint8_t> storage[2];
+    LogRing rings[2];
+
+    void SetUp() override {
+        for (int i = 0; i < 2; i++) {
+            storage[i].resize(LogRing::storageSize(SLOTS, SLOT_SIZE));
+            rings[i].init(storage[i].data(), SLOTS, SLOT_SIZE);
+        }
+    }
+
+    bool log(LogRing &ring, uint64_t timeUs, const char *msg) {
+        bool wasEmpty;
+        char *buf = ring.reserve(timeUs, &wasEmpty);
+        if (!buf) {
+            return false;
+        }
+        strcpy(buf, msg);
+        ring.commit(buf, strlen(msg));
+        return true;
+    }
+
+    std::string next(LogRing &ring) {
+        LogRing::Entry entry;
+        if (!ring.peek(&entry)) {
+            return "";
+        }
+        std::string msg(entry.msg, entry.len);
+        ring.pop();
+        return msg;
+    }
+};
+
+} // namespace
+
+TEST_F(LogRingTest, ReadsInOrderUntilFull) {
+    bool wasEmpty = false;
+    char *buf = rings[0].reserve(1, &wasEmpty);
+    EXPECT_TRUE(wasEmpty);
+    rings[0].commit(strcpy(buf, "a"), 1);
+    EXPECT_TRUE(log(rings[0], 2, "b"));
+    EXPECT_TRUE(log(rings[0], 3, "c"));
+    EXPECT_TRUE(log(rings[0], 4, "d"));
+    EXPECT_FALSE(log(rings[0], 5, "e"));
+
+    EXPECT_EQ(next(rings[0]), "a");
+    EXPECT_TRUE(log(rings[0], 6, "f"));
+    EXPECT_EQ(next(rings[0]), "b");
+    EXPECT_EQ(next(rings[0]), "c");
+    EXPECT_EQ(next(rings[0]), "d");
+    EXPECT_EQ(next(rings[0]), "f");
+    EXPECT_EQ(next(rings[0]), "");
+}
+
+TEST_F(LogRingTest, WaitsForEarlierReservation) {
+    // A task reserves, then an interrupt logs before the task commits
+    bool wasEmpty;
+    char *task = rings[0].reserve(1, &wasEmpty);
+    EXPECT_TRUE(log(rings[0], 2, "isr"));
+    EXPECT_EQ(next(rings[0]), "");
+
+    rings[0].commit(strcpy(task, "task"), 4);
+    EXPECT_EQ(next(rings[0]), "task");
+    EXPECT_EQ(next(rings[0]), "isr");
+}
+
+TEST_F(LogRingTest, MergesByTime) {
+    log(rings[0], 10, "a10");
+    log(rings[1], 5, "b5");
+    log(rings[0], 20, "a20");
+    log(rings[1], 15, "b15");
+
+    std::string order;
+    LogRing::Entry entry;
+    while (LogRing *ring = LogRing::oldest(rings, 2, &entry)) {
+        order += std::string(entry.msg, entry.len) + " ";
+        ring->pop();
+    }
+    EXPECT_EQ(order, "b5 a10 b15 a20 ");
+}
+
+TEST_F(LogRingTest, ConcurrentWriterAndReader) {
+    std::vector<uint8_t> big(LogRing::storageSize(64, SLOT_SIZE));
+    LogRing ring;
+    ring.init(big.data(), 64, SLOT_SIZE);
+    const int n = 200000;
+
+    std::thread writer([&] {
+        for (int i = 0; i < n;) {
+            bool wasEmpty;
+            char *buf = ring.reserve(i, &wasEmpty);
+            if (!buf) {
+                std::this_thread::yield();
+                continue;
+            }
+            int len = snprintf(buf, SLOT_SIZE, "msg %d", i);
+            ring.commit(buf, len);
+            i++;
+        }
+    });
+
+    int expected = 0;
+    while (expected < n) {
+        LogRing::Entry entry;
+        if (!ring.peek(&entry)) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_EQ(entry.timeUs, (uint64_t)expected);
+        ASSERT_EQ(std::string(entry.msg, entry.len), "msg " + std::to_string(expected));
+        ring.pop();
+        expected++;
+    }
+    writer.join();
+}
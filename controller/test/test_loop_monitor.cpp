@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "LoopMonitor.h"
+#include "Metrics.h"
+
+using namespace std::chrono_literals;
+
+class LoopMonitorTest : public testing::Test {
+  protected:
+    enum { Read, Compute, NumPhases };
+    static constexpr LoopMonitor::Phase phases_[] = {{"read", 10}, {"compute", 0}};
+
+    LoopMonitor mon_{"test", 100, phases_, NumPhases};
+    LoopMonitor::time_point now_ = std::chrono::steady_clock::time_point{} + 1h;
+
+    void iteration(std::chrono::milliseconds readTime, std::chrono::milliseconds computeTime,
+                   uint32_t waitMs) {
+        mon_.start(now_);
+        now_ += readTime;
+        mon_.endPhase(Read, now_);
+        now_ += computeTime;
+        mon_.endPhase(Compute, now_);
+        mon_.finish(now_, waitMs);
+    }
+};
+
+TEST_F(LoopMonitorTest, PhaseTimesAndBudgets) {
+    iteration(5ms, 30ms, 500);
+    now_ += 500ms;
+    iteration(15ms, 0ms, 500);
+
+    const LoopMonitor::Stats &read = mon_.phaseStats(Read);
+    EXPECT_EQ(read.count, 2);
+    EXPECT_EQ(read.maxUs, 15000);
+    EXPECT_EQ(read.meanUs(), 10000);
+    EXPECT_EQ(read.overruns, 1);
+    EXPECT_EQ(read.hist[3], 1); // 5-10ms
+    EXPECT_EQ(read.hist[4], 1); // 10-20ms
+
+    // No budget
+    EXPECT_EQ(mon_.phaseStats(Compute).overruns, 0);
+    EXPECT_EQ(mon_.phaseStats(Compute).maxUs, 30000);
+
+    const LoopMonitor::Stats &iter = mon_.iterationStats();
+    EXPECT_EQ(iter.count, 2);
+    EXPECT_EQ(iter.totalUs, 50000);
+    EXPECT_EQ(iter.overruns, 0);
+}
+
+TEST_F(LoopMonitorTest, LateStartCountsAgainstDeadline) {
+    iteration(1ms, 1ms, 500);
+
+    // Started 80ms late with 30ms of work
+    now_ += 580ms;
+    iteration(10ms, 20ms, 500);
+
+    const LoopMonitor::Stats &jitter = mon_.startJitterStats();
+    EXPECT_EQ(jitter.count, 1);
+    EXPECT_EQ(jitter.maxUs, 80000);
+    EXPECT_EQ(jitter.hist[6], 1); // 50-100ms
+
+    const LoopMonitor::Stats &iter = mon_.iterationStats();
+    EXPECT_EQ(iter.maxUs, 30000);
+    EXPECT_EQ(iter.overruns, 1);
+}
+
+TEST_F(LoopMonitorTest, EarlyStartIsNotLate) {
+    iteration(1ms, 1ms, 500);
+
+    // Woken early by an event
+    now_ += 100ms;
+    iteration(1ms, 1ms, 500);
+
+    EXPECT_EQ(mon_.startJitterStats().maxUs, 0);
+    EXPECT_EQ(mon_.startJitterStats().hist[0], 1);
+    EXPECT_EQ(mon_.iterationStats().overruns, 0);
+}
+
+TEST_F(LoopMonitorTest, LongTimesInLastBucket) {
+    iteration(1ms, 5s, 0);
+
+    const LoopMonitor::Stats &compute = mon_.phaseStats(Compute);
+    EXPECT_EQ(compute.hist[LOOP_HIST_BUCKETS - 1], 1);
+    EXPECT_EQ(LoopMonitor::bucketLimitMs(LOOP_HIST_BUCKETS - 1), 0);
+    EXPECT_EQ(mon_.iterationStats().overruns, 1);
+}
+
+TEST_F(LoopMonitorTest, IgnoresPhasesOutsideIteration) {
+    mon_.endPhase(Read, now_);
+    mon_.finish(now_, 500);
+
+    EXPECT_EQ(mon_.phaseStats(Read).count, 0);
+    EXPECT_EQ(mon_.iterationStats().count, 0);
+}
+
+TEST_F(LoopMonitorTest, ExportsHistograms) {
+    iteration(5ms, 30ms, 500);
+    now_ += 500ms;
+    iteration(15ms, 0ms, 500);
+
+    size_t len = Metric::render(nullptr, 0);
+    std::string out(len + 1, '\0');
+    Metric::render(out.data(), out.size());
+    out.resize(len);
+
+    EXPECT_NE(out.find("# TYPE loop_iteration_seconds histogram\n"
+                       "loop_iteration_seconds_bucket{loop=\"test\",le=\"0.001\"} 0\n"),
+              std::string::npos)
+        << out;
+    EXPECT_NE(out.find("loop_iteration_seconds_bucket{loop=\"test\",le=\"0.02\"} 1\n"
+                       "loop_iteration_seconds_bucket{loop=\"test\",le=\"0.05\"} 2\n"),
+              std::string::npos)
+        << out;
+    EXPECT_NE(out.find("loop_iteration_seconds_bucket{loop=\"test\",le=\"+Inf\"} 2\n"
+                       "loop_iteration_seconds_sum{loop=\"test\"} 0.05\n"
+                       "loop_iteration_seconds_count{loop=\"test\"} 2\n"),
+              std::string::npos)
+        << out;
+    EXPECT_NE(out.find("loop_start_jitter_seconds_count{loop=\"test\"} 1\n"), std::string::npos)
+        << out;
+    EXPECT_NE(out.find("loop_phase_seconds_bucket{loop=\"test\",phase=\"read\",le=\"0.005\"} 0\n"
+                       "loop_phase_seconds_bucket{loop=\"test\",phase=\"read\",le=\"0.01\"} 1\n"
+                       "loop_phase_seconds_bucket{loop=\"test\",phase=\"read\",le=\"0.02\"} 2\n"),
+              std::string::npos)
+        << out;
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <iterator>
+#include <string>
+
+#include "Metrics.h"
+#include "ModbusMetrics.h"
+
+static const uint32_t testBoundsMs[] = {10, 100};
+
+static MetricCounter testCounter("test_events_total", "Events", "kind=\"a\"");
+static MetricGauge testGauge("test_level", "Level");
+static MetricCounter testCounterB("test_events_total", "Events", "kind=\"b\"");
+static MetricHistogram testHist("test_latency_seconds", "Latency", testBoundsMs,
+                                std::size(testBoundsMs), 0.001);
+
+static std::string render() {
+    size_t len = Metric::render(nullptr, 0);
+    std::string out(len + 1, '\0');
+    EXPECT_EQ(Metric::render(out.data(), out.size()), len);
+    out.resize(len);
+    return out;
+}
+
+TEST(Metrics, CounterLabelsGroupedUnderOneHeader) {
+    testCounter.inc();
+    testCounter.inc(2);
+    testCounterB.inc();
+
+    std::string out = render();
+    EXPECT_NE(out.find("# HELP test_events_total Events\n"
+                       "# TYPE test_events_total counter\n"
+                       "test_events_total{kind=\"a\"} 3\n"
+                       "test_events_total{kind=\"b\"} 1\n"),
+              std::string::npos)
+        << out;
+
+    size_t first = out.find("# TYPE test_events_total");
+    EXPECT_EQ(out.find("# TYPE test_events_total", first + 1), std::string::npos);
+}
+
+TEST(Metrics, GaugeStartsNaN) {
+    std::string out = render();
+    EXPECT_NE(out.find("# TYPE test_level gauge\ntest_level NaN\n"), std::string::npos) << out;
+
+    testGauge.set(21.5);
+    out = render();
+    EXPECT_NE(out.find("test_level 21.5\n"), std::string::npos) << out;
+}
+
+TEST(Metrics, HistogramIsCumulative) {
+    testHist.observe(5);
+    testHist.observe(10);
+    testHist.observe(50);
+    testHist.observe(1000);
+
+    EXPECT_EQ(testHist.count(), 4);
+    EXPECT_EQ(testHist.bucketCount(0), 2);
+    EXPECT_EQ(testHist.bucketCount(1), 1);
+    EXPECT_EQ(testHist.bucketCount(2), 1);
+
+    std::string out = render();
+    EXPECT_NE(out.find("# TYPE test_latency_seconds histogram\n"
+                       "test_latency_seconds_bucket{le=\"0.01\"} 2\n"
+                       "test_latency_seconds_bucket{le=\"0.1\"} 3\n"
+                       "test_latency_seconds_bucket{le=\"+Inf\"} 4\n"
+                       "test_latency_seconds_sum 1.065\n"
+                       "test_latency_seconds_count 4\n"),
+              std::string::npos)
+        << out;
+}
+
+TEST(Metrics, TruncatesToBuffer) {
+    size_t len = Metric::render(nullptr, 0);
+    char buf[16];
+    EXPECT_EQ(Metric::render(buf, sizeof(buf)), len);
+    EXPECT_EQ(strlen(buf), sizeof(buf) - 1);
+}
+
+TEST(Metrics, ModbusMetricsLabelsByClient) {
+    static ModbusMetrics modbus("test");
+    modbus.request(ModbusMetrics::Op::Read, 15);
+    modbus.request(ModbusMetrics::Op::Write, 5);
+    modbus.error(ModbusMetrics::Op::Write);
+
+    std::string out = render();
+    EXPECT_NE(out.find("modbus_requests_total{client=\"test\",op=\"read\"} 1\n"
+                       "modbus_requests_total{client=\"test\",op=\"write\"} 1\n"),
+              std::string::npos)
+        << out;
+    EXPECT_NE(out.find("modbus_errors_total{client=\"test\",op=\"read\"} 0\n"
+                       "modbus_errors_total{client=\"test\",op=\"write\"} 1\n"),
+              std::string::npos)
+        << out;
+    EXPECT_NE(out.find("modbus_request_seconds_bucket{client=\"test\",le=\"0.01\"} 1\n"
+                       "modbus_request_seconds_bucket{client=\"test\",le=\"0.02\"} 2\n"),
+              std::string::npos)
+        << out;
+}
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "NetJobQueue.h"
+
+using JobClass = NetJobQueue::JobClass;
+
+TEST(NetJobQueue, ClaimsMostOverdueFirst) {
+    NetJobQueue queue;
+    int a = queue.add(JobClass::Short, 300);
+    int b = queue.add(JobClass::Short, 100);
+    int c = queue.add(JobClass::Short, 200);
+
+    EXPECT_EQ(queue.claim(50), NetJobQueue::NONE);
+    EXPECT_EQ(queue.nextDueMs(), 100);
+
+    EXPECT_EQ(queue.claim(1000), b);
+    EXPECT_EQ(queue.claim(1000), c);
+    EXPECT_EQ(queue.claim(1000), a);
+    EXPECT_EQ(queue.claim(1000), NetJobQueue::NONE);
+    EXPECT_EQ(queue.nextDueMs(), UINT64_MAX);
+    EXPECT_TRUE(queue.running(a));
+
+    queue.finish(a, 1500);
+    queue.finish(c, 1200);
+    EXPECT_FALSE(queue.running(a));
+    EXPECT_EQ(queue.nextDueMs(), 1200);
+    EXPECT_EQ(queue.claim(1300), c);
+    EXPECT_EQ(queue.claim(1300), NetJobQueue::NONE);
+}
+
+TEST(NetJobQueue, ShortJobsWinTies) {
+    NetJobQueue queue;
+    int longJob = queue.add(JobClass::Long, 100);
+    int shortJob = queue.add(JobClass::Short, 100);
+
+    EXPECT_EQ(queue.claim(100), shortJob);
+    EXPECT_EQ(queue.claim(100), longJob);
+}
+
+TEST(NetJobQueue, OneLongJobAtATime) {
+    NetJobQueue queue(1);
+    int ota = queue.add(JobClass::Long, 0);
+    int upload = queue.add(JobClass::Long, 10);
+    int state = queue.add(JobClass::Short, 20);
+
+    EXPECT_EQ(queue.claim(100), ota);
+    // The upload is overdue but has to wait for the OTA download, the short
+    // job doesn't
+    EXPECT_EQ(queue.claim(100), state);
+    EXPECT_EQ(queue.claim(100), NetJobQueue::NONE);
+    // Nothing a free worker could run
+    EXPECT_EQ(queue.nextDueMs(), UINT64_MAX);
+
+    queue.finish(state, 200);
+    EXPECT_EQ(queue.nextDueMs(), 200);
+    EXPECT_EQ(queue.claim(250), state);
+    queue.finish(state, 300);
+
+    queue.finish(ota, 60000);
+    EXPECT_EQ(queue.nextDueMs(), 10);
+    EXPECT_EQ(queue.claim(400), upload);
+    EXPECT_EQ(queue.claim(400), state);
+    EXPECT_EQ(queue.claim(400), NetJobQueue::NONE);
+}
+
+TEST(NetJobQueue, ManyJobsStayOrdered) {
+    NetJobQueue queue(4);
+    for (int i = 0; i < 20; i++) {
+        // Interleaved deadlines across both classes
+        queue.add(i % 2 ? JobClass::Long : JobClass::Short, (i * 7) % 20 * 10);
+    }
+
+    uint64_t last = 0;
+    for (int i = 0; i < 20; i++) {
+        int job = queue.claim(1000);
+        ASSERT_NE(job, NetJobQueue::NONE);
+        EXPECT_GE(queue.dueMs(job), last);
+        last = queue.dueMs(job);
+        // Long jobs are put straight back so the cap doesn't get in the way
+        queue.finish(job, 5000 + i);
+    }
+}
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "LoopbackOtaServer.h"
+#include "OtaDownloader.h"
+
+using Result = OtaDownloader::Result;
+
+namespace {
+
+// Fake partition: keeps what was written, and like esp_ota_resume only accepts
+// resuming from data it already has
+class FakeSink : public OtaDownloader::Sink {
+  public:
+    std::vector<uint8_t> data;
+    bool finished = false, writing = false;
+    uint32_t lastBegin = 0;
+
+    esp_err_t begin(uint32_t offset) override {
+        if (offset > data.size()) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        data.resize(offset);
+        lastBegin = offset;
+        writing = true;
+        return ESP_OK;
+    }
+    esp_err_t write(const uint8_t *buf, size_t len) override {
+        data.insert(data.end(), buf, buf + len);
+        return ESP_OK;
+    }
+    esp_err_t finish() override {
+        writing = false;
+        finished = true;
+        return ESP_OK;
+    }
+    void abort() override { writing = false; }
+};
+
+class FakeStore : public OtaDownloader::Store {
+  public:
+    bool saved = false;
+    OtaDownloader::Progress progress = {};
+    int saves = 0;
+
+    bool load(OtaDownloader::Progress *p) override {
+        *p = progress;
+        return saved;
+    }
+    void save(const OtaDownloader::Progress &p) override {
+        progress = p;
+        saved = true;
+        saves++;
+    }
+    void clear() override { saved = false; }
+};
+
+uint64_t nowMs_ = 0;
+uint64_t sleptMs_ = 0;
+uint64_t nowMs() { return nowMs_; }
+void sleepMs(uint32_t ms) {
+    nowMs_ += ms;
+    sleptMs_ += ms;
+}
+
+std::vector<uint8_t> makeImage(size_t size, uint8_t seed = 1) {
+    std::vector<uint8_t> image(size);
+    for (size_t i = 0; i < size; i++) {
+        image[i] = (uint8_t)(i * 7 + seed);
+    }
+    return image;
+}
+
+class OtaDownloaderTest : public ::testing::Test {
+  protected:
+    static constexpr uint32_t CHUNK = 2 * OTA_RESUME_ALIGN;
+
+    std::vector<uint8_t> image = makeImage(5 * CHUNK + 1000);
+    LoopbackOtaServer server{image};
+    LoopbackOtaClient client{server};
+    FakeSink sink;
+    FakeStore store;
+    uint8_t buf[CHUNK];
+    OtaDownloader downloader{client.transport, sink, store, buf, CHUNK, sleepMs, nowMs};
+
+    void SetUp() override {
+        nowMs_ = sleptMs_ = 0;
+        downloader.setRateLimit(0);
+    }
+};
+
+} // namespace
+
+TEST_F(OtaDownloaderTest, DownloadsInChunks) {
+    EXPECT_EQ(downloader.download("v2"), Result::Done);
+    EXPECT_TRUE(sink.finished);
+    EXPECT_EQ(sink.data, image);
+    EXPECT_EQ(server.requests(), 6);
+    EXPECT_EQ(server.connections(), 1);
+    EXPECT_EQ(server.bytesServed(), image.size());
+    EXPECT_FALSE(store.saved);
+}
+
+TEST_F(OtaDownloaderTest, ResumesAfterDrop) {
+    // Drop part way through the third chunk
+    server.dropAfter(3, 5000);
+    EXPECT_EQ(downloader.download("v2"), Result::Interrupted);
+    EXPECT_FALSE(sink.writing);
+    ASSERT_TRUE(store.saved);
+    EXPECT_STREQ(store.progress.version, "v2");
+    // Back to the last sector boundary
+    EXPECT_EQ(store.progress.offset, 2 * CHUNK + OTA_RESUME_ALIGN);
+    EXPECT_EQ(store.progress.total, image.size());
+
+    EXPECT_EQ(downloader.download("v2"), Result::Done);
+    EXPECT_EQ(sink.lastBegin, 2 * CHUNK + OTA_RESUME_ALIGN);
+    EXPECT_EQ(sink.data, image);
+    // Only the bytes past the boundary are fetched again
+    EXPECT_EQ(server.bytesServed(), image.size() + 5000 - OTA_RESUME_ALIGN);
+    EXPECT_FALSE(store.saved);
+}
+
+TEST_F(OtaDownloaderTest, ResumesAcrossRestart) {
+    server.dropAfter(2, 100);
+    EXPECT_EQ(downloader.download("v2"), Result::Interrupted);
+    EXPECT_EQ(store.progress.offset, CHUNK);
+
+    // A new downloader picks up the saved progress
+    OtaDownloader restarted(client.transport, sink, store, buf, CHUNK, sleepMs, nowMs);
+    restarted.setRateLimit(0);
+    EXPECT_EQ(restarted.download("v2"), Result::Done);
+    EXPECT_EQ(sink.lastBegin, CHUNK);
+    EXPECT_EQ(sink.data, image);
+}
+
+TEST_F(OtaDownloaderTest, RestartsForNewVersion) {
+    server.dropAfter(2, 100);
+    EXPECT_EQ(downloader.download("v2"), Result::Interrupted);
+
+    std::vector<uint8_t> v3 = makeImage(3 * CHUNK, 9);
+    server.setImage(v3);
+    EXPECT_EQ(downloader.download("v3"), Result::Done);
+    EXPECT_EQ(sink.lastBegin, 0);
+    EXPECT_EQ(sink.data, v3);
+}
+
+TEST_F(OtaDownloaderTest, RestartsWhenResumeRejected) {
+    server.dropAfter(3, 0);
+    EXPECT_EQ(downloader.download("v2"), Result::Interrupted);
+
+    // The partition was written over since
+    sink.data.clear();
+    EXPECT_EQ(downloader.download("v2"), Result::Done);
+    EXPECT_EQ(sink.lastBegin, 0);
+    EXPECT_EQ(sink.data, image);
+}
+
+TEST_F(OtaDownloaderTest, FailsWhenImageChanges) {
+    server.dropAfter(2, 100);
+    EXPECT_EQ(downloader.download("v2"), Result::Interrupted);
+
+    // Rebuilt under the same version
+    server.setImage(makeImage(image.size() + 10));
+    EXPECT_EQ(downloader.download("v2"), Result::Failed);
+    EXPECT_FALSE(sink.finished);
+    EXPECT_FALSE(store.saved);
+}
+
+TEST_F(OtaDownloaderTest, HandlesServerIgnoringRange) {
+    // The one response is read in order, throttled like ranged chunks
+    downloader.setRateLimit(CHUNK);
+    server.setIgnoreRange(true);
+    EXPECT_EQ(downloader.download("v2"), Result::Done);
+    EXPECT_EQ(sink.data, image);
+    EXPECT_EQ(server.requests(), 1);
+    EXPECT_EQ(server.bytesServed(), image.size());
+    EXPECT_EQ(sleptMs_, 5000);
+}
+
+TEST_F(OtaDownloaderTest, RestartsWhenServerCantResume) {
+    server.setIgnoreRange(true);
+    server.dropAfter(1, 2 * CHUNK + 100);
+    EXPECT_EQ(downloader.download("v2"), Result::Interrupted);
+    EXPECT_EQ(server.requests(), 1);
+    EXPECT_EQ(store.progress.offset, 2 * CHUNK);
+
+    // Resuming gets a 200 with the whole image, which is read from the start
+    EXPECT_EQ(downloader.download("v2"), Result::Done);
+    EXPECT_EQ(sink.lastBegin, 0);
+    EXPECT_EQ(sink.data, image);
+    EXPECT_EQ(server.requests(), 2);
+    EXPECT_EQ(server.bytesServed(), 2 * CHUNK + 100 + image.size());
+}
+
+TEST_F(OtaDownloaderTest, ThrottlesToRateLimit) {
+    downloader.setRateLimit(CHUNK);
+    EXPECT_EQ(downloader.download("v2"), Result::Done);
+    EXPECT_EQ(sink.data, image);
+    // A second per chunk, with no wait after the last
+    EXPECT_EQ(sleptMs_, 5000);
+}
+
+TEST(OtaDownloader, ParsesContentRange) {
+    uint32_t first, total;
+    EXPECT_TRUE(OtaDownloader::parseContentRange("bytes 4096-8191/100000", &first, &total));
+    EXPECT_EQ(first, 4096);
+    EXPECT_EQ(total, 100000);
+
+    EXPECT_FALSE(OtaDownloader::parseContentRange(nullptr, &first, &total));
+    EXPECT_FALSE(OtaDownloader::parseContentRange("bytes */100000", &first, &total));
+    EXPECT_FALSE(OtaDownloader::parseContentRange("bytes 10-5/100", &first, &total));
+    EXPECT_FALSE(OtaDownloader::parseContentRange("bytes 0-100/100", &first, &total));
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include "RtcClock.h"
+
+namespace {
+
+int64_t nowUs_;
+// The RTC reads startSec_ until nowUs_ reaches tickUs_, then counts from there
+int64_t startSec_, tickUs_;
+bool ticking_;
+esp_err_t err_;
+
+esp_err_t getTime(struct tm *dt) {
+    if (err_ != ESP_OK) {
+        return err_;
+    }
+    time_t sec = startSec_;
+    if (ticking_ && nowUs_ >= tickUs_) {
+        sec += 1 + (nowUs_ - tickUs_) / 1000000;
+    }
+    gmtime_r(&sec, dt);
+    return ESP_OK;
+}
+int64_t nowUs() { return nowUs_; }
+void pollWait() { nowUs_ += 10000; }
+
+class RtcClockTest : public ::testing::Test {
+  protected:
+    RtcClock clock{getTime, nowUs, pollWait};
+
+    void SetUp() override {
+        nowUs_ = 5000000;
+        startSec_ = 1700000000;
+        tickUs_ = nowUs_ + 400000;
+        ticking_ = true;
+        err_ = ESP_OK;
+    }
+};
+
+} // namespace
+
+TEST_F(RtcClockTest, ReadsOnTick) {
+    int64_t rtcSec, timerUs;
+    EXPECT_EQ(clock.readEdge(&rtcSec, &timerUs), ESP_OK);
+    EXPECT_EQ(rtcSec, startSec_ + 1);
+    EXPECT_EQ(timerUs, tickUs_);
+}
+
+TEST_F(RtcClockTest, RestoresCorrectedTime) {
+    // Set 10^6s ago, running 10ppm fast
+    RtcDrift drift(startSec_ - 1000000, 10000);
+    int64_t us;
+    bool ticking;
+    EXPECT_EQ(clock.bootTimeUs(drift, &us, &ticking), ESP_OK);
+    EXPECT_TRUE(ticking);
+    EXPECT_EQ(us, (startSec_ + 1) * 1000000 - drift.errorUs(startSec_ + 1));
+}
+
+TEST_F(RtcClockTest, StoppedRtcIsNotAnError) {
+    ticking_ = false;
+    int64_t rtcSec, timerUs;
+    EXPECT_EQ(clock.readEdge(&rtcSec, &timerUs), ESP_ERR_TIMEOUT);
+    EXPECT_GE(nowUs_, 5000000 + RTC_EDGE_TIMEOUT_US);
+
+    // Boot carries on without restoring the time
+    int64_t us = -1;
+    bool ticking = true;
+    EXPECT_EQ(clock.bootTimeUs(RtcDrift(), &us, &ticking), ESP_OK);
+    EXPECT_FALSE(ticking);
+    EXPECT_EQ(us, -1);
+}
+
+TEST_F(RtcClockTest, ReturnsReadErrors) {
+    err_ = ESP_FAIL;
+    int64_t us;
+    bool ticking;
+    EXPECT_EQ(clock.bootTimeUs(RtcDrift(), &us, &ticking), ESP_FAIL);
+    EXPECT_TRUE(ticking);
+}
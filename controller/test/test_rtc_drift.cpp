@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include "RtcDrift.h"
+
+static struct tm utc(int year, int mon, int mday, int hour, int min, int sec) {
+    struct tm dt = {};
+    dt.tm_year = year - 1900;
+    dt.tm_mon = mon - 1;
+    dt.tm_mday = mday;
+    dt.tm_hour = hour;
+    dt.tm_min = min;
+    dt.tm_sec = sec;
+    return dt;
+}
+
+TEST(RtcDrift, ToEpoch) {
+    EXPECT_EQ(RtcDrift::toEpoch(utc(1970, 1, 1, 0, 0, 0)), 0);
+    EXPECT_EQ(RtcDrift::toEpoch(utc(2000, 2, 29, 12, 0, 0)), 951825600);
+    EXPECT_EQ(RtcDrift::toEpoch(utc(2024, 12, 31, 23, 59, 59)), 1735689599);
+    // The RTC's range ends in 2099
+    EXPECT_EQ(RtcDrift::toEpoch(utc(2099, 3, 1, 0, 0, 0)), 4076006400);
+}
+
+TEST(RtcDrift, NoCorrectionUntilSet) {
+    RtcDrift drift(0, 20000);
+    EXPECT_EQ(drift.errorUs(1700000000), 0);
+    EXPECT_FALSE(drift.measured(1700000000, 50000));
+}
+
+TEST(RtcDrift, CorrectsForTimeSinceSet) {
+    // 20ppm fast, set a day ago
+    RtcDrift drift(1700000000, 20000);
+    EXPECT_EQ(drift.errorUs(1700000000 + 86400), 1728000);
+    EXPECT_EQ(drift.errorUs(1700000000 - 10), 0);
+}
+
+TEST(RtcDrift, IgnoresShortBaselines) {
+    RtcDrift drift;
+    drift.set(1700000000);
+    EXPECT_FALSE(drift.measured(1700000000 + RTC_DRIFT_MIN_BASELINE_SECS - 1, 1000));
+    EXPECT_EQ(drift.ppb(), 0);
+}
+
+TEST(RtcDrift, IgnoresImplausibleOffsets) {
+    RtcDrift drift;
+    drift.set(1700000000);
+    // An hour off after an hour is someone setting a clock, not drift
+    EXPECT_FALSE(drift.measured(1700000000 + 3600, 3600LL * 1000000));
+    EXPECT_EQ(drift.ppb(), 0);
+}
+
+TEST(RtcDrift, SettlesOnMeasuredDrift) {
+    RtcDrift drift;
+    int64_t now = 1700000000;
+    drift.set(now);
+    // 15ppm slow, measured at hourly syncs
+    for (int i = 0; i < 20; i++) {
+        now += 3600;
+        EXPECT_TRUE(drift.measured(now, -54000));
+        drift.set(now);
+    }
+    EXPECT_NEAR(drift.ppb(), -15000, 100);
+    EXPECT_NEAR(drift.errorUs(now + 86400), -1296000, 10000);
+}
@@ -0,0 +1,279 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "SyslogSender.h"
+
+using Transport = SyslogSender::Transport;
+
+namespace {
+
+uint64_t nowMs_ = 0;
+uint64_t fakeNowMs() { return nowMs_; }
+
+uint64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Local syslog server to send to, on an ephemeral port
+class Sink {
+  public:
+    explicit Sink(bool tcp) : tcp_(tcp) {
+        listen_ = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+        addr_.sin_family = AF_INET;
+        addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_, (sockaddr *)&addr_, sizeof(addr_));
+        socklen_t len = sizeof(addr_);
+        getsockname(listen_, (sockaddr *)&addr_, &len);
+        int rcvbuf = 4 << 20;
+        setsockopt(listen_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        timeval timeout = {0, 200 * 1000};
+        setsockopt(listen_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (tcp) {
+            listen(listen_, 4);
+        }
+    }
+    ~Sink() {
+        closeConn();
+        close(listen_);
+    }
+
+    const sockaddr_in &addr() const { return addr_; }
+
+    // Reads until nothing arrives for a while
+    void receive() {
+        if (!tcp_) {
+            char buf[2048];
+            ssize_t n;
+            while ((n = recv(listen_, buf, sizeof(buf), 0)) > 0) {
+                packets.push_back(std::string(buf, n));
+            }
+            return;
+        }
+        if (conn_ < 0) {
+            conn_ = accept(listen_, nullptr, nullptr);
+            if (conn_ < 0) {
+                return;
+            }
+            timeval timeout = {0, 200 * 1000};
+            setsockopt(conn_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(conn_, buf, sizeof(buf), 0)) > 0) {
+            stream.append(buf, n);
+        }
+    }
+
+    void closeConn() {
+        if (conn_ >= 0) {
+            close(conn_);
+            conn_ = -1;
+        }
+    }
+
+    // Messages received, split as a server would
+    std::vector<std::string> messages() const {
+        std::vector<std::string> out;
+        if (!tcp_) {
+            for (const std::string &p : packets) {
+                size_t start = 0, end;
+                while ((end = p.find('\n', start)) != std::string::npos) {
+                    out.push_back(p.substr(start, end - start));
+                    start = end + 1;
+                }
+                out.push_back(p.substr(start));
+            }
+            return out;
+        }
+        // RFC 6587 octet counting
+        size_t pos = 0;
+        while (pos < stream.size()) {
+            size_t space = stream.find(' ', pos);
+            size_t len = std::stoul(stream.substr(pos, space - pos));
+            out.push_back(stream.substr(space + 1, len));
+            pos = space + 1 + len;
+        }
+        return out;
+    }
+
+    std::vector<std::string> packets;
+    std::string stream;
+
+  private:
+    bool tcp_;
+    int listen_, conn_ = -1;
+    sockaddr_in addr_ = {};
+};
+
+std::string message(int i) {
+    return "<132>hvac_ctrl_test CTRL: message " + std::to_string(i) + " t=23.4 rh=45";
+}
+
+void sendAll(SyslogSender &sender, int n) {
+    for (int i = 0; i < n; i++) {
+        std::string msg = message(i);
+        sender.add(msg.data(), msg.size());
+    }
+    sender.flush();
+}
+
+} // namespace
+
+TEST(SyslogSender, UdpSendsOneMessagePerDatagram) {
+    Sink sink(false);
+    SyslogSender sender(Transport::Udp, fakeNowMs);
+    sender.setDest(sink.addr());
+
+    sendAll(sender, 5);
+    sink.receive();
+    ASSERT_EQ(sink.packets.size(), 5);
+    EXPECT_EQ(sink.packets[3], message(3));
+    EXPECT_EQ(sender.stats().messages, 5);
+    EXPECT_EQ(sender.stats().packets, 5);
+}
+
+TEST(SyslogSender, BatchesIntoFullDatagrams) {
+    Sink sink(false);
+    SyslogSender sender(Transport::UdpBatched, fakeNowMs);
+    sender.setDest(sink.addr());
+
+    sendAll(sender, 100);
+    sink.receive();
+    std::vector<std::string> msgs = sink.messages();
+    ASSERT_EQ(msgs.size(), 100);
+    EXPECT_EQ(msgs[0], message(0));
+    EXPECT_EQ(msgs[99], message(99));
+
+    size_t bytes = 0;
+    for (const std::string &p : sink.packets) {
+        EXPECT_LE(p.size(), SYSLOG_MAX_PACKET);
+        bytes += p.size();
+    }
+    EXPECT_EQ(sink.packets.size(), (bytes + SYSLOG_MAX_PACKET - 1) / SYSLOG_MAX_PACKET);
+    EXPECT_EQ(sender.stats().packets, sink.packets.size());
+}
+
+TEST(SyslogSender, FlushesAfterDelay) {
+    Sink sink(false);
+    SyslogSender sender(Transport::UdpBatched, fakeNowMs);
+    sender.setDest(sink.addr());
+    nowMs_ = 1000;
+    EXPECT_EQ(sender.nextPollMs(), UINT32_MAX);
+
+    std::string msg = message(1);
+    sender.add(msg.data(), msg.size());
+    nowMs_ += 50;
+    EXPECT_EQ(sender.nextPollMs(), SYSLOG_FLUSH_DELAY_MS - 50);
+    sender.poll();
+    EXPECT_EQ(sender.stats().packets, 0);
+
+    nowMs_ += SYSLOG_FLUSH_DELAY_MS;
+    EXPECT_EQ(sender.nextPollMs(), 0);
+    sender.poll();
+    sink.receive();
+    ASSERT_EQ(sink.packets.size(), 1);
+    EXPECT_EQ(sink.packets[0], msg);
+    EXPECT_EQ(sender.nextPollMs(), UINT32_MAX);
+}
+
+TEST(SyslogSender, CutsLongMessages) {
+    Sink sink(true);
+    SyslogSender sender(Transport::Tcp, fakeNowMs);
+    sender.setDest(sink.addr());
+
+    std::string msg(3000, 'x');
+    sender.add(msg.data(), msg.size());
+    sender.flush();
+    sink.receive();
+    std::vector<std::string> msgs = sink.messages();
+    ASSERT_EQ(msgs.size(), 1);
+    EXPECT_EQ(msgs[0].size(), SYSLOG_MAX_PACKET - SYSLOG_MAX_FRAME_PREFIX);
+}
+
+TEST(SyslogSender, TcpFramesAndReconnects) {
+    Sink sink(true);
+    SyslogSender sender(Transport::Tcp, fakeNowMs);
+    sender.setDest(sink.addr());
+    nowMs_ = 1000;
+
+    sendAll(sender, 50);
+    sink.receive();
+    std::vector<std::string> msgs = sink.messages();
+    ASSERT_EQ(msgs.size(), 50);
+    EXPECT_EQ(msgs[49], message(49));
+    EXPECT_EQ(sender.stats().connects, 1);
+    EXPECT_FALSE(sender.down());
+
+    // Sends fail once the server has gone, then the batch is held
+    sink.closeConn();
+    for (int i = 0; i < 20 && sender.stats().connects == 1; i++) {
+        std::string msg = message(100 + i);
+        sender.add(msg.data(), msg.size());
+        sender.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_GT(sender.nextPollMs(), 0);
+    EXPECT_TRUE(sender.down());
+
+    nowMs_ += SYSLOG_RECONNECT_MS;
+    std::string last = message(200);
+    sender.add(last.data(), last.size());
+    sender.flush();
+    EXPECT_EQ(sender.stats().connects, 2);
+    EXPECT_FALSE(sender.down());
+    sink.stream.clear();
+    sink.receive();
+    msgs = sink.messages();
+    ASSERT_FALSE(msgs.empty());
+    EXPECT_EQ(msgs.back(), last);
+}
+
+// Throughput to local servers, and how many messages each transport loses
+TEST(SyslogSender, Benchmark) {
+    const int n = 20000;
+    for (Transport transport : {Transport::Udp, Transport::UdpBatched, Transport::Tcp}) {
+        Sink sink(transport == Transport::Tcp);
+        SyslogSender sender(transport, steadyNowMs);
+        sender.setDest(sink.addr());
+
+        std::atomic<bool> done{false};
+        std::thread reader([&] {
+            while (!done) {
+                sink.receive();
+            }
+            sink.receive();
+        });
+        auto start = std::chrono::steady_clock::now();
+        sendAll(sender, n);
+        double secs =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        done = true;
+        reader.join();
+
+        size_t received = sink.messages().size();
+        const char *name = transport == Transport::Udp          ? "udp"
+                           : transport == Transport::UdpBatched ? "udp batched"
+                                                                : "tcp";
+        printf("%-12s %8.0f msgs/s %6u packets %5zu lost %u dropped\n", name, n / secs,
+               sender.stats().packets, n - received, sender.stats().dropped);
+
+        EXPECT_EQ(sender.stats().messages, n);
+        if (transport == Transport::Tcp) {
+            EXPECT_EQ(received, n);
+        }
+        if (transport != Transport::Udp) {
+            EXPECT_LT(sender.stats().packets, n / 10);
+        }
+    }
+}
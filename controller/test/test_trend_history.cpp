@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "TrendHistory.h"
+
+using Sample = TrendHistory::Sample;
+
+class TrendHistoryTest : public testing::Test {
+  protected:
+    static constexpr size_t CAPACITY = 12;
+
+    Sample buf_[CAPACITY];
+    TrendHistory hist_{buf_, CAPACITY};
+};
+
+TEST_F(TrendHistoryTest, EmptyIsAllInvalid) {
+    Sample out[4];
+    hist_.downsample(out, 4);
+
+    for (const Sample &s : out) {
+        EXPECT_EQ(s.inTempCx100, TrendHistory::INVALID_TEMP);
+        EXPECT_EQ(s.heatCx100, TrendHistory::INVALID_TEMP);
+        EXPECT_EQ(s.coolCx100, TrendHistory::INVALID_TEMP);
+        EXPECT_EQ(s.co2, TrendHistory::INVALID_CO2);
+        EXPECT_EQ(s.fanPct, TrendHistory::INVALID_FAN);
+    }
+    EXPECT_EQ(hist_.generation(), 0);
+}
+
+TEST_F(TrendHistoryTest, PartialFillIsRightAligned) {
+    for (int i = 0; i < 3; i++) {
+        hist_.add(20.0 + i, 18, 24, 600 + i * 100, 10 * i);
+    }
+
+    // 12 slots into 4 buckets of 3; only the newest bucket has data
+    Sample out[4];
+    hist_.downsample(out, 4);
+
+    for (int b = 0; b < 3; b++) {
+        EXPECT_EQ(out[b].inTempCx100, TrendHistory::INVALID_TEMP);
+        EXPECT_EQ(out[b].co2, TrendHistory::INVALID_CO2);
+    }
+    EXPECT_EQ(out[3].inTempCx100, 2100);
+    EXPECT_EQ(out[3].heatCx100, 1800);
+    EXPECT_EQ(out[3].coolCx100, 2400);
+    EXPECT_EQ(out[3].co2, 700);
+    EXPECT_EQ(out[3].fanPct, 10);
+}
+
+TEST_F(TrendHistoryTest, WrapKeepsNewest) {
+    for (int i = 0; i < 30; i++) {
+        hist_.add(i, i, i, 400 + i, i);
+    }
+    EXPECT_EQ(hist_.size(), CAPACITY);
+    EXPECT_EQ(hist_.generation(), 30);
+
+    Sample out[CAPACITY];
+    hist_.downsample(out, CAPACITY);
+    for (size_t i = 0; i < CAPACITY; i++) {
+        EXPECT_EQ(out[i].inTempCx100, (int16_t)((18 + i) * 100));
+        EXPECT_EQ(out[i].co2, 418 + i);
+    }
+}
+
+TEST_F(TrendHistoryTest, SkipsMissingValues) {
+    for (int i = 0; i < 6; i++) {
+        hist_.add(i % 2 ? std::nan("") : 21.5, 18, 24, i % 2 ? 0 : 800, i % 2 ? 200 : 50);
+    }
+    hist_.add(-5.25, std::nan(""), std::nan(""), 0, 0);
+    for (int i = 0; i < 5; i++) {
+        hist_.add(std::nan(""), std::nan(""), std::nan(""), 0, 255);
+    }
+
+    Sample out[2];
+    hist_.downsample(out, 2);
+
+    EXPECT_EQ(out[0].inTempCx100, 2150);
+    EXPECT_EQ(out[0].co2, 800);
+    EXPECT_EQ(out[0].fanPct, 50);
+
+    EXPECT_EQ(out[1].inTempCx100, -525);
+    EXPECT_EQ(out[1].heatCx100, TrendHistory::INVALID_TEMP);
+    EXPECT_EQ(out[1].co2, TrendHistory::INVALID_CO2);
+    EXPECT_EQ(out[1].fanPct, 0);
+}
+
+TEST(TrendHistory, NoStorage) {
+    TrendHistory hist(nullptr, 100);
+    hist.add(20, 18, 24, 600, 10);
+    EXPECT_EQ(hist.capacity(), 0);
+    EXPECT_EQ(hist.size(), 0);
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""
+Collect core dumps uploaded by the controllers (see CoreDumpUploader).
+
+Each upload is saved as coredumps/<device>/<time>_<elf sha>.elf with the
+request headers alongside in a .json file. Decode one with the ELF built from
+the matching commit:
+
+    idf.py coredump-info -c <dump>.elf --core-format elf
+
+Dumps hold everything that was in RAM, credentials included, so they're only
+uploaded over HTTPS. The devices check the certificate against the same root
+as the OTA server's (ISRG Root X1), so use a Let's Encrypt certificate for the
+host name in default_coredump_url.
+
+Usage: coredump_server.py cert.pem key.pem [port] [dir]
+"""
+
+import json
+import re
+import ssl
+import sys
+from datetime import datetime, timezone
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+
+DEFAULT_PORT = 8514
+MAX_DUMP_SIZE = 1024 * 1024
+
+HEADERS = ["X-Device", "X-Elf-Sha256", "X-Firmware-Version", "X-Crash-Task", "X-Crash-Pc"]
+
+
+def safe_name(s, default):
+    s = re.sub(r"[^A-Za-z0-9_.-]", "_", s or "")
+    return s or default
+
+
+class CoreDumpHandler(BaseHTTPRequestHandler):
+    out_dir = Path("coredumps")
+
+    def do_POST(self):
+        if self.path != "/coredump":
+            self.send_error(404)
+            return
+
+        length = int(self.headers.get("Content-Length", 0))
+        if length <= 0 or length > MAX_DUMP_SIZE:
+            self.send_error(400, "Bad length")
+            return
+        body = self.rfile.read(length)
+        if len(body) != length:
+            self.send_error(400, "Short body")
+            return
+
+        meta = {h: self.headers.get(h, "") for h in HEADERS}
+        meta["received"] = datetime.now(timezone.utc).isoformat()
+        meta["size"] = length
+
+        device_dir = self.out_dir / safe_name(meta["X-Device"], "unknown")
+        device_dir.mkdir(parents=True, exist_ok=True)
+        stem = "{}_{}".format(
+            datetime.now(timezone.utc).strftime("%Y%m%dT%H%M%SZ"),
+            safe_name(meta["X-Elf-Sha256"][:16], "nosha"),
+        )
+        (device_dir / (stem + ".elf")).write_bytes(body)
+        (device_dir / (stem + ".json")).write_text(json.dumps(meta, indent=2) + "\n")
+
+        print(
+            "{}: {} bytes, task={} pc={} elf={}".format(
+                meta["X-Device"],
+                length,
+                meta["X-Crash-Task"],
+                meta["X-Crash-Pc"],
+                meta["X-Elf-Sha256"],
+            )
+        )
+
+        self.send_response(201)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__.strip())
+    port = int(sys.argv[3]) if len(sys.argv) > 3 else DEFAULT_PORT
+    if len(sys.argv) > 4:
+        CoreDumpHandler.out_dir = Path(sys.argv[4])
+
+    server = ThreadingHTTPServer(("", port), CoreDumpHandler)
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(sys.argv[1], sys.argv[2])
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    print("Listening on port {}, saving to {}/".format(port, CoreDumpHandler.out_dir))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
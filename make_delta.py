@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""
+Make a delta patch for OTA updates (see DeltaPatcher), rebuilding new.bin from
+old.bin with copies of runs the two share and the bytes that changed.
+
+As in bsdiff, runs that mostly match are sent as their bytewise difference
+from the old image rather than as new bytes. Code that moved only differs in
+the addresses it refers to, so the differences are mostly zero and the zlib
+compressed records come out far smaller.
+
+Publish it next to the full image as <new version>.from-<old version>.delta,
+where the devices running the old version look for it before downloading
+<new version>.bin. A device falls back to the full image if there's no patch
+for its version or the patch doesn't apply.
+
+Usage: make_delta.py old.bin new.bin out.delta
+"""
+
+import hashlib
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = b"ESPZ"
+# Exact runs shorter than this are too weak to line the images up on
+MIN_COPY = 24
+# Exact runs inside a difference as long as this are copied instead
+LONG_COPY = 256
+BLOCK = 16
+# Code is word aligned, so indexing every 4th offset finds nearly all matches
+INDEX_STEP = 4
+MAX_CANDIDATES = 8
+
+
+def image_sha(image):
+    """The SHA-256 esp_partition_get_sha256 reports for the running image."""
+    # Images built with an appended digest report that instead of hashing
+    # the whole partition
+    if len(image) > 32 and hashlib.sha256(image[:-32]).digest() == image[-32:]:
+        return image[-32:]
+    return hashlib.sha256(image).digest()
+
+
+def index_blocks(source):
+    index = {}
+    for i in range(0, len(source) - BLOCK + 1, INDEX_STEP):
+        candidates = index.setdefault(source[i : i + BLOCK], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(i)
+    return index
+
+
+def match_len(source, s, target, t):
+    n = 0
+    limit = min(len(source) - s, len(target) - t)
+    while n < limit and source[s + n] == target[t + n]:
+        n += 1
+    return n
+
+
+def exact_matches(source, target):
+    """Yields (source offset, target offset, length) of runs the two share."""
+    index = index_blocks(source)
+    next_source = 0
+    t = 0
+    while t < len(target):
+        best_s, best_len = 0, 0
+        # Carrying on from the last copy is the most likely match
+        candidates = [next_source] + index.get(target[t : t + BLOCK], [])
+        for s in candidates:
+            n = match_len(source, s, target, t)
+            if n > best_len:
+                best_s, best_len = s, n
+        if best_len < MIN_COPY:
+            t += 1
+            continue
+
+        yield (best_s, t, best_len)
+        t += best_len
+        next_source = best_s + best_len
+
+
+def best_extension(source, s, target, t, limit, step):
+    """How far from (s, t) the images keep matching more often than not."""
+    best = score = length = 0
+    i = 0
+    while i < limit and 0 <= s + i * step < len(source):
+        score += 1 if source[s + i * step] == target[t + i * step] else -1
+        i += 1
+        if score > best:
+            best, length = score, i
+    return length
+
+
+def spans(source, target):
+    """Yields (source offset, target offset, length) of runs that mostly
+    match: the exact ones grown forward and back over the bytes around them,
+    as bsdiff does."""
+    span = None
+    for s, t, n in list(exact_matches(source, target)) + [(0, len(target), 0)]:
+        gap_start = span[1] + span[2] if span else 0
+        if span:
+            grow = best_extension(
+                source, span[0] + span[2], target, gap_start, t - gap_start, 1
+            )
+            span[2] += grow
+            gap_start += grow
+            yield tuple(span)
+        if not n:
+            break
+        back = best_extension(source, s - 1, target, t - 1, t - gap_start, -1)
+        span = [s - back, t - back, n + back]
+
+
+def records(source, target):
+    """Yields the patch records, uncompressed."""
+    t = 0
+    for s, span_t, n in spans(source, target):
+        if t < span_t:
+            yield struct.pack("<BII", ord("I"), 0, span_t - t) + target[t:span_t]
+        delta = bytes((target[span_t + i] - source[s + i]) & 0xFF for i in range(n))
+        # Long exact runs are copied, the rest sent as differences
+        i = 0
+        for run in re.finditer(b"\0{%d,}" % LONG_COPY, delta):
+            if i < run.start():
+                yield struct.pack("<BII", ord("A"), s + i, run.start() - i) + delta[i : run.start()]
+            yield struct.pack("<BII", ord("C"), s + run.start(), run.end() - run.start())
+            i = run.end()
+        if i < n:
+            yield struct.pack("<BII", ord("A"), s + i, n - i) + delta[i:]
+        t = span_t + n
+    if t < len(target):
+        yield struct.pack("<BII", ord("I"), 0, len(target) - t) + target[t:]
+
+
+def make_patch(source, target):
+    out = bytearray(MAGIC)
+    out += struct.pack("<I", len(target))
+    out += image_sha(source)
+    out += hashlib.sha256(target).digest()
+    out += zlib.compress(b"".join(records(source, target)), 9)
+    return bytes(out)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__.strip())
+    with open(sys.argv[1], "rb") as f:
+        source = f.read()
+    with open(sys.argv[2], "rb") as f:
+        target = f.read()
+
+    patch = make_patch(source, target)
+    with open(sys.argv[3], "wb") as f:
+        f.write(patch)
+    print(f"{len(patch)} bytes, {100 * len(patch) / len(target):.1f}% of the full image")
+
+
+if __name__ == "__main__":
+    main()
@@ -83,11 +83,17 @@ uint32_t ZCUIManager::handleTasks() {
     xSemaphoreTake(mutex_, portMAX_DELAY);
 
     sleepMgr_->update();
-    auto rv = lv_timer_handler();
+    auto rv = sleepMgr_->handleTimers();
     xSemaphoreGive(mutex_);
     return rv;
 }
 
+void ZCUIManager::logStats() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    sleepMgr_->logStats();
+    xSemaphoreGive(mutex_);
+}
+
 void ZCUIManager::updateState(SystemState state) {
     xSemaphoreTake(mutex_, portMAX_DELAY);
     for (int i = 0; i < 4; i++) {
@@ -24,6 +24,9 @@ class ZCUIManager : public AbstractZCUIManager {
     }
 
     uint32_t handleTasks();
+    // Someone is using the display. Only call from the UI task.
+    bool interactive() const { return sleepMgr_->awake(); }
+    void logStats();
 
     void setMessage(ZCDomain::MsgID msgID, bool allowCancel, const char *msg) override {
         xSemaphoreTake(mutex_, portMAX_DELAY);
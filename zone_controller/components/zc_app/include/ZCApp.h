@@ -4,6 +4,7 @@
 #include "AbstractZCUIManager.h"
 #include "BaseModbusClient.h"
 #include "BaseOutIO.h"
+#include "LoopMonitor.h"
 #include "OutCtrl.h"
 #include "StateChangeRateLimiter.h"
 
@@ -15,6 +16,8 @@
 #define ZONE_PUMP_MAX_CX_MODE_AGE std::chrono::minutes(15)
 #define MAX_VALVE_TRANSITION_INTERVAL std::chrono::minutes(2)
 #define SYSTEM_STATE_LOG_INTERVAL std::chrono::minutes(1)
+// Outputs should be updated within one update period of when they were due
+#define OUTPUT_UPDATE_DEADLINE_MS OUTPUT_UPDATE_PERIOD_MS
 
 class ZCApp {
   public:
@@ -30,6 +33,7 @@ class ZCApp {
     virtual ~ZCApp() = default;
 
     void task();
+    void logLoopStats() const { loopMon_.log(); }
 
   protected:
     virtual std::chrono::steady_clock::time_point steadyNow() const {
@@ -68,6 +72,18 @@ class ZCApp {
     StateChangeRateLimiter zonePumpChangeLimiter_{}, fcPumpChangeLimiter_{};
     bool zonePumpInLimit_ = false, fcPumpInLimit_ = false;
 
+    enum LoopPhase {
+        LoopInputs,
+        LoopControl,
+        LoopModbus,
+        LoopOutputs,
+        LoopLogging,
+        LoopUI,
+        NumLoopPhases
+    };
+    static const LoopMonitor::Phase loopPhases_[NumLoopPhases];
+    LoopMonitor loopMon_{"zc", OUTPUT_UPDATE_DEADLINE_MS, loopPhases_, NumLoopPhases};
+
     void logSystemState(SystemState state);
     void handleCancelMessage(MsgID id);
     bool pollUIEvent(bool wait);
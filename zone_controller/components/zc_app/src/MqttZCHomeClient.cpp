@@ -65,6 +65,8 @@ MqttZCHomeClient::MqttZCHomeClient() {
     config_.session.last_will.topic = AVAILABILITY_TOPIC;
     config_.session.last_will.msg = "0";
     config_.session.last_will.retain = true;
+
+    setHealthDevice("zone_controller");
 }
 
 MqttZCHomeClient::~MqttZCHomeClient() { vSemaphoreDelete(mutex_); }
@@ -1,5 +1,6 @@
 #include "ZCApp.h"
 
+#include "Metrics.h"
 #include "esp_log.h"
 
 #define VALVE_STUCK_MSG "valves may be stuck"
@@ -7,12 +8,35 @@
 
 static const char *TAG = "APP";
 
+static MetricCounter loopsMetric("zone_loops_total", "Output loop iterations");
+static MetricCounter cxErrsMetric("zone_cx_errors_total", "Failed CX mode sets and checks");
+// Set when the system state is logged
+static MetricGauge zonePumpMetric("zone_pump_on", "Pump on", "pump=\"zone\"");
+static MetricGauge fcPumpMetric("zone_pump_on", "Pump on", "pump=\"fancoil\"");
+static MetricGauge hpModeMetric("zone_heat_pump_mode", "0 off, 1 standby, 2 cool, 3 heat");
+static MetricGauge cxModeMetric("zone_cx_mode", "CX mode, -1 off, 0 cool, 1 heat");
+static MetricGauge hpOutTempMetric("zone_hp_temp_celsius", "Heat pump temperature",
+                                   "sensor=\"outlet\"");
+static MetricGauge hpAmbientTempMetric("zone_hp_temp_celsius", "Heat pump temperature",
+                                       "sensor=\"ambient\"");
+static MetricGauge hpFreqMetric("zone_hp_compressor_hz", "Heat pump compressor frequency");
+static MetricGauge hpCurrentMetric("zone_hp_input_current_amps", "Heat pump AC input current");
+
+// Budgets in ms for each LoopPhase. Logging includes the blocking CX reads
+// for the state log.
+const LoopMonitor::Phase ZCApp::loopPhases_[] = {
+    {"inputs", 50}, {"control", 20}, {"modbus", 300}, {"outputs", 50}, {"logging", 400}, {"ui", 20},
+};
+
 void ZCApp::task() {
+    loopMon_.start();
+    loopsMetric.inc();
     InputState zioState = getZioState_();
     if (zioState != lastZioState_) {
         logInputState(zioState);
     }
     lastZioState_ = zioState;
+    loopMon_.endPhase(LoopInputs);
 
     if (testMode_) {
         OutCtrl::setCalls(currentState_, zioState);
@@ -28,6 +52,8 @@ void ZCApp::task() {
     }
 
     checkStuckValves(zioState.valve_sw);
+    loopMon_.endPhase(LoopControl);
+
     if (!testMode_) {
         setCxOpMode(currentState_.heatPumpMode);
         pollCxStatus();
@@ -45,7 +71,10 @@ void ZCApp::task() {
             uiManager_->clearMessage(MsgID::StaleCXMode);
         }
     }
+    loopMon_.endPhase(LoopModbus);
+
     setIOStates(currentState_);
+    loopMon_.endPhase(LoopOutputs);
 
     if (currentState_ != lastState_ ||
         (steadyNow() - lastLoggedSystemState_) > SYSTEM_STATE_LOG_INTERVAL) {
@@ -56,8 +85,11 @@ void ZCApp::task() {
         lastLoggedSystemState_ = steadyNow();
     }
     lastState_ = currentState_;
+    loopMon_.endPhase(LoopLogging);
 
     uiManager_->updateState(currentState_);
+    loopMon_.endPhase(LoopUI);
+    loopMon_.finish(OUTPUT_UPDATE_PERIOD_MS);
 
     if (pollUIEvent(true)) {
         // If we found something in the queue, clear the queue before proceeeding with
@@ -102,11 +134,24 @@ void ZCApp::logSystemState(SystemState state) {
     double hpACCurrent = -1;
     double hpAmbientT = -1;
     CxOpMode cxOpMode = CxOpMode::Unknown;
-    mbClient_->getCxOpMode(&cxOpMode);
-    mbClient_->getCxAcOutletWaterTemp(&hpOutT);
-    mbClient_->getCxCompressorFrequency(&hpHz);
-    mbClient_->getCxInputACCurrent(&hpACCurrent);
-    mbClient_->getCxAmbientTemp(&hpAmbientT);
+    if (mbClient_->getCxOpMode(&cxOpMode) == ESP_OK) {
+        cxModeMetric.set(static_cast<int>(cxOpMode));
+    }
+    if (mbClient_->getCxAcOutletWaterTemp(&hpOutT) == ESP_OK) {
+        hpOutTempMetric.set(hpOutT);
+    }
+    if (mbClient_->getCxCompressorFrequency(&hpHz) == ESP_OK) {
+        hpFreqMetric.set(hpHz);
+    }
+    if (mbClient_->getCxInputACCurrent(&hpACCurrent) == ESP_OK) {
+        hpCurrentMetric.set(hpACCurrent);
+    }
+    if (mbClient_->getCxAmbientTemp(&hpAmbientT) == ESP_OK) {
+        hpAmbientTempMetric.set(hpAmbientT);
+    }
+    zonePumpMetric.set(state.zonePump);
+    fcPumpMetric.set(state.fcPump);
+    hpModeMetric.set(static_cast<int>(state.heatPumpMode));
 
     wrote = snprintf(
         buffer + pos, sizeof(buffer) - pos,
@@ -251,6 +296,7 @@ esp_err_t ZCApp::setCxOpMode(CxOpMode cxMode) {
         uiManager_->clearMessage(MsgID::CXError);
     } else {
         lastCxOpMode_ = CxOpMode::Error;
+        cxErrsMetric.inc();
         uiManager_->setMessage(MsgID::CXError, false, "CX communication error");
     }
 
@@ -304,6 +350,7 @@ void ZCApp::pollCxStatus() {
         }
     } else {
         lastCxOpMode_ = CxOpMode::Error;
+        cxErrsMetric.inc();
         uiManager_->setMessage(MsgID::CXError, false, "CX communication error");
     }
 }
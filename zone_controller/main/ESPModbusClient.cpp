@@ -1,7 +1,9 @@
 #include "ESPModbusClient.h"
 
+#include "ModbusMetrics.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #define MB_PORT_NUM UART_NUM_1 // Number of UART port used for Modbus connection
 #define MB_DEV_SPEED 9600      // The communication speed of the UART
@@ -16,6 +18,8 @@
 
 static const char *TAG = "MBC";
 
+static ModbusMetrics metrics("cx");
+
 esp_err_t ESPModbusClient::init() {
     int i = 0;
     for (auto &[reg, def] : cx_registers_) {
@@ -85,10 +89,13 @@ esp_err_t ESPModbusClient::getParam(CxRegister reg, uint16_t *value) {
     const CxRegDef regDef = cx_registers_.at(reg);
 
     ESP_LOGD(TAG, "Getting heatpump %s(%d)", regDef.name, regDef.idx);
+    int64_t startUs = esp_timer_get_time();
     err = mbc_master_get_parameter(regDef.idx, (char *)regDef.name, (uint8_t *)value, &type);
+    metrics.request(ModbusMetrics::Op::Read, (esp_timer_get_time() - startUs) / 1000);
     if (err == ESP_OK) {
         ESP_LOGD(TAG, "Got heatpump %s(%d)=%d", regDef.name, regDef.idx, *value);
     } else {
+        metrics.error(ModbusMetrics::Op::Read);
         ESP_LOGE(TAG, "Get failed %s(%d), err = 0x%x (%s)", regDef.name, regDef.idx, (int)err,
                  (char *)esp_err_to_name(err));
     }
@@ -103,10 +110,13 @@ esp_err_t ESPModbusClient::setParam(CxRegister reg, uint16_t value) {
     const CxRegDef regDef = cx_registers_.at(reg);
 
     ESP_LOGD(TAG, "Setting heatpump %s(%d)=%d", regDef.name, regDef.idx, value);
+    int64_t startUs = esp_timer_get_time();
     err = mbc_master_set_parameter(regDef.idx, (char *)regDef.name, (uint8_t *)&value, &type);
+    metrics.request(ModbusMetrics::Op::Write, (esp_timer_get_time() - startUs) / 1000);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Set heatpump %s(%d)=%d", regDef.name, regDef.idx, value);
     } else {
+        metrics.error(ModbusMetrics::Op::Write);
         ESP_LOGE(TAG, "Set failed %s(%d)=%d, err = 0x%x (%s)", regDef.name, regDef.idx, value,
                  (int)err, (char *)esp_err_to_name(err));
     }
@@ -27,6 +27,8 @@ void app_main() {
         .pin_dc = 13,
         .pin_rst = 12,
         .landscape_inverted = true,
+        .render_mode = DISP_RENDER_PARTIAL_DMA,
+        .pin_touch_int = 9, // TS_INT
     };
     init_display(&disp_cfg);
 
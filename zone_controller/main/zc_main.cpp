@@ -1,6 +1,7 @@
 #include "zc_main.h"
 
 #include <chrono>
+#include <iterator>
 
 #include "esp_log.h"
 #include "esp_task.h"
@@ -10,17 +11,22 @@
 #include "lvgl.h"
 #include "nvs_flash.h"
 
+#include "CoreDumpUploader.h"
 #include "ESPModbusClient.h"
 #include "ESPOTAClient.h"
 #include "ESPOutIO.h"
 #include "ESPWifi.h"
+#include "HeapAccounting.h"
+#include "MetricsServer.h"
 #include "MqttZCHomeClient.h"
 #include "NetworkTaskManager.h"
 #include "OtaTask.h"
 #include "OutCtrl.h"
+#include "TaskHealthSampler.h"
 #include "ValveStateManager.h"
 #include "ZCApp.h"
 #include "ZCUIManager.h"
+#include "init_display.h"
 #include "remote_logger.h"
 #include "wifi_credentials.h"
 #include "zone_io_client.h"
@@ -35,6 +41,7 @@
 
 #define INIT_ERR_RESTART_DELAY_TICKS pdMS_TO_TICKS(10 * 1000)
 #define HEAP_LOG_INTERVAL std::chrono::minutes(15)
+#define HEALTH_SAMPLE_INTERVAL std::chrono::minutes(1)
 
 static const char *TAG = "MAIN";
 static const char *DEVICE_NAME = "zonectrl";
@@ -48,6 +55,20 @@ static ESPOutIO outIO_;
 static ESPModbusClient mbClient_;
 static ESPOTAClient *ota_;
 static NetworkTaskManager *netTaskMgr_;
+static CoreDumpUploader *coreDump_;
+static TaskHealthSampler taskHealth_;
+static MetricsServer metricsServer_;
+
+static const HeapAccounting::Subsystem heapSubsystems_[] = {
+    {"lvgl", {"uiTask"}},
+    {"mqtt", {"mqtt_task"}},
+    {"zone_io", {"zone_io_task"}},
+    {"remote_logger", {"remoteLogger"}},
+    {"net_tasks", {"netTask", "netTask1"}},
+    {"app", {"output_task"}},
+    {"network", {"tiT", "wifi", "sys_evt"}},
+};
+static HeapAccounting heapAccounting_(heapSubsystems_, std::size(heapSubsystems_));
 ValveStateManager valveStateManager_;
 OutCtrl *outCtrl_;
 
@@ -64,12 +85,17 @@ bool uiEvtRcv(ZCUIManager::Event *evt, uint waitMs) {
 }
 
 void uiTask(void *uiManager) {
+    disp_touch_set_wake_task(xTaskGetCurrentTaskHandle());
     while (1) {
         uint32_t delayMs = ((ZCUIManager *)uiManager)->handleTasks();
+        // Someone at the screen may be using Home Assistant too, don't make its
+        // commands wait on power save
+        wifi_.holdFullPower(ESPWifi::HoldUI, ((ZCUIManager *)uiManager)->interactive());
         if (delayMs < portTICK_PERIOD_MS) {
             taskYIELD();
         } else {
-            vTaskDelay(pdMS_TO_TICKS(delayMs));
+            // Touch IRQs cut the wait short
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delayMs));
         }
     }
 }
@@ -98,15 +124,29 @@ void outputTask(void *) {
     bool firstTime = true;
 
     log_heap_stats();
+    disp_log_stats();
     wifi_.logDiagnostics();
     std::chrono::steady_clock::time_point last_logged_heap = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_health_sample = last_logged_heap;
+    taskHealth_.sample();
+    heapAccounting_.sample();
 
     while (1) {
         zcApp_->task();
 
         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if ((now - last_health_sample) > HEALTH_SAMPLE_INTERVAL) {
+            homeCli_->updateHealth(taskHealth_.sample());
+            last_health_sample = now;
+        }
         if ((now - last_logged_heap) > HEAP_LOG_INTERVAL) {
             log_heap_stats();
+            heapAccounting_.sample();
+            heapAccounting_.log();
+            taskHealth_.log();
+            zcApp_->logLoopStats();
+            disp_log_stats();
+            uiManager_->logStats();
             wifi_.logDiagnostics();
             last_logged_heap = now;
         }
@@ -129,13 +169,17 @@ void initNetwork() {
 
     wifi_.init(DEVICE_NAME);
     wifi_.connect(default_wifi_ssid, default_wifi_pswd);
+    metricsServer_.start();
 
     netTaskMgr_ = new NetworkTaskManager(wifi_);
-    netTaskMgr_->addTask(otaTaskFn, ota_);
+    netTaskMgr_->addTask(otaTaskFn, ota_, "ota", NetworkTaskManager::TaskClass::Long);
+    coreDump_ = new CoreDumpUploader(DEVICE_NAME, default_coredump_url);
+    netTaskMgr_->addTask(coreDumpTaskFn, coreDump_, "coredump",
+                         NetworkTaskManager::TaskClass::Long);
 
     homeCli_->start();
 
-    remote_logger_init(DEVICE_NAME, default_log_host);
+    remote_logger_init(DEVICE_NAME, default_log_host, SyslogSender::Transport::Udp, "logs");
 }
 
 extern "C" void zc_main() {
@@ -154,6 +198,7 @@ extern "C" void zc_main() {
     uiManager_ = new ZCUIManager(state, static_cast<size_t>(ZCDomain::MsgID::_Last), uiEvtCb);
     homeCli_ = new MqttZCHomeClient();
     ota_ = new ESPOTAClient("zone_controller", otaMsgCb, UI_MAX_MSG_LEN);
+    ota_->setWifi(&wifi_);
     uiManager_->setFirmwareVersion(ota_->currentVersion());
     outCtrl_ = new OutCtrl(valveStateManager_, *uiManager_);
     zcApp_ = new ZCApp(uiManager_, homeCli_, uiEvtRcv, &outIO_, outCtrl_, &mbClient_,